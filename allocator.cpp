@@ -22,16 +22,279 @@
 #ifdef __OTSERV_ALLOCATOR__
 
 #include "allocator.h"
+#include <new>
+#include <algorithm>
+
+namespace {
+	// Free blocks cached by the current thread for one size class, with the
+	// statistics it has not published yet. Plain data, so it can be thread local.
+	struct ThreadMagazine {
+		void* head;
+		uint32_t count;
+		uint32_t operations;
+		int64_t allocations;
+		int64_t deallocations;
+		int64_t usedBytes;
+	};
+
+	OTSERV_THREAD_LOCAL ThreadMagazine threadMagazines[ALLOCATOR_CLASS_COUNT];
+
+	const uint32_t statsPublishInterval = 256;
+
+	inline void*& nextBlock(void* block) {
+		return static_cast<void**>(block)[0];
+	}
+
+	inline void*& nextMagazine(void* block) {
+		return static_cast<void**>(block)[1];
+	}
+}
+
+PoolManager::PoolManager()
+{
+	static const uint32_t sizes[ALLOCATOR_CLASS_COUNT] = {
+		0, 16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256,
+		320, 384, 512, 768, 1024, 2048, 4096, 8192, 16384
+	};
+
+	for(uint32_t i = 0; i < ALLOCATOR_CLASS_COUNT; ++i){
+		blockSizes[i] = sizes[i];
+		// keep about 16kb per class and thread
+		magazineSizes[i] = (i == 0 ? 0 : std::max<uint32_t>(8, std::min<uint32_t>(128, 16384 / sizes[i])));
+
+		depots[i].magazines = NULL;
+		depots[i].slabPos = NULL;
+		depots[i].slabEnd = NULL;
+		depots[i].allocations = 0;
+		depots[i].deallocations = 0;
+		depots[i].usedBytes = 0;
+		depots[i].reservedBytes = 0;
+	}
+
+	uint32_t sizeClass = 1;
+	for(uint32_t i = 0; i <= 64; ++i){
+		while(blockSizes[sizeClass] < i * 16){
+			++sizeClass;
+		}
+		smallClasses[i] = (uint8_t)sizeClass;
+	}
+}
+
+uint32_t PoolManager::getSizeClass(size_t bytes) const
+{
+	if(bytes <= 1024){
+		return smallClasses[(bytes + 15) >> 4];
+	}
+
+	for(uint32_t i = ALLOCATOR_CLASS_COUNT - 4; i < ALLOCATOR_CLASS_COUNT; ++i){
+		if(bytes <= blockSizes[i]){
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+void* PoolManager::allocate(size_t size)
+{
+	size_t bytes = size + sizeof(poolTag);
+	uint32_t sizeClass = getSizeClass(bytes);
+
+	poolTag* tag;
+	if(sizeClass == 0){
+		tag = static_cast<poolTag*>(std::malloc(bytes));
+		if(!tag){
+			return NULL;
+		}
+
+		Depot& depot = depots[0];
+		depot.allocations.fetch_add(1, boost::memory_order_relaxed);
+		depot.usedBytes.fetch_add(size, boost::memory_order_relaxed);
+		depot.reservedBytes.fetch_add(bytes, boost::memory_order_relaxed);
+	}
+	else{
+		ThreadMagazine& magazine = threadMagazines[sizeClass];
+		if(!magazine.head && !refill(sizeClass)){
+			return NULL;
+		}
+
+		tag = static_cast<poolTag*>(magazine.head);
+		magazine.head = nextBlock(tag);
+		--magazine.count;
+
+		++magazine.allocations;
+		magazine.usedBytes += size;
+		if(++magazine.operations >= statsPublishInterval){
+			publishStats(sizeClass);
+		}
+	}
+
+	tag->sizeClass = sizeClass;
+	tag->bytes = (uint32_t)size;
+	return tag + 1;
+}
+
+void PoolManager::deallocate(void* deletable)
+{
+	if(deletable == NULL)
+		return;
+
+	poolTag* const tag = reinterpret_cast<poolTag*>(deletable) - 1U;
+	uint32_t sizeClass = tag->sizeClass;
+	uint32_t size = tag->bytes;
+
+	if(sizeClass == 0){
+		std::free(tag);
+
+		Depot& depot = depots[0];
+		depot.deallocations.fetch_add(1, boost::memory_order_relaxed);
+		depot.usedBytes.fetch_sub(size, boost::memory_order_relaxed);
+		depot.reservedBytes.fetch_sub(size + sizeof(poolTag), boost::memory_order_relaxed);
+		return;
+	}
+
+	ThreadMagazine& magazine = threadMagazines[sizeClass];
+	nextBlock(tag) = magazine.head;
+	magazine.head = tag;
+	++magazine.count;
+
+	++magazine.deallocations;
+	magazine.usedBytes -= size;
+	if(++magazine.operations >= statsPublishInterval){
+		publishStats(sizeClass);
+	}
+
+	if(magazine.count >= 2 * magazineSizes[sizeClass]){
+		flush(sizeClass);
+	}
+}
+
+void* PoolManager::refill(uint32_t sizeClass)
+{
+	ThreadMagazine& magazine = threadMagazines[sizeClass];
+	Depot& depot = depots[sizeClass];
+	uint32_t blockSize = blockSizes[sizeClass];
+
+	boost::mutex::scoped_lock lockClass(depot.lock);
+	if(depot.magazines){
+		magazine.head = depot.magazines;
+		magazine.count = magazineSizes[sizeClass];
+		depot.magazines = nextMagazine(magazine.head);
+		return magazine.head;
+	}
+
+	if(depot.slabPos + blockSize > depot.slabEnd){
+		// the rest of the old slab is too small to be of use
+		char* slab = static_cast<char*>(std::malloc(ALLOCATOR_SLAB_SIZE));
+		if(!slab){
+			return NULL;
+		}
+
+		depot.slabPos = slab;
+		depot.slabEnd = slab + ALLOCATOR_SLAB_SIZE;
+		depot.reservedBytes.fetch_add(ALLOCATOR_SLAB_SIZE, boost::memory_order_relaxed);
+	}
+
+	// carve a magazine worth of blocks
+	uint32_t count = 0;
+	while(count < magazineSizes[sizeClass] && depot.slabPos + blockSize <= depot.slabEnd){
+		nextBlock(depot.slabPos) = magazine.head;
+		magazine.head = depot.slabPos;
+		depot.slabPos += blockSize;
+		++count;
+	}
+
+	magazine.count = count;
+	return magazine.head;
+}
+
+void PoolManager::flush(uint32_t sizeClass)
+{
+	ThreadMagazine& magazine = threadMagazines[sizeClass];
+	Depot& depot = depots[sizeClass];
+	uint32_t magazineSize = magazineSizes[sizeClass];
+
+	// the newest blocks stay with the thread, they are the warmest
+	void* last = magazine.head;
+	for(uint32_t i = 1; i < magazine.count - magazineSize; ++i){
+		last = nextBlock(last);
+	}
+
+	void* full = nextBlock(last);
+	nextBlock(last) = NULL;
+	magazine.count -= magazineSize;
+
+	boost::mutex::scoped_lock lockClass(depot.lock);
+	nextMagazine(full) = depot.magazines;
+	depot.magazines = full;
+}
+
+void PoolManager::publishStats(uint32_t sizeClass)
+{
+	ThreadMagazine& magazine = threadMagazines[sizeClass];
+	Depot& depot = depots[sizeClass];
+
+	depot.allocations.fetch_add(magazine.allocations, boost::memory_order_relaxed);
+	depot.deallocations.fetch_add(magazine.deallocations, boost::memory_order_relaxed);
+	depot.usedBytes.fetch_add(magazine.usedBytes, boost::memory_order_relaxed);
+
+	magazine.allocations = 0;
+	magazine.deallocations = 0;
+	magazine.usedBytes = 0;
+	magazine.operations = 0;
+}
+
+void PoolManager::getStats(std::vector<AllocatorClassStats>& stats)
+{
+	stats.resize(ALLOCATOR_CLASS_COUNT);
+	for(uint32_t i = 0; i < ALLOCATOR_CLASS_COUNT; ++i){
+		stats[i].blockSize = blockSizes[i];
+		stats[i].allocations = depots[i].allocations.load(boost::memory_order_relaxed);
+		stats[i].deallocations = depots[i].deallocations.load(boost::memory_order_relaxed);
+		stats[i].usedBytes = depots[i].usedBytes.load(boost::memory_order_relaxed);
+		stats[i].reservedBytes = depots[i].reservedBytes.load(boost::memory_order_relaxed);
+	}
+}
+
+#ifdef __OTSERV_ALLOCATOR_STATS__
+void PoolManager::dumpStats()
+{
+	std::vector<AllocatorClassStats> stats;
+	getStats(stats);
+
+	time_t rawtime;
+	time(&rawtime);
+	std::ofstream output("mem_dump.txt",std::ios_base::app);
+	output << "Otserv Allocator Stats: " << std::ctime(&rawtime);
+	for(std::vector<AllocatorClassStats>::iterator it = stats.begin(); it != stats.end(); ++it){
+		output << it->blockSize << " alloc: " << it->allocations <<
+			" dealloc: " << it->deallocations <<
+			" used: " << it->usedBytes <<
+			" reserved: " << it->reservedBytes <<
+			" N: " << (it->allocations - it->deallocations) << std::endl;
+	}
+	output << std::endl;
+	output.close();
+}
+#endif
 
 //normal new/delete
 void* operator new(size_t bytes)
 {
-	return PoolManager::getInstance().allocate(bytes);
+	void* p = PoolManager::getInstance().allocate(bytes);
+	if(!p){
+		throw std::bad_alloc();
+	}
+	return p;
 }
 
 void* operator new[](size_t bytes)
 {
-	return PoolManager::getInstance().allocate(bytes);
+	void* p = PoolManager::getInstance().allocate(bytes);
+	if(!p){
+		throw std::bad_alloc();
+	}
+	return p;
 }
 
 void operator delete(void *p)
@@ -26,11 +26,11 @@
 #include "definitions.h"
 #include <memory>
 #include <cstdlib>
-#include <map>
+#include <vector>
 #include <fstream>
 #include <ctime>
-#include <boost/pool/pool.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 
 template<typename T>
 class dummyallocator {
@@ -84,10 +84,34 @@ void operator delete[](void* p, int dummy);
 void allocatorStatsThread(void *a);
 #endif
 
+// Every block starts with this tag, sizeClass 0 means it came from malloc
 struct poolTag {
-	size_t poolbytes;
+	uint32_t sizeClass;
+	uint32_t bytes;
 };
 
+// Block sizes (including the tag) served from the pools, larger
+// requests go straight to malloc
+#define ALLOCATOR_CLASS_COUNT 26
+#define ALLOCATOR_MAX_BLOCK 16384
+#define ALLOCATOR_SLAB_SIZE 65536
+
+struct AllocatorClassStats {
+	uint32_t blockSize;
+	int64_t allocations;
+	int64_t deallocations;
+	// requested bytes of the blocks in use, the rest of them is wasted
+	int64_t usedBytes;
+	// bytes taken from malloc for this class
+	int64_t reservedBytes;
+};
+
+/**
+  * Size-class allocator behind the global operator new.
+  * Each thread keeps a magazine of free blocks per class, so most
+  * allocations and deallocations never lock. Magazines are exchanged
+  * with a per-class depot when a thread runs out or holds too many.
+  */
 class PoolManager {
 public:
 	static PoolManager& getInstance() {
@@ -95,165 +119,47 @@ public:
 		return instance;
 	}
 
-	void* allocate(size_t size) {
-		Pools::iterator it;
-		poolLock.lock();
-
-		for(it = pools.begin(); it != pools.end(); ++it) {
-			if(it->first >= size + sizeof(poolTag)) {
-				poolTag* tag = reinterpret_cast<poolTag*>(it->second->malloc());
-				#ifdef __OTSERV_ALLOCATOR_STATS__
-				if(!tag){
-					dumpStats();
-				}
-				#endif
-				tag->poolbytes = it->first;
-				#ifdef __OTSERV_ALLOCATOR_STATS__
-				poolsStats[it->first]->allocations++;
-				poolsStats[it->first]->unused+= it->first - (size + sizeof(poolTag));
-				#endif
-				poolLock.unlock();
-				return tag + 1;
-			}
-		}
-
-		poolTag* tag = reinterpret_cast<poolTag*>(std::malloc(size + sizeof(poolTag)));
-		#ifdef __OTSERV_ALLOCATOR_STATS__
-		poolsStats[0]->allocations++;
-		poolsStats[0]->unused += size;
-		#endif
-		tag->poolbytes = 0;
-		poolLock.unlock();
-		return tag + 1;
-	}
-
-	void deallocate(void* deletable) {
-		if(deletable == NULL)
-			return;
-
-		poolTag* const tag = reinterpret_cast<poolTag*>(deletable) - 1U;
-		poolLock.lock();
-		if(tag->poolbytes) {
-			Pools::iterator it;
-
-			it = pools.find(tag->poolbytes);
-			//it->second->ordered_free(tag);
-			it->second->free(tag);
-			#ifdef __OTSERV_ALLOCATOR_STATS__
-			poolsStats[it->first]->deallocations++;
-			#endif
-		}
-		else{
-			std::free(tag);
-			#ifdef __OTSERV_ALLOCATOR_STATS__
-			poolsStats[0]->deallocations++;
-			#endif
-		}
-		poolLock.unlock();
-	}
-
-	/*
-	void releaseMemory(){
-		Pools::iterator it;
-		for(it = pools.begin(); it != pools.end(); ++it) {
-			it->second->release_memory();
-		}
-	}
-	*/
+	void* allocate(size_t size);
+	void deallocate(void* deletable);
 
+	// Statistics are published by every thread every few operations,
+	// so they can lag slightly behind
+	void getStats(std::vector<AllocatorClassStats>& stats);
 	#ifdef __OTSERV_ALLOCATOR_STATS__
-	void dumpStats(){
-		time_t rawtime;
-		time(&rawtime);
-		std::ofstream output("mem_dump.txt",std::ios_base::app);
-		output << "Otserv Allocator Stats: " << std::ctime(&rawtime);
-		PoolsStats::iterator it;
-		for(it = poolsStats.begin(); it != poolsStats.end(); ++it) {
-			output << (int)(it->first) << " alloc: " << (int64_t)(it->second->allocations) <<
-				" dealloc: " << (int64_t)(it->second->deallocations) <<
-				" unused: " << (int64_t)(it->second->unused);
-			if(it->second->allocations != 0 && it->first != 0){
-				output << " avg: " << (int64_t)((it->first) - (it->second->unused)/(it->second->allocations)) <<
-				" unused: " << (int64_t)((it->second->unused)*100/(it->second->allocations)/(it->first));
-			}
-			output << "% N: " << ((int64_t)(it->second->allocations) - (int64_t)(it->second->deallocations)) <<
-				std::endl;
-		}
-		output << std::endl;
-		output.close();
-	}
+	void dumpStats();
 	#endif
 
-	~PoolManager() {
-		Pools::iterator it = pools.begin();
-		while(it != pools.end()) {
-			std::free(it->second);
-			pools.erase(it++);
-		}
-		#ifdef __OTSERV_ALLOCATOR_STATS__
-		PoolsStats::iterator it2;
-		for(it2 = poolsStats.begin(); it2 != poolsStats.end(); ++it2) {
-			std::free(it2->second);
-			poolsStats.erase(it2++);
-		}
-		#endif
-	}
-
 private:
-	void addPool(size_t size, size_t next_size) {
-		pools[size] = new(0) boost::pool<boost::default_user_allocator_malloc_free>(size, next_size);
-		#ifdef __OTSERV_ALLOCATOR_STATS__
-		t_PoolStats * tmp = new(0) t_PoolStats;
-		tmp->unused = 0;
-		tmp->allocations = 0;
-		tmp->deallocations = 0;
-		poolsStats[size] = tmp;
-		#endif
-	}
-
-	PoolManager() {
-		addPool(4 + sizeof(poolTag), 32768);
-		addPool(20 + sizeof(poolTag), 32768);
-		addPool(32 + sizeof(poolTag), 32768);
-		addPool(48 + sizeof(poolTag), 32768);
-		addPool(96 + sizeof(poolTag), 16384);
-		addPool(128 + sizeof(poolTag), 1024);
-		addPool(384 + sizeof(poolTag), 2048);
-		addPool(512 + sizeof(poolTag), 128);
-		addPool(1024 + sizeof(poolTag), 128);
-		addPool(8192 + sizeof(poolTag), 128);
-		addPool(16384 + sizeof(poolTag), 128);
-
-		addPool(60 + sizeof(poolTag), 10000); //Tile class
-		addPool(36 + sizeof(poolTag), 10000); //Item class
+	struct Depot {
+		boost::mutex lock;
+		// full magazines, linked through the second word of their first block
+		void* magazines;
+		// unused rest of the last slab
+		char* slabPos;
+		char* slabEnd;
+
+		boost::atomic<int64_t> allocations;
+		boost::atomic<int64_t> deallocations;
+		boost::atomic<int64_t> usedBytes;
+		boost::atomic<int64_t> reservedBytes;
+	};
 
-		#ifdef __OTSERV_ALLOCATOR_STATS__
-		t_PoolStats * tmp = new(0) t_PoolStats;
-		tmp->unused = 0;
-		tmp->allocations = 0;
-		tmp->deallocations = 0;
-		poolsStats[0] = tmp;
-		#endif
-	}
+	PoolManager();
+	~PoolManager() {}
 
 	PoolManager(const PoolManager&);
 	const PoolManager& operator=(const PoolManager&);
 
-	typedef std::map<size_t, boost::pool<boost::default_user_allocator_malloc_free >*, std::less<size_t >,
-		dummyallocator<std::pair<const size_t, boost::pool<boost::default_user_allocator_malloc_free>* > > > Pools;
+	uint32_t getSizeClass(size_t bytes) const;
+	void* refill(uint32_t sizeClass);
+	void flush(uint32_t sizeClass);
+	void publishStats(uint32_t sizeClass);
 
-	Pools pools;
-	#ifdef __OTSERV_ALLOCATOR_STATS__
-	struct t_PoolStats{
-		int64_t allocations;
-		int64_t deallocations;
-		int64_t unused;
-	};
-	typedef std::map<size_t, t_PoolStats*, std::less<size_t >,
-		dummyallocator<std::pair<const size_t, t_PoolStats* > > > PoolsStats;
-	PoolsStats poolsStats;
-	#endif
-	boost::recursive_mutex poolLock;
+	Depot depots[ALLOCATOR_CLASS_COUNT];
+	uint32_t blockSizes[ALLOCATOR_CLASS_COUNT];
+	uint32_t magazineSizes[ALLOCATOR_CLASS_COUNT];
+	// size class of every 16 byte step up to 1024 bytes
+	uint8_t smallClasses[65];
 };
 
 #endif
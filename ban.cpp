@@ -24,14 +24,164 @@
 #include "configmanager.h"
 #include "ioplayer.h"
 #include "database.h"
+#include "scheduler.h"
+#include "workerpool.h"
 
 extern ConfigManager g_config;
+extern Scheduler g_scheduler;
+extern WorkerPool g_loginWorkers;
 
-bool BanManager::clearTemporaryBans() const
+// Same condition as the queries: negative never expires, 0 lasts until
+// the server closes (see clearTemporaryBans)
+static inline bool isBanActive(int32_t expires, int32_t now)
+{
+	return expires <= 0 || expires >= now;
+}
+
+// Several bans on the same value keep the one lasting longest
+static void addBanExpiry(BanExpiryMap& map, uint32_t value, int32_t expires)
+{
+	BanExpiryMap::iterator it = map.find(value);
+	if(it == map.end()){
+		map[value] = expires;
+	}
+	else if(it->second < 0 || expires < 0){
+		it->second = -1;
+	}
+	else if(it->second == 0 || expires == 0){
+		it->second = 0;
+	}
+	else if(expires > it->second){
+		it->second = expires;
+	}
+}
+
+bool BanManager::loadBans()
 {
 	Database* db = Database::instance();
+
+	banLock.lock();
+	uint32_t changes = indexChanges;
+	banLock.unlock();
+
 	DBQuery query;
-	return db->executeQuery("UPDATE `bans` SET `active` = 0 WHERE `expires` = 0");
+	query <<
+		"SELECT "
+			"`type`, "
+			"`value`, "
+			"`param`, "
+			"`expires` "
+		"FROM "
+			"`bans` "
+		"WHERE "
+			"`type` IN (" << BAN_IPADDRESS << ", " << BAN_PLAYER << ", " << BAN_ACCOUNT << ") AND "
+			"`active` = 1 AND "
+			"(`expires` >= " << std::time(NULL) << " OR `expires` <= 0)";
+
+	// An empty result can not be told from a failed query, count first
+	// so a lost connection does not lift every ban until the next reload
+	DBQuery countQuery;
+	countQuery << "SELECT COUNT(*) AS `count` FROM (" << query.str() << ") AS `active_bans`";
+
+	DBResult* result;
+	if(!(result = db->storeQuery(countQuery.str())))
+		return false;
+
+	int32_t count = result->getDataInt("count");
+	db->freeResult(result);
+
+	BanIndex index;
+	if(count > 0){
+		if(!(result = db->storeQuery(query.str())))
+			return false;
+
+		do {
+			uint32_t value = (uint32_t)result->getDataLong("value");
+			int32_t expires = result->getDataInt("expires");
+
+			switch(result->getDataInt("type")){
+				case BAN_IPADDRESS:
+				{
+					uint32_t mask = (uint32_t)result->getDataLong("param");
+					addBanExpiry(index.ipBans[mask], value & mask, expires);
+					break;
+				}
+
+				case BAN_PLAYER:
+					addBanExpiry(index.playerBans, value, expires);
+					break;
+
+				case BAN_ACCOUNT:
+					addBanExpiry(index.accountBans, value, expires);
+					break;
+
+				default:
+					break;
+			}
+		} while(result->next());
+
+		db->freeResult(result);
+	}
+
+	if((result = db->storeQuery("SELECT `id` FROM `accounts` WHERE `blocked` = 1"))){
+		do {
+			index.blockedAccounts.insert(result->getDataInt("id"));
+		} while(result->next());
+
+		db->freeResult(result);
+	}
+
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	if(changes != indexChanges){
+		// A ban was written while we were reading, the index already has
+		// it and the next reload will pick up the rest
+		return false;
+	}
+
+	banIndex.ipBans.swap(index.ipBans);
+	banIndex.playerBans.swap(index.playerBans);
+	banIndex.accountBans.swap(index.accountBans);
+	banIndex.blockedAccounts.swap(index.blockedAccounts);
+	return true;
+}
+
+void BanManager::scheduleRefresh()
+{
+	int64_t interval = g_config.getNumber(ConfigManager::BAN_REFRESH_INTERVAL);
+	if(interval <= 0)
+		return;
+
+	g_scheduler.addEvent(createSchedulerTask(interval * 1000,
+		boost::bind(&BanManager::refreshBans, this)));
+}
+
+void BanManager::refreshBans()
+{
+	// Drops the expired bans and picks up the ones written by other
+	// tools (like the website), the queries run on a login worker
+	g_loginWorkers.addTask(createTask(boost::bind(&BanManager::loadBans, this)));
+	scheduleRefresh();
+}
+
+size_t BanManager::getIndexedBanCount() const
+{
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	size_t count = banIndex.playerBans.size() + banIndex.accountBans.size() + banIndex.blockedAccounts.size();
+	for(IpBanIndex::const_iterator it = banIndex.ipBans.begin(); it != banIndex.ipBans.end(); ++it){
+		count += it->second.size();
+	}
+
+	return count;
+}
+
+bool BanManager::clearTemporaryBans()
+{
+	Database* db = Database::instance();
+	if(!db->executeQuery("UPDATE `bans` SET `active` = 0 WHERE `expires` = 0"))
+		return false;
+
+	// Merged entries may hide a longer ban behind a temporary one
+	return loadBans();
 }
 
 bool BanManager::acceptConnection(uint32_t clientip)
@@ -99,52 +249,37 @@ bool BanManager::isIpDisabled(uint32_t clientip)
 bool BanManager::isIpBanished(uint32_t clientip, uint32_t mask /*= 0xFFFFFFFF*/) const
 {
 	if(clientip == 0) return false;
-	Database* db = Database::instance();
+	int32_t now = (int32_t)std::time(NULL);
 
-	DBQuery query;
-	query <<
-		"SELECT "
-			"COUNT(*) AS `count` "
-		"FROM "
-			"`bans` "
-		"WHERE "
-			"`type` = " << BAN_IPADDRESS << " AND "
-			"((" << clientip << " & " << mask << " & `param`) = (`value` & `param` & " << mask << ")) AND "
-			"`active` = 1 AND "
-			"(`expires` >= " << std::time(NULL) << " OR `expires` <= 0)";
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	for(IpBanIndex::const_iterator it = banIndex.ipBans.begin(); it != banIndex.ipBans.end(); ++it){
+		const uint32_t param = it->first;
+		const uint32_t target = clientip & mask & param;
 
-	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
-		return false;
+		if((param & mask) == param){
+			BanExpiryMap::const_iterator bit = it->second.find(target);
+			if(bit != it->second.end() && isBanActive(bit->second, now))
+				return true;
+		}
+		else{
+			// The lookup mask is wider than the ban, compare them all
+			for(BanExpiryMap::const_iterator bit = it->second.begin(); bit != it->second.end(); ++bit){
+				if((bit->first & mask) == target && isBanActive(bit->second, now))
+					return true;
+			}
+		}
+	}
 
-	int t = result->getDataInt("count");
-	db->freeResult(result);
-	return t > 0;
+	return false;
 }
 
 bool BanManager::isPlayerBanished(uint32_t playerId) const
 {
-	Database* db = Database::instance();
-
-	DBQuery query;
-	query <<
-		"SELECT "
-			"COUNT(*) AS `count` "
-		"FROM "
-			"`bans` "
-		"WHERE "
-			"`type` = " << BAN_PLAYER << " AND "
-			"`value` = " << playerId << " AND "
-			"`active` = 1 AND "
-			"(`expires` >= " << std::time(NULL) << " OR `expires` <= 0)";
+	int32_t now = (int32_t)std::time(NULL);
 
-	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
-		return false;
-
-	int t = result->getDataInt("count");
-	db->freeResult(result);
-	return t > 0;
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	BanExpiryMap::const_iterator it = banIndex.playerBans.find(playerId);
+	return it != banIndex.playerBans.end() && isBanActive(it->second, now);
 }
 
 bool BanManager::isPlayerBanished(const std::string& name) const
@@ -157,46 +292,14 @@ bool BanManager::isPlayerBanished(const std::string& name) const
 
 bool BanManager::isAccountBanished(uint32_t accountId) const
 {
-	Database* db = Database::instance();
-	DBQuery query;
-	DBResult* result;
+	int32_t now = (int32_t)std::time(NULL);
 
-	int32_t t = 0;
-
-	//Check for banishments
-	query <<
-		"SELECT "
-			"COUNT(*) AS `count` "
-		"FROM "
-			"`bans` "
-		"WHERE "
-			"`type` = " << BAN_ACCOUNT << " AND "
-			"`value` = " << accountId << " AND "
-			"`active` = 1 AND "
-			"(`expires` >= " << std::time(NULL) << " OR `expires` <= 0)";
-
-	if((result = db->storeQuery(query.str()))){
-		t += result->getDataInt("count");
-		db->freeResult(result);
-	}
-	
-	//Check if account is blocked
-	query.str("");
-	query <<
-		"SELECT "
-			"COUNT(*) AS `count` "
-		"FROM "
-			"`accounts` "
-		"WHERE "
-			"`id` = " << accountId << " AND "
-			"`blocked` = 1";
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	if(banIndex.blockedAccounts.find(accountId) != banIndex.blockedAccounts.end())
+		return true;
 
-	if((result = db->storeQuery(query.str()))){
-		t += result->getDataInt("count");
-		db->freeResult(result);
-	}
-	
-	return t > 0;
+	BanExpiryMap::const_iterator it = banIndex.accountBans.find(accountId);
+	return it != banIndex.accountBans.end() && isBanActive(it->second, now);
 }
 
 void BanManager::addLoginAttempt(uint32_t clientip, bool isSuccess)
@@ -229,7 +332,7 @@ void BanManager::addLoginAttempt(uint32_t clientip, bool isSuccess)
 }
 
 bool BanManager::addIpBan(uint32_t ip, uint32_t mask, int32_t time,
-	uint32_t adminid, std::string comment) const
+	uint32_t adminid, std::string comment)
 {
 	if(ip == 0 || mask == 0) return false;
 	Database* db = Database::instance();
@@ -241,13 +344,16 @@ bool BanManager::addIpBan(uint32_t ip, uint32_t mask, int32_t time,
 	query << BAN_IPADDRESS << ", " << ip << ", " << mask << ", " << time << ", ";
 	query << std::time(NULL) << ", " << adminid << ", " << db->escapeString(comment);
 
+	if(!stmt.addRow(query.str()) || !stmt.execute()) return false;
 
-	if(!stmt.addRow(query.str())) return false;
-	return stmt.execute();
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	addBanExpiry(banIndex.ipBans[mask], ip & mask, time);
+	++indexChanges;
+	return true;
 }
 
 bool BanManager::addPlayerBan(uint32_t playerId, int32_t time, uint32_t adminid,
-	std::string comment, std::string statement, uint32_t reason, violationAction_t action) const
+	std::string comment, std::string statement, uint32_t reason, violationAction_t action)
 {
 	if(playerId == 0) return false;
 	Database* db = Database::instance();
@@ -259,12 +365,16 @@ bool BanManager::addPlayerBan(uint32_t playerId, int32_t time, uint32_t adminid,
 	query << BAN_PLAYER << ", " << playerId << ", " << time << ", " << std::time(NULL) << ", " << adminid << ", ";
 	query << db->escapeString(comment) << ", " << db->escapeString(statement) << ", " << reason << ", " << action;
 
-	if(!stmt.addRow(query.str())) return false;
-	return stmt.execute();
+	if(!stmt.addRow(query.str()) || !stmt.execute()) return false;
+
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	addBanExpiry(banIndex.playerBans, playerId, time);
+	++indexChanges;
+	return true;
 }
 
 bool BanManager::addPlayerBan(const std::string& name, int32_t time, uint32_t adminid,
-	std::string comment, std::string statement, uint32_t reason, violationAction_t action) const
+	std::string comment, std::string statement, uint32_t reason, violationAction_t action)
 {
 	uint32_t guid = 0;
 	std::string n = name;
@@ -307,7 +417,7 @@ bool BanManager::addPlayerNameReport(uint32_t playerId, uint32_t adminid, std::s
 }  
 
 bool BanManager::addAccountBan(uint32_t account, int32_t time, uint32_t adminid,
-	std::string comment, std::string statement, uint32_t reason, violationAction_t action) const
+	std::string comment, std::string statement, uint32_t reason, violationAction_t action)
 {
 	if(account == 0) return false;
 	Database* db = Database::instance();
@@ -319,8 +429,12 @@ bool BanManager::addAccountBan(uint32_t account, int32_t time, uint32_t adminid,
 	query << BAN_ACCOUNT << ", " << account << ", " << time << ", " << std::time(NULL) << ", " << adminid << ", ";
 	query << db->escapeString(comment) << ", " << db->escapeString(statement) << ", " << reason << ", " << action;
 
-	if(!stmt.addRow(query.str())) return false;
-	return stmt.execute();
+	if(!stmt.addRow(query.str()) || !stmt.execute()) return false;
+
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	addBanExpiry(banIndex.accountBans, account, time);
+	++indexChanges;
+	return true;
 }
 
 bool BanManager::addAccountNotation(uint32_t account, uint32_t adminid, std::string comment,
@@ -340,27 +454,54 @@ bool BanManager::addAccountNotation(uint32_t account, uint32_t adminid, std::str
 	return stmt.execute();
 }
 
-bool BanManager::removeIpBans(uint32_t ip, uint32_t mask) const
+bool BanManager::removeIpBans(uint32_t ip, uint32_t mask)
 {
 	if(!isIpBanished(ip, mask)) return false;
 	Database* db = Database::instance();
 
 	DBQuery query;
 	query << "UPDATE `bans` SET `active` = 0 WHERE `type` = " << BAN_IPADDRESS << " AND (`value` & `param` & " << mask << ") = (" << ip << " & `param` & " << mask << ")" << " AND `active` = 1";
-	return db->executeQuery(query.str());
+	if(!db->executeQuery(query.str())) return false;
+
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	IpBanIndex::iterator it = banIndex.ipBans.begin();
+	while(it != banIndex.ipBans.end()){
+		const uint32_t target = ip & it->first & mask;
+
+		BanExpiryMap::iterator bit = it->second.begin();
+		while(bit != it->second.end()){
+			if((bit->first & mask) == target)
+				it->second.erase(bit++);
+			else
+				++bit;
+		}
+
+		if(it->second.empty())
+			banIndex.ipBans.erase(it++);
+		else
+			++it;
+	}
+
+	++indexChanges;
+	return true;
 }
 
-bool BanManager::removePlayerBans(uint32_t guid) const
+bool BanManager::removePlayerBans(uint32_t guid)
 {
 	if(!isPlayerBanished(guid)) return false;
 	Database* db = Database::instance();
 
 	DBQuery query;
 	query << "UPDATE `bans` SET `active` = 0 WHERE `type` = " << BAN_PLAYER << " AND `value` = " << guid << " AND `active` = 1";
-	return db->executeQuery(query.str());
+	if(!db->executeQuery(query.str())) return false;
+
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	banIndex.playerBans.erase(guid);
+	++indexChanges;
+	return true;
 }
 
-bool BanManager::removePlayerBans(const std::string& name) const
+bool BanManager::removePlayerBans(const std::string& name)
 {
 	uint32_t playerId = 0;
 	std::string n = name;
@@ -368,14 +509,19 @@ bool BanManager::removePlayerBans(const std::string& name) const
 		&& removePlayerBans(playerId);
 }
 
-bool BanManager::removeAccountBans(uint32_t accno) const
+bool BanManager::removeAccountBans(uint32_t accno)
 {
 	if(!isAccountBanished(accno)) return false;
 	Database* db = Database::instance();
 
 	DBQuery query;
 	query << "UPDATE `bans` SET `active` = 0 WHERE `type` = " << BAN_ACCOUNT << " AND `value` = " << accno << " AND `active` = 1";
-	return db->executeQuery(query.str());
+	if(!db->executeQuery(query.str())) return false;
+
+	boost::recursive_mutex::scoped_lock lockClass(banLock);
+	banIndex.accountBans.erase(accno);
+	++indexChanges;
+	return true;
 }
 
 bool BanManager::removeNotations(uint32_t accno) const
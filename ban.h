@@ -64,12 +64,31 @@ struct ConnectBlock {
 typedef std::map<uint32_t, LoginBlock > IpLoginMap;
 typedef std::map<uint32_t, ConnectBlock > IpConnectMap;
 
+// Expiry of the active bans on a value, as stored in `bans`.`expires`
+typedef std::unordered_map<uint32_t, int32_t> BanExpiryMap;
+// IP bans grouped by mask, keyed by the masked address: a lookup is one
+// hash probe per distinct mask in use, and there are rarely more than a few
+typedef std::map<uint32_t, BanExpiryMap> IpBanIndex;
+
+struct BanIndex {
+	IpBanIndex ipBans;
+	BanExpiryMap playerBans;
+	BanExpiryMap accountBans;
+	std::unordered_set<uint32_t> blockedAccounts;
+};
+
 class BanManager {
 public:
-	BanManager() {}
+	BanManager() : indexChanges(0) {}
 	~BanManager() {}
 
-	bool clearTemporaryBans() const;
+	// Reads the active bans and blocked accounts into memory, lookups
+	// do not touch the database afterwards and changes write through
+	bool loadBans();
+	void scheduleRefresh();
+	size_t getIndexedBanCount() const;
+
+	bool clearTemporaryBans();
 	bool acceptConnection(uint32_t clientip);
 
 	bool isIpDisabled(uint32_t clientip);
@@ -79,31 +98,37 @@ public:
 	bool isAccountBanished(uint32_t accountId) const;
 
 	void addLoginAttempt(uint32_t clientip, bool isSuccess);
-	bool addIpBan(uint32_t ip, uint32_t mask, int32_t time, uint32_t adminid, std::string comment) const;
+	bool addIpBan(uint32_t ip, uint32_t mask, int32_t time, uint32_t adminid, std::string comment);
 	bool addPlayerBan(uint32_t playerId, int32_t time, uint32_t adminid, std::string comment,
-		std::string statement, uint32_t reason, violationAction_t action) const;
+		std::string statement, uint32_t reason, violationAction_t action);
 	bool addPlayerBan(const std::string& name, int32_t time, uint32_t adminid, std::string comment,
-		std::string statement, uint32_t reason, violationAction_t action) const;
+		std::string statement, uint32_t reason, violationAction_t action);
 	bool addPlayerStatement(uint32_t playerId, uint32_t adminid, std::string comment,
 		std::string statement, uint32_t reason, violationAction_t action) const;
 	bool addPlayerNameReport(uint32_t playerId, uint32_t adminid, std::string comment,
 		std::string statement, uint32_t reason, violationAction_t action) const;
 	bool addAccountBan(uint32_t account, int32_t time, uint32_t adminid, std::string comment,
-		std::string statement, uint32_t reason, violationAction_t action) const;
+		std::string statement, uint32_t reason, violationAction_t action);
 	bool addAccountNotation(uint32_t account, uint32_t adminid, std::string comment,
 		std::string statement, uint32_t reason, violationAction_t action) const;
 
-	bool removeIpBans(uint32_t ip, uint32_t mask = 0xFFFFFFFF) const;
-	bool removePlayerBans(uint32_t guid) const;
-	bool removePlayerBans(const std::string& name) const;
-	bool removeAccountBans(uint32_t accno) const;
+	bool removeIpBans(uint32_t ip, uint32_t mask = 0xFFFFFFFF);
+	bool removePlayerBans(uint32_t guid);
+	bool removePlayerBans(const std::string& name);
+	bool removeAccountBans(uint32_t accno);
 	bool removeNotations(uint32_t accno) const;
 
 	uint32_t getNotationsCount(uint32_t account);
 	std::vector<Ban> getBans(BanType_t type);
 protected:
+	void refreshBans();
+
 	mutable boost::recursive_mutex banLock;
 
+	BanIndex banIndex;
+	// Bumped by every write through, a reload that raced with one is dropped
+	uint32_t indexChanges;
+
 	IpLoginMap ipLoginMap;
 	IpConnectMap ipConnectMap;
 };
@@ -69,6 +69,20 @@
 	#undef __USE_MINIDUMP__
 #endif
 
+/*
+	Storage class for plain data that has a copy per thread
+*/
+#define OTSERV_THREAD_LOCAL __thread
+
+/*
+	Compiles a single function for an instruction set the rest of
+	the build does not assume, callers have to check the cpu first
+*/
+#if defined(__x86_64__) || defined(__i386__)
+	#define __OTSERV_X86__
+	#define OTSERV_TARGET(isa) __attribute__((target(isa)))
+#endif
+
 /*
 	String to 64 bit integer macro
 */
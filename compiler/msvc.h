@@ -114,6 +114,24 @@
 #pragma warning(disable:4244) // 'argument' : conversion from 'type1' to 'type2', possible loss of data
 #pragma warning(disable:4267) // 'var' : conversion from 'size_t' to 'type', possible loss of data
 
+/*
+	Storage class for plain data that has a copy per thread
+*/
+#define OTSERV_THREAD_LOCAL __declspec(thread)
+
+/*
+	Compiles a single function for an instruction set the rest of
+	the build does not assume, callers have to check the cpu first
+*/
+#if defined(_M_X64) || defined(_M_IX86)
+	#define __OTSERV_X86__
+	#define OTSERV_TARGET(isa)
+	#if _MSC_VER < 1700
+		// no AVX2 intrinsics before Visual C++ 2012
+		#define __OTSERV_NO_AVX2__
+	#endif
+#endif
+
 /*
 	String to 64 bit integer macro
 */
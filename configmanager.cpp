@@ -91,6 +91,7 @@ bool ConfigManager::loadFile(const std::string& _filename)
 #endif
 		m_confString[HOUSE_RENT_PERIOD] = getGlobalString(L, "houserentperiod", "monthly");
 		m_confString[MAP_KIND] = getGlobalString(L, "mapkind");
+		m_confString[SNAPSHOT_FILE] = getGlobalString(L, "snapshot", "");
 		if(getGlobalString(L, "md5passwords") != ""){
 			std::cout << "Warning: [ConfigManager] md5passwords is deprecated. Use passwordtype instead." << std::endl;
 		}
@@ -221,6 +222,12 @@ bool ConfigManager::loadFile(const std::string& _filename)
 	m_confInteger[MAX_CONTAINERS_INSIDE_PLAYER_INVENTORY] = getGlobalNumber(L, "max_containers_inside_player_inventory", 100);
 	m_confInteger[GUILD_WARS_END_ONLY_ON_STARTUP] = getGlobalBoolean(L, "guild_wars_end_only_on_startup", true);
 	m_confInteger[USE_RUNE_LEVEL_REQUIREMENTS] = getGlobalBoolean(L, "use_rune_level_requirements", true);
+	m_confInteger[MONSTER_FLOWFIELD_PATHING] = getGlobalBoolean(L, "monster_flowfield_pathing", false);
+	m_confInteger[NETWORK_THREADS] = getGlobalNumber(L, "network_threads", 0);
+	m_confInteger[LOGIN_THREADS] = getGlobalNumber(L, "login_threads", 2);
+	m_confInteger[LOGIN_QUEUE_SIZE] = getGlobalNumber(L, "login_queue_size", 500);
+	m_confInteger[BAN_REFRESH_INTERVAL] = getGlobalNumber(L, "ban_refresh_interval", 60);
+	m_confInteger[STATUS_REFRESH_INTERVAL] = getGlobalNumber(L, "status_refresh_interval", 5 * 1000);
 	
 	m_isLoaded = true;
 	return true;
@@ -45,6 +45,7 @@ public:
 		HOUSE_STORE_FILE,
 		HOUSE_RENT_PERIOD,
 		MAP_KIND,
+		SNAPSHOT_FILE,
 		LOGIN_MSG,
 		SERVER_NAME,
 		WORLD_NAME,
@@ -178,6 +179,12 @@ public:
 		MAX_CONTAINERS_INSIDE_PLAYER_INVENTORY,
 		GUILD_WARS_END_ONLY_ON_STARTUP,
 		USE_RUNE_LEVEL_REQUIREMENTS,
+		MONSTER_FLOWFIELD_PATHING,
+		NETWORK_THREADS,
+		LOGIN_THREADS,
+		LOGIN_QUEUE_SIZE,
+		BAN_REFRESH_INTERVAL,
+		STATUS_REFRESH_INTERVAL,
 		LAST_INTEGER_CONFIG /* this must be the last one */
 	};
 
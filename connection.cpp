@@ -130,6 +130,11 @@ void Connection::closeConnectionTask()
 
 	m_connectionState = CONNECTION_STATE_CLOSING;
 
+	if(m_pendingWrite == 0 && !m_writeError && !m_writeQueue.empty()){
+		//deliver what is still queued (a disconnect reason, for example) before closing
+		internalSend();
+	}
+
 	if(m_pendingWrite == 0 || m_writeError){
 		closeSocket();
 		releaseConnection();
@@ -150,6 +155,9 @@ void Connection::closeSocket()
 
 	m_connectionLock.lock();
 
+	//queued messages hold a reference to this connection
+	m_writeQueue.clear();
+
 	if(m_socket->is_open()){
 		#ifdef __DEBUG_NET_DETAIL__
 		std::cout << "Closing socket" << std::endl;
@@ -393,34 +401,63 @@ bool Connection::send(OutputMessage_ptr msg)
 		return false;
 	}
 
-	if(m_pendingWrite == 0){
-		msg->getProtocol()->onSendMessage(msg);
+	if(msg->isOverrun()){
+		//something did not fit and was left out, the client would
+		//misread everything after it
+		std::cout << "Error: [Connection::send] Message overrun, closing connection." << std::endl;
+		closeConnection();
+		m_connectionLock.unlock();
+		return false;
+	}
 
-		TRACK_MESSAGE(msg);
+	msg->getProtocol()->onSendMessage(msg);
 
-		#ifdef __DEBUG_NET_DETAIL__
-		std::cout << "Connection::send " << msg->getMessageLength() << std::endl;
-		#endif
+	TRACK_MESSAGE(msg);
 
-		internalSend(msg);
-	}
-	else{
-		#ifdef __DEBUG_NET__
-		std::cout << "Connection::send Adding to queue " << msg->getMessageLength() << std::endl;
-		#endif
+	#ifdef __DEBUG_NET_DETAIL__
+	std::cout << "Connection::send " << msg->getMessageLength() << std::endl;
+	#endif
+
+	m_writeQueue.push_back(msg);
 
-		TRACK_MESSAGE(msg);
+	if(m_pendingWrite == 0 && !m_flushQueued){
 		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
-		outputPool->addToAutoSend(msg);
+		if(outputPool->isInExecutionFrame()){
+			// everything else this frame sends goes out with the same write
+			m_flushQueued = true;
+			outputPool->addToFlush(shared_from_this());
+		}
+		else{
+			internalSend();
+		}
 	}
-	
+	// else it is sent as soon as the write in progress completes
+
 	m_connectionLock.unlock();
 	return true;
 }
 
-void Connection::internalSend(OutputMessage_ptr msg)
+void Connection::flushWriteQueue()
 {
-	TRACK_MESSAGE(msg);
+	m_connectionLock.lock();
+	m_flushQueued = false;
+	if(m_pendingWrite == 0 && !m_writeQueue.empty() &&
+		m_connectionState == CONNECTION_STATE_OPEN && !m_writeError){
+		internalSend();
+	}
+	m_connectionLock.unlock();
+}
+
+void Connection::internalSend()
+{
+	//m_connectionLock must be held, and no write may be in progress
+	m_writeBatch.swap(m_writeQueue);
+
+	m_writeBuffers.clear();
+	for(OutputMessageQueue::iterator it = m_writeBatch.begin(); it != m_writeBatch.end(); ++it){
+		TRACK_MESSAGE(*it);
+		m_writeBuffers.push_back(boost::asio::const_buffer((*it)->getOutputBuffer(), (*it)->getMessageLength()));
+	}
 
 	try{
 		++m_pendingWrite;
@@ -428,9 +465,23 @@ void Connection::internalSend(OutputMessage_ptr msg)
 		m_writeTimer.async_wait( boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
 			boost::asio::placeholders::error));
 
-		boost::asio::async_write(getHandle(),
-			boost::asio::buffer(msg->getOutputBuffer(), msg->getMessageLength()),
-			boost::bind(&Connection::onWriteOperation, shared_from_this(), msg, boost::asio::placeholders::error));
+		// one gathered write for every message queued since the last one
+		boost::asio::async_write(getHandle(), m_writeBuffers,
+			boost::bind(&Connection::onWriteOperation, shared_from_this(), boost::asio::placeholders::error));
+	}
+	catch(boost::system::system_error& e){
+		if(m_logError){
+			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
+			m_logError = false;
+		}
+	}
+}
+
+bool Connection::post(const boost::function<void ()>& f)
+{
+	try{
+		m_io_service.post(f);
+		return true;
 	}
 	catch(boost::system::system_error& e){
 		if(m_logError){
@@ -438,6 +489,7 @@ void Connection::internalSend(OutputMessage_ptr msg)
 			m_logError = false;
 		}
 	}
+	return false;
 }
 
 uint32_t Connection::getIP() const
@@ -454,7 +506,7 @@ uint32_t Connection::getIP() const
 	}
 }
 
-void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error)
+void Connection::onWriteOperation(const boost::system::error_code& error)
 {
 	#ifdef __DEBUG_NET_DETAIL__
 	std::cout << "onWriteOperation" << std::endl;
@@ -463,8 +515,7 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
 	m_connectionLock.lock();
 	m_writeTimer.cancel();
 
-	TRACK_MESSAGE(msg);
-	msg.reset();
+	m_writeBatch.clear();
 
 	if(error){
 		handleWriteError(error);
@@ -478,6 +529,11 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
 	}
 
 	--m_pendingWrite;
+
+	if(m_pendingWrite == 0 && !m_writeQueue.empty()){
+		internalSend();
+	}
+
 	m_connectionLock.unlock();
 }
 
@@ -27,6 +27,8 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <vector>
 #include "networkmessage.h"
 
 class Protocol;
@@ -105,6 +107,7 @@ private:
 		m_protocol = NULL;
 		m_pendingWrite = 0;
 		m_pendingRead = 0;
+		m_flushQueued = false;
 		m_connectionState = CONNECTION_STATE_OPEN;
 		m_receivedFirst = false;
 		m_writeError = false;
@@ -132,6 +135,10 @@ public:
 	void acceptConnection();
 
 	bool send(OutputMessage_ptr msg);
+	void flushWriteQueue();
+
+	// Runs f on the network thread that owns this connection
+	bool post(const boost::function<void ()>& f);
 
 	uint32_t getIP() const;
 
@@ -142,7 +149,7 @@ private:
 	void parseHeader(const boost::system::error_code& error);
 	void parsePacket(const boost::system::error_code& error);
 
-	void onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error);
+	void onWriteOperation(const boost::system::error_code& error);
 
 	void onStopOperation();
 	void handleReadError(const boost::system::error_code& error);
@@ -158,7 +165,7 @@ private:
 	void onReadTimeout();
 	void onWriteTimeout();
 
-	void internalSend(OutputMessage_ptr msg);
+	void internalSend();
 
 	NetworkMessage m_msg;
 	boost::asio::ip::tcp::socket* m_socket;
@@ -170,6 +177,14 @@ private:
 	bool m_writeError;
 	bool m_readError;
 
+	typedef std::vector<OutputMessage_ptr> OutputMessageQueue;
+	// messages already sealed by the protocol, waiting for the next write
+	OutputMessageQueue m_writeQueue;
+	// messages (and their buffers) owned by the write in progress
+	OutputMessageQueue m_writeBatch;
+	std::vector<boost::asio::const_buffer> m_writeBuffers;
+	bool m_flushQueued;
+
 	int32_t m_pendingWrite;
 	int32_t m_pendingRead;
 	ConnectionState_t m_connectionState;
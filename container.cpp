@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "container.h"
+#include "objectpool.h"
 #include "iomapotbm.h"
 #include "game.h"
 #include "player.h"
@@ -39,6 +40,22 @@ Container::Container(uint16_t _type) : Item(_type)
 	serializationCount = 0;
 }
 
+static ObjectPool& getContainerPool()
+{
+	static ObjectPool* pool = new ObjectPool("Container", sizeof(Container));
+	return *pool;
+}
+
+void* Container::operator new(size_t size)
+{
+	return getContainerPool().allocate(size);
+}
+
+void Container::operator delete(void* p, size_t size)
+{
+	getContainerPool().deallocate(p, size);
+}
+
 Container::~Container()
 {
 	//std::cout << "Container destructor " << this << std::endl;
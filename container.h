@@ -61,6 +61,10 @@ public:
 	virtual ~Container();
 	virtual Item* clone() const;
 
+	// Allocated from an object pool, see objectpool.h
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 	virtual Container* getContainer() {return this;};
 	virtual const Container* getContainer() const {return this;};
 	virtual Depot* getDepot() {return NULL;};
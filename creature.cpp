@@ -80,6 +80,7 @@ Creature::Creature() :
 	forceUpdateFollowPath = false;
 	isMapLoaded = false;
 	isUpdatingPath = false;
+	spectatorEpoch = 0;
 	memset(localMapCache, false, sizeof(localMapCache));
 
 	attackedCreature = NULL;
@@ -1142,13 +1143,25 @@ void Creature::getPathSearchParams(const Creature* creature, FindPathParams& fpp
 	fpp.maxTargetDist = 1;
 }
 
+bool Creature::getPathToFollowCreature(const FindPathParams& fpp)
+{
+	//monsters chasing the same creature share one flow field around it
+	if(getMonster() && g_config.getBoolean(ConfigManager::MONSTER_FLOWFIELD_PATHING)){
+		if(g_game.getPathByFlowField(this, followCreature, listWalkDir, fpp)){
+			return true;
+		}
+	}
+
+	return g_game.getPathToEx(this, followCreature->getPosition(), listWalkDir, fpp);
+}
+
 void Creature::goToFollowCreature()
 {
 	if(followCreature){
 		FindPathParams fpp;
 		getPathSearchParams(followCreature, fpp);
 
-		if(g_game.getPathToEx(this, followCreature->getPosition(), listWalkDir, fpp)){
+		if(getPathToFollowCreature(fpp)){
 			hasFollowPath = true;
 			startAutoWalk(listWalkDir);
 		}
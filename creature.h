@@ -440,6 +440,8 @@ protected:
 	// -1 represents that the creature isn't in any vector
 	int32_t checkCreatureVectorIndex;
 	bool creatureCheck;
+	// Last spectator query that already returned this creature, see Map::getSpectatorsInternal
+	uint32_t spectatorEpoch;
 
 	int32_t health, healthMax;
 	int32_t mana, manaMax;
@@ -517,6 +519,7 @@ protected:
 	virtual void dropLoot(Container* corpse) {};
 	virtual uint16_t getLookCorpse() const { return 0; }
 	virtual void getPathSearchParams(const Creature* creature, FindPathParams& fpp) const;
+	bool getPathToFollowCreature(const FindPathParams& fpp);
 	virtual Item* dropCorpse();
 	virtual Item* createCorpse();
 
@@ -48,28 +48,40 @@ Database* _Database::_instance = NULL;
 
 Database* _Database::instance(){
 	if(!_instance){
+		_instance = createConnection();
+	}
+	return _instance;
+}
+
+Database* _Database::createConnection(){
+	Database* db = NULL;
 #if defined MULTI_SQL_DRIVERS
 #ifdef __USE_MYSQL__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "mysql")
-			_instance = new DatabaseMySQL;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "mysql")
+		db = new DatabaseMySQL;
 #endif
 #ifdef __USE_ODBC__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "odbc")
-			_instance = new DatabaseODBC;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "odbc")
+		db = new DatabaseODBC;
 #endif
 #ifdef __USE_SQLITE__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "sqlite")
-			_instance = new DatabaseSQLite;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "sqlite")
+		db = new DatabaseSQLite;
 #endif
 #ifdef __USE_PGSQL__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "pgsql")
-			_instance = new DatabasePgSQL;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "pgsql")
+		db = new DatabasePgSQL;
 #endif
 #else
-		_instance = new Database;
+	db = new Database;
 #endif
+	return db;
+}
+
+void _Database::releaseConnection(Database* db){
+	if(db != _instance){
+		delete db;
 	}
-	return _instance;
 }
 
 DBResult* _Database::verifyResult(DBResult* result)
@@ -164,3 +176,69 @@ bool DBInsert::execute()
 		return true;
 	}
 }
+
+void DBBatch::addQuery(const std::string& query)
+{
+	m_statements.push_back(Statement());
+	m_statements.back().query = query;
+	m_statements.back().insert = false;
+}
+
+void DBBatch::addQuery(std::stringstream& query)
+{
+	addQuery(query.str());
+	query.str("");
+}
+
+void DBBatch::setInsert(const std::string& query)
+{
+	m_statements.push_back(Statement());
+	m_statements.back().query = query;
+	m_statements.back().insert = true;
+}
+
+void DBBatch::addRow(const std::string& row)
+{
+	m_statements.back().rows.push_back(row);
+}
+
+void DBBatch::addRow(std::stringstream& row)
+{
+	addRow(row.str());
+	row.str("");
+}
+
+void DBBatch::addRows(const std::vector<std::string>& rows)
+{
+	std::vector<std::string>& statementRows = m_statements.back().rows;
+	statementRows.insert(statementRows.end(), rows.begin(), rows.end());
+}
+
+bool DBBatch::execute(Database* db) const
+{
+	DBTransaction transaction(db);
+	if(!transaction.begin())
+		return false;
+
+	for(std::list<Statement>::const_iterator it = m_statements.begin(); it != m_statements.end(); ++it){
+		if(!it->insert){
+			if(!db->executeQuery(it->query))
+				return false;
+
+			continue;
+		}
+
+		// execute() does nothing if no rows were added
+		DBInsert stmt(db);
+		stmt.setQuery(it->query);
+		for(std::vector<std::string>::const_iterator row = it->rows.begin(); row != it->rows.end(); ++row){
+			if(!stmt.addRow(*row))
+				return false;
+		}
+
+		if(!stmt.execute())
+			return false;
+	}
+
+	return transaction.commit();
+}
@@ -24,6 +24,9 @@
 #include "definitions.h"
 #include <boost/thread.hpp>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <list>
 
 #ifdef MULTI_SQL_DRIVERS
 #define DATABASE_VIRTUAL virtual
@@ -69,7 +72,8 @@ typedef std::map<const std::string, uint32_t> listNames_t;
 class DBQuery;
 
 enum DBParam_t{
-	DBPARAM_MULTIINSERT = 1
+	DBPARAM_MULTIINSERT = 1,
+	DBPARAM_MULTICONNECTION = 2
 };
 
 class _Database
@@ -84,6 +88,16 @@ public:
 	*/
 	static Database* instance();
 
+	/**
+	* Additional connection.
+	*
+	* Opens a new connection with the configured driver, for a thread that must not wait on DBQuery's lock. Only use it if getParam(DBPARAM_MULTICONNECTION) is set, and only from one thread at a time.
+	*
+	* @return new connection handler (check isConnected()), release it with releaseConnection()
+	*/
+	static Database* createConnection();
+	static void releaseConnection(Database* db);
+
 	/**
 	* Database information.
 	*
@@ -314,6 +328,57 @@ protected:
 	std::string m_buf;
 };
 
+/**
+ * Deferred transaction.
+ *
+ * Collects the statements of a transaction so it can be built on one thread and executed later on another connection.
+ */
+class DBBatch
+{
+public:
+	DBBatch() {};
+	~DBBatch() {};
+
+	/**
+	* Adds a statement that doesn't generate results.
+	*
+	* @param std::string& query command
+	*/
+	void addQuery(const std::string& query);
+	/**
+	* Allows to use addQuery() with stringstream as parameter.
+	*/
+	void addQuery(std::stringstream& query);
+
+	/**
+	* Starts a new INSERT statement, the following addRow() calls add its rows.
+	*
+	* @param std::string& INSERT query, as for DBInsert::setQuery()
+	*/
+	void setInsert(const std::string& query);
+	void addRow(const std::string& row);
+	void addRow(std::stringstream& row);
+	void addRows(const std::vector<std::string>& rows);
+
+	bool empty() const {return m_statements.empty();}
+
+	/**
+	* Executes all statements in a single transaction.
+	*
+	* @param Database* connection to use
+	* @return true if the transaction was commited
+	*/
+	bool execute(Database* db) const;
+
+protected:
+	struct Statement{
+		std::string query;
+		std::vector<std::string> rows;
+		bool insert;
+	};
+
+	std::list<Statement> m_statements;
+};
 
 #ifndef MULTI_SQL_DRIVERS
 #if defined(__USE_MYSQL__)
@@ -94,6 +94,9 @@ bool DatabaseMySQL::getParam(DBParam_t param)
 		case DBPARAM_MULTIINSERT: 
 			return true;
 			break;
+		case DBPARAM_MULTICONNECTION:
+			return true;
+			break;
 		default:
 			return false;
 	}
@@ -55,6 +55,9 @@ bool DatabasePgSQL::getParam(DBParam_t param)
 		case DBPARAM_MULTIINSERT:
 			return true;
 			break;
+		case DBPARAM_MULTICONNECTION:
+			return true;
+			break;
 		default:
 			return false;
 	}
@@ -21,7 +21,13 @@
 #include "otpch.h"
 
 #include "fileloader.h"
-#include <cmath>
+
+#if !defined(__WINDOWS__)
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
 
 FileLoader::FileLoader()
 {
@@ -30,12 +36,10 @@ FileLoader::FileLoader()
 	m_buffer = new unsigned char[1024];
 	m_buffer_size = 1024;
 	m_lastError = ERROR_NONE;
-	//cache
-	m_use_cache = false;
-	m_cache_size = 0;
-	m_cache_index = NO_VALID_CACHE;
-	m_cache_offset = NO_VALID_CACHE;
-	memset(m_cached_data, 0, sizeof(m_cached_data));
+	m_data = NULL;
+	m_data_size = 0;
+	m_data_mapped = false;
+	m_node_block_used = NODE_BLOCK_SIZE;
 }
 
 
@@ -46,16 +50,15 @@ FileLoader::~FileLoader()
 		m_file = NULL;
 	}
 
-	NodeStruct::clearNet(m_root);
+	unloadData();
 	delete[] m_buffer;
 
-	for(int i = 0; i < CACHE_BLOCKS; ++i){
-		if(m_cached_data[i].data)
-			delete[] m_cached_data[i].data;
+	for(std::vector<NodeStruct*>::iterator it = m_node_blocks.begin(); it != m_node_blocks.end(); ++it){
+		delete[] *it;
 	}
 }
 
-bool FileLoader::openFile(const char* filename, const char* accept_identifier, bool write, bool caching /*= false*/)
+bool FileLoader::openFile(const char* filename, const char* accept_identifier, bool write)
 {
 	if(write) {
 		m_file = fopen(filename, "wb");
@@ -70,190 +73,267 @@ bool FileLoader::openFile(const char* filename, const char* accept_identifier, b
 		}
 	}
 	else {
-		m_file = fopen(filename, "rb");
-		if(m_file){
-			char identifier[4];
-			if(fread(identifier, 1, 4, m_file) < 4){
-				fclose(m_file);
-				m_file = NULL;
-				m_lastError = ERROR_INVALID_FILE_VERSION;
-				return false;
-			}
-			// Accept 0x00000000 as wildcard
-			else if (memcmp(identifier, accept_identifier, 4) != 0 &&
-					 memcmp(identifier, "\0\0\0\0", 4) != 0)
-			{
-				fclose(m_file);
-				m_file = NULL;
-				m_lastError = ERROR_INVALID_FILE_VERSION;
-				return false;
-			}
-			else{
-				if(caching){
-					m_use_cache = true;
-					fseek(m_file, 0, SEEK_END);
-					int file_size = ftell(m_file);
-					m_cache_size = std::min(32768, std::max(file_size/20, 8192)) & ~0x1FFF;
-				}
+		if(!loadData(filename)){
+			return false;
+		}
 
-				//parse nodes
-				if(safeSeek(4)){
-					delete m_root;
-					m_root = new NodeStruct();
-					m_root->start = 4;
-					int byte;
-					if(safeSeek(4) && readByte(byte) && byte == NODE_START){
-						bool ret = parseNode(m_root);
-						return ret;
-					}
-					else{
-						return false;
-					}
-				}
-				else{
-					m_lastError = ERROR_INVALID_FORMAT;
-					return false;
-				}
-			}
+		if(m_data_size < 4){
+			unloadData();
+			m_lastError = ERROR_INVALID_FILE_VERSION;
+			return false;
 		}
-		else{
-			m_lastError = ERROR_CAN_NOT_OPEN;
+		// Accept 0x00000000 as wildcard
+		else if(memcmp(m_data, accept_identifier, 4) != 0 &&
+				memcmp(m_data, "\0\0\0\0", 4) != 0)
+		{
+			unloadData();
+			m_lastError = ERROR_INVALID_FILE_VERSION;
 			return false;
 		}
+
+		return parseNodes();
 	}
 }
 
-bool FileLoader::parseNode(NODE node)
+bool FileLoader::loadData(const char* filename)
 {
-	int byte;
-	long pos;
-	NODE currentNode = node;
-	while(1){
-		//read node type
-		if(readByte(byte)){
-			currentNode->type = byte;
-			bool setPropsSize = false;
-			while(1){
-				//search child and next node
-				if(readByte(byte)){
-					if(byte == NODE_START){
-						//child node start
-						if(safeTell(pos)){
-							NODE childNode = new NodeStruct();
-							childNode->start = pos;
-							setPropsSize = true;
-							currentNode->propsSize = pos - currentNode->start - 2;
-							currentNode->child = childNode;
-							if(!parseNode(childNode)){
-								return false;
-							}
-						}
-						else{
-							return false;
-						}
-					}
-					else if(byte == NODE_END){
-						//current node end
-						if(!setPropsSize){
-							if(safeTell(pos)){
-								currentNode->propsSize = pos - currentNode->start - 2;
-							}
-							else{
-								return false;
-							}
-						}
-						if(readByte(byte)){
-							if(byte == NODE_START){
-								//starts next node
-								if(safeTell(pos)){
-									NODE nextNode = new NodeStruct();
-									nextNode->start = pos;
-									currentNode->next = nextNode;
-									currentNode = nextNode;
-									break;
-								}
-								else{
-									return false;
-								}
-							}
-							else if(byte == NODE_END){
-								//up 1 level and move 1 position back
-								if(safeTell(pos) && safeSeek(pos)){
-									return true;
-								}
-								else{
-									return false;
-								}
-							}
-							else{
-								//wrong format
-								m_lastError = ERROR_INVALID_FORMAT;
-								return false;
-							}
-						}
-						else{
-							//end of file?
-							return true;
-						}
-					}
-					else if(byte == ESCAPE_CHAR){
-						if(!readByte(byte))
-							return false;
-					}
-				}
-				else{
-					return false;
-				}
-			}
+#if !defined(__WINDOWS__)
+	//map the file, the pages are shared with the page cache and
+	//props without escaped bytes are handed out without a copy
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1){
+		m_lastError = ERROR_CAN_NOT_OPEN;
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) == -1){
+		close(fd);
+		m_lastError = ERROR_CAN_NOT_OPEN;
+		return false;
+	}
+
+	m_data_size = st.st_size;
+	if(m_data_size > 0){
+		void* data = mmap(NULL, m_data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED){
+			madvise(data, m_data_size, MADV_WILLNEED);
+			m_data = (const unsigned char*)data;
+			m_data_mapped = true;
+			close(fd);
+			return true;
 		}
-		else{
-			return false;
+	}
+	close(fd);
+#endif
+
+	//no mapping, read the whole file at once
+	FILE* file = fopen(filename, "rb");
+	if(!file){
+		m_lastError = ERROR_CAN_NOT_OPEN;
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if(size < 0){
+		fclose(file);
+		m_lastError = ERROR_TELL_ERROR;
+		return false;
+	}
+
+	unsigned char* data = new unsigned char[size > 0 ? size : 1];
+	if(fread(data, 1, size, file) != (size_t)size){
+		delete[] data;
+		fclose(file);
+		m_lastError = ERROR_EOF;
+		return false;
+	}
+	fclose(file);
+
+	m_data = data;
+	m_data_size = size;
+	m_data_mapped = false;
+	return true;
+}
+
+void FileLoader::unloadData()
+{
+	if(!m_data){
+		return;
+	}
+
+#if !defined(__WINDOWS__)
+	if(m_data_mapped){
+		munmap((void*)m_data, m_data_size);
+	}
+	else{
+		delete[] m_data;
+	}
+#else
+	delete[] m_data;
+#endif
+
+	m_data = NULL;
+	m_data_size = 0;
+	m_data_mapped = false;
+}
+
+NODE FileLoader::createNode(unsigned long start)
+{
+	if(m_node_block_used == NODE_BLOCK_SIZE){
+		m_node_blocks.push_back(new NodeStruct[NODE_BLOCK_SIZE]);
+		m_node_block_used = 0;
+	}
+
+	NODE node = &m_node_blocks.back()[m_node_block_used++];
+	node->start = start;
+	return node;
+}
+
+inline const unsigned char* FileLoader::findSpecial(const unsigned char* p, const unsigned char* end) const
+{
+	//all special bytes are above 0xFC, so a word is skipped when no byte
+	//in it has a complement below 3
+	const uint64_t ones = 0x0101010101010101ULL;
+	while(end - p >= 8){
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		word = ~word;
+		if(((word - ones * 3) & ~word & (ones * 0x80)) != 0){
+			break;
 		}
+		p += 8;
 	}
+
+	while(p < end && *p < ESCAPE_CHAR){
+		++p;
+	}
+	return p;
 }
 
-const unsigned char* FileLoader::getProps(const NODE node, unsigned long &size)
+bool FileLoader::parseNodes()
 {
-	if(node){
-		while(node->propsSize >= m_buffer_size){
-            delete[] m_buffer;
-            while (node->propsSize >= m_buffer_size)
-				m_buffer_size *= 2;
-            m_buffer = new unsigned char[m_buffer_size];
-        }
-		//get buffer
-		if(readBytes(m_buffer, node->propsSize, node->start + 2)){
-			//unscape buffer
-			unsigned int j = 0;
-			bool escaped = false;
-			for(unsigned int i = 0; i < node->propsSize; ++i, ++j){
-				if(m_buffer[i] == ESCAPE_CHAR){
-					//escape char found, skip it and write next
-					++i;
-					m_buffer[j] = m_buffer[i];
-					//is neede a displacement for next bytes
-					escaped = true;
-				}
-				else if(escaped){
-					//perform that displacement
-					m_buffer[j] = m_buffer[i];
-				}
-				else{
-					//the buffer is right as is
-				}
+	//one pass over the data, nodes are linked as their bounds are found
+	const unsigned char* end = m_data + m_data_size;
+	const unsigned char* p = m_data + 4;
+	if(p + 1 >= end || *p != NODE_START){
+		m_lastError = ERROR_INVALID_FORMAT;
+		return false;
+	}
+
+	std::vector<NODE> parents;
+	NODE node = createNode(4);
+	m_root = node;
+	node->type = p[1];
+	p += 2;
+
+	while(true){
+		p = findSpecial(p, end);
+		if(p == end){
+			m_lastError = ERROR_EOF;
+			return false;
+		}
+
+		if(*p == ESCAPE_CHAR){
+			if(p + 1 >= end){
+				m_lastError = ERROR_EOF;
+				return false;
+			}
+			if(!node->child){
+				node->escaped = true;
+			}
+			p += 2;
+		}
+		else if(*p == NODE_START){
+			//child node start
+			if(node->child || p + 1 >= end){
+				m_lastError = ERROR_INVALID_FORMAT;
+				return false;
 			}
-			size = j;
-			return m_buffer;
+
+			NODE childNode = createNode(p - m_data);
+			node->propsSize = childNode->start - node->start - 2;
+			node->child = childNode;
+			parents.push_back(node);
+
+			node = childNode;
+			node->type = p[1];
+			p += 2;
 		}
 		else{
-			return NULL;
+			//current node end
+			if(!node->child){
+				node->propsSize = (p - m_data) - node->start - 2;
+			}
+			++p;
+
+			if(parents.empty() || p == end){
+				return true;
+			}
+
+			if(*p == NODE_START){
+				//starts next node
+				if(p + 1 >= end){
+					m_lastError = ERROR_INVALID_FORMAT;
+					return false;
+				}
+
+				NODE nextNode = createNode(p - m_data);
+				node->next = nextNode;
+
+				node = nextNode;
+				node->type = p[1];
+				p += 2;
+			}
+			else if(*p == NODE_END){
+				//up 1 level, the parent ends at this byte
+				node = parents.back();
+				parents.pop_back();
+			}
+			else{
+				//wrong format
+				m_lastError = ERROR_INVALID_FORMAT;
+				return false;
+			}
 		}
 	}
-	else{
+}
+
+const unsigned char* FileLoader::getProps(const NODE node, unsigned long &size)
+{
+	if(!node || !m_data){
 		return NULL;
 	}
-}
 
+	const unsigned char* props = m_data + node->start + 2;
+	if(!node->escaped){
+		//the data is right as is
+		size = node->propsSize;
+		return props;
+	}
+
+	if(node->propsSize >= m_buffer_size){
+		delete[] m_buffer;
+		while(node->propsSize >= m_buffer_size)
+			m_buffer_size *= 2;
+		m_buffer = new unsigned char[m_buffer_size];
+	}
+
+	//unescape buffer
+	unsigned long j = 0;
+	for(unsigned long i = 0; i < node->propsSize; ++i, ++j){
+		if(props[i] == ESCAPE_CHAR && i + 1 < node->propsSize){
+			//escape char found, skip it and write next
+			++i;
+		}
+		m_buffer[j] = props[i];
+	}
+
+	size = j;
+	return m_buffer;
+}
 
 bool FileLoader::getProps(const NODE node, PropStream &props)
 {
@@ -320,232 +400,3 @@ const NODE FileLoader::getNextNode(const NODE prev, unsigned long &type)
 	}
 }
 
-
-inline bool FileLoader::readByte(int &value)
-{
-	if(m_use_cache){
-		if(m_cache_index == NO_VALID_CACHE){
-			m_lastError = ERROR_CACHE_ERROR;
-			return false;
-		}
-		if(m_cache_offset >= m_cached_data[m_cache_index].size){
-			long pos = m_cache_offset + m_cached_data[m_cache_index].base;
-			long tmp = getCacheBlock(pos);
-			if(tmp < 0)
-				return false;
-
-			m_cache_index = tmp;
-			m_cache_offset = pos - m_cached_data[m_cache_index].base;
-			if(m_cache_offset >= m_cached_data[m_cache_index].size){
-				return false;
-			}
-		}
-		value = m_cached_data[m_cache_index].data[m_cache_offset];
-		m_cache_offset++;
-		return true;
-	}
-	else{
-		value = fgetc(m_file);
-		if(value == EOF){
-			m_lastError = ERROR_EOF;
-			return false;
-		}
-		else
-			return true;
-	}
-}
-
-inline bool FileLoader::readBytes(unsigned char* buffer, unsigned int size, long pos)
-{
-	if(m_use_cache){
-		//seek at pos
-		unsigned long reading, remain = size, bufferPos = 0;
-		do{
-			//prepare cache
-			unsigned long i = getCacheBlock(pos);
-			if(i == NO_VALID_CACHE)
-				return false;
-
-			m_cache_index = i;
-			m_cache_offset = pos - m_cached_data[i].base;
-
-			//get maximun read block size and calculate remaining bytes
-			reading = std::min(remain, m_cached_data[i].size - m_cache_offset);
-			remain = remain - reading;
-
-			//read it
-			memcpy(buffer + bufferPos, m_cached_data[m_cache_index].data + m_cache_offset, reading);
-
-			//update variables
-			m_cache_offset = m_cache_offset + reading;
-			bufferPos = bufferPos + reading;
-			pos = pos + reading;
-		}while(remain > 0);
-		return true;
-	}
-	else{
-		if(fseek(m_file, pos, SEEK_SET)){
-			m_lastError = ERROR_SEEK_ERROR;
-			return false;
-		}
-		size_t value = fread(buffer, 1, size, m_file);
-		if(value != size){
-			m_lastError = ERROR_EOF;
-			return false;
-		}
-		else{
-			return true;
-		}
-	}
-}
-
-
-/*
-inline bool FileLoader::writeData(void* data, int size, bool unescape)
-{
-	for(int i = 0; i < size; ++i) {
-		unsigned char c = *(((unsigned char*)data) + i);
-
-		if(unescape && (c == NODE_START || c == NODE_END || c == ESCAPE_CHAR)) {
-			unsigned char escape = ESCAPE_CHAR;
-			int value = fwrite(&escape, 1, 1, m_file);
-			if(value != 1) {
-				m_lastError = ERROR_COULDNOTWRITE;
-				return false;
-			}
-		}
-
-		int value = fwrite(&c, 1, 1, m_file);
-		if(value != 1) {
-			m_lastError = ERROR_COULDNOTWRITE;
-			return false;
-		}
-	}
-
-	return true;
-}
-*/
-inline bool FileLoader::checks(const NODE node)
-{
-	if(!m_file){
-		m_lastError = ERROR_NOT_OPEN;
-		return false;
-	}
-	if(!node){
-		m_lastError = ERROR_INVALID_NODE;
-		return false;
-	}
-
-	return true;
-}
-
-inline bool FileLoader::safeSeek(unsigned long pos)
-{
-	if(m_use_cache){
-		unsigned long i = getCacheBlock(pos);
-		if(i == NO_VALID_CACHE)
-			return false;
-
-		m_cache_index = i;
-		m_cache_offset = pos - m_cached_data[i].base;
-	}
-	else{
-		if(fseek(m_file, pos, SEEK_SET)){
-			m_lastError = ERROR_SEEK_ERROR;
-			return false;
-		}
-	}
-	return true;
-}
-
-
-
-inline bool FileLoader::safeTell(long &pos)
-{
-	if(m_use_cache){
-		if(m_cache_index == NO_VALID_CACHE){
-			m_lastError = ERROR_CACHE_ERROR;
-			return false;
-		}
-
-		pos = m_cached_data[m_cache_index].base + m_cache_offset - 1;
-		return true;
-	}
-	else{
-		pos = ftell(m_file);
-		if(pos == -1){
-			m_lastError = ERROR_TELL_ERROR;
-			return false;
-		}
-		else{
-			pos = pos - 1;
-			return true;
-		}
-	}
-}
-
-inline unsigned long FileLoader::getCacheBlock(unsigned long pos)
-{
-	bool found = false;
-	unsigned long i;
-	unsigned long base_pos = pos & ~(m_cache_size - 1);
-	for(i = 0; i < CACHE_BLOCKS; ++i){
-		if(m_cached_data[i].loaded){
-			if(m_cached_data[i].base == base_pos){
-				found = true;
-				break;
-			}
-		}
-	}
-	if(!found){
-		i = loadCacheBlock(pos);
-	}
-	return i;
-}
-
-long FileLoader::loadCacheBlock(unsigned long pos)
-{
-	long i;
-	long loading_cache = -1;
-	long base_pos = pos & ~(m_cache_size - 1);
-	for(i = 0; i < CACHE_BLOCKS; ++i){
-		if(!m_cached_data[i].loaded){
-			loading_cache = i;
-			break;
-		}
-	}
-	if(loading_cache == -1){
-		for(i = 0; i < CACHE_BLOCKS; ++i){
-			if((long)(labs((long)m_cached_data[i].base - base_pos)) > (long)(2*m_cache_size)){
-				loading_cache = i;
-				break;
-			}
-		}
-		if(loading_cache == -1){
-			loading_cache = 0;
-		}
-	}
-
-	if(m_cached_data[loading_cache].data == NULL){
-		m_cached_data[loading_cache].data = new unsigned char[m_cache_size];
-	}
-
-	m_cached_data[loading_cache].base = base_pos;
-
-	if(fseek(m_file, m_cached_data[loading_cache].base, SEEK_SET)){
-		m_lastError = ERROR_SEEK_ERROR;
-		return -1;
-	}
-
-	size_t size = fread(m_cached_data[loading_cache].data, 1, m_cache_size, m_file);
-	m_cached_data[loading_cache].size = size;
-
-	if(size < (pos - m_cached_data[loading_cache].base)){
-		m_lastError = ERROR_SEEK_ERROR;
-		return -1;
-	}
-
-	m_cached_data[loading_cache].loaded = 1;
-
-	return loading_cache;
-}
@@ -23,6 +23,7 @@
 
 #include "definitions.h"
 #include <string>
+#include <vector>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -38,45 +39,15 @@ struct NodeStruct{
 		next = 0;
 		child = 0;
 		type = 0;
-	}
-	~NodeStruct(){
-		//
+		escaped = false;
 	}
 	unsigned long start;
 	unsigned long propsSize;
 	unsigned long type;
 	NodeStruct* next;
 	NodeStruct* child;
-
-	static void clearNet(NodeStruct* root){
-		if(root){
-			clearChild(root);
-		}
-	}
-
-private:
-	static void clearNext(NodeStruct* node){
-		NodeStruct* deleteNode = node;
-		NodeStruct* nextNode;
-		while(deleteNode){
-			if(deleteNode->child){
-				clearChild(deleteNode->child);
-			}
-			nextNode = deleteNode->next;
-			delete deleteNode;
-			deleteNode = nextNode;
-		}
-	}
-
-	static void clearChild(NodeStruct* node){
-		if(node->child){
-			clearChild(node->child);
-		}
-		if(node->next){
-			clearNext(node->next);
-		}
-		delete node;
-	}
+	//props contain escaped bytes and have to be copied before use
+	bool escaped;
 };
 
 #define NO_NODE 0
@@ -103,7 +74,7 @@ public:
 	FileLoader();
 	virtual ~FileLoader();
 
-	bool openFile(const char* filename, const char* identifier, bool write, bool caching = false);
+	bool openFile(const char* filename, const char* identifier, bool write);
 	const unsigned char* getProps(const NODE, unsigned long &size);
 	bool getProps(const NODE, PropStream& props);
 	const NODE getChildNode(const NODE parent, unsigned long &type);
@@ -123,13 +94,11 @@ protected:
 		ESCAPE_CHAR = 0xFD
 	};
 
-	bool parseNode(NODE node);
-
-	inline bool readByte(int &value);
-	inline bool readBytes(unsigned char* buffer, unsigned int size, long pos);
-	inline bool checks(const NODE node);
-	inline bool safeSeek(unsigned long pos);
-	inline bool safeTell(long &pos);
+	bool loadData(const char* filename);
+	void unloadData();
+	bool parseNodes();
+	NODE createNode(unsigned long start);
+	inline const unsigned char* findSpecial(const unsigned char* p, const unsigned char* end) const;
 
 public:
 	inline bool writeData(const void* data, int size, bool unescape){
@@ -159,21 +128,15 @@ protected:
 	unsigned long m_buffer_size;
 	unsigned char* m_buffer;
 
-	bool m_use_cache;
-	struct _cache{
-		unsigned long loaded;
-		unsigned long base;
-		unsigned char* data;
-		size_t size;
-	};
-	#define CACHE_BLOCKS 3
-	unsigned long m_cache_size;
-	_cache m_cached_data[CACHE_BLOCKS];
-	#define NO_VALID_CACHE 0xFFFFFFFF
-	unsigned long m_cache_index;
-	unsigned long m_cache_offset;
-	inline unsigned long getCacheBlock(unsigned long pos);
-	long loadCacheBlock(unsigned long pos);
+	//the whole file while reading, either mapped or read into memory
+	const unsigned char* m_data;
+	unsigned long m_data_size;
+	bool m_data_mapped;
+
+	//nodes are allocated in blocks and released together
+	#define NODE_BLOCK_SIZE 4096
+	std::vector<NodeStruct*> m_node_blocks;
+	unsigned long m_node_block_used;
 };
 
 class PropStream{
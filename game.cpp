@@ -45,6 +45,8 @@
 #include "quests.h"
 #include "movement.h"
 #include "guild.h"
+#include "objectpool.h"
+#include "workerpool.h"
 #include <boost/config.hpp>
 #include <boost/bind.hpp>
 #include <string>
@@ -63,6 +65,7 @@ extern MoveEvents* g_moveEvents;
 extern Npcs g_npcs;
 extern CreatureEvents* g_creatureEvents;
 extern GlobalEvents* g_globalEvents;
+extern WorkerPool g_loginWorkers;
 
 Game::Game()
 {
@@ -190,32 +193,45 @@ void Game::saveGameState()
 	ScriptEnviroment::saveGameState();
 }
 
-bool Game::saveServer(bool payHouses, bool shallowSave /*=false*/)
+bool Game::saveServer(bool payHouses, bool shallowSave /*=false*/, const SaveCallback& callback /*= SaveCallback()*/)
 {
 	uint64_t start = OTSYS_TIME();
 
 	saveGameState();
 
+	GlobalSave_ptr save(new GlobalSave);
+	save->callback = callback;
+
+	bool ret = true;
 	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin();
 		it != Player::listPlayer.list.end();
 		++it)
 	{
 		it->second->loginPosition = it->second->getPosition();
-		IOPlayer::instance()->savePlayer(it->second, shallowSave);
-	}
-
-	if(shallowSave)
-		return true;
 
-	if(payHouses){
-		Houses::getInstance().payHouses();
+		save->players.push_back(GlobalSave::PlayerEntry());
+		if(!IOPlayer::instance()->preparePlayerSave(it->second, shallowSave, save->players.back().data)){
+			save->players.pop_back();
+			ret = false;
+		}
 	}
 
-	bool ret = map->saveMap();
+	if(!shallowSave){
+		if(payHouses){
+			Houses::getInstance().payHouses();
+		}
 
-	std::cout << "Notice: Server saved. Process took " <<
-		(OTSYS_TIME() - start)/(1000.) << "s." << std::endl;
+		if(map->prepareSaveMap(save->mapBatch, save->mapState, save->houseBatch)){
+			save->saveMap = true;
+		}
+		else{
+			std::cout << "Error: [Game::saveServer] Could not serialize the map." << std::endl;
+			ret = false;
+		}
+	}
 
+	save->captureTime = OTSYS_TIME() - start;
+	SaveManager::getInstance()->addSave(save);
 	return ret;
 }
 
@@ -230,7 +246,10 @@ int Game::loadMap(std::string filename, std::string filekind)
 		map = new Map;
 	}
 
-	return map->loadMap(filename, filekind);
+	int ret = map->loadMap(filename, filekind);
+	//loading leaves plenty of temporary items behind
+	ObjectPool::releaseAllEmptySlabs();
+	return ret;
 }
 
 void Game::refreshMap(Map::TileMap::iterator* map_iter, int clean_max)
@@ -298,6 +317,7 @@ void Game::proceduralRefresh(Map::TileMap::iterator* begin)
 
 	if(*begin == map->refreshTileMap.end()){
 		delete begin;
+		ObjectPool::releaseAllEmptySlabs();
 		return;
 	}
 
@@ -3871,6 +3891,12 @@ bool Game::getPathToEx(const Creature* creature, const Position& targetPos,
 	return map->getPathMatching(creature, dirList, FrozenPathingConditionCall(targetPos), fpp);
 }
 
+bool Game::getPathByFlowField(const Creature* creature, const Creature* target,
+	std::list<Direction>& dirList, const FindPathParams& fpp)
+{
+	return map->getPathByFlowField(creature, target, dirList, fpp);
+}
+
 bool Game::getPathToEx(const Creature* creature, const Position& targetPos, std::list<Direction>& dirList,
 	uint32_t minTargetDist, uint32_t maxTargetDist, bool fullPathSearch /*= true*/,
 	bool clearSight /*= true*/, int32_t maxSearchDist /*= -1*/)
@@ -4660,7 +4686,11 @@ void Game::shutdown()
 	std::cout << "Shutting down server...";
 
 	g_scheduler.shutdown();
+	//the last saves are completed on this thread, before the dispatcher is
+	//flushed for the last time
+	SaveManager::getInstance()->shutdown();
 	g_dispatcher.shutdown();
+	g_loginWorkers.shutdown();
 	Spawns::getInstance()->clear();
 	Raids::getInstance()->clear();
 
@@ -5031,6 +5061,7 @@ void Game::reloadInfo(reloadTypes_t info)
 			break;
 		case RELOAD_TYPE_ITEMS:
 			Item::items.reload();
+			ProtocolGame::clearTileDescriptionCache();
 			break;
 		case RELOAD_TYPE_GLOBALEVENTS:
 			g_globalEvents->reload();
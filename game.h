@@ -31,6 +31,7 @@
 #include "templates.h"
 #include "enums.h"
 #include "scheduler.h"
+#include "savemanager.h"
 #include <queue>
 #include <vector>
 #include <set>
@@ -288,12 +289,19 @@ public:
 		return map->getSpectators(centerPos);
 	}
 
-	void clearSpectatorCache(){
+	void updateSpectatorCache(Creature* creature, const Tile* oldTile, const Tile* newTile){
+		map->updateSpectatorCache(creature, oldTile, newTile);
+	}
+
+	void cleanSpectatorCache(){
 		if(map){
-			map->clearSpectatorCache();
+			map->cleanSpectatorCache();
 		}
 	}
 
+	const SpectatorCacheStats& getSpectatorCacheStats() const {return map->getSpectatorCacheStats();}
+	uint32_t getSpectatorCacheSize() const {return map->getSpectatorCacheSize();}
+
 	ReturnValue internalMoveCreature(Creature* creature, Direction direction, uint32_t flags = 0);
 	ReturnValue internalMoveCreature(Creature* creature, Cylinder* fromCylinder, Cylinder* toCylinder, uint32_t flags = 0);
 
@@ -482,6 +490,9 @@ public:
 	bool getPathToEx(const Creature* creature, const Position& targetPos, std::list<Direction>& dirList,
 		const FindPathParams& fpp);
 
+	bool getPathByFlowField(const Creature* creature, const Creature* target, std::list<Direction>& dirList,
+		const FindPathParams& fpp);
+
 	bool getPathToEx(const Creature* creature, const Position& targetPos, std::list<Direction>& dirList,
 		uint32_t minTargetDist, uint32_t maxTargetDist, bool fullPathSearch = true,
 		bool clearSight = true, int32_t maxSearchDist = -1);
@@ -501,7 +512,9 @@ public:
 	void updateCreatureEmblem(Creature* creature);
 	GameState_t getGameState();
 	void setGameState(GameState_t newState);
-	bool saveServer(bool payHouses, bool shallowSave = false);
+	// Captures the save on the game thread, the writing happens on the save
+	// thread and callback runs here once it is done
+	bool saveServer(bool payHouses, bool shallowSave = false, const SaveCallback& callback = SaveCallback());
 	void saveGameState();
 	void loadGameState();
 	void refreshMap(Map::TileMap::iterator* begin = NULL, int clean_max = 0);
@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "housetile.h"
+#include "objectpool.h"
 #include "house.h"
 #include "game.h"
 #include "configmanager.h"
@@ -27,6 +28,22 @@
 extern Game g_game;
 extern ConfigManager g_config;
 
+static ObjectPool& getHouseTilePool()
+{
+	static ObjectPool* pool = new ObjectPool("HouseTile", sizeof(HouseTile));
+	return *pool;
+}
+
+void* HouseTile::operator new(size_t size)
+{
+	return getHouseTilePool().allocate(size);
+}
+
+void HouseTile::operator delete(void* p, size_t size)
+{
+	getHouseTilePool().deallocate(p, size);
+}
+
 HouseTile::HouseTile(int x, int y, int z, House* _house) :
 	DynamicTile(x, y, z)
 {
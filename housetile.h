@@ -33,6 +33,10 @@ public:
 	HouseTile(int x, int y, int z, House* _house);
 	~HouseTile();
 
+	// Allocated from an object pool, see objectpool.h
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 	//cylinder implementations
 	virtual ReturnValue __queryAdd(int32_t index, const Thing* thing, uint32_t count,
 		uint32_t flags) const;
@@ -87,7 +87,7 @@ bool IOMapOTBM::loadMap(Map* map, const std::string& identifier)
 	int64_t start = OTSYS_TIME();
 
 	FileLoader f;
-	if(!f.openFile(identifier.c_str(), "OTBM", false, true)){
+	if(!f.openFile(identifier.c_str(), "OTBM", false)){
 		std::stringstream ss;
 		ss << "Could not open the file " << identifier << ".";
 		setLastErrorString(ss.str());
@@ -47,19 +47,87 @@ bool IOMapSerialize::loadMap(Map* map)
 }
 
 bool IOMapSerialize::saveMap(Map* map)
+{
+	DBQuery query;
+	DBBatch batch;
+	MapSaveState state;
+	if(!prepareMapSave(map, batch, state))
+		return false;
+
+	if(!batch.execute(Database::instance()))
+		return false;
+
+	onMapSaved(state);
+	return true;
+}
+
+bool IOMapSerialize::prepareMapSave(Map* map, DBBatch& batch, MapSaveState& state)
 {
 	bool s = false;
 
-	if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "relational")
-		s = saveMapRelational(map);
-	else if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "binary")
-		s = saveMapBinary(map);
+	state.storageType = g_config.getString(ConfigManager::MAP_STORAGE_TYPE);
+	state.changedHouses = 0;
+
+	//only the changed houses are rewritten, unless we do not know what the database holds
+	bool full = (state.storageType != m_savedStorageType);
+
+	if(state.storageType == "relational")
+		s = saveMapRelational(map, batch, state, full);
+	else if(state.storageType == "binary")
+		s = saveMapBinary(map, batch, state, full);
 	else
 		std::cout << "[IOMapSerialize::saveMap] Unknown map storage type" << std::endl;
 
 	return s;
 }
 
+void IOMapSerialize::onMapSaved(const MapSaveState& state)
+{
+	m_savedStorageType = state.storageType;
+	m_savedHouseHashes = state.houseHashes;
+}
+
+bool IOMapSerialize::reconcileMap(Map* map)
+{
+	uint64_t start = OTSYS_TIME();
+
+	m_savedStorageType = "";
+	m_savedHouseHashes.clear();
+	m_capturedHouseHashes.clear();
+
+	bool s = false;
+	uint32_t changedHouses = 0;
+	std::string storageType = g_config.getString(ConfigManager::MAP_STORAGE_TYPE);
+
+	if(storageType == "relational")
+		s = reconcileMapRelational(map, changedHouses);
+	else if(storageType == "binary")
+		s = reconcileMapBinary(map, changedHouses);
+
+	if(s){
+		m_savedStorageType = storageType;
+		m_capturedHouseHashes = m_savedHouseHashes;
+		std::cout << "Notice: Map reconciliation took : " << (OTSYS_TIME() - start)/(1000.) << " s, "
+			<< changedHouses << " houses differ from the database." << std::endl;
+	}
+	else{
+		m_savedHouseHashes.clear();
+		std::cout << "Notice: Map reconciliation took : " << (OTSYS_TIME() - start)/(1000.) << " s, "
+			<< "the next save rewrites all houses." << std::endl;
+	}
+
+	return s;
+}
+
+bool IOMapSerialize::isHouseChanged(uint32_t houseId, uint64_t hash)
+{
+	//saves that are still being written end with the last captured items,
+	//a house can only be skipped if those match the database too
+	bool changed = (m_savedHouseHashes[houseId] != hash || m_capturedHouseHashes[houseId] != hash);
+	m_capturedHouseHashes[houseId] = hash;
+	return changed;
+}
+
 bool IOMapSerialize::loadMapRelational(Map* map)
 {
 	Database* db = Database::instance();
@@ -282,43 +350,161 @@ bool IOMapSerialize::loadItems(Database* db, DBResult* result, Cylinder* parent,
 	return true;
 }
 
-bool IOMapSerialize::saveMapRelational(Map* map)
+bool IOMapSerialize::saveMapRelational(Map* map, DBBatch& batch, MapSaveState& state, bool full)
+{
+	if(full){
+		//clear old tile data
+		batch.addQuery("DELETE FROM `tiles`");
+		batch.addQuery("DELETE FROM `tile_items`");
+	}
+
+	std::vector<std::string> tileRows;
+	std::vector<std::string> itemRows;
+	DBQuery query;
+
+	//the tile ids follow the house tiles, so each house keeps its own range
+	uint32_t tileId = 0;
+	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin();
+		it != Houses::getInstance().getHouseEnd(); ++it){
+
+		House* house = it->second;
+		uint32_t firstTileId = tileId + 1;
+
+		std::vector<std::string> houseTileRows;
+		std::vector<std::string> houseItemRows;
+		if(!saveHouseRelational(house, tileId, houseTileRows, houseItemRows)){
+			return false;
+		}
+
+		uint64_t hash = hashStrings(houseItemRows, hashStrings(houseTileRows));
+		state.houseHashes[house->getId()] = hash;
+		if(!isHouseChanged(house->getId(), hash) && !full){
+			continue;
+		}
+
+		++state.changedHouses;
+		if(!full && tileId >= firstTileId){
+			query << "DELETE FROM `tile_items` WHERE `tile_id` BETWEEN " << firstTileId << " AND " << tileId;
+			batch.addQuery(query);
+			query << "DELETE FROM `tiles` WHERE `id` BETWEEN " << firstTileId << " AND " << tileId;
+			batch.addQuery(query);
+		}
+
+		tileRows.insert(tileRows.end(), houseTileRows.begin(), houseTileRows.end());
+		itemRows.insert(itemRows.end(), houseItemRows.begin(), houseItemRows.end());
+	}
+
+	//the tiles go first, the items refer to them
+	batch.setInsert("INSERT INTO `tiles` (`id`, `house_id`, `x`, `y`, `z`) VALUES ");
+	batch.addRows(tileRows);
+	batch.setInsert("INSERT INTO `tile_items` (`tile_id`, `sid`, `pid`, `itemtype`, `count`, `attributes`) VALUES ");
+	batch.addRows(itemRows);
+	return true;
+}
+
+bool IOMapSerialize::saveHouseRelational(House* house, uint32_t& tileId,
+	std::vector<std::string>& tileRows, std::vector<std::string>& itemRows)
+{
+	for(HouseTileList::iterator it = house->getTileBegin(); it != house->getTileEnd(); ++it){
+		++tileId;
+		if(!saveItems(tileId, house->getId(), *it, tileRows, itemRows)){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool IOMapSerialize::reconcileMapRelational(Map* map, uint32_t& changedHouses)
 {
 	Database* db = Database::instance();
 	DBQuery query;
-	DBTransaction transaction(db);
 
-	//Start the transaction
-	if(!transaction.begin())
-		return false;
+	//the range of tile ids each house is saved with, by last id
+	typedef std::map<uint32_t, std::pair<uint32_t, uint32_t> > TileRangeMap;
+	TileRangeMap tileRanges;
+	HouseHashMap loadedHashes;
 
-	//clear old tile data
-	if(!db->executeQuery("DELETE FROM `tiles`")){
+	uint32_t tileId = 0;
+	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it){
+		House* house = it->second;
+		uint32_t firstTileId = tileId + 1;
+
+		std::vector<std::string> houseTileRows;
+		std::vector<std::string> houseItemRows;
+		if(!saveHouseRelational(house, tileId, houseTileRows, houseItemRows)){
+			return false;
+		}
+
+		loadedHashes[house->getId()] = hashStrings(houseItemRows, hashStrings(houseTileRows));
+		if(tileId >= firstTileId){
+			tileRanges[tileId] = std::make_pair(firstTileId, house->getId());
+		}
+	}
+
+	typedef std::map<uint32_t, std::vector<std::string> > HouseRowMap;
+	HouseRowMap storedTileRows;
+	HouseRowMap storedItemRows;
+
+	//rows outside the range of their house can only be removed by a full save
+	DBResult* result;
+	if(!(result = db->storeQuery("SELECT `id`, `house_id`, `x`, `y`, `z` FROM `tiles` ORDER BY `id`"))){
 		return false;
 	}
-	if(!db->executeQuery("DELETE FROM `tile_items`")){
+
+	do{
+		uint32_t id = result->getDataInt("id");
+		uint32_t houseId = result->getDataInt("house_id");
+		TileRangeMap::iterator range = tileRanges.lower_bound(id);
+		if(range == tileRanges.end() || range->second.first > id || range->second.second != houseId){
+			db->freeResult(result);
+			return false;
+		}
+
+		query << id << ", " << houseId << ", " << result->getDataInt("x") << ", "
+			<< result->getDataInt("y") << ", " << result->getDataInt("z");
+		storedTileRows[houseId].push_back(query.str());
+		query.str("");
+	}while(result->next());
+	db->freeResult(result);
+
+	if(!(result = db->storeQuery("SELECT `tile_id`, `sid`, `pid`, `itemtype`, `count`, `attributes` FROM `tile_items` ORDER BY `tile_id`, `sid`"))){
 		return false;
 	}
 
-	uint32_t tileId = 0;
-	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin();
-		it != Houses::getInstance().getHouseEnd(); ++it){
+	do{
+		uint32_t id = result->getDataInt("tile_id");
+		TileRangeMap::iterator range = tileRanges.lower_bound(id);
+		if(range == tileRanges.end() || range->second.first > id){
+			db->freeResult(result);
+			return false;
+		}
 
-		//save house items
-		House* house = it->second;
-		for(HouseTileList::iterator it = house->getTileBegin(); it != house->getTileEnd(); ++it){
-			++tileId;
-			if(!saveItems(db, tileId, house->getId(), *it)){
-				return false;
-			}
+		unsigned long attrSize = 0;
+		const char* attr = result->getDataStream("attributes", attrSize);
+		query << id << ", " << result->getDataInt("sid") << ", " << result->getDataInt("pid") << ", "
+			<< result->getDataInt("itemtype") << ", " << result->getDataInt("count") << ", "
+			<< db->escapeBlob(attr, attrSize);
+		storedItemRows[range->second.second].push_back(query.str());
+		query.str("");
+	}while(result->next());
+	db->freeResult(result);
+
+	for(HouseHashMap::iterator it = loadedHashes.begin(); it != loadedHashes.end(); ++it){
+		uint64_t hash = hashStrings(storedItemRows[it->first], hashStrings(storedTileRows[it->first]));
+		if(hash == it->second){
+			m_savedHouseHashes[it->first] = hash;
+		}
+		else{
+			++changedHouses;
 		}
 	}
 
-	//End the transaction
-	return transaction.commit();
+	return true;
 }
 
-bool IOMapSerialize::saveItems(Database* db, uint32_t tileId, uint32_t houseId, const Tile* tile)
+bool IOMapSerialize::saveItems(uint32_t tileId, uint32_t houseId, const Tile* tile,
+	std::vector<std::string>& tileRows, std::vector<std::string>& itemRows)
 {
 	typedef std::list<std::pair<Container*, int32_t> > ContainerStackList;
 	typedef ContainerStackList::value_type ContainerStackList_Pair;
@@ -330,12 +516,9 @@ bool IOMapSerialize::saveItems(Database* db, uint32_t tileId, uint32_t houseId,
 	Container* container = NULL;
 
 	int parentid = 0;
+	Database* db = Database::instance();
 	DBQuery query;
 
-	DBInsert stmt(db);
-
-	stmt.setQuery("INSERT INTO `tile_items` (`tile_id`, `sid`, `pid`, `itemtype`, `count`, `attributes`) VALUES ");
-
 	for(uint32_t i = 0; i < tile->getThingCount(); ++i){
 		item = tile->__getThing(i)->getItem();
 
@@ -351,12 +534,10 @@ bool IOMapSerialize::saveItems(Database* db, uint32_t tileId, uint32_t houseId,
 
 		if(!storedTile){
 			const Position& tilePos = tile->getPosition();
-			query << "INSERT INTO `tiles` (`id`, `house_id`, `x`, `y`, `z`) VALUES ("
-			<< tileId << ", " << houseId << ", "
-			<< tilePos.x << ", " << tilePos.y << ", " << tilePos.z << ")";
+			query << tileId << ", " << houseId << ", "
+			<< tilePos.x << ", " << tilePos.y << ", " << tilePos.z;
 
-			if(!db->executeQuery(query.str()))
-				return false;
+			tileRows.push_back(query.str());
 			query.str("");
 			storedTile = true;
 		}
@@ -370,8 +551,8 @@ bool IOMapSerialize::saveItems(Database* db, uint32_t tileId, uint32_t houseId,
 
 		query << tileId << ", " << runningID << ", " << parentid << ", " << item->getID() << ", " << (int32_t)item->getSubType() << ", " << db->escapeBlob(attributes, attributesSize);
 
-		if(!stmt.addRow(query))
-			return false;
+		itemRows.push_back(query.str());
+		query.str("");
 
 		if(item->getContainer())
 			containerStackList.push_back(ContainerStackList_Pair(item->getContainer(), runningID));
@@ -397,14 +578,11 @@ bool IOMapSerialize::saveItems(Database* db, uint32_t tileId, uint32_t houseId,
 
 			query << tileId << ", " << runningID << ", " << parentid << ", " << item->getID() << ", " << (int32_t)item->getSubType() << ", " << db->escapeBlob(attributes, attributesSize);
 
-			if(!stmt.addRow(query))
-				return false;
+			itemRows.push_back(query.str());
+			query.str("");
 		}
 	}
 
-	if(!stmt.execute())
-		return false;
-
 	return true;
 }
 
@@ -607,23 +785,14 @@ bool IOMapSerialize::loadItem(PropStream& propStream, Cylinder* parent, bool dep
 	return true;
 }
 
-bool IOMapSerialize::saveMapBinary(Map* map)
+bool IOMapSerialize::saveMapBinary(Map* map, DBBatch& batch, MapSaveState& state, bool full)
 {
 	Database* db = Database::instance();
 	DBQuery query;
-	DBTransaction transaction(db);
-	DBInsert stmt(db);
-	stmt.setQuery("INSERT INTO `map_store` (`house_id`, `data`) VALUES ");
-
 
-	//Start the transaction
-	if(!transaction.begin())
-		return false;
+	std::vector<std::string> rows;
+	std::ostringstream changedIds;
 
-	if(!db->executeQuery("DELETE FROM `map_store`;"))
-		return false;
-
-	//clear old tile data
 	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin();
 		it != Houses::getInstance().getHouseEnd();
 		++it)
@@ -631,29 +800,103 @@ bool IOMapSerialize::saveMapBinary(Map* map)
 		//save house items
 		House* house = it->second;
 		PropWriteStream stream;
-		for(HouseTileList::iterator tile_iter = house->getTileBegin();
-			tile_iter != house->getTileEnd();
-			++tile_iter)
-		{
-			if(!saveTile(stream, *tile_iter)){
-				return false;
-			}
+		if(!saveHouseBinary(house, stream)){
+			return false;
 		}
 
 		uint32_t attributesSize;
 		const char* attributes = stream.getStream(attributesSize);
-		query << it->second->getId() << ", " <<
+
+		uint64_t hash = hashBytes(attributes, attributesSize);
+		state.houseHashes[house->getId()] = hash;
+		if(!isHouseChanged(house->getId(), hash) && !full){
+			continue;
+		}
+
+		++state.changedHouses;
+		if(!rows.empty()){
+			changedIds << ", ";
+		}
+		changedIds << house->getId();
+
+		query << house->getId() << ", " <<
 			db->escapeBlob(attributes, attributesSize);
+		rows.push_back(query.str());
+		query.str("");
+	}
 
-		if(!stmt.addRow(query))
+	//clear old tile data
+	if(full){
+		batch.addQuery("DELETE FROM `map_store`;");
+	}
+	else if(!rows.empty()){
+		batch.addQuery("DELETE FROM `map_store` WHERE `house_id` IN (" + changedIds.str() + ");");
+	}
+
+	batch.setInsert("INSERT INTO `map_store` (`house_id`, `data`) VALUES ");
+	batch.addRows(rows);
+	return true;
+}
+
+bool IOMapSerialize::saveHouseBinary(House* house, PropWriteStream& stream)
+{
+	for(HouseTileList::iterator it = house->getTileBegin(); it != house->getTileEnd(); ++it){
+		if(!saveTile(stream, *it)){
 			return false;
+		}
 	}
 
-	if(!stmt.execute())
+	return true;
+}
+
+bool IOMapSerialize::reconcileMapBinary(Map* map, uint32_t& changedHouses)
+{
+	Database* db = Database::instance();
+	DBQuery query;
+
+	HouseHashMap storedHashes;
+
+	DBResult* result;
+	if(!(result = db->storeQuery("SELECT `house_id`, `data` FROM `map_store`;"))){
 		return false;
+	}
+
+	do{
+		uint32_t houseId = result->getDataInt("house_id");
+
+		//rows of unknown houses, or several rows of one house, can only be removed by a full save
+		if(!Houses::getInstance().getHouse(houseId) || storedHashes.find(houseId) != storedHashes.end()){
+			db->freeResult(result);
+			return false;
+		}
+
+		unsigned long dataSize = 0;
+		const char* data = result->getDataStream("data", dataSize);
+		storedHashes[houseId] = hashBytes(data, dataSize);
+	}while(result->next());
+	db->freeResult(result);
+
+	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it){
+		House* house = it->second;
+		PropWriteStream stream;
+		if(!saveHouseBinary(house, stream)){
+			return false;
+		}
+
+		uint32_t attributesSize;
+		const char* attributes = stream.getStream(attributesSize);
 
-	//End the transaction
-	return transaction.commit();
+		uint64_t hash = hashBytes(attributes, attributesSize);
+		HouseHashMap::iterator sit = storedHashes.find(house->getId());
+		if(sit != storedHashes.end() && sit->second == hash){
+			m_savedHouseHashes[house->getId()] = hash;
+		}
+		else{
+			++changedHouses;
+		}
+	}
+
+	return true;
 }
 
 bool IOMapSerialize::saveItem(PropWriteStream& stream, const Item* item)
@@ -863,17 +1106,22 @@ bool IOMapSerialize::loadHouseInfo(Map* map)
 
 bool IOMapSerialize::saveHouseInfo(Map* map)
 {
-	Database* db = Database::instance();
 	DBQuery query;
-	DBTransaction transaction(db);
-
-	if(!transaction.begin())
+	DBBatch batch;
+	if(!prepareHouseInfoSave(batch))
 		return false;
 
+	return batch.execute(Database::instance());
+}
+
+bool IOMapSerialize::prepareHouseInfoSave(DBBatch& batch)
+{
+	Database* db = Database::instance();
+	DBQuery query;
+
 	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it){
 		House* house = it->second;
 
-		query.str("");
 		query << "UPDATE `houses` SET "
 			<< "`owner` = " << house->getOwner() << ", "
 			<< "`paid` = " << house->getPaidUntil() << ", "
@@ -882,54 +1130,33 @@ bool IOMapSerialize::saveHouseInfo(Map* map)
 			<< "`clear` = " << 0
 			<< " WHERE `id` = " << house->getId();
 
-		if(!db->executeQuery(query.str())){
-			return false;
-		}
-	}
-
-	query.str("DELETE FROM `house_lists`");
-	if(!db->executeQuery(query.str())) {
-		return false;
+		batch.addQuery(query);
 	}
 
-	DBInsert stmt(db);
-	stmt.setQuery("INSERT INTO `house_lists` (`house_id`, `listid`, `list`) VALUES ");
+	batch.addQuery("DELETE FROM `house_lists`");
+	batch.setInsert("INSERT INTO `house_lists` (`house_id`, `listid`, `list`) VALUES ");
 
 	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it){
 		House* house = it->second;
-		query.str("");
 
 		std::string listText;
 		if(house->getAccessList(GUEST_LIST, listText) && listText != ""){
 			query << house->getId() << ", " << GUEST_LIST << ", " << db->escapeString(listText);
-
-			if(!stmt.addRow(query)){
-				return false;
-			}
+			batch.addRow(query);
 		}
 		if(house->getAccessList(SUBOWNER_LIST, listText) && listText != ""){
 			query << house->getId() << ", " << SUBOWNER_LIST << ", " << db->escapeString(listText);
-
-			if(!stmt.addRow(query)){
-				return false;
-			}
+			batch.addRow(query);
 		}
 
 		for(HouseDoorList::iterator it = house->getDoorBegin(); it != house->getDoorEnd(); ++it){
 			const Door* door = *it;
 			if(door->getAccessList(listText) && listText != ""){
 				query << house->getId() << ", " << door->getDoorId() << ", " << db->escapeString(listText);
-
-				if(!stmt.addRow(query)){
-					return false;
-				}
+				batch.addRow(query);
 			}
 		}
 	}
 
-	if(!stmt.execute()){
-		return false;
-	}
-
-	return transaction.commit();
+	return true;
 }
@@ -29,6 +29,18 @@ class Map;
 #include "database.h"
 #include "map.h"
 #include <string>
+#include <map>
+
+class House;
+
+typedef std::map<uint32_t, uint64_t> HouseHashMap;
+
+/** What a map save captured, remembered once it is written */
+struct MapSaveState{
+	std::string storageType;
+	HouseHashMap houseHashes;
+	uint32_t changedHouses;
+};
 
 class IOMapSerialize{
 public:
@@ -75,22 +87,54 @@ public:
 	*/
 	bool saveHouseInfo(Map* map);
 
+	/** Capture the queries of saveMap() and saveHouseInfo() without running them,
+	  * so a global save can write them from another thread. Only the houses whose
+	  * items changed since the last save are rewritten
+	  * \param batch receives the queries
+	  * \param state receives what to pass to onMapSaved() once the queries are written
+	  * \return Returns true if the map could be serialized
+	*/
+	bool prepareMapSave(Map* map, DBBatch& batch, MapSaveState& state);
+	bool prepareHouseInfoSave(DBBatch& batch);
+	void onMapSaved(const MapSaveState& state);
+
+	/** Compare the house items in the database with the loaded map, so the
+	  * next save only rewrites the houses that differ
+	  * \param map pointer to the Map class
+	  * \return Returns false if the next save has to rewrite all houses
+	*/
+	bool reconcileMap(Map* map);
+
 protected:
 	// Relational storage uses a row for each item/tile
 	bool loadMapRelational(Map* map);
-	bool saveMapRelational(Map* map);
+	bool saveMapRelational(Map* map, DBBatch& batch, MapSaveState& state, bool full);
+	bool saveHouseRelational(House* house, uint32_t& tileId,
+		std::vector<std::string>& tileRows, std::vector<std::string>& itemRows);
+	bool reconcileMapRelational(Map* map, uint32_t& changedHouses);
 	
-	bool saveItems(Database* db, uint32_t tileId, uint32_t houseId, const Tile* tile);
+	bool saveItems(uint32_t tileId, uint32_t houseId, const Tile* tile,
+		std::vector<std::string>& tileRows, std::vector<std::string>& itemRows);
 	bool loadItems(Database* db, DBResult* result, Cylinder* parent, bool depotTransfer = false);
 
 	// Binary storage uses a giant BLOB field for storing everything
 	bool loadMapBinary(Map* map);
-	bool saveMapBinary(Map* map);
+	bool saveMapBinary(Map* map, DBBatch& batch, MapSaveState& state, bool full);
+	bool saveHouseBinary(House* house, PropWriteStream& stream);
+	bool reconcileMapBinary(Map* map, uint32_t& changedHouses);
 
 	bool saveItem(PropWriteStream& stream, const Item* item);
 	bool saveTile(PropWriteStream& stream, const Tile* tile);
 	bool loadItem(PropStream& propStream, Cylinder* parent, bool depotTransfer = false);
 	bool loadContainer(PropStream& propStream, Container* container);
+
+	bool isHouseChanged(uint32_t houseId, uint64_t hash);
+
+	// what the database holds for each house, in m_savedStorageType
+	std::string m_savedStorageType;
+	HouseHashMap m_savedHouseHashes;
+	// what the last captured save holds for each house, written or not
+	HouseHashMap m_capturedHouseHashes;
 };
 
 #endif
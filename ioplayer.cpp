@@ -27,6 +27,7 @@
 #include "tools.h"
 #include "guild.h"
 #include "game.h"
+#include "savemanager.h"
 #include <iostream>
 #include <iomanip>
 
@@ -434,7 +435,7 @@ void IOPlayer::loadConditions(Player* player, DBResult* result)
 	}
 }
 
-bool IOPlayer::saveItems(Player* player, const ItemBlockList& itemList, DBInsert& query_insert)
+bool IOPlayer::saveItems(Player* player, const ItemBlockList& itemList, SaveRowList& rows)
 {
 	std::list<Container*> listContainer;
 	std::stringstream stream;
@@ -462,9 +463,8 @@ bool IOPlayer::saveItems(Player* player, const ItemBlockList& itemList, DBInsert
 
 		stream << player->getGUID() << ", " << pid << ", " << runningId << ", " << item->getID() << ", " << (int32_t)item->getSubType() << ", " << db->escapeBlob(attributes, attributesSize);
 
-		if(!query_insert.addRow(stream)){
-			return false;
-		}
+		rows.push_back(stream.str());
+		stream.str("");
 
 		if(Container* container = item->getContainer()){
 			stack.push_back(containerBlock(container, runningId));
@@ -492,8 +492,8 @@ bool IOPlayer::saveItems(Player* player, const ItemBlockList& itemList, DBInsert
 
 			stream << player->getGUID() << ", " << parentId << ", " << runningId << ", " << item->getID() << ", " << (int32_t)item->getSubType() << ", " << db->escapeBlob(attributes, attributesSize);
 
-			if(!query_insert.addRow(stream))
-				return false;
+			rows.push_back(stream.str());
+			stream.str("");
 		}
 	}
 
@@ -502,23 +502,37 @@ bool IOPlayer::saveItems(Player* player, const ItemBlockList& itemList, DBInsert
 
 bool IOPlayer::savePlayer(Player* player, bool shallow)
 {
-	player->preSave();
+	//a global save that is still being written must not overwrite this one
+	SaveManager::getInstance()->supersedePlayer(player->getGUID());
+	++player->saveCounter;
 
-	Database* db = Database::instance();
-	DBQuery query;
-	DBResult* result;
+	//the shared connection is only used under DBQuery's lock
+	DBQuery lockQuery;
 
-	//check if the player has to be saved or not
-	query << "SELECT `save` FROM `players` WHERE `id` = " << player->getGUID();
-	if(!(result = db->storeQuery(query.str()))){
+	PlayerSaveData data;
+	if(!preparePlayerSave(player, shallow, data)){
 		return false;
 	}
 
-	const uint32_t save = result->getDataInt("save");
-	db->freeResult(result);
+	if(!writePlayerSave(Database::instance(), data)){
+		return false;
+	}
 
-	if(save == 0)
-		return true;
+	onPlayerSaved(data);
+	return true;
+}
+
+bool IOPlayer::preparePlayerSave(Player* player, bool shallow, PlayerSaveData& data)
+{
+	player->preSave();
+
+	Database* db = Database::instance();
+	DBQuery query;
+
+	data.guid = player->getGUID();
+	data.playerId = player->getID();
+	data.saveCounter = player->saveCounter;
+	data.shallow = shallow;
 
 	//serialize conditions
 	PropWriteStream propWriteStream;
@@ -536,7 +550,6 @@ bool IOPlayer::savePlayer(Player* player, bool shallow)
 	const char* conditions = propWriteStream.getStream(conditionsSize);
 
 	//First, an UPDATE query to write the player itself
-	query.str("");
 	query << "UPDATE `players` SET `level` = " << player->level
 	<< ", `vocation` = " << (int32_t)player->getVocationId()
 	<< ", `health` = " << player->health
@@ -575,81 +588,38 @@ bool IOPlayer::savePlayer(Player* player, bool shallow)
 #endif
 
 	query << " WHERE `id` = " << player->getGUID();
+	data.batch.addQuery(query);
 
-	DBTransaction transaction(db);
-	if(!transaction.begin())
-		return false;
-
-	if(!db->executeQuery(query.str())){
-		return false;
-	}
-	query.str("");
+	const uint32_t guid = player->getGUID();
+	uint64_t* sectionHash = data.sectionHash;
+	SaveRowList rows[PLAYERSAVE_LAST];
 
 	//skills
 	for(int32_t i = 0; i <= 6; ++i){
-		query << "UPDATE `player_skills` SET `value` = " << player->skills[i][SKILL_LEVEL] << ", `count` = " << player->skills[i][SKILL_TRIES] << " WHERE `player_id` = " << player->getGUID() << " AND `skillid` = " << i;
-
-		if(!db->executeQuery(query.str())){
-			return false;
-		}
+		query << "UPDATE `player_skills` SET `value` = " << player->skills[i][SKILL_LEVEL] << ", `count` = " << player->skills[i][SKILL_TRIES] << " WHERE `player_id` = " << guid << " AND `skillid` = " << i;
+		rows[PLAYERSAVE_SKILLS].push_back(query.str());
 		query.str("");
 	}
 
-	if(shallow)
-		return transaction.commit();
-
-	// deletes all player-related stuff
-
-	query << "DELETE FROM `player_spells` WHERE `player_id` = " << player->getGUID();
-
-	if(!db->executeQuery(query.str())){
-		return false;
-	}
-	query.str("");
-
-	query << "DELETE FROM `player_items` WHERE `player_id` = " << player->getGUID();
-
-	if(!db->executeQuery(query.str())){
-		return false;
-	}
-	query.str("");
-
-	query << "DELETE FROM `player_depotitems` WHERE `player_id` = " << player->getGUID();
-
-	if(!db->executeQuery(query.str())){
-		return false;
-	}
-	query.str("");
-
-	query << "DELETE FROM `player_storage` WHERE `player_id` = " << player->getGUID();
-
-	if(!db->executeQuery(query.str())){
-		return false;
+	sectionHash[PLAYERSAVE_SKILLS] = hashStrings(rows[PLAYERSAVE_SKILLS]);
+	if(isSectionChanged(player, PLAYERSAVE_SKILLS, sectionHash[PLAYERSAVE_SKILLS])){
+		for(SaveRowList::const_iterator it = rows[PLAYERSAVE_SKILLS].begin(); it != rows[PLAYERSAVE_SKILLS].end(); ++it){
+			data.batch.addQuery(*it);
+		}
 	}
-	query.str("");
 
-	query << "DELETE FROM `player_viplist` WHERE `player_id` = " << player->getGUID();
-
-	if(!db->executeQuery(query.str())){
-		return false;
-	}
-	query.str("");
+	if(shallow)
+		return true;
 
-	DBInsert stmt(db);
 	//learned spells
-	stmt.setQuery("INSERT INTO `player_spells` (`player_id`, `name`) VALUES ");
 	for(LearnedInstantSpellList::const_iterator it = player->learnedInstantSpellList.begin();
 			it != player->learnedInstantSpellList.end(); ++it){
-		query << player->getGUID() << ", " << db->escapeString(*it);
-		if(!stmt.addRow(query)){
-			return false;
-		}
-	}
-
-	if(!stmt.execute()){
-		return false;
+		query << guid << ", " << db->escapeString(*it);
+		rows[PLAYERSAVE_SPELLS].push_back(query.str());
+		query.str("");
 	}
 
+	//inventory items
 	ItemBlockList itemList;
 	Item* item;
 	for(int32_t slotId = 1; slotId <= 10; ++slotId){
@@ -658,59 +628,131 @@ bool IOPlayer::savePlayer(Player* player, bool shallow)
 		}
 	}
 
-	//item saving
-	stmt.setQuery("INSERT INTO `player_items` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
-	if(!(saveItems(player, itemList, stmt) && stmt.execute())){
+	if(!saveItems(player, itemList, rows[PLAYERSAVE_ITEMS])){
 		return false;
 	}
 
+	//depot items
 	itemList.clear();
 	for(DepotMap::iterator it = player->depots.begin(); it != player->depots.end(); ++it){
 		itemList.push_back(itemBlock(it->first, it->second));
 	}
 
-	//save depot items
-	stmt.setQuery("INSERT INTO `player_depotitems` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
-	if(!(saveItems(player, itemList, stmt) && stmt.execute())){
+	if(!saveItems(player, itemList, rows[PLAYERSAVE_DEPOTITEMS])){
 		return false;
 	}
 
-	stmt.setQuery("INSERT INTO `player_storage` (`player_id` , `key` , `value` ) VALUES ");
+	//storage
 	player->genReservedStorageRange();
 	for(StorageMap::const_iterator cit = player->getStorageIteratorBegin(); cit != player->getStorageIteratorEnd(); ++cit){
-		query << player->getGUID() << ", " << cit->first << ", " << cit->second;
-		if(!stmt.addRow(query)){
-			return false;
-		}
+		query << guid << ", " << cit->first << ", " << cit->second;
+		rows[PLAYERSAVE_STORAGE].push_back(query.str());
+		query.str("");
 	}
 
-	if(!stmt.execute()){
-		return false;
+	//vip list
+	for(VIPListSet::iterator it = player->VIPList.begin(); it != player->VIPList.end(); ++it){
+		query << (*it);
+		rows[PLAYERSAVE_VIPLIST].push_back(query.str());
+		query.str("");
 	}
 
-	//save vip list
-	if(!player->VIPList.empty()){
-		query << "INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT " << player->getGUID()
-			<< ", `id` FROM `players` WHERE `id` IN (";
-		for(VIPListSet::iterator it = player->VIPList.begin(); it != player->VIPList.end(); ){
-			query << (*it);
-			++it;
-			if(it != player->VIPList.end()){
-				query << ",";
-			}
-			else{
-				query << ")";
+	for(int32_t i = PLAYERSAVE_SPELLS; i < PLAYERSAVE_LAST; ++i){
+		sectionHash[i] = hashStrings(rows[i]);
+	}
+
+	//only rewrite the sections that changed since the last save
+	if(isSectionChanged(player, PLAYERSAVE_SPELLS, sectionHash[PLAYERSAVE_SPELLS])){
+		saveRows(player, data.batch, "player_spells", "`player_id`, `name`", rows[PLAYERSAVE_SPELLS]);
+	}
+
+	if(isSectionChanged(player, PLAYERSAVE_ITEMS, sectionHash[PLAYERSAVE_ITEMS])){
+		saveRows(player, data.batch, "player_items", "`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ", rows[PLAYERSAVE_ITEMS]);
+	}
+
+	if(isSectionChanged(player, PLAYERSAVE_DEPOTITEMS, sectionHash[PLAYERSAVE_DEPOTITEMS])){
+		saveRows(player, data.batch, "player_depotitems", "`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ", rows[PLAYERSAVE_DEPOTITEMS]);
+	}
+
+	if(isSectionChanged(player, PLAYERSAVE_STORAGE, sectionHash[PLAYERSAVE_STORAGE])){
+		saveRows(player, data.batch, "player_storage", "`player_id` , `key` , `value` ", rows[PLAYERSAVE_STORAGE]);
+	}
+
+	if(isSectionChanged(player, PLAYERSAVE_VIPLIST, sectionHash[PLAYERSAVE_VIPLIST])){
+		query << "DELETE FROM `player_viplist` WHERE `player_id` = " << guid;
+		data.batch.addQuery(query);
+
+		//only keep the entries whose players still exist
+		if(!rows[PLAYERSAVE_VIPLIST].empty()){
+			query << "INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT " << guid
+				<< ", `id` FROM `players` WHERE `id` IN (";
+			for(SaveRowList::const_iterator it = rows[PLAYERSAVE_VIPLIST].begin(); it != rows[PLAYERSAVE_VIPLIST].end(); ++it){
+				if(it != rows[PLAYERSAVE_VIPLIST].begin()){
+					query << ",";
+				}
+				query << (*it);
 			}
+			query << ")";
+			data.batch.addQuery(query);
 		}
+	}
 
-		if(!db->executeQuery(query.str())){
-			return false;
-		}
-		query.str("");
+	return true;
+}
+
+bool IOPlayer::writePlayerSave(Database* db, const PlayerSaveData& data)
+{
+	//check if the player has to be saved or not
+	std::ostringstream query;
+	query << "SELECT `save` FROM `players` WHERE `id` = " << data.guid;
+
+	DBResult* result;
+	if(!(result = db->storeQuery(query.str()))){
+		return false;
 	}
 
-	//End the transaction
-	return transaction.commit();
+	const uint32_t save = result->getDataInt("save");
+	db->freeResult(result);
+
+	if(save == 0)
+		return true;
+
+	return data.batch.execute(db);
+}
+
+void IOPlayer::onPlayerSaved(const PlayerSaveData& data)
+{
+	Player* player = g_game.getPlayerByID(data.playerId);
+	if(!player || player->saveCounter != data.saveCounter){
+		return;
+	}
+
+	//the rows are in the database now, later saves can skip them while they stay the same
+	int32_t sections = (data.shallow ? PLAYERSAVE_SKILLS + 1 : PLAYERSAVE_LAST);
+	for(int32_t i = 0; i < sections; ++i){
+		player->savedSectionHash[i] = data.sectionHash[i];
+	}
+}
+
+bool IOPlayer::isSectionChanged(Player* player, PlayerSaveSection_t section, uint64_t hash)
+{
+	//saves that are still being written end with the last captured rows,
+	//the section can only be skipped if those match the database too
+	bool changed = (hash != player->savedSectionHash[section] || hash != player->capturedSectionHash[section]);
+	player->capturedSectionHash[section] = hash;
+	return changed;
+}
+
+void IOPlayer::saveRows(Player* player, DBBatch& batch, const std::string& table, const std::string& columns, const SaveRowList& rows)
+{
+	std::ostringstream query;
+	query << "DELETE FROM `" << table << "` WHERE `player_id` = " << player->getGUID();
+	batch.addQuery(query.str());
+
+	batch.setInsert("INSERT INTO `" + table + "` (" + columns + ") VALUES ");
+	for(SaveRowList::const_iterator it = rows.begin(); it != rows.end(); ++it){
+		batch.addRow(*it);
+	}
 }
 
 bool IOPlayer::storeNameByGuid(Database &db, uint32_t guid)
@@ -34,6 +34,17 @@ enum UnjustKillPeriod_t{
 
 typedef std::pair<int32_t, Item*> itemBlock;
 typedef std::list<itemBlock> ItemBlockList;
+typedef std::vector<std::string> SaveRowList;
+
+/** What a player save writes, captured on the game thread so it can be written from another one */
+struct PlayerSaveData{
+	uint32_t guid;
+	uint32_t playerId;
+	uint32_t saveCounter;
+	bool shallow;
+	uint64_t sectionHash[PLAYERSAVE_LAST];
+	DBBatch batch;
+};
 
 /** Class responsible for loading players from database. */
 class IOPlayer {
@@ -61,6 +72,22 @@ public:
 	  */
 	bool savePlayer(Player* player, bool shallow = false);
 
+	/** Capture the queries of a player save, only the sections that changed since the last save are written
+	  * \param player the player to save
+	  * \param data receives the queries and section hashes
+	  * \return true if the player could be serialized
+	  */
+	bool preparePlayerSave(Player* player, bool shallow, PlayerSaveData& data);
+
+	/** Write a captured player save
+	  * \param db connection to use, the caller holds DBQuery's lock if it is the shared one
+	  * \return true if the player was successfully saved
+	  */
+	bool writePlayerSave(Database* db, const PlayerSaveData& data);
+
+	/** Remember what a written save stored, if the player did not save again since it was captured */
+	void onPlayerSaved(const PlayerSaveData& data);
+
 	bool addPlayerDeath(Player* dying_player, const DeathList& dl);
 	int32_t getPlayerUnjustKillCount(const Player* player, UnjustKillPeriod_t period);
 
@@ -98,7 +125,9 @@ protected:
 	void loadConditions(Player* player, DBResult* result);
 
 	void loadItems(ItemMap& itemMap, DBResult* result);
-	bool saveItems(Player* player, const ItemBlockList& itemList, DBInsert& query_insert);
+	bool saveItems(Player* player, const ItemBlockList& itemList, SaveRowList& rows);
+	bool isSectionChanged(Player* player, PlayerSaveSection_t section, uint64_t hash);
+	void saveRows(Player* player, DBBatch& batch, const std::string& table, const std::string& columns, const SaveRowList& rows);
 
 	typedef std::map<uint32_t, std::string> NameCacheMap;
 	typedef std::map<std::string, uint32_t, StringCompareCase> GuidCacheMap;
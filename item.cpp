@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "item.h"
+#include "objectpool.h"
 #include "container.h"
 #include "configmanager.h"
 #include "depot.h"
@@ -168,6 +169,22 @@ bool Item::loadContainer(xmlNodePtr parentNode, Container* parent)
 	return true;
 }
 
+static ObjectPool& getItemPool()
+{
+	static ObjectPool* pool = new ObjectPool("Item", sizeof(Item));
+	return *pool;
+}
+
+void* Item::operator new(size_t size)
+{
+	return getItemPool().allocate(size);
+}
+
+void Item::operator delete(void* p, size_t size)
+{
+	getItemPool().deallocate(p, size);
+}
+
 Item::Item(const uint16_t _type, uint16_t _count /*= 0*/) :
 	ItemAttributes()
 {
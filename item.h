@@ -265,6 +265,10 @@ public:
 
 	virtual ~Item();
 
+	// Allocated from an object pool, see objectpool.h
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 	virtual Item* getItem() {return this;};
 	virtual const Item* getItem() const {return this;};
 	virtual Container* getContainer() {return NULL;};
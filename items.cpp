@@ -23,6 +23,7 @@
 #include "spells.h"
 #include "condition.h"
 #include "weapons.h"
+#include "tools.h"
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 #include <libxml/xmlschemas.h>
@@ -37,6 +38,17 @@ uint32_t Items::dwBuildNumber = 0;
 extern Spells* g_spells;
 std::map<ClientFluidTypes_t, FluidTypes_t> Items::reverseCustomFluidMap;
 
+//has to be raised whenever ItemType::serialize changes
+#define ITEMS_SNAPSHOT_VERSION 1
+
+enum SnapshotNode_t{
+	SNAPSHOT_NODE_ROOT = 0,
+	SNAPSHOT_NODE_ITEM = 1,
+	SNAPSHOT_NODE_CLIENTID = 2,
+	SNAPSHOT_NODE_FLUID = 3,
+	SNAPSHOT_NODE_CURRENCY = 4
+};
+
 ItemType::ItemType()
 {
 	article          = "";
@@ -59,6 +71,7 @@ ItemType::ItemType()
 	floorChangeWest = false;
 
 	blockSolid = false;
+	blockPickupable = false;
 	blockProjectile = false;
 	blockPathFind = false;
 	allowPickupable = false;
@@ -99,6 +112,7 @@ ItemType::ItemType()
 	isVertical		= false;
 	isHorizontal	= false;
 	isHangable		= false;
+	lookThrough		= false;
 
 	lightLevel    = 0;
 	lightColor    = 0;
@@ -149,6 +163,399 @@ std::string ItemType::getDescription(uint8_t count) const
     return Item::getDescription(*this, 1, NULL, subType);
 }
 
+bool ItemType::serialize(PropWriteStream& propWriteStream) const
+{
+	propWriteStream.ADD_UINT16(id);
+	propWriteStream.ADD_UINT16(clientId);
+	propWriteStream.ADD_INT32((int32_t)group);
+	propWriteStream.ADD_INT32((int32_t)type);
+
+	propWriteStream.ADD_INT32((int32_t)bedPartnerDir);
+	propWriteStream.ADD_UINT16(maleSleeperID);
+	propWriteStream.ADD_UINT16(femaleSleeperID);
+	propWriteStream.ADD_UINT16(noSleeperID);
+
+	propWriteStream.ADD_LSTRING(name);
+	propWriteStream.ADD_LSTRING(article);
+	propWriteStream.ADD_LSTRING(pluralName);
+	propWriteStream.ADD_LSTRING(description);
+	propWriteStream.ADD_UINT16(maxItems);
+	propWriteStream.ADD_FLOAT(weight);
+	propWriteStream.ADD_UINT8(showCount);
+	propWriteStream.ADD_INT32((int32_t)weaponType);
+	propWriteStream.ADD_INT32((int32_t)amuType);
+	propWriteStream.ADD_INT32((int32_t)shootType);
+	propWriteStream.ADD_INT32((int32_t)magicEffect);
+	propWriteStream.ADD_INT32(attack);
+	propWriteStream.ADD_INT32(defense);
+	propWriteStream.ADD_INT32(extraDef);
+	propWriteStream.ADD_INT32(armor);
+	propWriteStream.ADD_UINT16(slot_position);
+	propWriteStream.ADD_UINT16(wield_position);
+	propWriteStream.ADD_UINT8(isVertical);
+	propWriteStream.ADD_UINT8(isHorizontal);
+	propWriteStream.ADD_UINT8(isHangable);
+	propWriteStream.ADD_UINT8(allowDistRead);
+	propWriteStream.ADD_UINT8(lookThrough);
+	propWriteStream.ADD_UINT16(speed);
+	propWriteStream.ADD_INT32(decayTo);
+	propWriteStream.ADD_UINT32(decayTime);
+	propWriteStream.ADD_UINT8(stopTime);
+	propWriteStream.ADD_INT32((int32_t)corpseType);
+
+	propWriteStream.ADD_UINT8(canReadText);
+	propWriteStream.ADD_UINT8(canWriteText);
+	propWriteStream.ADD_UINT16(maxTextLen);
+	propWriteStream.ADD_UINT16(writeOnceItemId);
+
+	propWriteStream.ADD_UINT8(stackable);
+	propWriteStream.ADD_UINT8(useable);
+	propWriteStream.ADD_UINT8(moveable);
+	propWriteStream.ADD_UINT8(alwaysOnTop);
+	propWriteStream.ADD_INT32(alwaysOnTopOrder);
+	propWriteStream.ADD_UINT8(pickupable);
+	propWriteStream.ADD_UINT8(rotable);
+	propWriteStream.ADD_INT32(rotateTo);
+
+	propWriteStream.ADD_INT32(runeMagLevel);
+	propWriteStream.ADD_INT32(runeLevel);
+	propWriteStream.ADD_LSTRING(runeSpellName);
+
+	propWriteStream.ADD_UINT32(wieldInfo);
+	propWriteStream.ADD_LSTRING(vocationString);
+	propWriteStream.ADD_UINT32(minReqLevel);
+	propWriteStream.ADD_UINT32(minReqMagicLevel);
+
+	propWriteStream.ADD_INT32(lightLevel);
+	propWriteStream.ADD_INT32(lightColor);
+
+	propWriteStream.ADD_UINT8(floorChangeDown);
+	propWriteStream.ADD_UINT8(floorChangeNorth);
+	propWriteStream.ADD_UINT8(floorChangeSouth);
+	propWriteStream.ADD_UINT8(floorChangeEast);
+	propWriteStream.ADD_UINT8(floorChangeWest);
+	propWriteStream.ADD_UINT8(hasHeight);
+
+	propWriteStream.ADD_UINT8(blockSolid);
+	propWriteStream.ADD_UINT8(blockPickupable);
+	propWriteStream.ADD_UINT8(blockProjectile);
+	propWriteStream.ADD_UINT8(blockPathFind);
+	propWriteStream.ADD_UINT8(allowPickupable);
+
+	propWriteStream.ADD_UINT16(transformEquipTo);
+	propWriteStream.ADD_UINT16(transformDeEquipTo);
+	propWriteStream.ADD_UINT8(showDuration);
+	propWriteStream.ADD_UINT8(showCharges);
+	propWriteStream.ADD_UINT32(charges);
+	propWriteStream.ADD_INT32(breakChance);
+	propWriteStream.ADD_INT32(hitChance);
+	propWriteStream.ADD_INT32(maxHitChance);
+	propWriteStream.ADD_UINT32(shootRange);
+	propWriteStream.ADD_INT32((int32_t)ammoAction);
+	propWriteStream.ADD_INT32(fluidSource);
+	propWriteStream.ADD_INT32((int32_t)clientFluidType);
+	propWriteStream.ADD_UINT8(isCustomFluidType);
+
+	propWriteStream.ADD_UINT32(currency);
+
+	for(int32_t i = 0; i < COMBAT_COUNT; ++i){
+		propWriteStream.ADD_INT16(abilities.absorb.resistances[i]);
+	}
+	for(int32_t i = 0; i <= SKILL_LAST; ++i){
+		propWriteStream.ADD_INT16(abilities.skill.upgrades[i]);
+	}
+	propWriteStream.ADD_UINT32(abilities.absorbFieldDamage.size());
+	for(std::map<uint16_t, int16_t>::const_iterator it = abilities.absorbFieldDamage.begin(); it != abilities.absorbFieldDamage.end(); ++it){
+		propWriteStream.ADD_UINT16(it->first);
+		propWriteStream.ADD_INT16(it->second);
+	}
+	propWriteStream.ADD_UINT16(abilities.conditionCount);
+	propWriteStream.ADD_INT32((int32_t)abilities.elementType);
+	propWriteStream.ADD_INT16(abilities.elementDamage);
+	for(int32_t i = 0; i <= STAT_LAST; ++i){
+		propWriteStream.ADD_INT32(abilities.stats[i]);
+		propWriteStream.ADD_INT32(abilities.statsPercent[i]);
+	}
+	propWriteStream.ADD_INT32(abilities.speed);
+	propWriteStream.ADD_UINT8(abilities.manaShield);
+	propWriteStream.ADD_UINT8(abilities.invisible);
+	propWriteStream.ADD_UINT8(abilities.regeneration);
+	propWriteStream.ADD_UINT32(abilities.healthGain);
+	propWriteStream.ADD_UINT32(abilities.healthTicks);
+	propWriteStream.ADD_UINT32(abilities.manaGain);
+	propWriteStream.ADD_UINT32(abilities.manaTicks);
+	propWriteStream.ADD_UINT32(abilities.conditionImmunities);
+	propWriteStream.ADD_UINT32(abilities.conditionSuppressions);
+	propWriteStream.ADD_UINT8(abilities.preventItemLoss);
+	propWriteStream.ADD_UINT8(abilities.preventSkillLoss);
+
+	propWriteStream.ADD_INT32((int32_t)combatType);
+	propWriteStream.ADD_UINT8(replaceable);
+
+	//field conditions are the only ones items.xml creates
+	ConditionDamage* conditionDamage = dynamic_cast<ConditionDamage*>(condition);
+	if(condition && !conditionDamage){
+		return false;
+	}
+
+	propWriteStream.ADD_UINT8(conditionDamage != NULL);
+	if(conditionDamage){
+		propWriteStream.ADD_UINT8(conditionDamage->doForceUpdate());
+		if(!conditionDamage->serialize(propWriteStream)){
+			return false;
+		}
+		propWriteStream.ADD_UINT8(CONDITIONATTR_END);
+	}
+
+	return true;
+}
+
+bool ItemType::unserialize(PropStream& propStream)
+{
+	int32_t value;
+	uint8_t flag;
+
+	if(!propStream.GET_UINT16(id) ||
+		!propStream.GET_UINT16(clientId)){
+		return false;
+	}
+
+	if(!propStream.GET_INT32(value)) return false;
+	group = (itemgroup_t)value;
+	if(!propStream.GET_INT32(value)) return false;
+	type = (ItemTypes_t)value;
+
+	if(!propStream.GET_INT32(value)) return false;
+	bedPartnerDir = (Direction)value;
+	if(!propStream.GET_UINT16(maleSleeperID) ||
+		!propStream.GET_UINT16(femaleSleeperID) ||
+		!propStream.GET_UINT16(noSleeperID)){
+		return false;
+	}
+
+	if(!propStream.GET_LSTRING(name) ||
+		!propStream.GET_LSTRING(article) ||
+		!propStream.GET_LSTRING(pluralName) ||
+		!propStream.GET_LSTRING(description) ||
+		!propStream.GET_UINT16(maxItems) ||
+		!propStream.GET_FLOAT(weight)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	showCount = (flag != 0);
+	if(!propStream.GET_INT32(value)) return false;
+	weaponType = (WeaponType_t)value;
+	if(!propStream.GET_INT32(value)) return false;
+	amuType = (Ammo_t)value;
+	if(!propStream.GET_INT32(value)) return false;
+	shootType = (ShootType_t)value;
+	if(!propStream.GET_INT32(value)) return false;
+	magicEffect = (MagicEffectClasses)value;
+
+	if(!propStream.GET_INT32(attack) ||
+		!propStream.GET_INT32(defense) ||
+		!propStream.GET_INT32(extraDef) ||
+		!propStream.GET_INT32(armor) ||
+		!propStream.GET_UINT16(slot_position) ||
+		!propStream.GET_UINT16(wield_position)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	isVertical = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	isHorizontal = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	isHangable = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	allowDistRead = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	lookThrough = (flag != 0);
+
+	if(!propStream.GET_UINT16(speed) ||
+		!propStream.GET_INT32(decayTo) ||
+		!propStream.GET_UINT32(decayTime)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	stopTime = (flag != 0);
+	if(!propStream.GET_INT32(value)) return false;
+	corpseType = (RaceType_t)value;
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	canReadText = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	canWriteText = (flag != 0);
+	if(!propStream.GET_UINT16(maxTextLen) ||
+		!propStream.GET_UINT16(writeOnceItemId)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	stackable = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	useable = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	moveable = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	alwaysOnTop = (flag != 0);
+	if(!propStream.GET_INT32(alwaysOnTopOrder)) return false;
+	if(!propStream.GET_UINT8(flag)) return false;
+	pickupable = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	rotable = (flag != 0);
+	if(!propStream.GET_INT32(rotateTo)) return false;
+
+	if(!propStream.GET_INT32(runeMagLevel) ||
+		!propStream.GET_INT32(runeLevel) ||
+		!propStream.GET_LSTRING(runeSpellName)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT32(wieldInfo) ||
+		!propStream.GET_LSTRING(vocationString) ||
+		!propStream.GET_UINT32(minReqLevel) ||
+		!propStream.GET_UINT32(minReqMagicLevel)){
+		return false;
+	}
+
+	if(!propStream.GET_INT32(lightLevel) ||
+		!propStream.GET_INT32(lightColor)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	floorChangeDown = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	floorChangeNorth = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	floorChangeSouth = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	floorChangeEast = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	floorChangeWest = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	hasHeight = (flag != 0);
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	blockSolid = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	blockPickupable = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	blockProjectile = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	blockPathFind = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	allowPickupable = (flag != 0);
+
+	if(!propStream.GET_UINT16(transformEquipTo) ||
+		!propStream.GET_UINT16(transformDeEquipTo)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	showDuration = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	showCharges = (flag != 0);
+
+	if(!propStream.GET_UINT32(charges) ||
+		!propStream.GET_INT32(breakChance) ||
+		!propStream.GET_INT32(hitChance) ||
+		!propStream.GET_INT32(maxHitChance) ||
+		!propStream.GET_UINT32(shootRange)){
+		return false;
+	}
+
+	if(!propStream.GET_INT32(value)) return false;
+	ammoAction = (AmmoAction_t)value;
+	if(!propStream.GET_INT32(fluidSource)) return false;
+	if(!propStream.GET_INT32(value)) return false;
+	clientFluidType = (ClientFluidTypes_t)value;
+	if(!propStream.GET_UINT8(flag)) return false;
+	isCustomFluidType = (flag != 0);
+
+	if(!propStream.GET_UINT32(currency)) return false;
+
+	for(int32_t i = 0; i < COMBAT_COUNT; ++i){
+		if(!propStream.GET_INT16(abilities.absorb.resistances[i])) return false;
+	}
+	for(int32_t i = 0; i <= SKILL_LAST; ++i){
+		if(!propStream.GET_INT16(abilities.skill.upgrades[i])) return false;
+	}
+
+	uint32_t fieldCount;
+	if(!propStream.GET_UINT32(fieldCount)) return false;
+	for(uint32_t i = 0; i < fieldCount; ++i){
+		uint16_t fieldId;
+		int16_t fieldDamage;
+		if(!propStream.GET_UINT16(fieldId) ||
+			!propStream.GET_INT16(fieldDamage)){
+			return false;
+		}
+		abilities.absorbFieldDamage[fieldId] = fieldDamage;
+	}
+
+	if(!propStream.GET_UINT16(abilities.conditionCount)) return false;
+	if(!propStream.GET_INT32(value)) return false;
+	abilities.elementType = (CombatType_t)value;
+	if(!propStream.GET_INT16(abilities.elementDamage)) return false;
+	for(int32_t i = 0; i <= STAT_LAST; ++i){
+		if(!propStream.GET_INT32(abilities.stats[i]) ||
+			!propStream.GET_INT32(abilities.statsPercent[i])){
+			return false;
+		}
+	}
+
+	if(!propStream.GET_INT32(abilities.speed)) return false;
+	if(!propStream.GET_UINT8(flag)) return false;
+	abilities.manaShield = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	abilities.invisible = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	abilities.regeneration = (flag != 0);
+
+	if(!propStream.GET_UINT32(abilities.healthGain) ||
+		!propStream.GET_UINT32(abilities.healthTicks) ||
+		!propStream.GET_UINT32(abilities.manaGain) ||
+		!propStream.GET_UINT32(abilities.manaTicks) ||
+		!propStream.GET_UINT32(abilities.conditionImmunities) ||
+		!propStream.GET_UINT32(abilities.conditionSuppressions)){
+		return false;
+	}
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	abilities.preventItemLoss = (flag != 0);
+	if(!propStream.GET_UINT8(flag)) return false;
+	abilities.preventSkillLoss = (flag != 0);
+
+	if(!propStream.GET_INT32(value)) return false;
+	combatType = (CombatType_t)value;
+	if(!propStream.GET_UINT8(flag)) return false;
+	replaceable = (flag != 0);
+
+	if(!propStream.GET_UINT8(flag)) return false;
+	if(flag){
+		uint8_t forceUpdate;
+		if(!propStream.GET_UINT8(forceUpdate)){
+			return false;
+		}
+
+		//the damage intervals add their ticks back while unserializing
+		condition = Condition::createCondition(propStream);
+		if(!condition || !condition->unserialize(propStream)){
+			return false;
+		}
+
+		if(forceUpdate){
+			condition->setParam(CONDITIONPARAM_FORCEUPDATE, true);
+		}
+	}
+
+	return true;
+}
+
 
 Items::Items() :
 items(8000)
@@ -185,7 +592,7 @@ bool Items::reload()
 int Items::loadFromOtb(std::string file)
 {
 	FileLoader f;
-	if(!f.openFile(file.c_str(), "OTBI", false, true)){
+	if(!f.openFile(file.c_str(), "OTBI", false)){
 		return f.getError();
 	}
 
@@ -1470,6 +1877,293 @@ bool Items::loadFromXml(const std::string& datadir)
 	return true;
 }
 
+bool Items::getSourceHash(const std::string& datadir, uint64_t& hash)
+{
+	std::string files[] = {datadir + "items/items.otb", datadir + "/items/items.xml"};
+
+	hash = HASH_INITIAL;
+	char buffer[32768];
+	for(uint32_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+		FILE* file = fopen(files[i].c_str(), "rb");
+		if(!file){
+			return false;
+		}
+
+		size_t size;
+		while((size = fread(buffer, 1, sizeof(buffer), file)) > 0){
+			hash = hashBytes(buffer, size, hash);
+		}
+		fclose(file);
+	}
+
+	return true;
+}
+
+bool Items::loadFromSnapshot(const std::string& file, const std::string& datadir)
+{
+	uint64_t sourceHash;
+	if(!getSourceHash(datadir, sourceHash)){
+		return false;
+	}
+
+	FileLoader f;
+	if(!f.openFile(file.c_str(), "OTSN", false)){
+		return false;
+	}
+
+	unsigned long type;
+	NODE root = f.getChildNode(NO_NODE, type);
+
+	PropStream props;
+	if(!f.getProps(root, props)){
+		return false;
+	}
+
+	uint32_t version, layout, hashLow, hashHigh, sumLow, sumHigh;
+	uint32_t majorVersion, minorVersion, buildNumber;
+	if(!props.GET_UINT32(version) ||
+		!props.GET_UINT32(layout) ||
+		!props.GET_UINT32(hashLow) ||
+		!props.GET_UINT32(hashHigh) ||
+		!props.GET_UINT32(sumLow) ||
+		!props.GET_UINT32(sumHigh) ||
+		!props.GET_UINT32(majorVersion) ||
+		!props.GET_UINT32(minorVersion) ||
+		!props.GET_UINT32(buildNumber)){
+		return false;
+	}
+
+	//a snapshot from another build or of other source files is rebuilt
+	if(version != ITEMS_SNAPSHOT_VERSION || layout != sizeof(ItemType) ||
+		(((uint64_t)hashHigh << 32) | hashLow) != sourceHash){
+		return false;
+	}
+
+	uint64_t checksum = HASH_INITIAL;
+	for(NODE node = f.getChildNode(root, type); node != NO_NODE; node = f.getNextNode(node, type)){
+		unsigned long size;
+		const unsigned char* data = f.getProps(node, size);
+		if(!data){
+			return false;
+		}
+
+		char nodeType = (char)type;
+		checksum = hashBytes(&nodeType, 1, checksum);
+		checksum = hashBytes((const char*)data, size, checksum);
+	}
+
+	if(checksum != (((uint64_t)sumHigh << 32) | sumLow)){
+		std::cout << "Warning: [Items::loadFromSnapshot] " << file << " is damaged." << std::endl;
+		return false;
+	}
+
+	std::vector<ItemType*> itemTypes;
+	ReverseItemMap clientIds;
+	std::map<ClientFluidTypes_t, FluidTypes_t> fluids;
+	std::map<uint32_t, uint16_t> currencies;
+
+	bool ret = true;
+	for(NODE node = f.getChildNode(root, type); ret && node != NO_NODE; node = f.getNextNode(node, type)){
+		if(!f.getProps(node, props)){
+			ret = false;
+			break;
+		}
+
+		switch(type){
+			case SNAPSHOT_NODE_ITEM:
+			{
+				ItemType* iType = new ItemType();
+				if(!iType->unserialize(props)){
+					delete iType;
+					ret = false;
+					break;
+				}
+
+				itemTypes.push_back(iType);
+				break;
+			}
+
+			case SNAPSHOT_NODE_CLIENTID:
+			{
+				int32_t clientId, id;
+				while(props.size() > 0){
+					if(!props.GET_INT32(clientId) || !props.GET_INT32(id)){
+						ret = false;
+						break;
+					}
+					clientIds[clientId] = id;
+				}
+				break;
+			}
+
+			case SNAPSHOT_NODE_FLUID:
+			{
+				int32_t clientFluid, fluid;
+				while(props.size() > 0){
+					if(!props.GET_INT32(clientFluid) || !props.GET_INT32(fluid)){
+						ret = false;
+						break;
+					}
+					fluids[(ClientFluidTypes_t)clientFluid] = (FluidTypes_t)fluid;
+				}
+				break;
+			}
+
+			case SNAPSHOT_NODE_CURRENCY:
+			{
+				uint32_t currency;
+				uint16_t id;
+				while(props.size() > 0){
+					if(!props.GET_UINT32(currency) || !props.GET_UINT16(id)){
+						ret = false;
+						break;
+					}
+					currencies[currency] = id;
+				}
+				break;
+			}
+
+			default:
+				ret = false;
+				break;
+		}
+	}
+
+	if(!ret){
+		for(std::vector<ItemType*>::iterator it = itemTypes.begin(); it != itemTypes.end(); ++it){
+			delete *it;
+		}
+		return false;
+	}
+
+	for(std::vector<ItemType*>::iterator it = itemTypes.begin(); it != itemTypes.end(); ++it){
+		items.addElement(*it, (*it)->id);
+	}
+
+	reverseItemMap = clientIds;
+	reverseCustomFluidMap = fluids;
+	for(std::map<uint32_t, uint16_t>::iterator it = currencies.begin(); it != currencies.end(); ++it){
+		if(ItemType* iType = items.getElement(it->second)){
+			currencyMap[it->first] = iType;
+		}
+	}
+
+	Items::dwMajorVersion = majorVersion;
+	Items::dwMinorVersion = minorVersion;
+	Items::dwBuildNumber = buildNumber;
+	m_datadir = datadir;
+	return true;
+}
+
+bool Items::saveSnapshot(const std::string& file, const std::string& datadir)
+{
+	uint64_t sourceHash;
+	if(!getSourceHash(datadir, sourceHash)){
+		return false;
+	}
+
+	//the props of every node are built first, the checksum goes in the root node
+	std::vector< std::pair<uint8_t, PropWriteStream*> > nodes;
+
+	bool ret = true;
+	for(uint32_t i = 0; i < items.size(); ++i){
+		const ItemType* iType = items.getElement(i);
+		if(!iType){
+			continue;
+		}
+
+		PropWriteStream* stream = new PropWriteStream();
+		nodes.push_back(std::make_pair((uint8_t)SNAPSHOT_NODE_ITEM, stream));
+		if(!iType->serialize(*stream)){
+			ret = false;
+			break;
+		}
+	}
+
+	PropWriteStream* stream = new PropWriteStream();
+	nodes.push_back(std::make_pair((uint8_t)SNAPSHOT_NODE_CLIENTID, stream));
+	for(ReverseItemMap::const_iterator it = reverseItemMap.begin(); it != reverseItemMap.end(); ++it){
+		stream->ADD_INT32(it->first);
+		stream->ADD_INT32(it->second);
+	}
+
+	stream = new PropWriteStream();
+	nodes.push_back(std::make_pair((uint8_t)SNAPSHOT_NODE_FLUID, stream));
+	for(std::map<ClientFluidTypes_t, FluidTypes_t>::const_iterator it = reverseCustomFluidMap.begin(); it != reverseCustomFluidMap.end(); ++it){
+		stream->ADD_INT32((int32_t)it->first);
+		stream->ADD_INT32((int32_t)it->second);
+	}
+
+	stream = new PropWriteStream();
+	nodes.push_back(std::make_pair((uint8_t)SNAPSHOT_NODE_CURRENCY, stream));
+	for(std::map<uint32_t, ItemType*>::const_iterator it = currencyMap.begin(); it != currencyMap.end(); ++it){
+		stream->ADD_UINT32(it->first);
+		stream->ADD_UINT16(it->second->id);
+	}
+
+	uint64_t checksum = HASH_INITIAL;
+	for(std::vector< std::pair<uint8_t, PropWriteStream*> >::iterator it = nodes.begin(); it != nodes.end(); ++it){
+		uint32_t size;
+		const char* data = it->second->getStream(size);
+
+		char nodeType = (char)it->first;
+		checksum = hashBytes(&nodeType, 1, checksum);
+		checksum = hashBytes(data, size, checksum);
+	}
+
+	//written aside and renamed, a running server never sees half a snapshot
+	std::string tmpFile = file + ".tmp";
+	if(ret){
+		FileLoader f;
+		if(!f.openFile(tmpFile.c_str(), "OTSN", true)){
+			ret = false;
+		}
+		else{
+			PropWriteStream header;
+			header.ADD_UINT32(ITEMS_SNAPSHOT_VERSION);
+			header.ADD_UINT32(sizeof(ItemType));
+			header.ADD_UINT32((uint32_t)sourceHash);
+			header.ADD_UINT32((uint32_t)(sourceHash >> 32));
+			header.ADD_UINT32((uint32_t)checksum);
+			header.ADD_UINT32((uint32_t)(checksum >> 32));
+			header.ADD_UINT32(Items::dwMajorVersion);
+			header.ADD_UINT32(Items::dwMinorVersion);
+			header.ADD_UINT32(Items::dwBuildNumber);
+
+			uint32_t size;
+			const char* data = header.getStream(size);
+
+			f.startNode(SNAPSHOT_NODE_ROOT);
+			f.setProps((void*)data, size);
+			for(std::vector< std::pair<uint8_t, PropWriteStream*> >::iterator it = nodes.begin(); it != nodes.end(); ++it){
+				data = it->second->getStream(size);
+
+				f.startNode(it->first);
+				//setProps takes at most 64k at once
+				for(uint32_t written = 0; written < size; written += 0xFFFF){
+					f.setProps((void*)(data + written), std::min<uint32_t>(size - written, 0xFFFF));
+				}
+				f.endNode();
+			}
+			f.endNode();
+
+			ret = (f.getError() == ERROR_NONE);
+		}
+	}
+
+	for(std::vector< std::pair<uint8_t, PropWriteStream*> >::iterator it = nodes.begin(); it != nodes.end(); ++it){
+		delete it->second;
+	}
+
+	if(!ret){
+		std::remove(tmpFile.c_str());
+		return false;
+	}
+
+	std::remove(file.c_str());
+	return std::rename(tmpFile.c_str(), file.c_str()) == 0;
+}
+
 // the proper way to implement this would be to use ClientFluidTypes_t only, but that would break compatibility with
 // old scripts, so we instead will use the old FluidTypes_t and these functions,
 // which maps the oldTypes into the new ones (and vice-versa)
@@ -1629,6 +2323,8 @@ Abilities::Abilities()
 	memset(&absorb, 0, sizeof(absorb));
 	memset(&skill, 0, sizeof(skill));
 
+	conditionCount = 0;
+
 	elementType = COMBAT_NONE;
 	elementDamage = 0;
 
@@ -124,6 +124,9 @@ public:
 	ItemType();
 	~ItemType();
 
+	bool serialize(PropWriteStream& propWriteStream) const;
+	bool unserialize(PropStream& propStream);
+
 	itemgroup_t group;
 	ItemTypes_t type;
 
@@ -321,6 +324,9 @@ public:
 
 	bool loadFromXml(const std::string& datadir);
 
+	bool loadFromSnapshot(const std::string& file, const std::string& datadir);
+	bool saveSnapshot(const std::string& file, const std::string& datadir);
+
 	void addItemType(ItemType* iType);
 
 	const ItemType* getElement(uint32_t id) const {return items.getElement(id);}
@@ -332,6 +338,8 @@ public:
 	std::map<uint32_t, ItemType*> currencyMap;
 
 protected:
+	static bool getSourceHash(const std::string& datadir, uint64_t& hash);
+
 	typedef std::map<int32_t, int32_t> ReverseItemMap;
 	ReverseItemMap reverseItemMap;
 
@@ -0,0 +1,200 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Creatures known to a client, indexed by id in seen order
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_KNOWNCREATURES_H__
+#define __OTSERV_KNOWNCREATURES_H__
+
+#include "definitions.h"
+#include <cassert>
+
+// The client keeps this many creatures, it has to be told which one to
+// forget when a new one would go past it
+#define KNOWNCREATURES_MAX 250
+
+/**
+  * The creatures a client knows, in least recently seen order.
+  * Ids are found through an open addressing table pointing into a fixed
+  * array of nodes linked in that order, so lookups, refreshes and
+  * removals do not walk the list.
+  */
+class KnownCreatureSet
+{
+public:
+	KnownCreatureSet() :
+		m_head(none), m_tail(none), m_free(0), m_size(0)
+	{
+		for(uint32_t i = 0; i < table_size; ++i){
+			m_table[i] = none;
+		}
+
+		for(uint32_t i = 0; i < capacity; ++i){
+			m_nodes[i].next = (i + 1 < capacity ? i + 1 : static_cast<uint16_t>(none));
+		}
+	}
+
+	uint32_t size() const {return m_size;}
+	bool contains(uint32_t id) const {return findSlot(id) != none;}
+
+	// Makes a known creature the most recently seen one, false if unknown
+	bool touch(uint32_t id){
+		uint32_t slot = findSlot(id);
+		if(slot == none){
+			return false;
+		}
+
+		uint16_t n = m_table[slot];
+		if(n != m_tail){
+			unlink(n);
+			linkBack(n);
+		}
+		return true;
+	}
+
+	// The creature must not be known yet
+	void push_back(uint32_t id){
+		assert(m_free != none && !contains(id));
+
+		uint16_t n = m_free;
+		m_free = m_nodes[n].next;
+		m_nodes[n].id = id;
+		linkBack(n);
+
+		uint32_t slot = hash(id);
+		while(m_table[slot] != none){
+			slot = (slot + 1) & (table_size - 1);
+		}
+		m_table[slot] = n;
+		++m_size;
+	}
+
+	uint32_t front() const {
+		assert(m_size > 0);
+		return m_nodes[m_head].id;
+	}
+
+	void pop_front(){
+		assert(m_size > 0);
+
+		uint16_t n = m_head;
+		eraseSlot(findSlot(m_nodes[n].id));
+		unlink(n);
+
+		m_nodes[n].next = m_free;
+		m_free = n;
+		--m_size;
+	}
+
+	// Moves the least recently seen creature to the back
+	void rotate(){
+		assert(m_size > 0);
+
+		uint16_t n = m_head;
+		if(n != m_tail){
+			unlink(n);
+			linkBack(n);
+		}
+	}
+
+protected:
+	// One spare node for the creature added before one is forgotten,
+	// the table is kept at most half full
+	enum {capacity = KNOWNCREATURES_MAX + 1};
+	enum {table_size = 512};
+	enum {none = 0xFFFF};
+
+	struct Node{
+		uint32_t id;
+		uint16_t prev;
+		uint16_t next;
+	};
+
+	static uint32_t hash(uint32_t id){
+		return (id * 2654435761U) >> 23;
+	}
+
+	uint32_t findSlot(uint32_t id) const {
+		uint32_t slot = hash(id);
+		while(m_table[slot] != none){
+			if(m_nodes[m_table[slot]].id == id){
+				return slot;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+		return none;
+	}
+
+	// Shifts the following entries back instead of leaving a tombstone
+	void eraseSlot(uint32_t slot){
+		uint32_t i = slot;
+		uint32_t j = slot;
+		for(;;){
+			j = (j + 1) & (table_size - 1);
+			if(m_table[j] == none){
+				break;
+			}
+
+			uint32_t k = hash(m_nodes[m_table[j]].id);
+			if(i <= j ? (i < k && k <= j) : (i < k || k <= j)){
+				continue;
+			}
+
+			m_table[i] = m_table[j];
+			i = j;
+		}
+		m_table[i] = none;
+	}
+
+	void unlink(uint16_t n){
+		if(m_nodes[n].prev != none){
+			m_nodes[m_nodes[n].prev].next = m_nodes[n].next;
+		}
+		else{
+			m_head = m_nodes[n].next;
+		}
+
+		if(m_nodes[n].next != none){
+			m_nodes[m_nodes[n].next].prev = m_nodes[n].prev;
+		}
+		else{
+			m_tail = m_nodes[n].prev;
+		}
+	}
+
+	void linkBack(uint16_t n){
+		m_nodes[n].prev = m_tail;
+		m_nodes[n].next = none;
+		if(m_tail != none){
+			m_nodes[m_tail].next = n;
+		}
+		else{
+			m_head = n;
+		}
+		m_tail = n;
+	}
+
+	Node m_nodes[capacity];
+	uint16_t m_table[table_size];
+	uint16_t m_head;
+	uint16_t m_tail;
+	uint16_t m_free;
+	uint16_t m_size;
+};
+
+#endif
@@ -3545,9 +3545,6 @@ int LuaScriptInterface::luaDoSendAnimatedText(lua_State *L)
 
 	ScriptEnviroment* env = getScriptEnv();
 
-	SpectatorVec list;
-	SpectatorVec::iterator it;
-
 	if(pos.x == 0xFFFF){
 		pos = env->getRealPos();
 	}
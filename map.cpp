@@ -31,6 +31,7 @@
 #include "configmanager.h"
 #include <boost/config.hpp>
 #include <boost/bind.hpp>
+#include <boost/thread/tss.hpp>
 #include <cstdio>
 #include <iomanip>
 #include <string>
@@ -44,6 +45,11 @@ Map::Map()
 {
 	mapWidth = 0;
 	mapHeight = 0;
+	spectatorEpoch = 0;
+	spectatorCacheTime = OTSYS_TIME();
+	nextSpectatorCacheClean = spectatorCacheTime + spectatorCacheTimeout;
+	memset(&spectatorCacheStats, 0, sizeof(spectatorCacheStats));
+	nextFlowFieldClean = spectatorCacheTime + flowFieldTimeout;
 }
 
 Map::~Map()
@@ -85,6 +91,7 @@ bool Map::loadMap(const std::string& identifier, const std::string& type)
 	IOMapSerialize->processHouseAuctions();
 	IOMapSerialize->loadHouseInfo(this);
 	IOMapSerialize->loadMap(this);
+	IOMapSerialize->reconcileMap(this);
 	return true;
 }
 
@@ -113,6 +120,13 @@ bool Map::saveMap()
 	return saved;
 }
 
+bool Map::prepareSaveMap(DBBatch& mapBatch, MapSaveState& mapState, DBBatch& houseBatch)
+{
+	IOMapSerialize* IOMapSerialize = IOMapSerialize::getInstance();
+	return IOMapSerialize->prepareMapSave(this, mapBatch, mapState) &&
+		IOMapSerialize->prepareHouseInfoSave(houseBatch);
+}
+
 Tile* Map::getTile(int32_t x, int32_t y, int32_t z)
 {
 	if(x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || z  < 0 || z >= MAP_MAX_LAYERS){
@@ -150,6 +164,10 @@ void Map::setTile(int32_t x, int32_t y, int32_t z, Tile* newtile)
 	QTreeLeafNode::newLeaf = false;
 	QTreeLeafNode* leaf = root.createLeaf(x, y, 15);
 	if(QTreeLeafNode::newLeaf){
+		//cached viewports and flow fields do not know the new leaf
+		clearSpectatorCache();
+		flowFields.clear();
+
 		//update north
 		QTreeLeafNode* northLeaf = root.getLeaf(x, y - FLOOR_SIZE);
 		if(northLeaf){
@@ -281,6 +299,7 @@ bool Map::placeCreature(const Position& centerPos, Creature* creature, bool exte
 		toCylinder->__internalAddThing(creature);
 		Tile* toTile = toCylinder->getTile();
 		toTile->qt_node->addCreature(creature);
+		updateSpectatorCache(creature, NULL, toTile);
 		return true;
 	}
 
@@ -296,6 +315,7 @@ bool Map::removeCreature(Creature* creature)
 	Tile* tile = creature->getTile();
 	if(tile){
 		tile->qt_node->removeCreature(creature);
+		updateSpectatorCache(creature, tile, NULL);
 		tile->__removeThing(creature, 0);
 		return true;
 	}
@@ -306,7 +326,8 @@ bool Map::removeCreature(Creature* creature)
 void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, bool checkforduplicate,
 	int32_t minRangeX, int32_t maxRangeX,
 	int32_t minRangeY, int32_t maxRangeY,
-	int32_t minRangeZ, int32_t maxRangeZ)
+	int32_t minRangeZ, int32_t maxRangeZ,
+	SpectatorCacheEntry* cacheEntry /*= NULL*/)
 {
 	int32_t minoffset = centerPos.z - maxRangeZ;
 	int32_t x1 = std::min((int32_t)0xFFFF, std::max((int32_t)0, (centerPos.x + minRangeX + minoffset  )));
@@ -321,6 +342,16 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
 	int32_t endx2 = x2 - (x2 % FLOOR_SIZE);
 	int32_t endy2 = y2 - (y2 % FLOOR_SIZE);
 
+	// Creatures already in the list are stamped with a fresh epoch so
+	// duplicates are rejected without searching the list
+	uint32_t epoch = 0;
+	if(checkforduplicate && !list.empty()){
+		epoch = nextSpectatorEpoch();
+		for(SpectatorVec::iterator it = list.begin(); it != list.end(); ++it){
+			(*it)->spectatorEpoch = epoch;
+		}
+	}
+
 	QTreeLeafNode* startLeaf;
 	QTreeLeafNode* leafE;
 	QTreeLeafNode* leafS;
@@ -332,6 +363,10 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
 		leafE = leafS;
 		for(int32_t nx = startx1; nx <= endx2; nx += FLOOR_SIZE){
 			if(leafE){
+				if(cacheEntry){
+					leafE->spectator_cache_list.push_back(cacheEntry);
+					cacheEntry->leafs.push_back(leafE);
+				}
 
 				CreatureVector& node_list = leafE->creature_list;
 				CreatureVector::const_iterator node_iter = node_list.begin();
@@ -359,14 +394,11 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
 							continue;
 						}
 
-						if(checkforduplicate){
-							if(std::find(list.begin(), list.end(), creature) == list.end()){
-								list.push_back(creature);
-							}
-						}
-						else{
-							list.push_back(creature);
+						if(epoch != 0 && creature->spectatorEpoch == epoch){
+							continue;
 						}
+
+						list.push_back(creature);
 					}while(++node_iter != node_end);
 				}
 
@@ -386,70 +418,66 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
 	}
 }
 
+void Map::getSpectatorFloorRange(int32_t z, int32_t& minRangeZ, int32_t& maxRangeZ)
+{
+	if(z > 7){
+		//underground
+
+		//8->15
+		minRangeZ = std::max(z - 2, (int32_t)0);
+		maxRangeZ = std::min(z + 2, (int32_t)MAP_MAX_LAYERS - 1);
+	}
+	//above ground
+	else if(z == 6){
+		minRangeZ = 0;
+		maxRangeZ = 8;
+	}
+	else if(z == 7){
+		minRangeZ = 0;
+		maxRangeZ = 9;
+	}
+	else{
+		minRangeZ = 0;
+		maxRangeZ = 7;
+	}
+}
+
 void Map::getSpectators(SpectatorVec& list, const Position& centerPos,
 	bool checkforduplicate /*= false*/, bool multifloor /*= false*/,
 	int32_t minRangeX /*= 0*/, int32_t maxRangeX /*= 0*/,
 	int32_t minRangeY /*= 0*/, int32_t maxRangeY /*= 0*/)
 {
 	if(centerPos.z < MAP_MAX_LAYERS){
-		bool foundCache = false;
-		bool cacheResult = false;
-		if(minRangeX == 0 && maxRangeX == 0 && minRangeY == 0 && maxRangeY == 0 && multifloor && !checkforduplicate) {
-			SpectatorCache::iterator it = spectatorCache.find(centerPos);
-			if(it != spectatorCache.end()){
-				list = *it->second;
-				foundCache = true;
-			}
-			else{
-				cacheResult = true;
-			}
+		// the cached list can only be taken as it is, a list that already
+		// has creatures goes through the duplicate check below instead
+		if(minRangeX == 0 && maxRangeX == 0 && minRangeY == 0 && maxRangeY == 0 && multifloor &&
+			!checkforduplicate && list.empty())
+		{
+			const SpectatorVec& cachedList = getSpectators(centerPos);
+			list.append(cachedList.begin(), cachedList.end());
+			return;
 		}
 
-		if(!foundCache){
-			minRangeX = (minRangeX == 0 ? -maxViewportX : -minRangeX);
-			maxRangeX = (maxRangeX == 0 ? maxViewportX : maxRangeX);
-			minRangeY = (minRangeY == 0 ? -maxViewportY : -minRangeY);
-			maxRangeY = (maxRangeY == 0 ? maxViewportY : maxRangeY);
-
-			int32_t minRangeZ;
-			int32_t maxRangeZ;
-
-			if(multifloor){
-				if(centerPos.z > 7){
-					//underground
-
-					//8->15
-					minRangeZ = std::max(centerPos.z - 2, (int32_t)0);
-					maxRangeZ = std::min(centerPos.z + 2, (int32_t)MAP_MAX_LAYERS - 1);
-				}
-				//above ground
-				else if(centerPos.z == 6){
-					minRangeZ = 0;
-					maxRangeZ = 8;
-				}
-				else if(centerPos.z == 7){
-					minRangeZ = 0;
-					maxRangeZ = 9;
-				}
-				else{
-					minRangeZ = 0;
-					maxRangeZ = 7;
-				}
-			}
-			else{
-				minRangeZ = centerPos.z;
-				maxRangeZ = centerPos.z;
-			}
+		minRangeX = (minRangeX == 0 ? -maxViewportX : -minRangeX);
+		maxRangeX = (maxRangeX == 0 ? maxViewportX : maxRangeX);
+		minRangeY = (minRangeY == 0 ? -maxViewportY : -minRangeY);
+		maxRangeY = (maxRangeY == 0 ? maxViewportY : maxRangeY);
 
-			getSpectatorsInternal(list, centerPos, true,
-				minRangeX, maxRangeX,
-				minRangeY, maxRangeY,
-				minRangeZ, maxRangeZ);
+		int32_t minRangeZ;
+		int32_t maxRangeZ;
 
-			if(cacheResult){
-				spectatorCache[centerPos].reset(new SpectatorVec(list));
-			}
+		if(multifloor){
+			getSpectatorFloorRange(centerPos.z, minRangeZ, maxRangeZ);
+		}
+		else{
+			minRangeZ = centerPos.z;
+			maxRangeZ = centerPos.z;
 		}
+
+		getSpectatorsInternal(list, centerPos, true,
+			minRangeX, maxRangeX,
+			minRangeY, maxRangeY,
+			minRangeZ, maxRangeZ);
 	}
 }
 
@@ -458,62 +486,145 @@ const SpectatorVec& Map::getSpectators(const Position& centerPos)
 	if(centerPos.z < MAP_MAX_LAYERS){
 		SpectatorCache::iterator it = spectatorCache.find(centerPos);
 		if(it != spectatorCache.end()){
-			return *it->second;
+			++spectatorCacheStats.hits;
+			it->second.lastAccess = spectatorCacheTime;
+			return it->second.list;
 		}
 		else{
-			boost::shared_ptr<SpectatorVec> p(new SpectatorVec());
-			spectatorCache[centerPos] = p;
-			SpectatorVec& list = *p;
+			++spectatorCacheStats.misses;
+			SpectatorCacheEntry& entry = spectatorCache[centerPos];
+			entry.centerPos = centerPos;
+			entry.lastAccess = spectatorCacheTime;
+			entry.epoch = 0;
+			getSpectatorFloorRange(centerPos.z, entry.minRangeZ, entry.maxRangeZ);
+
+			getSpectatorsInternal(entry.list, centerPos, false,
+				-maxViewportX, maxViewportX,
+				-maxViewportY, maxViewportY,
+				entry.minRangeZ, entry.maxRangeZ, &entry);
+
+			return entry.list;
+		}
+	}
+	else{
+		static const SpectatorVec emptyList;
+		return emptyList;
+	}
+}
+
+// Same test getSpectatorsInternal applies to every creature of a scanned leaf
+static inline bool isInSpectatorCacheEntry(const SpectatorCacheEntry& entry, const Position& pos)
+{
+	if(pos.z < entry.minRangeZ || pos.z > entry.maxRangeZ){
+		return false;
+	}
+
+	int32_t offsetZ = entry.centerPos.z - pos.z;
+	if(pos.y < (entry.centerPos.y - Map::maxViewportY + offsetZ) || pos.y > (entry.centerPos.y + Map::maxViewportY + offsetZ)){
+		return false;
+	}
+	if(pos.x < (entry.centerPos.x - Map::maxViewportX + offsetZ) || pos.x > (entry.centerPos.x + Map::maxViewportX + offsetZ)){
+		return false;
+	}
 
-			int32_t minRangeX = -maxViewportX;
-			int32_t maxRangeX = maxViewportX;
-			int32_t minRangeY = -maxViewportY;
-			int32_t maxRangeY = maxViewportY;
+	return true;
+}
 
-			int32_t minRangeZ;
-			int32_t maxRangeZ;
+void Map::updateSpectatorCache(Creature* creature, const Tile* oldTile, const Tile* newTile)
+{
+	if(spectatorCache.empty()){
+		return;
+	}
+
+	// Entries spanning both leaves must only be patched once
+	uint32_t epoch = nextSpectatorEpoch();
 
-			if(centerPos.z > 7){
-				//underground
+	for(int32_t i = 0; i < 2; ++i){
+		const Tile* tile = (i == 0 ? oldTile : newTile);
+		if(!tile || !tile->qt_node){
+			continue;
+		}
 
-				//8->15
-				minRangeZ = std::max(centerPos.z - 2, (int32_t)0);
-				maxRangeZ = std::min(centerPos.z + 2, (int32_t)MAP_MAX_LAYERS - 1);
+		SpectatorCacheEntryVector& entryList = tile->qt_node->spectator_cache_list;
+		for(SpectatorCacheEntryVector::iterator it = entryList.begin(); it != entryList.end(); ++it){
+			SpectatorCacheEntry* entry = *it;
+			if(entry->epoch == epoch){
+				continue;
 			}
-			//above ground
-			else if(centerPos.z == 6){
-				minRangeZ = 0;
-				maxRangeZ = 8;
+			entry->epoch = epoch;
+
+			bool wasInRange = (oldTile && isInSpectatorCacheEntry(*entry, oldTile->getTilePosition()));
+			bool isInRange = (newTile && isInSpectatorCacheEntry(*entry, newTile->getTilePosition()));
+			if(wasInRange == isInRange){
+				continue;
 			}
-			else if(centerPos.z == 7){
-				minRangeZ = 0;
-				maxRangeZ = 9;
+
+			++spectatorCacheStats.updates;
+			if(isInRange){
+				entry->list.push_back(creature);
 			}
 			else{
-				minRangeZ = 0;
-				maxRangeZ = 7;
+				entry->list.erase(creature);
 			}
+		}
+	}
+}
 
-			getSpectatorsInternal(list, centerPos, false,
-				minRangeX, maxRangeX,
-				minRangeY, maxRangeY,
-				minRangeZ, maxRangeZ);
-
-			return list;
+void Map::removeSpectatorCacheEntry(SpectatorCacheEntry& entry)
+{
+	for(std::vector<QTreeLeafNode*>::iterator it = entry.leafs.begin(); it != entry.leafs.end(); ++it){
+		SpectatorCacheEntryVector& entryList = (*it)->spectator_cache_list;
+		SpectatorCacheEntryVector::iterator eit = std::find(entryList.begin(), entryList.end(), &entry);
+		if(eit != entryList.end()){
+			std::swap(*eit, entryList.back());
+			entryList.pop_back();
 		}
 	}
-	else{
-		boost::shared_ptr<SpectatorVec> p(new SpectatorVec());
-		SpectatorVec& list = *p;
-		return list;
+
+	entry.leafs.clear();
+}
+
+void Map::cleanSpectatorCache()
+{
+	spectatorCacheTime = OTSYS_TIME();
+	if(spectatorCacheTime < nextSpectatorCacheClean){
+		return;
+	}
+
+	nextSpectatorCacheClean = spectatorCacheTime + spectatorCacheTimeout;
+
+	SpectatorCache::iterator it = spectatorCache.begin();
+	while(it != spectatorCache.end()){
+		if(spectatorCacheTime - it->second.lastAccess >= spectatorCacheTimeout){
+			removeSpectatorCacheEntry(it->second);
+			spectatorCache.erase(it++);
+			++spectatorCacheStats.evictions;
+		}
+		else{
+			++it;
+		}
 	}
 }
 
 void Map::clearSpectatorCache()
 {
+	for(SpectatorCache::iterator it = spectatorCache.begin(); it != spectatorCache.end(); ++it){
+		removeSpectatorCacheEntry(it->second);
+	}
+
+	spectatorCacheStats.evictions += spectatorCache.size();
 	spectatorCache.clear();
 }
 
+uint32_t Map::nextSpectatorEpoch()
+{
+	// 0 is reserved for "never stamped"
+	if(++spectatorEpoch == 0){
+		++spectatorEpoch;
+	}
+	return spectatorEpoch;
+}
+
 bool Map::canThrowObjectTo(const Position& fromPos, const Position& toPos, bool checkLineOfSight /*= true*/,
 	int32_t rangex /*= Map::maxClientViewportX*/, int32_t rangey /*= Map::maxClientViewportY*/)
 {
@@ -637,16 +748,14 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 		return false;
 	}
 
-	AStarNodes nodes;
-	AStarNode* startNode = nodes.createOpenNode();
-
-	startNode->x = startPos.x;
-	startNode->y = startPos.y;
+	AStarNodes& nodes = AStarNodes::getInstance();
+	AStarNode* startNode = nodes.createNode(startPos.x, startPos.y);
 
 	startNode->g = 0;
 	startNode->h = nodes.getEstimatedDistance(startPos.x, startPos.y, endPos.x, endPos.y);
 	startNode->f = startNode->g + startNode->h;
 	startNode->parent = NULL;
+	nodes.openNode(startNode);
 
 	Position pos;
 	pos.z = startPos.z;
@@ -690,7 +799,7 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 					outOfRange = true;
 				}
 
-				if(!outOfRange && (tile = canWalkTo(creature, pos))){
+				if(!outOfRange && (tile = nodes.canWalkTo(this, creature, pos))){
 					//The cost (g) for this neighbour
 					int32_t cost = nodes.getMapWalkCost(creature, n, tile, pos);
 					int32_t extraCost = nodes.getTileWalkCost(creature, tile);
@@ -705,12 +814,10 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 							//The node on the closed/open list is cheaper than this one
 							continue;
 						}
-
-						nodes.openNode(neighbourNode);
 					}
 					else{
 						//Does not exist in the open/closed list, create a new node
-						neighbourNode = nodes.createOpenNode();
+						neighbourNode = nodes.createNode(pos.x, pos.y);
 						if(!neighbourNode){
 							//seems we ran out of nodes
 							listDir.clear();
@@ -719,13 +826,12 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 					}
 
 					//This node is the best node so far with this state
-					neighbourNode->x = pos.x;
-					neighbourNode->y = pos.y;
 					neighbourNode->parent = n;
 					neighbourNode->g = newg;
 					neighbourNode->h = nodes.getEstimatedDistance(neighbourNode->x, neighbourNode->y,
 						endPos.x, endPos.y);
 					neighbourNode->f = neighbourNode->g + neighbourNode->h;
+					nodes.openNode(neighbourNode);
 				}
 			}
 
@@ -786,14 +892,12 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 	Position startPos = creature->getPosition();
 	Position endPos;
 
-	AStarNodes nodes;
-	AStarNode* startNode = nodes.createOpenNode();
-
-	startNode->x = startPos.x;
-	startNode->y = startPos.y;
+	AStarNodes& nodes = AStarNodes::getInstance();
+	AStarNode* startNode = nodes.createNode(startPos.x, startPos.y);
 
 	startNode->f = 0;
 	startNode->parent = NULL;
+	nodes.openNode(startNode);
 
 	Position pos;
 	pos.z = startPos.z;
@@ -852,7 +956,7 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 				}
 			}
 
-			if(inRange && (tile = canWalkTo(creature, pos))){
+			if(inRange && (tile = nodes.canWalkTo(this, creature, pos))){
 				//The cost (g) for this neighbour
 				int32_t cost = nodes.getMapWalkCost(creature, n, tile, pos);
 				int32_t extraCost = nodes.getTileWalkCost(creature, tile);
@@ -867,12 +971,10 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 						//The node on the closed/open list is cheaper than this one
 						continue;
 					}
-
-					nodes.openNode(neighbourNode);
 				}
 				else{
 					//Does not exist in the open/closed list, create a new node
-					neighbourNode = nodes.createOpenNode();
+					neighbourNode = nodes.createNode(pos.x, pos.y);
 					if(!neighbourNode){
 						if(found){
 							//not quite what we want, but we found something
@@ -886,10 +988,9 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 				}
 
 				//This node is the best node so far with this state
-				neighbourNode->x = pos.x;
-				neighbourNode->y = pos.y;
 				neighbourNode->parent = n;
 				neighbourNode->f = newf;
+				nodes.openNode(neighbourNode);
 			}
 		}
 
@@ -946,15 +1047,335 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 	return true;
 }
 
+bool Map::isFlowFieldWalkable(const Tile* tile)
+{
+	// only what blocks every monster, the walker checks the rest itself
+	if(!tile || !tile->ground || tile->floorChange() || tile->positionChange()){
+		return false;
+	}
+
+	return !tile->hasFlag(TILESTATE_PROTECTIONZONE) && !tile->hasFlag(TILESTATE_BLOCKSOLID) &&
+		!tile->hasFlag(TILESTATE_IMMOVABLENOFIELDBLOCKPATH) && !tile->hasFlag(TILESTATE_NOFIELDBLOCKPATH);
+}
+
+bool Map::isFlowFieldValid(const FlowField& field, const Position& centerPos, int64_t now) const
+{
+	if(field.centerPos != centerPos || now - field.created >= flowFieldTimeout){
+		return false;
+	}
+
+	for(std::vector< std::pair<QTreeLeafNode*, uint32_t> >::const_iterator it = field.leafs.begin();
+		it != field.leafs.end(); ++it)
+	{
+		if(it->first->getTileRevision() != it->second){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Map::buildFlowField(FlowField& field, const Position& centerPos)
+{
+	static int32_t neighbourOrderList[8][3] = {
+		{-1, 0, MAP_NORMALWALKCOST},
+		{0, 1, MAP_NORMALWALKCOST},
+		{1, 0, MAP_NORMALWALKCOST},
+		{0, -1, MAP_NORMALWALKCOST},
+
+		//diagonal
+		{-1, -1, MAP_DIAGONALWALKCOST},
+		{1, -1, MAP_DIAGONALWALKCOST},
+		{1, 1, MAP_DIAGONALWALKCOST},
+		{-1, 1, MAP_DIAGONALWALKCOST},
+	};
+
+	field.centerPos = centerPos;
+	field.created = OTSYS_TIME();
+	field.leafs.clear();
+
+	int32_t startX = (int32_t)centerPos.x - FLOWFIELD_RADIUS;
+	int32_t startY = (int32_t)centerPos.y - FLOWFIELD_RADIUS;
+
+	bool walkable[FLOWFIELD_SIZE][FLOWFIELD_SIZE];
+	for(int32_t x = 0; x < FLOWFIELD_SIZE; ++x){
+		for(int32_t y = 0; y < FLOWFIELD_SIZE; ++y){
+			field.cost[x][y] = FLOWFIELD_UNREACHABLE;
+			walkable[x][y] = isFlowFieldWalkable(getTile(startX + x, startY + y, centerPos.z));
+		}
+	}
+
+	//remember the leafs, so item changes on them can be noticed
+	int32_t endX = std::min(startX + FLOWFIELD_SIZE - 1, 0xFFFF);
+	int32_t endY = std::min(startY + FLOWFIELD_SIZE - 1, 0xFFFF);
+	for(int32_t nx = (std::max(startX, 0) & ~FLOOR_MASK); nx <= endX; nx += FLOOR_SIZE){
+		for(int32_t ny = (std::max(startY, 0) & ~FLOOR_MASK); ny <= endY; ny += FLOOR_SIZE){
+			if(QTreeLeafNode* leaf = getLeaf(nx, ny)){
+				field.leafs.push_back(std::make_pair(leaf, leaf->getTileRevision()));
+			}
+		}
+	}
+
+	//dijkstra starting at the target, it is walkable whatever stands on it
+	typedef std::pair<int32_t, int32_t> FlowFieldNode;
+	std::priority_queue<FlowFieldNode, std::vector<FlowFieldNode>, std::greater<FlowFieldNode> > openList;
+
+	field.cost[FLOWFIELD_RADIUS][FLOWFIELD_RADIUS] = 0;
+	openList.push(FlowFieldNode(0, FLOWFIELD_RADIUS * FLOWFIELD_SIZE + FLOWFIELD_RADIUS));
+
+	while(!openList.empty()){
+		FlowFieldNode node = openList.top();
+		openList.pop();
+
+		int32_t x = node.second / FLOWFIELD_SIZE;
+		int32_t y = node.second % FLOWFIELD_SIZE;
+		if(node.first > field.cost[x][y]){
+			continue;
+		}
+
+		for(int32_t i = 0; i < 8; ++i){
+			int32_t nx = x + neighbourOrderList[i][0];
+			int32_t ny = y + neighbourOrderList[i][1];
+			if(nx < 0 || ny < 0 || nx >= FLOWFIELD_SIZE || ny >= FLOWFIELD_SIZE || !walkable[nx][ny]){
+				continue;
+			}
+
+			int32_t cost = node.first + neighbourOrderList[i][2];
+			if(cost < field.cost[nx][ny]){
+				field.cost[nx][ny] = cost;
+				openList.push(FlowFieldNode(cost, nx * FLOWFIELD_SIZE + ny));
+			}
+		}
+	}
+}
+
+FlowField& Map::getFlowField(const Creature* target)
+{
+	int64_t now = OTSYS_TIME();
+	if(now >= nextFlowFieldClean){
+		nextFlowFieldClean = now + flowFieldTimeout;
+
+		FlowFieldMap::iterator it = flowFields.begin();
+		while(it != flowFields.end()){
+			if(now - it->second.lastAccess >= flowFieldTimeout){
+				flowFields.erase(it++);
+			}
+			else{
+				++it;
+			}
+		}
+	}
+
+	const Position& centerPos = target->getPosition();
+
+	FlowFieldMap::iterator it = flowFields.find(target->getID());
+	if(it == flowFields.end()){
+		it = flowFields.insert(std::make_pair(target->getID(), FlowField())).first;
+		buildFlowField(it->second, centerPos);
+	}
+	else if(!isFlowFieldValid(it->second, centerPos, now)){
+		buildFlowField(it->second, centerPos);
+	}
+
+	it->second.lastAccess = now;
+	return it->second;
+}
+
+bool Map::getPathByFlowField(const Creature* creature, const Creature* target,
+	std::list<Direction>& dirList, const FindPathParams& fpp)
+{
+	static int32_t neighbourOrderList[8][3] = {
+		{-1, 0, WEST},
+		{0, 1, SOUTH},
+		{1, 0, EAST},
+		{0, -1, NORTH},
+
+		//diagonal
+		{-1, -1, NORTHWEST},
+		{1, -1, NORTHEAST},
+		{1, 1, SOUTHEAST},
+		{-1, 1, SOUTHWEST},
+	};
+
+	if(fpp.keepDistance || fpp.minTargetDist > 1 || fpp.maxTargetDist != 1){
+		return false;
+	}
+
+	const Position& targetPos = target->getPosition();
+	Position pos = creature->getPosition();
+	if(pos.z != targetPos.z ||
+		std::max(std::abs(pos.x - targetPos.x), std::abs(pos.y - targetPos.y)) < fpp.minTargetDist)
+	{
+		return false;
+	}
+
+	const FlowField& field = getFlowField(target);
+
+	int32_t startX = (int32_t)targetPos.x - FLOWFIELD_RADIUS;
+	int32_t startY = (int32_t)targetPos.y - FLOWFIELD_RADIUS;
+
+	dirList.clear();
+	int32_t dirCount = (fpp.allowDiagonal ? 8 : 4);
+
+	while(std::max(std::abs(pos.x - targetPos.x), std::abs(pos.y - targetPos.y)) > 1){
+		int32_t x = pos.x - startX;
+		int32_t y = pos.y - startY;
+		if(x < 0 || y < 0 || x >= FLOWFIELD_SIZE || y >= FLOWFIELD_SIZE){
+			dirList.clear();
+			return false;
+		}
+
+		//step to the cheapest neighbour we can actually walk to
+		int32_t bestCost = field.cost[x][y];
+		int32_t bestDir = -1;
+		for(int32_t i = 0; i < dirCount; ++i){
+			int32_t nx = x + neighbourOrderList[i][0];
+			int32_t ny = y + neighbourOrderList[i][1];
+			if(nx < 0 || ny < 0 || nx >= FLOWFIELD_SIZE || ny >= FLOWFIELD_SIZE ||
+				field.cost[nx][ny] >= bestCost)
+			{
+				continue;
+			}
+
+			if(canWalkTo(creature, Position(startX + nx, startY + ny, pos.z))){
+				bestCost = field.cost[nx][ny];
+				bestDir = i;
+			}
+		}
+
+		if(bestDir == -1){
+			//blocked for this creature, or the target is unreachable
+			dirList.clear();
+			return false;
+		}
+
+		pos.x += neighbourOrderList[bestDir][0];
+		pos.y += neighbourOrderList[bestDir][1];
+		dirList.push_back((Direction)neighbourOrderList[bestDir][2]);
+	}
+
+	return true;
+}
+
 //*********** AStarNodes *************
 
 AStarNodes::AStarNodes()
 {
 	curNode = 0;
-	openNodes.reset();
+	openCount = 0;
+	usedSlots = 0;
+	stamp = 1;
+	memset(slots, 0, sizeof(slots));
+}
+
+AStarNodes& AStarNodes::getInstance()
+{
+	// too large for the stack, every thread reuses its own
+	static boost::thread_specific_ptr<AStarNodes> instance;
+	if(!instance.get()){
+		instance.reset(new AStarNodes);
+	}
+
+	instance->reset();
+	return *instance;
+}
+
+void AStarNodes::reset()
+{
+	curNode = 0;
+	openCount = 0;
+	usedSlots = 0;
+
+	if(++stamp == 0){
+		memset(slots, 0, sizeof(slots));
+		stamp = 1;
+	}
+}
+
+AStarSlot* AStarNodes::getSlot(int32_t x, int32_t y, bool create)
+{
+	uint32_t key = ((uint32_t)(x & 0xFFFF) << 16) | (uint32_t)(y & 0xFFFF);
+	uint32_t index = ((uint32_t)x * 73856093 ^ (uint32_t)y * 19349663) & ASTAR_SLOT_MASK;
+
+	while(true){
+		AStarSlot& slot = slots[index];
+		if(slot.stamp != stamp){
+			if(!create || usedSlots >= ASTAR_SLOT_MAXUSED){
+				return NULL;
+			}
+
+			++usedSlots;
+			slot.key = key;
+			slot.stamp = stamp;
+			slot.node = -1;
+			slot.walkable = -1;
+			slot.tile = NULL;
+			return &slot;
+		}
+
+		if(slot.key == key){
+			return &slot;
+		}
+
+		index = (index + 1) & ASTAR_SLOT_MASK;
+	}
+}
+
+bool AStarNodes::lessNode(int32_t a, int32_t b) const
+{
+	// equal costs go to the older node, like the linear search did
+	if(nodes[a].f != nodes[b].f){
+		return nodes[a].f < nodes[b].f;
+	}
+
+	return a < b;
+}
+
+void AStarNodes::siftUp(int32_t heapIndex)
+{
+	int32_t node = openHeap[heapIndex];
+	while(heapIndex > 0){
+		int32_t parent = (heapIndex - 1) / 2;
+		if(!lessNode(node, openHeap[parent])){
+			break;
+		}
+
+		openHeap[heapIndex] = openHeap[parent];
+		nodes[openHeap[heapIndex]].heapIndex = heapIndex;
+		heapIndex = parent;
+	}
+
+	openHeap[heapIndex] = node;
+	nodes[node].heapIndex = heapIndex;
 }
 
-AStarNode* AStarNodes::createOpenNode()
+void AStarNodes::siftDown(int32_t heapIndex)
+{
+	int32_t node = openHeap[heapIndex];
+	while(true){
+		int32_t child = heapIndex * 2 + 1;
+		if(child >= (int32_t)openCount){
+			break;
+		}
+
+		if(child + 1 < (int32_t)openCount && lessNode(openHeap[child + 1], openHeap[child])){
+			++child;
+		}
+
+		if(!lessNode(openHeap[child], node)){
+			break;
+		}
+
+		openHeap[heapIndex] = openHeap[child];
+		nodes[openHeap[heapIndex]].heapIndex = heapIndex;
+		heapIndex = child;
+	}
+
+	openHeap[heapIndex] = node;
+	nodes[node].heapIndex = heapIndex;
+}
+
+AStarNode* AStarNodes::createNode(int32_t x, int32_t y)
 {
 	if(curNode >= MAX_NODES){
 		return NULL;
@@ -962,32 +1383,36 @@ AStarNode* AStarNodes::createOpenNode()
 
 	uint32_t ret_node = curNode;
 	curNode++;
-	openNodes[ret_node] = 1;
-	return &nodes[ret_node];
+
+	AStarNode* node = &nodes[ret_node];
+	node->x = x;
+	node->y = y;
+	node->parent = NULL;
+	node->f = node->g = node->h = 0;
+	node->heapIndex = -1;
+
+	if(AStarSlot* slot = getSlot(x, y, true)){
+		slot->node = ret_node;
+	}
+
+	// the caller sets the costs and adds it with openNode
+	return node;
 }
 
 AStarNode* AStarNodes::getBestNode()
 {
-	if(curNode == 0)
+	if(openCount == 0)
 		return NULL;
 
-	int best_node_f = 100000;
-	uint32_t best_node = 0;
-	bool found = false;
-
-	for(uint32_t i = 0; i < curNode; ++i){
-		if(nodes[i].f < best_node_f && openNodes[i] == 1){
-			found = true;
-			best_node_f = nodes[i].f;
-			best_node = i;
-		}
-	}
-
-	if(found){
-		return &nodes[best_node];
+	int32_t best_node = openHeap[0];
+	--openCount;
+	if(openCount > 0){
+		openHeap[0] = openHeap[openCount];
+		siftDown(0);
 	}
 
-	return NULL;
+	nodes[best_node].heapIndex = -1;
+	return &nodes[best_node];
 }
 
 void AStarNodes::closeNode(AStarNode* node)
@@ -999,7 +1424,18 @@ void AStarNodes::closeNode(AStarNode* node)
 		return;
 	}
 
-	openNodes[pos] = 0;
+	if(node->heapIndex != -1){
+		// still on the open list, fill its place with the last open node
+		int32_t heapIndex = node->heapIndex;
+		node->heapIndex = -1;
+		--openCount;
+		if(heapIndex < (int32_t)openCount){
+			int32_t moved = openHeap[openCount];
+			openHeap[heapIndex] = moved;
+			siftDown(heapIndex);
+			siftUp(nodes[moved].heapIndex);
+		}
+	}
 }
 
 void AStarNodes::openNode(AStarNode* node)
@@ -1011,43 +1447,35 @@ void AStarNodes::openNode(AStarNode* node)
 		return;
 	}
 
-	openNodes[pos] = 1;
+	if(node->heapIndex == -1){
+		node->heapIndex = openCount;
+		openHeap[openCount++] = pos;
+	}
+
+	siftUp(node->heapIndex);
 }
 
-uint32_t AStarNodes::countClosedNodes()
+bool AStarNodes::isInList(int32_t x, int32_t y)
 {
-	uint32_t counter = 0;
-	for(uint32_t i = 0; i < curNode; ++i){
-		if(openNodes[i] == 0){
-			counter++;
-		}
-	}
-	return counter;
+	return getNodeInList(x, y) != NULL;
 }
 
-uint32_t AStarNodes::countOpenNodes()
+AStarNode* AStarNodes::getNodeInList(int32_t x, int32_t y)
 {
-	uint32_t counter = 0;
-	for(uint32_t i = 0; i < curNode; ++i){
-		if(openNodes[i] == 1){
-			counter++;
+	AStarSlot* slot = getSlot(x, y, false);
+	if(slot){
+		if(slot->node != -1){
+			return &nodes[slot->node];
 		}
+
+		return NULL;
 	}
-	return counter;
-}
 
-bool AStarNodes::isInList(int32_t x, int32_t y)
-{
-	for(uint32_t i = 0; i < curNode; ++i){
-		if(nodes[i].x == x && nodes[i].y == y){
-			return true;
-		}
+	if(usedSlots < ASTAR_SLOT_MAXUSED){
+		return NULL;
 	}
-	return false;
-}
 
-AStarNode* AStarNodes::getNodeInList(int32_t x, int32_t y)
-{
+	// the index is full, positions seen from now on are not in it
 	for(uint32_t i = 0; i < curNode; ++i){
 		if(nodes[i].x == x && nodes[i].y == y){
 			return &nodes[i];
@@ -1057,6 +1485,21 @@ AStarNode* AStarNodes::getNodeInList(int32_t x, int32_t y)
 	return NULL;
 }
 
+const Tile* AStarNodes::canWalkTo(Map* map, const Creature* creature, const Position& pos)
+{
+	AStarSlot* slot = getSlot(pos.x, pos.y, true);
+	if(!slot){
+		return map->canWalkTo(creature, pos);
+	}
+
+	if(slot->walkable == -1){
+		slot->tile = map->canWalkTo(creature, pos);
+		slot->walkable = (slot->tile != NULL ? 1 : 0);
+	}
+
+	return slot->tile;
+}
+
 int32_t AStarNodes::getMapWalkCost(const Creature* creature, AStarNode* node,
 	const Tile* neighbourTile, const Position& neighbourPos)
 {
@@ -1209,6 +1652,7 @@ QTreeLeafNode::QTreeLeafNode()
 	m_isLeaf = true;
 	m_leafS = NULL;
 	m_leafE = NULL;
+	tileRevision = 0;
 }
 
 QTreeLeafNode::~QTreeLeafNode()
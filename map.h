@@ -40,6 +40,7 @@ class Creature;
 class Player;
 class Game;
 struct FindPathParams;
+struct MapSaveState;
 
 #define MAP_MAX_LAYERS 16
 
@@ -51,37 +52,78 @@ struct AStarNode{
 	int32_t x, y;
 	AStarNode* parent;
 	int32_t f, g, h;
+	// Position in the open heap, -1 once the node is closed
+	int32_t heapIndex;
 };
 
 #define MAX_NODES 512
 #define GET_NODE_INDEX(a) (a - &nodes[0])
 
+// Positions looked at by one search, every expanded node checks up to 8
+#define ASTAR_SLOT_BITS 12
+#define ASTAR_SLOT_COUNT (1 << ASTAR_SLOT_BITS)
+#define ASTAR_SLOT_MASK (ASTAR_SLOT_COUNT - 1)
+#define ASTAR_SLOT_MAXUSED (ASTAR_SLOT_COUNT * 3 / 4)
+
 #define MAP_NORMALWALKCOST 10
 #define MAP_DIAGONALWALKCOST 25
 
+// One position known to the current search, holds the node created for it
+// and the result of Map::canWalkTo so neither is looked up twice.
+struct AStarSlot{
+	uint32_t key;
+	uint32_t stamp;
+	int32_t node;
+	int32_t walkable;
+	const Tile* tile;
+};
+
 class AStarNodes{
 public:
 	AStarNodes();
 	~AStarNodes(){};
 
-	AStarNode* createOpenNode();
+	// Returns the scratch nodes of the calling thread, emptied for a new search
+	static AStarNodes& getInstance();
+	void reset();
+
+	// The node is not open until the costs are set and openNode is called
+	AStarNode* createNode(int32_t x, int32_t y);
+	// Removes the open node with the lowest f from the open list
 	AStarNode* getBestNode();
 	void closeNode(AStarNode* node);
+	// Adds a node to the open list, or resorts it after its f was lowered
 	void openNode(AStarNode* node);
-	uint32_t countClosedNodes();
-	uint32_t countOpenNodes();
+	uint32_t countClosedNodes() const {return curNode - openCount;}
+	uint32_t countOpenNodes() const {return openCount;}
 	bool isInList(int32_t x, int32_t y);
 	AStarNode* getNodeInList(int32_t x, int32_t y);
 
+	// Map::canWalkTo, remembered for the rest of the search
+	const Tile* canWalkTo(Map* map, const Creature* creature, const Position& pos);
+
 	int32_t getMapWalkCost(const Creature* creature, AStarNode* node,
 		const Tile* neighbourTile, const Position& neighbourPos);
 	static int32_t getTileWalkCost(const Creature* creature, const Tile* tile);
 	int32_t getEstimatedDistance(int32_t x, int32_t y, int32_t xGoal, int32_t yGoal);
 
 private:
+	AStarSlot* getSlot(int32_t x, int32_t y, bool create);
+	bool lessNode(int32_t a, int32_t b) const;
+	void siftUp(int32_t heapIndex);
+	void siftDown(int32_t heapIndex);
+
 	AStarNode nodes[MAX_NODES];
-	std::bitset<MAX_NODES> openNodes;
 	uint32_t curNode;
+
+	// Binary heap of open node indexes ordered by f
+	int32_t openHeap[MAX_NODES];
+	uint32_t openCount;
+
+	// Open addressed position index, slots of older searches have an older stamp
+	AStarSlot slots[ASTAR_SLOT_COUNT];
+	uint32_t usedSlots;
+	uint32_t stamp;
 };
 
 template<class T> class lessPointer : public std::binary_function<T*, T*, bool>
@@ -104,6 +146,45 @@ struct Floor{
 class FrozenPathingConditionCall;
 class QTreeLeafNode;
 
+// A cached result of the default (full viewport, multifloor) spectator query.
+// The entry is registered on every leaf its viewport spans, so creature
+// movement only has to patch the entries of the leaves it touches.
+struct SpectatorCacheEntry{
+	Position centerPos;
+	int32_t minRangeZ, maxRangeZ;
+	int64_t lastAccess;
+	uint32_t epoch;
+	SpectatorVec list;
+	std::vector<QTreeLeafNode*> leafs;
+};
+
+typedef std::map<Position, SpectatorCacheEntry> SpectatorCache;
+typedef std::vector<SpectatorCacheEntry*> SpectatorCacheEntryVector;
+
+struct SpectatorCacheStats{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t updates;
+	uint64_t evictions;
+};
+
+#define FLOWFIELD_RADIUS 12
+#define FLOWFIELD_SIZE (FLOWFIELD_RADIUS * 2 + 1)
+#define FLOWFIELD_UNREACHABLE 0xFFFF
+
+// Walking costs towards one creature, computed once and shared by every
+// monster following it. The revisions of the leaves it covers are kept,
+// an item change on any of them invalidates the field.
+struct FlowField{
+	Position centerPos;
+	int64_t created;
+	int64_t lastAccess;
+	std::vector< std::pair<QTreeLeafNode*, uint32_t> > leafs;
+	uint16_t cost[FLOWFIELD_SIZE][FLOWFIELD_SIZE];
+};
+
+typedef std::map<uint32_t, FlowField> FlowFieldMap;
+
 class QTreeNode{
 public:
 	QTreeNode();
@@ -136,12 +217,18 @@ public:
 	void addCreature(Creature* c);
 	void removeCreature(Creature* c);
 
+	// Bumped whenever an item on any tile of the leaf changes
+	void increaseTileRevision() {++tileRevision;}
+	uint32_t getTileRevision() const {return tileRevision;}
+
 protected:
 	static bool newLeaf;
+	uint32_t tileRevision;
 	QTreeLeafNode* m_leafS;
 	QTreeLeafNode* m_leafE;
 	Floor* m_array[MAP_MAX_LAYERS];
 	CreatureVector creature_list;
+	SpectatorCacheEntryVector spectator_cache_list;
 
 	friend class Map;
 	friend class QTreeNode;
@@ -165,6 +252,11 @@ public:
 	static const int32_t maxClientViewportX = 8;
 	static const int32_t maxClientViewportY = 6;
 
+	// Cached spectator lists not used for this long are dropped
+	static const int32_t spectatorCacheTimeout = 10000;
+	// Flow fields are rebuilt at least this often
+	static const int32_t flowFieldTimeout = 1000;
+
 	/**
 	* Load a map.
 	* \param identifier file/database to load
@@ -180,6 +272,12 @@ public:
 	*/
 	bool saveMap();
 
+	/**
+	* Capture what saveMap() writes, without writing it.
+	* \return true if the map could be serialized
+	*/
+	bool prepareSaveMap(DBBatch& mapBatch, MapSaveState& mapState, DBBatch& houseBatch);
+
 	/**
 	* Get a single tile.
 	* \return A pointer to that tile.
@@ -252,6 +350,21 @@ public:
 	bool getPathMatching(const Creature* creature, std::list<Direction>& dirList,
 		const FrozenPathingConditionCall& pathCondition, const FindPathParams& fpp);
 
+	/**
+	* Get a path next to a creature from the flow field around it.
+	* Only handles plain melee following, anything else returns false and
+	* should use getPathMatching.
+	* \param creature The creature that wants a path
+	* \param target The creature to walk to
+	* \param dirList contains a list of directions to the target
+	* \returns returns true if a path was found
+	*/
+	bool getPathByFlowField(const Creature* creature, const Creature* target,
+		std::list<Direction>& dirList, const FindPathParams& fpp);
+
+
+	const SpectatorCacheStats& getSpectatorCacheStats() const {return spectatorCacheStats;}
+	uint32_t getSpectatorCacheSize() const {return (uint32_t)spectatorCache.size();}
 
 	// Waypoints on the map
 	Waypoints waypoints;
@@ -261,12 +374,21 @@ protected:
 	std::string spawnfile;
 	std::string housefile;
 	SpectatorCache spectatorCache;
-
-	// Actually scans the map for spectators
+	SpectatorCacheStats spectatorCacheStats;
+	int64_t spectatorCacheTime;
+	int64_t nextSpectatorCacheClean;
+	uint32_t spectatorEpoch;
+	FlowFieldMap flowFields;
+	int64_t nextFlowFieldClean;
+
+	// Actually scans the map for spectators, if cacheEntry is set the entry
+	// is also registered on every leaf that was scanned
 	void getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, bool checkforduplicate,
 		int32_t minRangeX, int32_t maxRangeX,
 		int32_t minRangeY, int32_t maxRangeY,
-		int32_t minRangeZ, int32_t maxRangeZ);
+		int32_t minRangeZ, int32_t maxRangeZ,
+		SpectatorCacheEntry* cacheEntry = NULL);
+	static void getSpectatorFloorRange(int32_t z, int32_t& minRangeZ, int32_t& maxRangeZ);
 
 	// Use this when a custom spectator vector is needed, this support many
 	// more parameters than the heavily cached version below.
@@ -275,11 +397,24 @@ protected:
 		int32_t minRangeX = 0, int32_t maxRangeX = 0,
 		int32_t minRangeY = 0, int32_t maxRangeY = 0);
 	// The returned SpectatorVec is a temporary and should not be kept around
-	// Take special heed in that the vector will be destroyed if any function
-	// that calls clearSpectatorCache is called.
+	// Take special heed in that the vector is patched whenever a creature
+	// in its viewport moves, and destroyed by clearSpectatorCache.
 	const SpectatorVec& getSpectators(const Position& centerPos);
 
+	// Patches the cached spectator lists around the old and new tile,
+	// either tile may be NULL when the creature is placed or removed.
+	void updateSpectatorCache(Creature* creature, const Tile* oldTile, const Tile* newTile);
+	// Drops cached spectator lists that have not been used recently
+	void cleanSpectatorCache();
 	void clearSpectatorCache();
+	void removeSpectatorCacheEntry(SpectatorCacheEntry& entry);
+	uint32_t nextSpectatorEpoch();
+
+	// Returns an up to date flow field around the target
+	FlowField& getFlowField(const Creature* target);
+	void buildFlowField(FlowField& field, const Position& centerPos);
+	bool isFlowFieldValid(const FlowField& field, const Position& centerPos, int64_t now) const;
+	static bool isFlowFieldWalkable(const Tile* tile);
 
 	// Root node of the quad tree
 	QTreeNode root;
@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "monster.h"
+#include "objectpool.h"
 #include "monsters.h"
 #include "game.h"
 #include "spells.h"
@@ -104,6 +105,22 @@ Creature()
 #endif
 }
 
+static ObjectPool& getMonsterPool()
+{
+	static ObjectPool* pool = new ObjectPool("Monster", sizeof(Monster));
+	return *pool;
+}
+
+void* Monster::operator new(size_t size)
+{
+	return getMonsterPool().allocate(size);
+}
+
+void Monster::operator delete(void* p, size_t size)
+{
+	getMonsterPool().deallocate(p, size);
+}
+
 Monster::~Monster()
 {
 	clearTargetList();
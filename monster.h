@@ -56,6 +56,10 @@ public:
 
 	virtual ~Monster();
 
+	// Allocated from an object pool, see objectpool.h
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 	virtual Monster* getMonster() {return this;};
 	virtual const Monster* getMonster() const {return this;};
 
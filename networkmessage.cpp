@@ -72,7 +72,12 @@ Position NetworkMessage::GetPosition()
 void NetworkMessage::AddString(const char* value)
 {
 	uint32_t stringlen = (uint32_t)strlen(value);
-	if(!canAdd(stringlen+2) || stringlen > 8192)
+	if(stringlen > 8192){
+		m_overrun = true;
+		return;
+	}
+
+	if(!Reserve(stringlen+2))
 		return;
 
 	AddU16(stringlen);
@@ -83,7 +88,12 @@ void NetworkMessage::AddString(const char* value)
 
 void NetworkMessage::AddBytes(const char* bytes, uint32_t size)
 {
-	if(!canAdd(size) || size > 8192)
+	if(size > 8192){
+		m_overrun = true;
+		return;
+	}
+
+	if(!Reserve(size))
 		return;
 
 	memcpy(m_MsgBuf + m_ReadPos, bytes, size);
@@ -93,45 +103,65 @@ void NetworkMessage::AddBytes(const char* bytes, uint32_t size)
 
 void NetworkMessage::AddPaddingBytes(uint32_t n)
 {
-	if(!canAdd(n))
+	if(!Reserve(n))
 		return;
 
 	memset((void*)&m_MsgBuf[m_ReadPos], 0x33, n);
 	m_MsgSize = m_MsgSize + n;
 }
 
+bool NetworkMessage::AddMessage(const NetworkMessage& msg)
+{
+	if(!canAdd(msg.m_MsgSize))
+		return false;
+
+	memcpy(m_MsgBuf + m_ReadPos, msg.m_MsgBuf + msg.m_ReadPos - msg.m_MsgSize, msg.m_MsgSize);
+	m_ReadPos += msg.m_MsgSize;
+	m_MsgSize += msg.m_MsgSize;
+	return true;
+}
+
 void NetworkMessage::AddPosition(const Position& pos)
 {
-	AddU16(pos.x);
-	AddU16(pos.y);
-	AddByte(pos.z);
+	if(!Reserve(5))
+		return;
+
+	PutU16(pos.x);
+	PutU16(pos.y);
+	PutByte(pos.z);
 }
 
 void NetworkMessage::AddItem(uint16_t id, uint8_t count)
 {
+	if(!Reserve(3))
+		return;
+
 	const ItemType &it = Item::items[id];
 
-	AddU16(it.clientId);
+	PutU16(it.clientId);
 
 	if(it.stackable){
-		AddByte(count);
+		PutByte(count);
 	}
 	else if(it.isSplash() || it.isFluidContainer()){
-		AddByte(Item::items.getClientFluidType(FluidTypes_t(count)));
+		PutByte(Item::items.getClientFluidType(FluidTypes_t(count)));
 	}
 }
 
 void NetworkMessage::AddItem(const Item* item)
 {
+	if(!Reserve(3))
+		return;
+
 	const ItemType &it = Item::items[item->getID()];
 
-	AddU16(it.clientId);
+	PutU16(it.clientId);
 
 	if(it.stackable){
-		AddByte(item->getSubType());
+		PutByte(item->getSubType());
 	}
 	else if(it.isSplash() || it.isFluidContainer()){
-		AddByte(Item::items.getClientFluidType(FluidTypes_t(item->getSubType())));
+		PutByte(Item::items.getClientFluidType(FluidTypes_t(item->getSubType())));
 	}
 }
 
@@ -25,6 +25,7 @@
 #include "otsystem.h"
 #include "const.h"
 #include <string>
+#include <cstring>
 #include <boost/shared_ptr.hpp>
 
 class Item;
@@ -48,13 +49,11 @@ public:
 	virtual ~NetworkMessage(){};
 
 	// resets the internal buffer to an empty message
-protected:
 	void Reset(){
 		m_overrun = false;
 		m_MsgSize = 0;
 		m_ReadPos = 8;
 	}
-public:
 
 	// simply read functions for incoming message
 	uint8_t  GetByte(){
@@ -132,45 +131,70 @@ public:
 	// skips count unknown/unused bytes in an incoming message
 	void SkipBytes(int count){m_ReadPos += count;}
 
-	// simply write functions for outgoing message
-	void AddByte(uint8_t value){
-		if(canAdd(1)){
-			m_MsgBuf[m_ReadPos++] = value;
-			m_MsgSize++;
+	// checks once that size more bytes fit, the Put functions below then
+	// write them unchecked. When they do not fit the message is overrun
+	bool Reserve(uint32_t size){
+		if(!canAdd(size)){
+			m_overrun = true;
+			return false;
 		}
+		return true;
+	}
+
+	void PutByte(uint8_t value){
+		m_MsgBuf[m_ReadPos++] = value;
+		m_MsgSize++;
 	}
 
 #ifndef __SWAP_ENDIAN__
-	void AddU16(uint16_t value){
-		if(canAdd(2)){
-			*(uint16_t*)(m_MsgBuf + m_ReadPos) = value;
-			m_ReadPos += 2; m_MsgSize += 2;
-		}
+	void PutU16(uint16_t value){
+		*(uint16_t*)(m_MsgBuf + m_ReadPos) = value;
+		m_ReadPos += 2; m_MsgSize += 2;
 	}
-	void AddU32(uint32_t value){
-		if(canAdd(4)){
-			*(uint32_t*)(m_MsgBuf + m_ReadPos) = value;
-			m_ReadPos += 4; m_MsgSize += 4;
-		}
+	void PutU32(uint32_t value){
+		*(uint32_t*)(m_MsgBuf + m_ReadPos) = value;
+		m_ReadPos += 4; m_MsgSize += 4;
 	}
 #else
+	void PutU16(uint16_t value){
+		*(uint16_t*)(m_MsgBuf + m_ReadPos) = swap_uint16(value);
+		m_ReadPos += 2; m_MsgSize += 2;
+	}
+	void PutU32(uint32_t value){
+		*(uint32_t*)(m_MsgBuf + m_ReadPos) = swap_uint32(value);
+		m_ReadPos += 4; m_MsgSize += 4;
+	}
+#endif
+
+	void PutString(const std::string& value){
+		PutU16((uint16_t)value.size());
+		memcpy(m_MsgBuf + m_ReadPos, value.data(), value.size());
+		m_ReadPos += value.size(); m_MsgSize += value.size();
+	}
+
+	// simply write functions for outgoing message
+	void AddByte(uint8_t value){
+		if(Reserve(1)){
+			PutByte(value);
+		}
+	}
 	void AddU16(uint16_t value){
-		if(canAdd(2)){
-			*(uint16_t*)(m_MsgBuf + m_ReadPos) = swap_uint16(value);
-			m_ReadPos += 2; m_MsgSize += 2;
+		if(Reserve(2)){
+			PutU16(value);
 		}
 	}
 	void AddU32(uint32_t value){
-		if(canAdd(4)){
-			*(uint32_t*)(m_MsgBuf + m_ReadPos) = swap_uint32(value);
-			m_ReadPos += 4; m_MsgSize += 4;
+		if(Reserve(4)){
+			PutU32(value);
 		}
 	}
-#endif
 
 	void AddBytes(const char* bytes, uint32_t size);
 	void AddPaddingBytes(uint32_t n);
 
+	// appends everything written to msg, or nothing when it does not fit
+	bool AddMessage(const NetworkMessage& msg);
+
 	void AddString(const std::string& value){AddString(value.c_str());}
 	void AddString(const char* value);
 
@@ -0,0 +1,241 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Slab pools for frequently allocated game objects
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "otpch.h"
+
+#include "objectpool.h"
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+	#include <malloc.h>
+#endif
+
+// only modified while constructing pools, they are all created on first use
+ObjectPool* ObjectPool::m_pools = NULL;
+
+static boost::mutex& getPoolListLock()
+{
+	static boost::mutex poolListLock;
+	return poolListLock;
+}
+
+ObjectPool::ObjectPool(const char* name, size_t objectSize) :
+	m_name(name)
+{
+	// keep every object pointer aligned
+	m_objectSize = (objectSize + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	size_t headerSize = (sizeof(Slab) + 15) & ~15;
+	m_slabCapacity = (uint32_t)((OBJECTPOOL_SLAB_SIZE - headerSize) / m_objectSize);
+
+	m_partialSlabs = NULL;
+	m_fullSlabs = NULL;
+	m_slabCount = 0;
+	m_objectCount = 0;
+
+	boost::mutex::scoped_lock lockClass(getPoolListLock());
+	m_nextPool = m_pools;
+	m_pools = this;
+}
+
+void ObjectPool::linkSlab(Slab*& list, Slab* slab)
+{
+	slab->prev = NULL;
+	slab->next = list;
+	if(list){
+		list->prev = slab;
+	}
+	list = slab;
+}
+
+void ObjectPool::unlinkSlab(Slab*& list, Slab* slab)
+{
+	if(slab->prev){
+		slab->prev->next = slab->next;
+	}
+	else{
+		list = slab->next;
+	}
+
+	if(slab->next){
+		slab->next->prev = slab->prev;
+	}
+
+	slab->prev = NULL;
+	slab->next = NULL;
+}
+
+ObjectPool::Slab* ObjectPool::createSlab()
+{
+	void* memory = NULL;
+#ifdef _WIN32
+	memory = _aligned_malloc(OBJECTPOOL_SLAB_SIZE, OBJECTPOOL_SLAB_SIZE);
+#else
+	if(posix_memalign(&memory, OBJECTPOOL_SLAB_SIZE, OBJECTPOOL_SLAB_SIZE) != 0){
+		memory = NULL;
+	}
+#endif
+	if(!memory){
+		return NULL;
+	}
+
+	Slab* slab = static_cast<Slab*>(memory);
+	slab->prev = NULL;
+	slab->next = NULL;
+	slab->freeList = NULL;
+	slab->unused = static_cast<char*>(memory) + ((sizeof(Slab) + 15) & ~15);
+	slab->used = 0;
+	slab->full = false;
+	++m_slabCount;
+	return slab;
+}
+
+void ObjectPool::freeSlab(Slab* slab)
+{
+#ifdef _WIN32
+	_aligned_free(slab);
+#else
+	std::free(slab);
+#endif
+}
+
+void* ObjectPool::allocate(size_t size)
+{
+	if(!isPooledSize(size)){
+		return ::operator new(size);
+	}
+
+	boost::mutex::scoped_lock lockClass(m_lock);
+	Slab* slab = m_partialSlabs;
+	if(!slab){
+		slab = createSlab();
+		if(!slab){
+			throw std::bad_alloc();
+		}
+		linkSlab(m_partialSlabs, slab);
+	}
+
+	void* p;
+	if(slab->freeList){
+		p = slab->freeList;
+		slab->freeList = *static_cast<void**>(p);
+	}
+	else{
+		// objects past the first free are handed out in order
+		p = slab->unused;
+		slab->unused += m_objectSize;
+	}
+
+	++slab->used;
+	++m_objectCount;
+	if(slab->used == m_slabCapacity){
+		unlinkSlab(m_partialSlabs, slab);
+		linkSlab(m_fullSlabs, slab);
+		slab->full = true;
+	}
+
+	return p;
+}
+
+void ObjectPool::deallocate(void* p, size_t size)
+{
+	if(!p){
+		return;
+	}
+
+	if(!isPooledSize(size)){
+		::operator delete(p);
+		return;
+	}
+
+	Slab* slab = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) & ~((uintptr_t)OBJECTPOOL_SLAB_SIZE - 1));
+
+	boost::mutex::scoped_lock lockClass(m_lock);
+	*static_cast<void**>(p) = slab->freeList;
+	slab->freeList = p;
+	--m_objectCount;
+
+	if(slab->full){
+		// allocation prefers this nearly full slab, so mostly empty ones can drain
+		unlinkSlab(m_fullSlabs, slab);
+		linkSlab(m_partialSlabs, slab);
+		slab->full = false;
+	}
+	--slab->used;
+}
+
+uint32_t ObjectPool::releaseEmptySlabs()
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+
+	uint32_t released = 0;
+	Slab* slab = m_partialSlabs;
+	while(slab){
+		Slab* next = slab->next;
+		if(slab->used == 0){
+			unlinkSlab(m_partialSlabs, slab);
+			freeSlab(slab);
+			--m_slabCount;
+			++released;
+		}
+		slab = next;
+	}
+
+	return released;
+}
+
+ObjectPoolStats ObjectPool::getStats()
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+
+	ObjectPoolStats stats;
+	stats.name = m_name;
+	stats.objectSize = (uint32_t)m_objectSize;
+	stats.objects = m_objectCount;
+	stats.slabs = m_slabCount;
+	stats.capacity = m_slabCount * m_slabCapacity;
+	stats.emptySlabs = 0;
+	for(Slab* slab = m_partialSlabs; slab; slab = slab->next){
+		if(slab->used == 0){
+			++stats.emptySlabs;
+		}
+	}
+
+	return stats;
+}
+
+void ObjectPool::getAllStats(std::vector<ObjectPoolStats>& stats)
+{
+	boost::mutex::scoped_lock lockClass(getPoolListLock());
+	for(ObjectPool* pool = m_pools; pool; pool = pool->m_nextPool){
+		stats.push_back(pool->getStats());
+	}
+}
+
+uint32_t ObjectPool::releaseAllEmptySlabs()
+{
+	boost::mutex::scoped_lock lockClass(getPoolListLock());
+
+	uint32_t released = 0;
+	for(ObjectPool* pool = m_pools; pool; pool = pool->m_nextPool){
+		released += pool->releaseEmptySlabs();
+	}
+
+	return released;
+}
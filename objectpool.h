@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Slab pools for frequently allocated game objects
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+
+#ifndef __OTSERV_OBJECTPOOL_H__
+#define __OTSERV_OBJECTPOOL_H__
+
+#include "definitions.h"
+#include <vector>
+#include <string>
+#include <boost/thread.hpp>
+
+// Slabs are aligned to their size, so the slab of an object is found by
+// masking its address
+#define OBJECTPOOL_SLAB_SIZE 65536
+
+struct ObjectPoolStats{
+	std::string name;
+	uint32_t objectSize;
+	uint32_t objects;
+	uint32_t capacity;
+	uint32_t slabs;
+	uint32_t emptySlabs;
+};
+
+/**
+  * Pool of equally sized objects, carved out of 64kb slabs.
+  * Classes route their operator new/delete here, instances of derived
+  * classes of another size fall back to the global allocator.
+  * Pools are never destroyed, objects may be freed during shutdown.
+  */
+class ObjectPool{
+public:
+	ObjectPool(const char* name, size_t objectSize);
+
+	void* allocate(size_t size);
+	void deallocate(void* p, size_t size);
+
+	// Gives slabs without a live object back to the system
+	uint32_t releaseEmptySlabs();
+	ObjectPoolStats getStats();
+
+	static void getAllStats(std::vector<ObjectPoolStats>& stats);
+	static uint32_t releaseAllEmptySlabs();
+
+protected:
+	struct Slab{
+		Slab* prev;
+		Slab* next;
+		void* freeList;
+		char* unused;
+		uint32_t used;
+		bool full;
+	};
+
+	bool isPooledSize(size_t size) const {
+		return ((size + sizeof(void*) - 1) & ~(sizeof(void*) - 1)) == m_objectSize;
+	}
+
+	void linkSlab(Slab*& list, Slab* slab);
+	void unlinkSlab(Slab*& list, Slab* slab);
+	Slab* createSlab();
+	static void freeSlab(Slab* slab);
+
+	std::string m_name;
+	size_t m_objectSize;
+	uint32_t m_slabCapacity;
+
+	boost::mutex m_lock;
+	// slabs with at least one free object, and the full ones
+	Slab* m_partialSlabs;
+	Slab* m_fullSlabs;
+	uint32_t m_slabCount;
+	uint32_t m_objectCount;
+
+	ObjectPool* m_nextPool;
+	static ObjectPool* m_pools;
+};
+
+#endif
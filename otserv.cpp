@@ -58,6 +58,9 @@
 
 #include "exception.h"
 #include "networkmessage.h"
+#include "xtea.h"
+#include "workerpool.h"
+#include "savemanager.h"
 
 #ifdef __OTSERV_ALLOCATOR__
 #include "allocator.h"
@@ -67,6 +70,7 @@
 Game g_game;
 Dispatcher g_dispatcher;
 Scheduler g_scheduler;
+WorkerPool g_loginWorkers("login workers");
 RSA g_RSA;
 ConfigManager g_config;
 Monsters g_monsters;
@@ -101,6 +105,7 @@ struct CommandLineOptions{
 	bool truncate_log;
 	bool start_closed;
 	bool skip_scripts;
+	bool build_snapshot;
 	std::string logfile;
 	std::string errfile;
 #if !defined(__WINDOWS__)
@@ -258,6 +263,7 @@ int main(int argc, char** argv)
 		servicer.run();
 		g_scheduler.join();
 		g_dispatcher.join();
+		g_loginWorkers.join();
 	}
 	else{
 		ErrorMessage("No services running. Server is not online.");
@@ -274,6 +280,7 @@ bool parseCommandLine(CommandLineOptions& opts, std::vector<std::string> args)
 	opts.truncate_log = false;
 	opts.start_closed = false;
 	opts.skip_scripts = false;
+	opts.build_snapshot = false;
 
 	if(argi != args.end()){
 		++argi;
@@ -347,6 +354,9 @@ bool parseCommandLine(CommandLineOptions& opts, std::vector<std::string> args)
 		else if(arg == "--no-scripts"){
 			opts.skip_scripts = true;
 		}
+		else if(arg == "--build-snapshot"){
+			opts.build_snapshot = true;
+		}
 		else if(arg == "--help"){
 			std::cout <<
 			"Usage: otserv {-i|-p|-c|-r|-l}\n"
@@ -365,6 +375,8 @@ bool parseCommandLine(CommandLineOptions& opts, std::vector<std::string> args)
 			"\t--truncate-log\t\tReset log file each time the server is \n"
 			"\t\t\t\tstarted.\n"
 			"\t--closed\t\t\tStarts the server closed.\n"
+			"\t--build-snapshot\t\tWrites the snapshot file set in the config\n"
+			"\t\t\t\tand exits.\n"
 			;
 			return false;
 		}
@@ -488,6 +500,14 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 	std::cout << "Version = " << schema_version << " ";
 	std::cout << "[done]" << std::endl;
 
+	std::cout << ":: Loading bans... ";
+	if(!g_bans.loadBans()){
+		ErrorMessage("Unable to load bans!");
+		exit(-1);
+	}
+	g_bans.scheduleRefresh();
+	std::cout << g_bans.getIndexedBanCount() << " [done]" << std::endl;
+
 
 	//load RSA key
 	std::cout << ":: Loading RSA key..." << std::flush;
@@ -497,6 +517,7 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 	g_RSA.setKey(p, q, d);
 
 	std::cout << "[done]" << std::endl;
+	std::cout << ":: Using " << getXTEAKernelName() << " XTEA kernel" << std::endl;
 
 	std::stringstream filename;
 
@@ -511,27 +532,52 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 	std::cout << "[done]" << std::endl;
 
 	// load item data
-	filename.str("");
-	filename << g_config.getString(ConfigManager::DATA_DIRECTORY) << "items/items.otb";
-	std::cout << ":: Loading " << filename.str() << "... " << std::flush;
-	if(Item::items.loadFromOtb(filename.str())){
-		std::stringstream errormsg;
-		errormsg << "Unable to load " << filename.str() << "!";
-		ErrorMessage(errormsg.str().c_str());
-		exit(-1);
+	std::string snapshotFile = g_config.getString(ConfigManager::SNAPSHOT_FILE);
+	bool itemsLoaded = false;
+	if(!snapshotFile.empty() && !command_opts.build_snapshot){
+		std::cout << ":: Loading " << snapshotFile << "... " << std::flush;
+		if(Item::items.loadFromSnapshot(snapshotFile, g_config.getString(ConfigManager::DATA_DIRECTORY))){
+			itemsLoaded = true;
+			std::cout << "[done]" << std::endl;
+		}
+		else{
+			std::cout << "[outdated]" << std::endl;
+		}
 	}
-	std::cout << "[done]" << std::endl;
 
-	filename.str("");
-	filename << g_config.getString(ConfigManager::DATA_DIRECTORY) << "items/items.xml";
-	std::cout << ":: Loading " << filename.str() << "... " << std::flush;
-	if(!Item::items.loadFromXml(g_config.getString(ConfigManager::DATA_DIRECTORY))){
-		std::stringstream errormsg;
-		errormsg << "Unable to load " << filename.str() << "!";
-		ErrorMessage(errormsg.str().c_str());
-		exit(-1);
+	if(!itemsLoaded){
+		filename.str("");
+		filename << g_config.getString(ConfigManager::DATA_DIRECTORY) << "items/items.otb";
+		std::cout << ":: Loading " << filename.str() << "... " << std::flush;
+		if(Item::items.loadFromOtb(filename.str())){
+			std::stringstream errormsg;
+			errormsg << "Unable to load " << filename.str() << "!";
+			ErrorMessage(errormsg.str().c_str());
+			exit(-1);
+		}
+		std::cout << "[done]" << std::endl;
+
+		filename.str("");
+		filename << g_config.getString(ConfigManager::DATA_DIRECTORY) << "items/items.xml";
+		std::cout << ":: Loading " << filename.str() << "... " << std::flush;
+		if(!Item::items.loadFromXml(g_config.getString(ConfigManager::DATA_DIRECTORY))){
+			std::stringstream errormsg;
+			errormsg << "Unable to load " << filename.str() << "!";
+			ErrorMessage(errormsg.str().c_str());
+			exit(-1);
+		}
+		std::cout << "[done]" << std::endl;
+	}
+
+	if(command_opts.build_snapshot){
+		std::cout << ":: Building snapshot " << snapshotFile << "... " << std::flush;
+		if(snapshotFile.empty() || !Item::items.saveSnapshot(snapshotFile, g_config.getString(ConfigManager::DATA_DIRECTORY))){
+			ErrorMessage("Unable to build the snapshot! Is snapshot set in the config?");
+			exit(-1);
+		}
+		std::cout << "[done]" << std::endl;
+		exit(0);
 	}
-	std::cout << "[done]" << std::endl;
 
 	//load scripts
 	if (!command_opts.skip_scripts){
@@ -656,6 +702,19 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 
 	g_game.setGameState(GAME_STATE_INIT);
 
+	Status::instance()->startRefresh();
+
+	// Logins wait on RSA and the database on their own threads
+	int64_t loginThreads = g_config.getNumber(ConfigManager::LOGIN_THREADS);
+	if(loginThreads <= 0){
+		loginThreads = boost::thread::hardware_concurrency();
+	}
+	g_loginWorkers.start((uint32_t)std::min((int64_t)64, loginThreads),
+		g_config.getNumber(ConfigManager::LOGIN_QUEUE_SIZE));
+
+	// Global saves are written on their own thread
+	SaveManager::getInstance()->start();
+
 	// Tie ports and register services
 
 	// Tibia protocols
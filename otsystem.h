@@ -26,6 +26,9 @@
 
 #include <sys/types.h>
 #include <sys/timeb.h>
+#ifndef _WIN32
+	#include <time.h>
+#endif
 
 inline int64_t OTSYS_TIME()
 {
@@ -34,4 +37,16 @@ inline int64_t OTSYS_TIME()
 	return int64_t(t.millitm) + int64_t(t.time) * 1000;
 }
 
+// Milliseconds that never jump with the wall clock, only usable for intervals
+inline int64_t OTSYS_MONOTONIC_TIME()
+{
+#ifdef _WIN32
+	return OTSYS_TIME();
+#else
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return int64_t(t.tv_nsec) / 1000000 + int64_t(t.tv_sec) * 1000;
+#endif
+}
+
 #endif
@@ -25,6 +25,9 @@
 
 extern Dispatcher g_dispatcher;
 
+//set while the current thread is running an execution frame
+static OTSERV_THREAD_LOCAL bool inExecutionFrame = false;
+
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 uint32_t OutputMessagePool::OutputMessagePoolCount = OUTPUT_POOL_SIZE;
 #endif
@@ -36,11 +39,14 @@ OutputMessage::OutputMessage()
 
 //*********** OutputMessagePool ****************
 
-OutputMessagePool::OutputMessagePool()
+OutputMessagePool::OutputMessagePool() :
+	m_outputMessages(OUTPUT_POOL_SIZE),
+	m_availableMessages(0)
 {
 	for(uint32_t i = 0; i < OUTPUT_POOL_SIZE; ++i){
 		OutputMessage* msg = new OutputMessage();
-		m_outputMessages.push_back(msg);
+		m_outputMessages.push(msg);
+		++m_availableMessages;
 #ifdef __TRACK_NETWORK__
 		m_allOutputMessages.push_back(msg);
 #endif
@@ -53,15 +59,36 @@ void OutputMessagePool::startExecutionFrame()
 	//boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 	m_frameTime = OTSYS_TIME();
 	m_isOpen = true;
+	inExecutionFrame = true;
+}
+
+bool OutputMessagePool::isInExecutionFrame() const
+{
+	return inExecutionFrame;
+}
+
+void OutputMessagePool::addToFlush(Connection_ptr connection)
+{
+	m_flushConnections.push_back(connection);
+}
+
+void OutputMessagePool::flushConnections()
+{
+	inExecutionFrame = false;
+
+	std::vector<Connection_ptr>::iterator it;
+	for(it = m_flushConnections.begin(); it != m_flushConnections.end(); ++it){
+		(*it)->flushWriteQueue();
+	}
+	m_flushConnections.clear();
 }
 
 OutputMessagePool::~OutputMessagePool()
 {
-	InternalOutputMessageList::iterator it;
-	for(it = m_outputMessages.begin(); it != m_outputMessages.end(); ++it){
-		delete *it;
+	OutputMessage* msg;
+	while(m_outputMessages.pop(msg)){
+		delete msg;
 	}
-	m_outputMessages.clear();
 }
 
 void OutputMessagePool::send(OutputMessage_ptr msg)
@@ -97,26 +124,11 @@ void OutputMessagePool::send(OutputMessage_ptr msg)
 
 void OutputMessagePool::sendAll()
 {
-	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
-	OutputMessageMessageList::iterator it;
-
-	for(it = m_toAddQueue.begin(); it != m_toAddQueue.end();){
-		//drop messages that are older than 10 seconds
-		if(OTSYS_TIME() - (*it)->getFrame() > 10 * 1000){
-			(*it)->getProtocol()->onSendMessage(*it);
-			it = m_toAddQueue.erase(it);
-			continue;
-		}
-
-		(*it)->setState(OutputMessage::STATE_ALLOCATED);
-		m_autoSendOutputMessages.push_back(*it);
-		++it;
-	}
-
-	m_toAddQueue.clear();
+	m_outputPoolLock.lock();
 
-	for(it = m_autoSendOutputMessages.begin(); it != m_autoSendOutputMessages.end();){
-		OutputMessage_ptr omsg = *it;
+	size_t kept = 0;
+	for(size_t i = 0; i < m_autoSendOutputMessages.size(); ++i){
+		OutputMessage_ptr omsg = m_autoSendOutputMessages[i];
 		#ifdef __NO_PLAYER_SENDBUFFER__
 		//use this define only for debugging
 		bool v = 1;
@@ -141,13 +153,16 @@ void OutputMessagePool::sendAll()
 				std::cout << "Error: [OutputMessagePool::send] NULL connection." << std::endl;
 				#endif
 			}
-
-			it = m_autoSendOutputMessages.erase(it);
 		}
 		else{
-			++it;
+			m_autoSendOutputMessages[kept++] = omsg;
 		}
 	}
+	m_autoSendOutputMessages.resize(kept);
+
+	m_outputPoolLock.unlock();
+
+	flushConnections();
 }
 
 void OutputMessagePool::releaseMessage(OutputMessage* msg)
@@ -184,9 +199,8 @@ void OutputMessagePool::internalReleaseMessage(OutputMessage* msg)
 	msg->clearTrack();
 #endif
 	
-	m_outputPoolLock.lock();
-	m_outputMessages.push_back(msg);
-	m_outputPoolLock.unlock();
+	m_outputMessages.push(msg);
+	++m_availableMessages;
 }
 
 OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool autosend /*= true*/)
@@ -199,18 +213,20 @@ OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool a
 		return OutputMessage_ptr();
 	}
 
-	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
-
 	if(protocol->getConnection() == NULL){
 		return OutputMessage_ptr();
 	}
 
-	if(m_outputMessages.empty()){
-		OutputMessage* msg = new OutputMessage();
-		m_outputMessages.push_back(msg);
+	OutputMessage* msg;
+	if(m_outputMessages.pop(msg)){
+		--m_availableMessages;
+	}
+	else{
+		msg = new OutputMessage();
 
+		boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
-	OutputMessagePoolCount++;
+		OutputMessagePoolCount++;
 #endif
 
 #ifdef __TRACK_NETWORK__
@@ -219,11 +235,10 @@ OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool a
 	}
 
 	OutputMessage_ptr outputmessage;
-	outputmessage.reset(m_outputMessages.back(),
+	outputmessage.reset(msg,
 		boost::bind(&OutputMessagePool::releaseMessage, this, _1));
 
-	m_outputMessages.pop_back();
-
+	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 	configureOutputMessage(outputmessage, protocol, autosend);
 	return outputmessage;
 }
@@ -255,10 +270,3 @@ void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol*
 #endif
 	msg->setFrame(m_frameTime);
 }
-
-void OutputMessagePool::addToAutoSend(OutputMessage_ptr msg)
-{
-	m_outputPoolLock.lock();
-	m_toAddQueue.push_back(msg);
-	m_outputPoolLock.unlock();
-}
@@ -28,8 +28,11 @@
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/stack.hpp>
 #include <iostream>
 #include <list>
+#include <vector>
 
 #include <boost/utility.hpp>
 
@@ -60,6 +63,13 @@ public:
 		add_header((uint16_t)(m_MsgSize));
 	}
 
+	// Same as addCryptoHeader(true), for a checksum the caller already has
+	void addCryptoHeaderChecksum(uint32_t checksum)
+	{
+		add_header(checksum);
+		add_header((uint16_t)(m_MsgSize));
+	}
+
 	enum OutputMessageState{
 		STATE_FREE,
 		STATE_ALLOCATED,
@@ -184,9 +194,13 @@ public:
 #else
 	size_t getTotalMessageCount() const {return m_allOutputMessages.size();}
 #endif
-	size_t getAvailableMessageCount() const {return m_outputMessages.size();}
+	size_t getAvailableMessageCount() const {return m_availableMessages;}
 	size_t getAutoMessageCount() const {return m_autoSendOutputMessages.size();}
-	void addToAutoSend(OutputMessage_ptr msg);
+
+	// Connections that queue messages inside an execution frame are
+	// flushed together once the frame is over, see Connection::send
+	bool isInExecutionFrame() const;
+	void addToFlush(Connection_ptr connection);
 
 protected:
 
@@ -194,13 +208,18 @@ protected:
 	void releaseMessage(OutputMessage* msg);
 	void internalReleaseMessage(OutputMessage* msg);
 
+	void flushConnections();
+
 	typedef std::list<OutputMessage*> InternalOutputMessageList;
-	typedef std::list<OutputMessage_ptr> OutputMessageMessageList;
+	typedef std::vector<OutputMessage_ptr> OutputMessageMessageList;
+	typedef boost::lockfree::stack<OutputMessage*> FreeOutputMessageStack;
 
-	InternalOutputMessageList m_outputMessages;
+	FreeOutputMessageStack m_outputMessages;
+	boost::atomic<uint32_t> m_availableMessages;
 	InternalOutputMessageList m_allOutputMessages;
 	OutputMessageMessageList m_autoSendOutputMessages;
-	OutputMessageMessageList m_toAddQueue;
+	//only touched by the thread running the execution frame
+	std::vector<Connection_ptr> m_flushConnections;
 	boost::recursive_mutex m_outputPoolLock;
 	uint64_t m_frameTime;
 	bool m_isOpen;
@@ -152,6 +152,12 @@ Creature()
 		rateValue[i] = 1.0f;
 	}
 
+	for(int32_t i = 0; i < PLAYERSAVE_LAST; ++i){
+		savedSectionHash[i] = 0;
+		capturedSectionHash[i] = 0;
+	}
+	saveCounter = 0;
+
 	maxDepotLimit = 1000;
 	maxVipLimit = 50;
 	groupFlags = 0;
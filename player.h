@@ -86,6 +86,16 @@ enum tradestate_t {
 	TRADE_TRANSFER
 };
 
+enum PlayerSaveSection_t {
+	PLAYERSAVE_SKILLS,
+	PLAYERSAVE_SPELLS,
+	PLAYERSAVE_ITEMS,
+	PLAYERSAVE_DEPOTITEMS,
+	PLAYERSAVE_STORAGE,
+	PLAYERSAVE_VIPLIST,
+	PLAYERSAVE_LAST
+};
+
 typedef std::pair<uint32_t, Container*> containervector_pair;
 typedef std::vector<containervector_pair> ContainerVector;
 typedef std::map<uint32_t, Depot*> DepotMap;
@@ -901,6 +911,13 @@ protected:
 	AttackedSet attackedSet;
 #endif
 
+	//hash of the rows last written for each save section, 0 if unknown
+	uint64_t savedSectionHash[PLAYERSAVE_LAST];
+	//hash of the rows in the last captured save, written or not
+	uint64_t capturedSectionHash[PLAYERSAVE_LAST];
+	//counts the direct saves, a global save captured before one of them is stale
+	uint32_t saveCounter;
+
 	void updateItemsLight(bool internal = false);
 	virtual int32_t getStepSpeed() const;
 	void updateBaseSpeed();
@@ -28,8 +28,11 @@
 #include "connection.h"
 #include "outputmessage.h"
 #include "rsa.h"
+#include "xtea.h"
+#include "workerpool.h"
 
 extern RSA g_RSA;
+extern WorkerPool g_loginWorkers;
 
 void Protocol::onSendMessage(OutputMessage_ptr msg)
 {
@@ -45,8 +48,15 @@ void Protocol::onSendMessage(OutputMessage_ptr msg)
 			std::cout << "Protocol::onSendMessage - encrypt" << std::endl;
 			#endif
 
-			XTEA_encrypt(*msg);
-			msg->addCryptoHeader(m_checksumEnabled);
+			if(m_checksumEnabled){
+				uint32_t checksum;
+				XTEA_encrypt(*msg, &checksum);
+				msg->addCryptoHeaderChecksum(checksum);
+			}
+			else{
+				XTEA_encrypt(*msg);
+				msg->addCryptoHeader(false);
+			}
 		}
 		else if(m_checksumEnabled){
 			msg->addCryptoHeader(true);
@@ -74,9 +84,9 @@ void Protocol::onRecvMessage(NetworkMessage& msg)
 	parsePacket(msg);
 }
 
-OutputMessage_ptr Protocol::getOutputBuffer()
+OutputMessage_ptr Protocol::getOutputBuffer(int32_t size /*= 4096*/)
 {
-	if(m_outputBuffer && m_outputBuffer->getMessageLength() < NETWORKMESSAGE_MAXSIZE - 4096){
+	if(m_outputBuffer && m_outputBuffer->getMessageLength() < NETWORKMESSAGE_MAXSIZE - size){
 		return m_outputBuffer;
 	}
 	else if(m_connection){
@@ -109,11 +119,66 @@ void Protocol::deleteProtocolTask()
 	delete this;
 }
 
-void Protocol::XTEA_encrypt(OutputMessage& msg)
+bool Protocol::addLoginTask(Task* task)
 {
-	uint32_t k[4];
-	k[0] = m_key[0]; k[1] = m_key[1]; k[2] = m_key[2]; k[3] = m_key[3];
+	//network thread
+	m_loginConnection = getConnection();
+	if(!m_loginConnection){
+		delete task;
+		return false;
+	}
+
+	addRef();
+	if(!g_loginWorkers.addTask(task, boost::bind(&Protocol::dropLoginTask, this))){
+		unRef();
+		m_loginConnection.reset();
+		return false;
+	}
+	return true;
+}
+
+void Protocol::finishLoginTask(const boost::function<void ()>& result)
+{
+	//login worker
+	if(!m_loginConnection->post(boost::bind(&Protocol::runLoginResult, this, result))){
+		releaseLoginTask();
+	}
+}
+
+void Protocol::abortLoginTask()
+{
+	//login worker, closeConnection can be called from any thread
+	m_loginConnection->closeConnection();
+	releaseLoginTask();
+}
+
+void Protocol::runLoginResult(boost::function<void ()> result)
+{
+	//network thread
+	if(getConnection()){
+		result();
+	}
+	releaseLoginTask();
+}
+
+void Protocol::dropLoginTask()
+{
+	//game thread, the login workers were shut down before the task ran
+	m_loginConnection->closeConnection();
+	m_loginConnection.reset();
+	unRef();
+}
+
+void Protocol::releaseLoginTask()
+{
+	m_loginConnection.reset();
+	//dropped on the dispatcher, like the references output messages hold
+	g_dispatcher.addTask(
+		createTask(boost::bind(&Protocol::unRef, this)), true);
+}
 
+void Protocol::XTEA_encrypt(OutputMessage& msg, uint32_t* checksum /*= NULL*/)
+{
 	int32_t messageLength = msg.getMessageLength();
 
 	//add bytes until reach 8 multiple
@@ -124,21 +189,16 @@ void Protocol::XTEA_encrypt(OutputMessage& msg)
 		messageLength = messageLength + n;
 	}
 
-	int read_pos = 0;
 	uint32_t* buffer = (uint32_t*)msg.getOutputBuffer();
-	while(read_pos < messageLength/4){
-		uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-		uint32_t delta = 0x61C88647;
-		uint32_t sum = 0;
-
-		for(int32_t i = 0; i < 32; ++i) {
-			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-			sum -= delta;
-			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum>>11 & 3]);
-		}
-		buffer[read_pos] = v0; buffer[read_pos + 1] = v1;
-		read_pos = read_pos + 2;
+	if(!checksum){
+		xteaEncrypt(buffer, messageLength / 8, m_key);
+		return;
 	}
+
+	uint32_t adler = xteaEncryptChecksum(buffer, messageLength / 8, m_key);
+
+	//adlerChecksum gives 0 for oversized buffers
+	*checksum = (messageLength > NETWORKMESSAGE_MAXSIZE ? 0 : adler);
 }
 
 bool Protocol::XTEA_decrypt(NetworkMessage& msg)
@@ -150,27 +210,8 @@ bool Protocol::XTEA_decrypt(NetworkMessage& msg)
 		return false;
 	}
 
-	//
-	uint32_t k[4];
-	k[0] = m_key[0]; k[1] = m_key[1]; k[2] = m_key[2]; k[3] = m_key[3];
-
-	uint32_t* buffer = (uint32_t*)(msg.getBuffer() + msg.getReadPos());
-	int read_pos = 0;
 	int32_t messageLength = msg.getMessageLength() - 6;
-	while(read_pos < messageLength/4){
-		uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-		uint32_t delta = 0x61C88647;
-		uint32_t sum = 0xC6EF3720;
-
-		for(int32_t i = 0; i < 32; ++i) {
-			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum>>11 & 3]);
-			sum += delta;
-			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-		}
-		buffer[read_pos] = v0; buffer[read_pos + 1] = v1;
-		read_pos = read_pos + 2;
-	}
-	//
+	xteaDecrypt((uint32_t*)(msg.getBuffer() + msg.getReadPos()), messageLength / 8, m_key);
 
 	int tmp = msg.GetU16();
 	if(tmp > msg.getMessageLength() - 8){
@@ -26,6 +26,7 @@
 #include <cstring>
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 
 class NetworkMessage;
 class OutputMessage;
@@ -33,6 +34,7 @@ class Connection;
 typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
 typedef boost::shared_ptr<Connection> Connection_ptr;
 class RSA;
+class Task;
 
 #define CLIENT_VERSION_MIN 861
 #define CLIENT_VERSION_MAX 861
@@ -70,8 +72,9 @@ public:
 	int32_t unRef() {return --m_refCount;}
 
 protected:
-	//Use this function for autosend messages only
-	OutputMessage_ptr getOutputBuffer();
+	//Use this function for autosend messages only. When the current
+	//message has no room for size more bytes a new one is started
+	OutputMessage_ptr getOutputBuffer(int32_t size = 4096);
 
 	void enableXTEAEncryption() { m_encryptionEnabled = true; }
 	void disableXTEAEncryption() { m_encryptionEnabled = false; }
@@ -81,20 +84,34 @@ protected:
 	void enableChecksum() { m_checksumEnabled = true; }
 	void disableChecksum() { m_checksumEnabled = false; }
 
-	void XTEA_encrypt(OutputMessage& msg);
+	void XTEA_encrypt(OutputMessage& msg, uint32_t* checksum = NULL);
 	bool XTEA_decrypt(NetworkMessage& msg);
 	bool RSA_decrypt(NetworkMessage& msg);
 	bool RSA_decrypt(RSA* rsa, NetworkMessage& msg);
 
 	void setRawMessages(bool value) { m_rawMessages = value; }
 
+	// The part of a login that may block (RSA, ban and account lookups)
+	// runs as a task on the login workers. The task ends with either
+	// finishLoginTask, which runs result on the connection's network
+	// thread, or abortLoginTask, which closes the connection. The
+	// protocol is kept alive until then, or until the login workers
+	// shut down with the task still queued, see dropLoginTask.
+	bool addLoginTask(Task* task);
+	void finishLoginTask(const boost::function<void ()>& result);
+	void abortLoginTask();
+
 	virtual void releaseProtocol();
 	virtual void deleteProtocolTask();
 	friend class Connection;
 private:
+	void runLoginResult(boost::function<void ()> result);
+	void dropLoginTask();
+	void releaseLoginTask();
 
 	OutputMessage_ptr m_outputBuffer;
 	Connection_ptr m_connection;
+	Connection_ptr m_loginConnection;
 	bool m_encryptionEnabled;
 	bool m_checksumEnabled;
 	bool m_rawMessages;
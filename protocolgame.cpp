@@ -56,6 +56,15 @@ Chat g_chat;
 uint32_t ProtocolGame::protocolGameCount = 0;
 #endif
 
+TileDescriptionCache ProtocolGame::tileDescriptionCache;
+
+// Dropped as a whole when it grows past this, about 5MB
+#define TILE_DESCRIPTION_CACHE_SIZE 65536
+
+// Map descriptions are written here before they are copied to the output.
+// Only used from the dispatcher thread
+static NetworkMessage_ptr descriptionBuffer(new NetworkMessage());
+
 // Helping templates to add dispatcher tasks
 
 template<class FunctionType>
@@ -295,20 +304,14 @@ bool ProtocolGame::logout(bool forced)
 	return g_game.removeCreature(player);
 }
 
-bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
+void ProtocolGame::parseFirstPacket(NetworkMessage_ptr msgPtr, uint32_t clientip, uint16_t version)
 {
-	if(g_game.getGameState() == GAME_STATE_SHUTDOWN){
-		getConnection()->closeConnection();
-		return false;
-	}
-
-
-	/*uint16_t clientos =*/ msg.GetU16();
-	uint16_t version  = msg.GetU16();
+	//login worker
+	NetworkMessage& msg = *msgPtr;
 
 	if(!RSA_decrypt(msg)){
-		getConnection()->closeConnection();
-		return false;
+		abortLoginTask();
+		return;
 	}
 
 	uint32_t key[4];
@@ -316,7 +319,7 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 	key[1] = msg.GetU32();
 	key[2] = msg.GetU32();
 	key[3] = msg.GetU32();
-	enableXTEAEncryption();
+	//only used once loginFailed/loginAccepted enable encryption
 	setXTEAKey(key);
 
 	bool isSetGM = (msg.GetByte() == 1);
@@ -327,44 +330,66 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 	msg.SkipBytes(6); //841 specific
 
 	if(version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX){
-		disconnectClient(0x0A, STRING_CLIENT_VERSION);
-		return false;
+		finishLoginTask(boost::bind(&ProtocolGame::loginFailed, this, 0x0A, std::string(STRING_CLIENT_VERSION)));
+		return;
 	}
 
 	if(g_game.getGameState() == GAME_STATE_STARTUP){
 		std::string clientMessage = g_config.getString(ConfigManager::WORLD_NAME) + " is starting up. Please wait.";
-		disconnectClient(0x14, clientMessage.c_str());
-		return false;
+		finishLoginTask(boost::bind(&ProtocolGame::loginFailed, this, 0x14, clientMessage));
+		return;
 	}
 
-	if(g_bans.isIpDisabled(getIP())){
-		disconnectClient(0x14, "Too many connections attempts from this IP. Try again later.");
-		return false;
+	if(g_bans.isIpDisabled(clientip)){
+		finishLoginTask(boost::bind(&ProtocolGame::loginFailed, this, 0x14, std::string("Too many connections attempts from this IP. Try again later.")));
+		return;
 	}
 
-	if(g_bans.isIpBanished(getIP())){
-		disconnectClient(0x14, "Your IP is banished!");
-		return false;
+	if(g_bans.isIpBanished(clientip)){
+		finishLoginTask(boost::bind(&ProtocolGame::loginFailed, this, 0x14, std::string("Your IP is banished!")));
+		return;
 	}
 
 	std::string acc_pass;
 	if(!(IOAccount::instance()->getPassword(accname, name, acc_pass) && passwordTest(password, acc_pass))){
-		g_bans.addLoginAttempt(getIP(), false);
-		getConnection()->closeConnection();
-		return false;
+		g_bans.addLoginAttempt(clientip, false);
+		abortLoginTask();
+		return;
 	}
 
-	g_bans.addLoginAttempt(getIP(), true);
+	g_bans.addLoginAttempt(clientip, true);
+
+	finishLoginTask(boost::bind(&ProtocolGame::loginAccepted, this, name, isSetGM));
+}
 
+void ProtocolGame::loginFailed(uint8_t error, const std::string& message)
+{
+	enableXTEAEncryption();
+	disconnectClient(error, message.c_str());
+}
+
+void ProtocolGame::loginAccepted(const std::string& name, bool isSetGM)
+{
+	enableXTEAEncryption();
 	g_dispatcher.addTask(
 		createTask(boost::bind(&ProtocolGame::login, this, name, isSetGM)));
-
-	return true;
 }
 
 void ProtocolGame::onRecvFirstMessage(NetworkMessage& msg)
 {
-	parseFirstPacket(msg);
+	if(g_game.getGameState() == GAME_STATE_SHUTDOWN){
+		getConnection()->closeConnection();
+		return;
+	}
+
+	/*uint16_t clientos =*/ msg.GetU16();
+	uint16_t version  = msg.GetU16();
+
+	//the rest waits on RSA and the database, it runs on the login workers
+	if(!addLoginTask(createTask(boost::bind(&ProtocolGame::parseFirstPacket, this,
+		NetworkMessage_ptr(new NetworkMessage(msg)), getIP(), version)))){
+		getConnection()->closeConnection();
+	}
 }
 
 void ProtocolGame::onConnect()
@@ -709,26 +734,88 @@ void ProtocolGame::parsePacket(NetworkMessage &msg)
 	}
 }
 
-void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
+// Same bytes as NetworkMessage::AddItem
+static uint8_t encodeTileItem(uint8_t* p, const Item* item)
 {
-	if(tile){
-		int count = 0;
-		if(tile->ground){
-			msg->AddItem(tile->ground);
-			count++;
+	const ItemType& it = Item::items[item->getID()];
+
+	p[0] = (uint8_t)(it.clientId & 0xFF);
+	p[1] = (uint8_t)(it.clientId >> 8);
+
+	if(it.stackable){
+		p[2] = (uint8_t)item->getSubType();
+		return 3;
+	}
+	else if(it.isSplash() || it.isFluidContainer()){
+		p[2] = (uint8_t)Item::items.getClientFluidType(FluidTypes_t(item->getSubType()));
+		return 3;
+	}
+
+	return 2;
+}
+
+void ProtocolGame::clearTileDescriptionCache()
+{
+	tileDescriptionCache.clear();
+}
+
+const TileDescription& ProtocolGame::getCachedTileDescription(const Tile* tile)
+{
+	TileDescriptionCache::iterator cit = tileDescriptionCache.find(tile);
+	if(cit != tileDescriptionCache.end() && cit->second.revision == tile->getRevision()){
+		return cit->second;
+	}
+
+	if(cit == tileDescriptionCache.end()){
+		if(tileDescriptionCache.size() >= TILE_DESCRIPTION_CACHE_SIZE){
+			tileDescriptionCache.clear();
 		}
 
-		const TileItemVector* items = tile->getItemList();
-		const CreatureVector* creatures = tile->getCreatures();
+		cit = tileDescriptionCache.insert(std::make_pair(tile, TileDescription())).first;
+	}
 
-		ItemVector::const_iterator it;
-		if(items){
-			for(it = items->getBeginTopItem(); ((it != items->getEndTopItem()) && (count < 10)); ++it){
-				msg->AddItem(*it);
-				count++;
-			}
+	TileDescription& desc = cit->second;
+	desc.revision = tile->getRevision();
+	desc.topCount = 0;
+	desc.downCount = 0;
+
+	uint8_t length = 0;
+	if(tile->ground){
+		length += encodeTileItem(desc.bytes + length, tile->ground);
+		desc.topCount++;
+	}
+
+	const TileItemVector* items = tile->getItemList();
+	if(items){
+		for(ItemVector::const_iterator it = items->getBeginTopItem(); ((it != items->getEndTopItem()) && (desc.topCount < 10)); ++it){
+			length += encodeTileItem(desc.bytes + length, *it);
+			desc.topCount++;
+		}
+	}
+
+	desc.topLength = length;
+
+	// Creatures come in between, how many of these fit depends on them
+	if(items){
+		for(ItemVector::const_iterator it = items->getBeginDownItem(); ((it != items->getEndDownItem()) && (desc.topCount + desc.downCount < 10)); ++it){
+			length += encodeTileItem(desc.bytes + length, *it);
+			desc.downEnd[desc.downCount++] = length;
+		}
+	}
+
+	return desc;
+}
+
+void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
+{
+	if(tile){
+		const TileDescription& desc = getCachedTileDescription(tile);
+		int count = desc.topCount;
+		if(desc.topLength > 0){
+			msg->AddBytes((const char*)desc.bytes, desc.topLength);
 		}
 
+		const CreatureVector* creatures = tile->getCreatures();
 		if(creatures){
 			CreatureVector::const_reverse_iterator cit;
 			for(cit = creatures->rbegin(); ((cit != creatures->rend()) && (count < 10)); ++cit){
@@ -742,11 +829,9 @@ void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
 			}
 		}
 
-		if(items){
-			for(it = items->getBeginDownItem(); ((it != items->getEndDownItem()) && (count < 10)); ++it){
-				msg->AddItem(*it);
-				count++;
-			}
+		int32_t downCount = std::min<int32_t>(desc.downCount, 10 - count);
+		if(downCount > 0){
+			msg->AddBytes((const char*)desc.bytes + desc.topLength, desc.downEnd[downCount - 1] - desc.topLength);
 		}
 	}
 }
@@ -816,43 +901,35 @@ void ProtocolGame::GetFloorDescription(NetworkMessage_ptr msg, int32_t x, int32_
 
 void ProtocolGame::checkCreatureAsKnown(uint32_t id, bool &known, uint32_t &removedKnown)
 {
-	// loop through the known player and check if the given player is in
-	std::list<uint32_t>::iterator i;
-	for(i = knownCreatureList.begin(); i != knownCreatureList.end(); ++i){
-		if((*i) == id){
-			// know... make the creature even more known...
-			knownCreatureList.erase(i);
-			knownCreatureList.push_back(id);
-
-			known = true;
-			return;
-		}
+	// is the creature known? make it even more known...
+	if(knownCreatures.touch(id)){
+		known = true;
+		return;
 	}
 
 	// ok, he is unknown...
 	known = false;
 
 	// ... but not in future
-	knownCreatureList.push_back(id);
+	knownCreatures.push_back(id);
 
 	// to many known creatures?
-	if(knownCreatureList.size() > 250){
+	if(knownCreatures.size() > KNOWNCREATURES_MAX){
 		// lets try to remove one from the end of the list
-		for (int n = 0; n < 250; ++n){
-			removedKnown = knownCreatureList.front();
+		for (int n = 0; n < KNOWNCREATURES_MAX; ++n){
+			removedKnown = knownCreatures.front();
 
 			Creature* c = g_game.getCreatureByID(removedKnown);
 			if ((!c) || (!canSee(c)))
 				break;
 
 			// this creature we can't remove, still in sight, so back to the end
-			knownCreatureList.pop_front();
-			knownCreatureList.push_back(removedKnown);
+			knownCreatures.rotate();
 		}
 
 		// hopefully we found someone to remove :S, we got only 150 tries
 		// if not... lets kick some players with debug errors :)
-		knownCreatureList.pop_front();
+		knownCreatures.pop_front();
 	}
 	else{
 		// we can cache without problems :)
@@ -1541,8 +1618,7 @@ void ProtocolGame::sendCreatureEmblem(const Creature* creature)
 	if(msg)
 	{
 		TRACK_MESSAGE(msg);
-		std::list<uint32_t>::iterator it = std::find(knownCreatureList.begin(), knownCreatureList.end(), creature->getID());
-		if(it != knownCreatureList.end())
+		if(knownCreatures.contains(creature->getID()))
 		{
 			RemoveTileItem(msg, creature->getPosition(), stackpos);
 			msg->AddByte(0x6A);
@@ -2159,7 +2235,11 @@ void ProtocolGame::sendAddCreature(const Creature* creature, const Position& pos
 					}
 				}*/
 
-				AddMapDescription(msg, pos);
+				AddMapDescription(getDescriptionBuffer(), pos);
+				msg = flushDescriptionBuffer();
+				if(!msg){
+					return;
+				}
 
 				AddInventoryItem(msg, SLOT_HEAD, player->getInventoryItem(SLOT_HEAD));
 				AddInventoryItem(msg, SLOT_NECKLACE, player->getInventoryItem(SLOT_NECKLACE));
@@ -2224,7 +2304,8 @@ void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTil
 			TRACK_MESSAGE(msg);
 			if(teleport || oldStackPos >= 10){
 				RemoveTileItem(msg, oldPos, oldStackPos);
-				AddMapDescription(msg, newPos);
+				AddMapDescription(getDescriptionBuffer(), newPos);
+				flushDescriptionBuffer();
 			}
 			else{
 				if(oldPos.z == 7 && newPos.z >= 8){
@@ -2239,29 +2320,37 @@ void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTil
 
 				//floor change down
 				if(newPos.z > oldPos.z){
-					MoveDownCreature(msg, creature, newPos, oldPos, oldStackPos);
+					MoveDownCreature(creature, newPos, oldPos, oldStackPos);
 				}
 				//floor change up
 				else if(newPos.z < oldPos.z){
-					MoveUpCreature(msg, creature, newPos, oldPos, oldStackPos);
+					MoveUpCreature(creature, newPos, oldPos, oldStackPos);
 				}
 
 				if(oldPos.y > newPos.y){ // north, for old x
+					msg = getDescriptionBuffer();
 					msg->AddByte(0x65);
 					GetMapDescription(oldPos.x - 8, newPos.y - 6, newPos.z, 18, 1, msg);
+					flushDescriptionBuffer();
 				}
 				else if(oldPos.y < newPos.y){ // south, for old x
+					msg = getDescriptionBuffer();
 					msg->AddByte(0x67);
 					GetMapDescription(oldPos.x - 8, newPos.y + 7, newPos.z, 18, 1, msg);
+					flushDescriptionBuffer();
 				}
 
 				if(oldPos.x < newPos.x){ // east, [with new y]
+					msg = getDescriptionBuffer();
 					msg->AddByte(0x66);
 					GetMapDescription(newPos.x + 9, newPos.y - 6, newPos.z, 1, 14, msg);
+					flushDescriptionBuffer();
 				}
 				else if(oldPos.x > newPos.x){ // west, [with new y]
+					msg = getDescriptionBuffer();
 					msg->AddByte(0x68);
 					GetMapDescription(newPos.x - 8, newPos.y - 6, newPos.z, 1, 14, msg);
+					flushDescriptionBuffer();
 				}
 			}
 		}
@@ -2539,6 +2628,36 @@ void ProtocolGame::sendReLoginWindow()
 }
 
 ////////////// Add common messages
+NetworkMessage_ptr ProtocolGame::getDescriptionBuffer()
+{
+	descriptionBuffer->Reset();
+	return descriptionBuffer;
+}
+
+NetworkMessage_ptr ProtocolGame::flushDescriptionBuffer()
+{
+	//it did not fit even an empty message, and the client
+	//can not go on with a description that is cut short
+	if(descriptionBuffer->isOverrun()){
+		std::cout << "Error: [ProtocolGame::flushDescriptionBuffer] Description for " <<
+			player->getName() << " does not fit a message, closing connection." << std::endl;
+		if(getConnection()){
+			getConnection()->closeConnection();
+		}
+		return NetworkMessage_ptr();
+	}
+
+	NetworkMessage_ptr msg = getOutputBuffer(descriptionBuffer->getMessageLength());
+	if(msg && !msg->AddMessage(*descriptionBuffer)){
+		//no room left, continue in a new message
+		msg = getOutputBuffer(NETWORKMESSAGE_MAXSIZE);
+		if(msg){
+			msg->AddMessage(*descriptionBuffer);
+		}
+	}
+	return msg;
+}
+
 void ProtocolGame::AddMapDescription(NetworkMessage_ptr msg, const Position& pos)
 {
 	msg->AddByte(0x64);
@@ -2580,15 +2699,22 @@ void ProtocolGame::AddDistanceShoot(NetworkMessage_ptr msg, const Position& from
 
 void ProtocolGame::AddCreature(NetworkMessage_ptr msg,const Creature* creature, bool known, uint32_t remove)
 {
+	// header, then at most 17 bytes of health, direction, outfit,
+	// light, speed, skull, shield, emblem and walkthrough
+	const std::string& name = creature->getName();
+	if(!msg->Reserve((known ? 6 : 12 + name.size()) + 17)){
+		return;
+	}
+
 	if(known){
-		msg->AddU16(0x62);
-		msg->AddU32(creature->getID());
+		msg->PutU16(0x62);
+		msg->PutU32(creature->getID());
 	}
 	else{
-		msg->AddU16(0x61);
-		msg->AddU32(remove);
-		msg->AddU32(creature->getID());
-		msg->AddString(creature->getName());
+		msg->PutU16(0x61);
+		msg->PutU32(remove);
+		msg->PutU32(creature->getID());
+		msg->PutString(name);
 	}
 
 	int32_t healthToSend;
@@ -2596,36 +2722,36 @@ void ProtocolGame::AddCreature(NetworkMessage_ptr msg,const Creature* creature,
 		healthToSend = (int32_t)std::ceil(((float)creature->getHealth()) * 100 / std::max(creature->getMaxHealth(), (int32_t)1));
 	else
 		healthToSend = 0;
-	msg->AddByte(healthToSend);
+	msg->PutByte(healthToSend);
 
-	msg->AddByte((uint8_t)creature->getDirection());
+	msg->PutByte((uint8_t)creature->getDirection());
 	if(creature->isInvisible() ||
 		(creature->getPlayer() && creature->getPlayer()->isGmInvisible()))
 	{
 		static Outfit_t outfit;
-		AddCreatureOutfit(msg, creature, outfit);
+		PutCreatureOutfit(msg, outfit);
 	}
 	else{
-		AddCreatureOutfit(msg, creature, creature->getCurrentOutfit());
+		PutCreatureOutfit(msg, creature->getCurrentOutfit());
 	}
 
 	LightInfo lightInfo;
 	creature->getCreatureLight(lightInfo);
-	msg->AddByte(lightInfo.level);
-	msg->AddByte(lightInfo.color);
+	msg->PutByte(lightInfo.level);
+	msg->PutByte(lightInfo.color);
 
-	msg->AddU16(creature->getStepSpeed());
+	msg->PutU16(creature->getStepSpeed());
 #ifdef __SKULLSYSTEM__
-	msg->AddByte(player->getSkullClient(creature->getPlayer()));
+	msg->PutByte(player->getSkullClient(creature->getPlayer()));
 #else
-	msg->AddByte(SKULL_NONE);
+	msg->PutByte(SKULL_NONE);
 #endif
-	msg->AddByte(player->getPartyShield(creature->getPlayer()));
+	msg->PutByte(player->getPartyShield(creature->getPlayer()));
 	if(!known){
-		msg->AddByte(player->getGuildEmblem(creature->getPlayer())); // guild war emblem
+		msg->PutByte(player->getGuildEmblem(creature->getPlayer())); // guild war emblem
 	}
 
-	msg->AddByte(!player->canWalkthrough(creature));
+	msg->PutByte(!player->canWalkthrough(creature));
 }
 
 void ProtocolGame::AddPlayerStats(NetworkMessage_ptr msg)
@@ -2745,19 +2871,27 @@ void ProtocolGame::AddCreatureHealth(NetworkMessage_ptr msg,const Creature* crea
 
 void ProtocolGame::AddCreatureOutfit(NetworkMessage_ptr msg, const Creature* creature, const Outfit_t& outfit)
 {
-	msg->AddU16(outfit.lookType);
+	if(msg->Reserve(7)){
+		PutCreatureOutfit(msg, outfit);
+	}
+}
+
+void ProtocolGame::PutCreatureOutfit(NetworkMessage_ptr msg, const Outfit_t& outfit)
+{
+	// at most 7 bytes, reserved by the caller
+	msg->PutU16(outfit.lookType);
 	if(outfit.lookType != 0){
-		msg->AddByte(outfit.lookHead);
-		msg->AddByte(outfit.lookBody);
-		msg->AddByte(outfit.lookLegs);
-		msg->AddByte(outfit.lookFeet);
-		msg->AddByte(outfit.lookAddons);
+		msg->PutByte(outfit.lookHead);
+		msg->PutByte(outfit.lookBody);
+		msg->PutByte(outfit.lookLegs);
+		msg->PutByte(outfit.lookFeet);
+		msg->PutByte(outfit.lookAddons);
 	}
 	else if(outfit.lookTypeEx != 0){
-		msg->AddItemId(outfit.lookTypeEx);
+		msg->PutU16(Item::items[outfit.lookTypeEx].clientId);
 	}
 	else{
-		msg->AddU16(outfit.lookTypeEx);
+		msg->PutU16(outfit.lookTypeEx);
 	}
 }
 
@@ -2823,11 +2957,12 @@ void ProtocolGame::RemoveTileItem(NetworkMessage_ptr msg, const Position& pos, u
 	}
 }
 
-void ProtocolGame::MoveUpCreature(NetworkMessage_ptr msg, const Creature* creature,
+void ProtocolGame::MoveUpCreature(const Creature* creature,
 	const Position& newPos, const Position& oldPos, uint32_t oldStackPos)
 {
 	if(creature == player){
 		//floor change up
+		NetworkMessage_ptr msg = getDescriptionBuffer();
 		msg->AddByte(0xBE);
 
 		//going to surface
@@ -2856,22 +2991,29 @@ void ProtocolGame::MoveUpCreature(NetworkMessage_ptr msg, const Creature* creatu
 			}
 		}
 
+		flushDescriptionBuffer();
+
 		//moving up a floor up makes us out of sync
 		//west
+		msg = getDescriptionBuffer();
 		msg->AddByte(0x68);
 		GetMapDescription(oldPos.x - 8, oldPos.y + 1 - 6, newPos.z, 1, 14, msg);
+		flushDescriptionBuffer();
 
 		//north
+		msg = getDescriptionBuffer();
 		msg->AddByte(0x65);
 		GetMapDescription(oldPos.x - 8, oldPos.y - 6, newPos.z, 18, 1, msg);
+		flushDescriptionBuffer();
 	}
 }
 
-void ProtocolGame::MoveDownCreature(NetworkMessage_ptr msg, const Creature* creature,
+void ProtocolGame::MoveDownCreature(const Creature* creature,
 	const Position& newPos, const Position& oldPos, uint32_t oldStackPos)
 {
 	if(creature == player){
 		//floor change down
+		NetworkMessage_ptr msg = getDescriptionBuffer();
 		msg->AddByte(0xBF);
 
 		//going from surface to underground
@@ -2897,14 +3039,20 @@ void ProtocolGame::MoveDownCreature(NetworkMessage_ptr msg, const Creature* crea
 			}
 		}
 
+		flushDescriptionBuffer();
+
 		//moving down a floor makes us out of sync
 		//east
+		msg = getDescriptionBuffer();
 		msg->AddByte(0x66);
 		GetMapDescription(oldPos.x + 9, oldPos.y - 1 - 6, newPos.z, 1, 14, msg);
+		flushDescriptionBuffer();
 
 		//south
+		msg = getDescriptionBuffer();
 		msg->AddByte(0x67);
 		GetMapDescription(oldPos.x - 8, oldPos.y + 7, newPos.z, 18, 1, msg);
+		flushDescriptionBuffer();
 	}
 }
 
@@ -26,6 +26,7 @@
 #include "protocol.h"
 #include "enums.h"
 #include "creature.h"
+#include "knowncreatures.h"
 #include <string>
 
 enum connectResult_t{
@@ -45,6 +46,20 @@ class Tile;
 class Connection;
 class Quest;
 
+// The items of a tile as the clients get them, which is the same for
+// everyone: only the creatures depend on who is looking. Entries are
+// checked against the revision of their tile.
+struct TileDescription{
+	uint32_t revision;
+	uint8_t topCount;
+	uint8_t topLength;
+	uint8_t downCount;
+	uint8_t downEnd[10];
+	uint8_t bytes[60];
+};
+
+typedef std::unordered_map<const Tile*, TileDescription> TileDescriptionCache;
+
 class ProtocolGame : public Protocol
 {
 public:
@@ -66,8 +81,16 @@ public:
 
 	void setPlayer(Player* p);
 
+	// Item types are part of the cached tile descriptions, they have to
+	// be dropped when the types are reloaded
+	static void clearTileDescriptionCache();
+
 private:
-	std::list<uint32_t> knownCreatureList;
+	KnownCreatureSet knownCreatures;
+
+	// Tiles are only described on the dispatcher, one cache serves all
+	static TileDescriptionCache tileDescriptionCache;
+	static const TileDescription& getCachedTileDescription(const Tile* tile);
 
 	bool connect(uint32_t playerId);
 	void disconnectClient(uint8_t error, const char* message);
@@ -86,7 +109,10 @@ private:
 	virtual void parsePacket(NetworkMessage& msg);
 	virtual void onRecvFirstMessage(NetworkMessage& msg);
 	virtual void onConnect();
-	bool parseFirstPacket(NetworkMessage& msg);
+	// Runs on the login workers, see Protocol::addLoginTask
+	void parseFirstPacket(NetworkMessage_ptr msg, uint32_t clientip, uint16_t version);
+	void loginFailed(uint8_t error, const std::string& message);
+	void loginAccepted(const std::string& name, bool isSetGM);
 
 	//Parse methods
 	void parseLogout(NetworkMessage& msg);
@@ -263,6 +289,11 @@ private:
 	void GetMapDescription(int32_t x, int32_t y, int32_t z,
 		int32_t width, int32_t height, NetworkMessage_ptr msg);
 
+	// map descriptions are built in a buffer of their own and then copied
+	// whole to the output, in a new message when the current one is full
+	NetworkMessage_ptr getDescriptionBuffer();
+	NetworkMessage_ptr flushDescriptionBuffer();
+
 	void AddMapDescription(NetworkMessage_ptr msg, const Position& pos);
 	void AddTextMessage(NetworkMessage_ptr msg,MessageClasses mclass, const std::string& message);
 	void AddAnimatedText(NetworkMessage_ptr msg,const Position& pos, unsigned char color, const std::string& text);
@@ -273,6 +304,7 @@ private:
 	void AddCreatureSpeak(NetworkMessage_ptr msg, const Creature* creature, SpeakClasses type, std::string text, uint16_t channelId, uint32_t time = 0);
 	void AddCreatureHealth(NetworkMessage_ptr msg,const Creature* creature);
 	void AddCreatureOutfit(NetworkMessage_ptr msg, const Creature* creature, const Outfit_t& outfit);
+	void PutCreatureOutfit(NetworkMessage_ptr msg, const Outfit_t& outfit);
 	void AddCreatureInvisible(NetworkMessage_ptr msg, const Creature* creature);
 	void AddPlayerSkills(NetworkMessage_ptr msg);
 	void AddWorldLight(NetworkMessage_ptr msg, const LightInfo& lightInfo);
@@ -284,9 +316,9 @@ private:
 	void UpdateTileItem(NetworkMessage_ptr msg, const Position& pos, uint32_t stackpos, const Item* item);
 	void RemoveTileItem(NetworkMessage_ptr msg, const Position& pos, uint32_t stackpos);
 
-	void MoveUpCreature(NetworkMessage_ptr msg, const Creature* creature,
+	void MoveUpCreature(const Creature* creature,
 		const Position& newPos, const Position& oldPos, uint32_t oldStackPos);
-	void MoveDownCreature(NetworkMessage_ptr msg, const Creature* creature,
+	void MoveDownCreature(const Creature* creature,
 		const Position& newPos, const Position& oldPos, uint32_t oldStackPos);
 
 	//container
@@ -59,26 +59,14 @@ void ProtocolLogin::disconnectClient(uint8_t error, const char* message)
 	getConnection()->closeConnection();
 }
 
-bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
+void ProtocolLogin::parseFirstPacket(NetworkMessage_ptr msgPtr, uint32_t clientip, uint16_t version)
 {
-	if(g_game.getGameState() == GAME_STATE_SHUTDOWN){
-		getConnection()->closeConnection();
-		return false;
-	}
-
-	uint32_t clientip = getConnection()->getIP();
-
-	/*uint16_t clientos =*/ msg.GetU16();
-	uint16_t version  = msg.GetU16();
-	msg.SkipBytes(12);
-
-	if(version <= 760){
-		disconnectClient(0x0A, STRING_CLIENT_VERSION);
-	}
+	//login worker
+	NetworkMessage& msg = *msgPtr;
 
 	if(!RSA_decrypt(msg)){
-		getConnection()->closeConnection();
-		return false;
+		abortLoginTask();
+		return;
 	}
 
 	uint32_t key[4];
@@ -86,7 +74,7 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 	key[1] = msg.GetU32();
 	key[2] = msg.GetU32();
 	key[3] = msg.GetU32();
-	enableXTEAEncryption();
+	//only used once loginFailed/sendCharacterList enable encryption
 	setXTEAKey(key);
 
 	std::string accname = msg.GetString();
@@ -95,28 +83,28 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 	if(!accname.length()){
 		//Tibia sends this message if the account name length is < 5
 		//We will send it only if account name is BLANK
-		disconnectClient(0x0A, "Invalid Account Name.");
-		return false;
+		finishLoginTask(boost::bind(&ProtocolLogin::loginFailed, this, std::string("Invalid Account Name.")));
+		return;
 	}
 
 	if(version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX){
-		disconnectClient(0x0A, STRING_CLIENT_VERSION);
-		return false;
+		finishLoginTask(boost::bind(&ProtocolLogin::loginFailed, this, std::string(STRING_CLIENT_VERSION)));
+		return;
 	}
 
 	if(g_game.getGameState() == GAME_STATE_STARTUP){
-		disconnectClient(0x0A, "Gameworld is starting up. Please wait.");
-		return false;
+		finishLoginTask(boost::bind(&ProtocolLogin::loginFailed, this, std::string("Gameworld is starting up. Please wait.")));
+		return;
 	}
 
 	if(g_bans.isIpDisabled(clientip)){
-		disconnectClient(0x0A, "Too many connections attempts from this IP. Try again later.");
-		return false;
+		finishLoginTask(boost::bind(&ProtocolLogin::loginFailed, this, std::string("Too many connections attempts from this IP. Try again later.")));
+		return;
 	}
 
 	if(g_bans.isIpBanished(clientip)){
-		disconnectClient(0x0A, "Your IP is banished!");
-		return false;
+		finishLoginTask(boost::bind(&ProtocolLogin::loginFailed, this, std::string("Your IP is banished!")));
+		return;
 	}
 
 	uint32_t serverip = serverIPs[0].first;
@@ -132,12 +120,24 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 			passwordTest(password, account.password))){
 
 		g_bans.addLoginAttempt(clientip, false);
-		disconnectClient(0x0A, "Account name or password is not correct.");
-		return false;
+		finishLoginTask(boost::bind(&ProtocolLogin::loginFailed, this, std::string("Account name or password is not correct.")));
+		return;
 	}
 
 	g_bans.addLoginAttempt(clientip, true);
 
+	finishLoginTask(boost::bind(&ProtocolLogin::sendCharacterList, this, account, serverip));
+}
+
+void ProtocolLogin::loginFailed(const std::string& message)
+{
+	enableXTEAEncryption();
+	disconnectClient(0x0A, message.c_str());
+}
+
+void ProtocolLogin::sendCharacterList(const Account& account, uint32_t serverip)
+{
+	enableXTEAEncryption();
 
 	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
 	if(output){
@@ -151,7 +151,7 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		//Add char list
 		output->AddByte(0x64);
 		output->AddByte((uint8_t)account.charList.size());
-		std::list<std::string>::iterator it;
+		std::list<std::string>::const_iterator it;
 		for(it = account.charList.begin(); it != account.charList.end(); ++it){
 			output->AddString((*it));
 			output->AddString(g_config.getString(ConfigManager::WORLD_NAME));
@@ -164,11 +164,29 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		OutputMessagePool::getInstance()->send(output);
 	}
 	getConnection()->closeConnection();
-
-	return true;
 }
 
 void ProtocolLogin::onRecvFirstMessage(NetworkMessage& msg)
 {
-	parseFirstPacket(msg);
+	if(g_game.getGameState() == GAME_STATE_SHUTDOWN){
+		getConnection()->closeConnection();
+		return;
+	}
+
+	uint32_t clientip = getConnection()->getIP();
+
+	/*uint16_t clientos =*/ msg.GetU16();
+	uint16_t version  = msg.GetU16();
+	msg.SkipBytes(12);
+
+	if(version <= 760){
+		disconnectClient(0x0A, STRING_CLIENT_VERSION);
+		return;
+	}
+
+	//the rest waits on RSA and the database, it runs on the login workers
+	if(!addLoginTask(createTask(boost::bind(&ProtocolLogin::parseFirstPacket, this,
+		NetworkMessage_ptr(new NetworkMessage(msg)), clientip, version)))){
+		getConnection()->closeConnection();
+	}
 }
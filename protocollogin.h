@@ -24,11 +24,15 @@
 #include "definitions.h"
 #include "protocol.h"
 #include <vector>
+#include <string>
+#include <boost/shared_ptr.hpp>
 
 typedef std::vector<std::pair<uint32_t, uint32_t> > IPList;
 
 class NetworkMessage;
 class OutputMessage;
+class Account;
+typedef boost::shared_ptr<NetworkMessage> NetworkMessage_ptr;
 
 class ProtocolLogin : public Protocol
 {
@@ -64,7 +68,10 @@ public:
 protected:
 	void disconnectClient(uint8_t error, const char* message);
 	
-	bool parseFirstPacket(NetworkMessage& msg);
+	// Runs on the login workers, see Protocol::addLoginTask
+	void parseFirstPacket(NetworkMessage_ptr msg, uint32_t clientip, uint16_t version);
+	void loginFailed(const std::string& message);
+	void sendCharacterList(const Account& account, uint32_t serverip);
 
 	#ifdef __DEBUG_NET_DETAIL__
 	virtual void deleteProtocolTask();
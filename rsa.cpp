@@ -20,6 +20,37 @@
 #include "otpch.h"
 
 #include "rsa.h"
+#include <iostream>
+
+// Numbers used by a decryption, allocated once per thread instead of
+// on every login
+struct RSAScratch{
+	RSAScratch(){
+		mpz_init2(c, 1024);
+		mpz_init2(v1, 1024);
+		mpz_init2(v2, 1024);
+		mpz_init2(u2, 1024);
+		mpz_init2(tmp, 1024);
+	}
+
+	~RSAScratch(){
+		mpz_clear(c);
+		mpz_clear(v1);
+		mpz_clear(v2);
+		mpz_clear(u2);
+		mpz_clear(tmp);
+	}
+
+	static RSAScratch& getInstance(){
+		static boost::thread_specific_ptr<RSAScratch> instance;
+		if(!instance.get()){
+			instance.reset(new RSAScratch);
+		}
+		return *instance;
+	}
+
+	mpz_t c, v1, v2, u2, tmp;
+};
 
 RSA::RSA()
 {
@@ -108,7 +139,7 @@ bool RSA::setKey(const std::string& file)
 
 void RSA::setKey(const char* p, const char* q, const char* d)
 {
-	boost::recursive_mutex::scoped_lock lockClass(rsaLock);
+	boost::unique_lock<boost::shared_mutex> lockClass(rsaLock);
 
 	mpz_set_str(m_p, p, 10);
 	mpz_set_str(m_q, q, 10);
@@ -128,6 +159,8 @@ void RSA::setKey(const char* p, const char* q, const char* d)
 
 	mpz_clear(pm1);
 	mpz_clear(qm1);
+
+	m_keySet = true;
 }
 
 bool RSA::encrypt(char* msg, int32_t size, const char* key)
@@ -160,14 +193,18 @@ bool RSA::encrypt(char* msg, int32_t size, const char* key)
 
 bool RSA::decrypt(char* msg, int32_t size)
 {
-	boost::recursive_mutex::scoped_lock lockClass(rsaLock);
+	boost::shared_lock<boost::shared_mutex> lockClass(rsaLock);
+	if(!m_keySet){
+		std::cout << "Failure: [RSA::decrypt]. Key not set" << std::endl;
+		return false;
+	}
 
-	mpz_t c,v1,v2,u2,tmp;
-	mpz_init2(c, 1024);
-	mpz_init2(v1, 1024);
-	mpz_init2(v2, 1024);
-	mpz_init2(u2, 1024);
-	mpz_init2(tmp, 1024);
+	RSAScratch& scratch = RSAScratch::getInstance();
+	mpz_ptr c = scratch.c;
+	mpz_ptr v1 = scratch.v1;
+	mpz_ptr v2 = scratch.v2;
+	mpz_ptr u2 = scratch.u2;
+	mpz_ptr tmp = scratch.tmp;
 
 	mpz_import(c, 128, 1, 1, 0, 0, msg);
 
@@ -189,13 +226,6 @@ bool RSA::decrypt(char* msg, int32_t size)
 	size_t count = (mpz_sizeinbase(c, 2) + 7)/8;
 	memset(msg, 0, 128 - count);
 	mpz_export(&msg[128 - count], NULL, 1, 1, 0, 0, c);
-
-	mpz_clear(c);
-	mpz_clear(v1);
-	mpz_clear(v2);
-	mpz_clear(u2);
-	mpz_clear(tmp);
-
 	return true;
 }
 
@@ -43,7 +43,8 @@ protected:
 
 	bool m_keySet;
 
-	boost::recursive_mutex rsaLock;
+	// The key only changes when it is set, decryptions run in parallel
+	boost::shared_mutex rsaLock;
 
 	//use only GMP
 	mpz_t m_p, m_q, m_u, m_d, m_dp, m_dq, m_mod;
@@ -0,0 +1,273 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Writes global saves on their own thread
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+
+#include "otpch.h"
+
+#include "savemanager.h"
+#include "tasks.h"
+#include "exception.h"
+#include "tools.h"
+#include <boost/scoped_ptr.hpp>
+#include <iostream>
+
+extern Dispatcher g_dispatcher;
+
+SaveManager::SaveManager() :
+	m_running(false),
+	m_sequence(0),
+	m_pendingSaves(0)
+{
+	m_stats.saves = 0;
+	m_stats.failedSaves = 0;
+	m_stats.queueSize = 0;
+	m_stats.ownConnection = false;
+	m_stats.lastPlayers = 0;
+	m_stats.lastPlayersSkipped = 0;
+	m_stats.lastCaptureTime = 0;
+	m_stats.lastWriteTime = 0;
+}
+
+void SaveManager::start()
+{
+	boost::mutex::scoped_lock lockClass(m_taskLock);
+	if(m_running){
+		return;
+	}
+
+	m_running = true;
+	m_thread = boost::thread(boost::bind(&SaveManager::saveThread, (void*)this));
+}
+
+void SaveManager::shutdown()
+{
+	m_taskLock.lock();
+	m_running = false;
+	m_taskLock.unlock();
+	m_taskSignal.notify_one();
+
+	if(m_thread.joinable()){
+		m_thread.join();
+	}
+
+	//the dispatcher stops taking tasks before the server shuts down, so the
+	//last saves could not hand their completion to the game thread
+	while(!m_writtenList.empty()){
+		GlobalSave_ptr save = m_writtenList.front();
+		m_writtenList.pop_front();
+		onSaveWritten(save);
+	}
+}
+
+void SaveManager::addSave(GlobalSave_ptr save)
+{
+	{
+		boost::mutex::scoped_lock lockClass(m_playerLock);
+		save->sequence = ++m_sequence;
+		++m_pendingSaves;
+	}
+
+	m_taskLock.lock();
+	if(m_running){
+		m_saveList.push_back(save);
+		m_taskLock.unlock();
+		m_taskSignal.notify_one();
+		return;
+	}
+	m_taskLock.unlock();
+
+	//no save thread, write it the old way
+	writeSave(Database::instance(), true, save);
+	onSaveWritten(save);
+}
+
+void SaveManager::supersedePlayer(uint32_t guid)
+{
+	boost::mutex::scoped_lock lockClass(m_playerLock);
+	if(m_pendingSaves > 0){
+		m_superseded[guid] = ++m_sequence;
+	}
+}
+
+SaveStats SaveManager::getStats()
+{
+	boost::mutex::scoped_lock lockClass(m_taskLock);
+	SaveStats stats = m_stats;
+	stats.queueSize = (uint32_t)m_saveList.size();
+	return stats;
+}
+
+void SaveManager::saveThread(void* p)
+{
+	SaveManager* manager = (SaveManager*)p;
+
+	ExceptionHandler saveExceptionHandler;
+	saveExceptionHandler.InstallHandler();
+
+	//the writes would wait on DBQuery's lock together with the game thread,
+	//so use a connection of our own where the driver allows it
+	Database* db = NULL;
+	if(Database::instance()->getParam(DBPARAM_MULTICONNECTION)){
+		db = Database::createConnection();
+		if(!db->isConnected()){
+			std::cout << "Warning: [SaveManager::saveThread] Could not open a connection for saving, using the shared one." << std::endl;
+			Database::releaseConnection(db);
+			db = NULL;
+		}
+	}
+
+	bool sharedConnection = (db == NULL);
+	if(sharedConnection){
+		db = Database::instance();
+	}
+
+	manager->m_taskLock.lock();
+	manager->m_stats.ownConnection = !sharedConnection;
+	manager->m_taskLock.unlock();
+
+	boost::unique_lock<boost::mutex> taskLockUnique(manager->m_taskLock);
+	while(true){
+		while(manager->m_running && manager->m_saveList.empty()){
+			manager->m_taskSignal.wait(taskLockUnique);
+		}
+
+		//queued saves are still written when shutting down
+		if(manager->m_saveList.empty()){
+			break;
+		}
+
+		GlobalSave_ptr save = manager->m_saveList.front();
+		manager->m_saveList.pop_front();
+
+		taskLockUnique.unlock();
+		manager->writeSave(db, sharedConnection, save);
+		bool posted = g_dispatcher.addTask(createTask(
+			boost::bind(&SaveManager::onSaveWritten, manager, save)));
+		taskLockUnique.lock();
+
+		if(!posted){
+			manager->m_writtenList.push_back(save);
+		}
+	}
+	taskLockUnique.unlock();
+
+	if(!sharedConnection){
+		Database::releaseConnection(db);
+	}
+
+	saveExceptionHandler.RemoveHandler();
+}
+
+void SaveManager::writeSave(Database* db, bool sharedConnection, GlobalSave_ptr save)
+{
+	int64_t start = OTSYS_TIME();
+	save->success = true;
+
+	for(std::list<GlobalSave::PlayerEntry>::iterator it = save->players.begin(); it != save->players.end(); ++it){
+		it->written = false;
+
+		//DBQuery's lock is taken before ours, as on the game thread. Ours is
+		//held while writing, so a direct save of the same player waits for us
+		boost::scoped_ptr<DBQuery> lockQuery(sharedConnection ? new DBQuery : NULL);
+		boost::mutex::scoped_lock lockClass(m_playerLock);
+		SupersedeMap::iterator sit = m_superseded.find(it->data.guid);
+		if(sit != m_superseded.end() && sit->second > save->sequence){
+			++save->playersSkipped;
+			continue;
+		}
+
+		if(IOPlayer::instance()->writePlayerSave(db, it->data)){
+			it->written = true;
+			++save->playersWritten;
+		}
+		else{
+			std::cout << "Error: [SaveManager::writeSave] Could not save player " << it->data.guid << "." << std::endl;
+			save->success = false;
+		}
+	}
+
+	if(save->saveMap){
+		boost::scoped_ptr<DBQuery> lockQuery(sharedConnection ? new DBQuery : NULL);
+
+		//same as Map::saveMap, a few tries for each part
+		bool saved = false;
+		for(uint32_t tries = 0; tries < 3 && !saved; ++tries){
+			saved = save->mapBatch.execute(db);
+		}
+
+		if(saved){
+			save->mapWritten = true;
+			saved = false;
+			for(uint32_t tries = 0; tries < 3 && !saved; ++tries){
+				saved = save->houseBatch.execute(db);
+			}
+		}
+
+		if(!saved){
+			std::cout << "Error: [SaveManager::writeSave] Could not save the map." << std::endl;
+			save->success = false;
+		}
+	}
+
+	save->writeTime = OTSYS_TIME() - start;
+
+	{
+		boost::mutex::scoped_lock lockClass(m_playerLock);
+		if(--m_pendingSaves == 0){
+			m_superseded.clear();
+		}
+	}
+
+	{
+		boost::mutex::scoped_lock lockClass(m_taskLock);
+		++m_stats.saves;
+		if(!save->success){
+			++m_stats.failedSaves;
+		}
+		m_stats.lastPlayers = save->playersWritten;
+		m_stats.lastPlayersSkipped = save->playersSkipped;
+		m_stats.lastCaptureTime = save->captureTime;
+		m_stats.lastWriteTime = save->writeTime;
+	}
+
+	std::cout << "Notice: Server saved. Capture took " << save->captureTime/(1000.) << "s, writing "
+		<< save->playersWritten << " players";
+	if(save->saveMap){
+		std::cout << " and " << save->mapState.changedHouses << " houses";
+	}
+	std::cout << " took " << save->writeTime/(1000.) << "s." << std::endl;
+}
+
+void SaveManager::onSaveWritten(GlobalSave_ptr save)
+{
+	for(std::list<GlobalSave::PlayerEntry>::iterator it = save->players.begin(); it != save->players.end(); ++it){
+		if(it->written){
+			IOPlayer::instance()->onPlayerSaved(it->data);
+		}
+	}
+
+	if(save->mapWritten){
+		IOMapSerialize::getInstance()->onMapSaved(save->mapState);
+	}
+
+	if(save->callback){
+		save->callback(save->success);
+	}
+}
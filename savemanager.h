@@ -0,0 +1,127 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Writes global saves on their own thread
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+
+#ifndef __OTSERV_SAVEMANAGER_H__
+#define __OTSERV_SAVEMANAGER_H__
+
+#include "definitions.h"
+#include "ioplayer.h"
+#include "iomapserialize.h"
+#include "database.h"
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include <deque>
+#include <list>
+#include <map>
+
+typedef boost::function<void (bool)> SaveCallback;
+
+// Everything a global save writes. Game::saveServer captures it on the
+// game thread, it is written by the save thread with its own connection.
+struct GlobalSave{
+	struct PlayerEntry{
+		PlayerSaveData data;
+		bool written;
+	};
+
+	GlobalSave() : saveMap(false), mapWritten(false), sequence(0), captureTime(0),
+		writeTime(0), playersWritten(0), playersSkipped(0), success(false) {}
+
+	std::list<PlayerEntry> players;
+	bool saveMap;
+	bool mapWritten;
+	DBBatch mapBatch;
+	MapSaveState mapState;
+	DBBatch houseBatch;
+	SaveCallback callback;
+
+	uint64_t sequence;
+	int64_t captureTime;
+	int64_t writeTime;
+	uint32_t playersWritten;
+	uint32_t playersSkipped;
+	bool success;
+};
+
+typedef boost::shared_ptr<GlobalSave> GlobalSave_ptr;
+
+struct SaveStats{
+	uint64_t saves;
+	uint64_t failedSaves;
+	uint32_t queueSize;
+	bool ownConnection;
+	uint32_t lastPlayers;
+	uint32_t lastPlayersSkipped;
+	int64_t lastCaptureTime;
+	int64_t lastWriteTime;
+};
+
+class SaveManager : boost::noncopyable
+{
+public:
+	static SaveManager* getInstance()
+	{
+		static SaveManager instance;
+		return &instance;
+	}
+
+	void start();
+	// Writes the saves that are still queued before it returns. Call it on
+	// the game thread, saves the dispatcher refused are completed there
+	void shutdown();
+
+	// Queues a captured save, it is written right away if the save thread is not running
+	void addSave(GlobalSave_ptr save);
+
+	// A player is about to be saved directly, a queued global save must
+	// not overwrite it with what it captured before
+	void supersedePlayer(uint32_t guid);
+
+	SaveStats getStats();
+
+protected:
+	SaveManager();
+
+	static void saveThread(void* p);
+	void writeSave(Database* db, bool sharedConnection, GlobalSave_ptr save);
+	void onSaveWritten(GlobalSave_ptr save);
+
+	boost::thread m_thread;
+	boost::mutex m_taskLock;
+	boost::condition_variable m_taskSignal;
+	std::deque<GlobalSave_ptr> m_saveList;
+	// written saves whose completion the dispatcher refused, for shutdown()
+	std::deque<GlobalSave_ptr> m_writtenList;
+	bool m_running;
+
+	// sequence of the last direct save of each player while global saves are pending
+	typedef std::map<uint32_t, uint64_t> SupersedeMap;
+	boost::mutex m_playerLock;
+	SupersedeMap m_superseded;
+	uint64_t m_sequence;
+	uint32_t m_pendingSaves;
+
+	SaveStats m_stats;
+};
+
+#endif
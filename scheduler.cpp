@@ -20,12 +20,24 @@
 #include "otpch.h"
 
 #include <iostream>
+#include <algorithm>
 #include "scheduler.h"
 #include "exception.h"
 
 Scheduler::Scheduler()
 {
 	m_lastEventId = 0;
+	m_eventCount = 0;
+	m_currentTick = getCurrentTick();
+	m_wakeTick = 0;
+	for(uint32_t level = 0; level < SCHEDULER_WHEEL_LEVELS; ++level){
+		for(uint32_t i = 0; i < SCHEDULER_WHEEL_SIZE; ++i){
+			m_wheel[level][i] = NULL;
+		}
+	}
+
+	m_eventTable.resize(1024, NULL);
+	m_eventTableMask = (uint32_t)m_eventTable.size() - 1;
 	m_threadState = STATE_TERMINATED;
 }
 
@@ -46,66 +58,221 @@ void Scheduler::schedulerThread(void* p)
 	boost::unique_lock<boost::mutex> eventLockUnique(scheduler->m_eventLock, boost::defer_lock);
 
 	while(scheduler->m_threadState != STATE_TERMINATED){
-		SchedulerTask* task = NULL;
-		bool runTask = false;
-		bool ret = true;
+		SchedulerTask* expired = NULL;
 
 		// check if there are events waiting...
 		eventLockUnique.lock();
 
-		if(scheduler->m_eventList.empty()){
+		if(scheduler->m_eventCount == 0){
 			#ifdef __DEBUG_SCHEDULER__
 			std::cout << "Scheduler: No events" << std::endl;
 			#endif
-			scheduler->m_eventSignal.wait(eventLockUnique);
+			scheduler->m_wakeTick = (uint64_t)-1;
+			scheduler->m_eventSignal.timed_wait(eventLockUnique,
+				boost::get_system_time() + boost::posix_time::milliseconds(TASK_CLOCK_INTERVAL));
 		}
 		else{
 			#ifdef __DEBUG_SCHEDULER__
 			std::cout << "Scheduler: Waiting for event" << std::endl;
 			#endif
-			ret = scheduler->m_eventSignal.timed_wait(eventLockUnique, scheduler->m_eventList.top()->getCycle());
+			scheduler->m_wakeTick = scheduler->getNextTick();
+			// wake up at least every TASK_CLOCK_INTERVAL to keep the task clock fresh
+			int64_t waitTime = std::min((int64_t)(scheduler->m_wakeTick * SCHEDULER_TICK) - OTSYS_TIME(),
+				(int64_t)TASK_CLOCK_INTERVAL);
+			if(waitTime > 0){
+				scheduler->m_eventSignal.timed_wait(eventLockUnique,
+					boost::get_system_time() + boost::posix_time::milliseconds(waitTime));
+			}
 		}
+		scheduler->m_wakeTick = 0;
+		TaskClock::update();
 
 		#ifdef __DEBUG_SCHEDULER__
 		std::cout << "Scheduler: Signaled" << std::endl;
 		#endif
 
-		// the mutex is locked again now...
-		if(!ret && (scheduler->m_threadState != STATE_TERMINATED)){
-			// ok we had a timeout, so there has to be an event we have to execute...
-			task = scheduler->m_eventList.top();
-			scheduler->m_eventList.pop();
-
-			// check if the event was stopped
-			EventIdSet::iterator it = scheduler->m_eventIds.find(task->getEventId());
-			if(it != scheduler->m_eventIds.end()){
-				// was not stopped so we should run it
-				runTask = true;
-				scheduler->m_eventIds.erase(it);
-			}
+		// the mutex is locked again now, collect everything that is due
+		if(scheduler->m_threadState != STATE_TERMINATED && scheduler->m_eventCount != 0){
+			expired = scheduler->advance(getCurrentTick());
 		}
 
 		eventLockUnique.unlock();
 
-		// add task to dispatcher
-		if(task){
-			// if it was not stopped
-			if(runTask){
-				// Expiration has another meaning for dispatcher tasks, reset it
-				task->setDontExpire();
-				#ifdef __DEBUG_SCHEDULER__
-				std::cout << "Scheduler: Executing event " << task->getEventId() << std::endl;
-				#endif
-				g_dispatcher.addTask(task);
+		// add the whole batch to dispatcher
+		while(expired){
+			SchedulerTask* task = expired;
+			expired = task->m_next;
+			task->m_next = NULL;
+
+			// Expiration has another meaning for dispatcher tasks, reset it
+			task->setDontExpire();
+			#ifdef __DEBUG_SCHEDULER__
+			std::cout << "Scheduler: Executing event " << task->getEventId() << std::endl;
+			#endif
+			g_dispatcher.addTask(task);
+		}
+	}
+
+	schedulerExceptionHandler.RemoveHandler();
+}
+
+uint32_t Scheduler::generateEventId()
+{
+	if(m_eventCount * 2 >= m_eventTable.size()){
+		growEventTable();
+	}
+
+	do{
+		if(++m_lastEventId == 0){
+			++m_lastEventId;
+		}
+	}while(m_eventTable[m_lastEventId & m_eventTableMask] != NULL);
+
+	return m_lastEventId;
+}
+
+void Scheduler::growEventTable()
+{
+	// Pending ids are distinct modulo the old size, so they stay
+	// distinct modulo the doubled size
+	std::vector<SchedulerTask*> newTable(m_eventTable.size() * 2, NULL);
+	uint32_t newMask = (uint32_t)newTable.size() - 1;
+	for(std::vector<SchedulerTask*>::iterator it = m_eventTable.begin(); it != m_eventTable.end(); ++it){
+		if(*it){
+			newTable[(*it)->getEventId() & newMask] = *it;
+		}
+	}
+
+	m_eventTable.swap(newTable);
+	m_eventTableMask = newMask;
+}
+
+void Scheduler::insertTask(SchedulerTask* task)
+{
+	uint64_t expireTick = task->m_expireTick;
+	SchedulerTask** slot;
+
+	if(expireTick < m_currentTick){
+		// already due, run it with the next tick
+		slot = &m_wheel[0][m_currentTick & SCHEDULER_WHEEL_MASK];
+	}
+	else{
+		uint64_t delta = expireTick - m_currentTick;
+		uint32_t level = 0;
+		while(level < SCHEDULER_WHEEL_LEVELS - 1 &&
+			delta >= ((uint64_t)1 << (SCHEDULER_WHEEL_BITS * (level + 1))))
+		{
+			++level;
+		}
+
+		if(level == SCHEDULER_WHEEL_LEVELS - 1){
+			// beyond the range of the wheel, park it in the farthest slot
+			uint64_t maxDelta = ((uint64_t)1 << (SCHEDULER_WHEEL_BITS * SCHEDULER_WHEEL_LEVELS)) - 1;
+			if(delta > maxDelta){
+				expireTick = m_currentTick + maxDelta;
+			}
+		}
+
+		slot = &m_wheel[level][(expireTick >> (SCHEDULER_WHEEL_BITS * level)) & SCHEDULER_WHEEL_MASK];
+	}
+
+	task->m_slot = slot;
+	task->m_prev = NULL;
+	task->m_next = *slot;
+	if(*slot){
+		(*slot)->m_prev = task;
+	}
+	*slot = task;
+}
+
+void Scheduler::unlinkTask(SchedulerTask* task)
+{
+	if(task->m_prev){
+		task->m_prev->m_next = task->m_next;
+	}
+	else{
+		*task->m_slot = task->m_next;
+	}
+
+	if(task->m_next){
+		task->m_next->m_prev = task->m_prev;
+	}
+
+	task->m_next = NULL;
+	task->m_prev = NULL;
+	task->m_slot = NULL;
+}
+
+void Scheduler::cascade(uint32_t level)
+{
+	uint32_t index = (m_currentTick >> (SCHEDULER_WHEEL_BITS * level)) & SCHEDULER_WHEEL_MASK;
+	SchedulerTask* task = m_wheel[level][index];
+	m_wheel[level][index] = NULL;
+
+	while(task){
+		SchedulerTask* next = task->m_next;
+		insertTask(task);
+		task = next;
+	}
+
+	// the next level is due when this one wrapped around
+	if(index == 0 && level + 1 < SCHEDULER_WHEEL_LEVELS){
+		cascade(level + 1);
+	}
+}
+
+SchedulerTask* Scheduler::advance(uint64_t tick)
+{
+	SchedulerTask* expired = NULL;
+	SchedulerTask* expiredTail = NULL;
+
+	while(m_currentTick <= tick && m_eventCount != 0){
+		uint32_t index = m_currentTick & SCHEDULER_WHEEL_MASK;
+		if(index == 0){
+			cascade(1);
+		}
+
+		SchedulerTask* task = m_wheel[0][index];
+		m_wheel[0][index] = NULL;
+		while(task){
+			SchedulerTask* next = task->m_next;
+			m_eventTable[task->getEventId() & m_eventTableMask] = NULL;
+			--m_eventCount;
+
+			task->m_slot = NULL;
+			task->m_prev = NULL;
+			task->m_next = NULL;
+			if(expiredTail){
+				expiredTail->m_next = task;
 			}
 			else{
-				// was stopped, have to be deleted here
-				delete task;
+				expired = task;
 			}
+			expiredTail = task;
+			task = next;
 		}
+
+		++m_currentTick;
 	}
 
-	schedulerExceptionHandler.RemoveHandler();
+	if(m_eventCount == 0){
+		m_currentTick = tick + 1;
+	}
+
+	return expired;
+}
+
+uint64_t Scheduler::getNextTick() const
+{
+	for(uint32_t i = 0; i < SCHEDULER_WHEEL_SIZE; ++i){
+		uint64_t tick = m_currentTick + i;
+		// the wheel has to be cascaded when the first level wraps around
+		if(m_wheel[0][tick & SCHEDULER_WHEEL_MASK] || (tick & SCHEDULER_WHEEL_MASK) == 0){
+			return tick;
+		}
+	}
+
+	return m_currentTick + SCHEDULER_WHEEL_SIZE;
 }
 
 uint32_t Scheduler::addEvent(SchedulerTask* task)
@@ -113,43 +280,43 @@ uint32_t Scheduler::addEvent(SchedulerTask* task)
 	bool do_signal = false;
 	m_eventLock.lock();
 	if(Scheduler::m_threadState == Scheduler::STATE_RUNNING){
-
-		// check if the event has a valid id
-		if(task->getEventId() == 0){
-			// if not generate one
-			if(m_lastEventId >= 0xFFFFFFFF){
-				m_lastEventId = 0;
-			}
-			++m_lastEventId;
-			task->setEventId(m_lastEventId);
+		if(m_eventCount == 0){
+			// the wheel is idle, so there is nothing to catch up on
+			m_currentTick = getCurrentTick();
 		}
-		// insert the eventid in the list of active events
-		m_eventIds.insert(task->getEventId());
 
-		// add the event to the queue
-		m_eventList.push(task);
+		// event ids are always generated here, see generateEventId
+		task->setEventId(generateEventId());
+		task->m_expireTick = ((uint64_t)OTSYS_TIME() + task->getDelay() + SCHEDULER_TICK - 1) / SCHEDULER_TICK;
 
-		// if the list was empty or this event is the top in the list
-		// we have to signal it
-		do_signal = (task == m_eventList.top());
+		m_eventTable[task->getEventId() & m_eventTableMask] = task;
+		++m_eventCount;
+		insertTask(task);
+
+		// wake the scheduler if it is sleeping past this event
+		do_signal = (task->m_expireTick < m_wakeTick);
 
 #ifdef __DEBUG_SCHEDULER__
 		std::cout << "Scheduler: Added event " << task->getEventId() << std::endl;
 #endif
 	}
-#ifdef __DEBUG_SCHEDULER__
 	else{
+#ifdef __DEBUG_SCHEDULER__
 		std::cout << "Error: [Scheduler::addTask] Scheduler thread is terminated." << std::endl;
-	}
 #endif
+		m_eventLock.unlock();
+		delete task;
+		return 0;
+	}
 
+	uint32_t eventId = task->getEventId();
 	m_eventLock.unlock();
 
 	if(do_signal){
 		m_eventSignal.notify_one();
 	}
 
-	return task->getEventId();
+	return eventId;
 }
 
 
@@ -165,11 +332,15 @@ bool Scheduler::stopEvent(uint32_t eventid)
 	m_eventLock.lock();
 
 	// search the event id..
-	EventIdSet::iterator it = m_eventIds.find(eventid);
-	if(it != m_eventIds.end()) {
-		// if it is found erase from the list
-		m_eventIds.erase(it);
+	SchedulerTask* task = m_eventTable[eventid & m_eventTableMask];
+	if(task && task->getEventId() == eventid){
+		// if it is found take it out of the wheel
+		m_eventTable[eventid & m_eventTableMask] = NULL;
+		--m_eventCount;
+		unlinkTask(task);
 		m_eventLock.unlock();
+
+		delete task;
 		return true;
 	}
 	else{
@@ -198,11 +369,19 @@ void Scheduler::shutdown()
 	m_threadState = Scheduler::STATE_TERMINATED;
 
 	//this list should already be empty
-	while(!m_eventList.empty()){
-		m_eventList.pop();
+	for(std::vector<SchedulerTask*>::iterator it = m_eventTable.begin(); it != m_eventTable.end(); ++it){
+		delete *it;
+		*it = NULL;
+	}
+
+	for(uint32_t level = 0; level < SCHEDULER_WHEEL_LEVELS; ++level){
+		for(uint32_t i = 0; i < SCHEDULER_WHEEL_SIZE; ++i){
+			m_wheel[level][i] = NULL;
+		}
 	}
-	m_eventIds.clear();
+	m_eventCount = 0;
 	m_eventLock.unlock();
+	m_eventSignal.notify_one();
 }
 
 void Scheduler::join()
@@ -26,11 +26,18 @@
 #include "otsystem.h"
 #include <boost/bind.hpp>
 #include <vector>
-#include <queue>
-#include <set>
 
 #define SCHEDULER_MINTICKS 50
 
+// Resolution of the timing wheel in milliseconds
+#define SCHEDULER_TICK 10
+// The wheel has SCHEDULER_WHEEL_LEVELS levels of 2^SCHEDULER_WHEEL_BITS slots,
+// each level covering the whole range of the level below it in one slot
+#define SCHEDULER_WHEEL_BITS 8
+#define SCHEDULER_WHEEL_SIZE (1 << SCHEDULER_WHEEL_BITS)
+#define SCHEDULER_WHEEL_MASK (SCHEDULER_WHEEL_SIZE - 1)
+#define SCHEDULER_WHEEL_LEVELS 4
+
 class SchedulerTask : public Task
 {
 public:
@@ -39,25 +46,37 @@ public:
 	void setEventId(uint32_t eventid) {m_eventid = eventid;}
 	uint32_t getEventId() const {return m_eventid;}
 
-	boost::system_time getCycle() const {return m_expiration;}
-
-	bool operator<(const SchedulerTask& other) const
-	{
-		return getCycle() > other.getCycle();
-	}
+	uint32_t getDelay() const {return m_delay;}
 
 protected:
 
-	SchedulerTask(uint32_t delay, const boost::function<void (void)>& f) : Task(delay, f) {
+	template<class FunctionType>
+	SchedulerTask(uint32_t delay, const FunctionType& f) : Task(f) {
 		m_eventid = 0;
+		m_delay = delay;
+		m_expireTick = 0;
+		m_slot = NULL;
+		m_next = NULL;
+		m_prev = NULL;
 	}
 
 	uint32_t m_eventid;
-
-	friend SchedulerTask* createSchedulerTask(uint32_t, const boost::function<void (void)>&);
+	uint32_t m_delay;
+
+	// Intrusive links of the wheel slot the task is in, so neither
+	// inserting nor cancelling an event needs an allocation
+	uint64_t m_expireTick;
+	SchedulerTask** m_slot;
+	SchedulerTask* m_next;
+	SchedulerTask* m_prev;
+
+	template<class FunctionType>
+	friend SchedulerTask* createSchedulerTask(uint32_t, const FunctionType&);
+	friend class Scheduler;
 };
 
-inline SchedulerTask* createSchedulerTask(uint32_t delay, const boost::function<void (void)>& f)
+template<class FunctionType>
+inline SchedulerTask* createSchedulerTask(uint32_t delay, const FunctionType& f)
 {
 	assert(delay != 0);
 	if(delay < SCHEDULER_MINTICKS){
@@ -66,15 +85,6 @@ inline SchedulerTask* createSchedulerTask(uint32_t delay, const boost::function<
 	return new SchedulerTask(delay, f);
 }
 
-class lessSchedTask : public std::binary_function<SchedulerTask*&, SchedulerTask*&, bool>
-{
-public:
-	bool operator()(SchedulerTask*& t1, SchedulerTask*& t2)
-	{
-		return (*t1) < (*t2);
-	}
-};
-
 class Scheduler
 {
 public:
@@ -98,14 +108,33 @@ public:
 protected:
 	static void schedulerThread(void* p);
 
+	static uint64_t getCurrentTick() {return (uint64_t)OTSYS_TIME() / SCHEDULER_TICK;}
+
+	// All of these expect m_eventLock to be held
+	uint32_t generateEventId();
+	void growEventTable();
+	void insertTask(SchedulerTask* task);
+	void unlinkTask(SchedulerTask* task);
+	void cascade(uint32_t level);
+	SchedulerTask* advance(uint64_t tick);
+	uint64_t getNextTick() const;
+
 	boost::thread m_thread;
 	boost::mutex m_eventLock;
 	boost::condition_variable m_eventSignal;
 
 	uint32_t m_lastEventId;
-	std::priority_queue<SchedulerTask*, std::vector<SchedulerTask*>, lessSchedTask > m_eventList;
-	typedef std::set<uint32_t> EventIdSet;
-	EventIdSet m_eventIds;
+	uint32_t m_eventCount;
+	uint64_t m_currentTick;
+	// Tick the scheduler thread is sleeping until
+	uint64_t m_wakeTick;
+	SchedulerTask* m_wheel[SCHEDULER_WHEEL_LEVELS][SCHEDULER_WHEEL_SIZE];
+
+	// Pending tasks indexed by (event id & mask), ids are only handed out
+	// when their slot is free so stopEvent is a single lookup
+	std::vector<SchedulerTask*> m_eventTable;
+	uint32_t m_eventTableMask;
+
 	SchedulerState m_threadState;
 };
 
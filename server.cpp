@@ -40,13 +40,66 @@ bool ServicePort::m_logError = true;
 // Service
 
 ServiceManager::ServiceManager()
-	: m_io_service(), death_timer(m_io_service), running(false)
+	: m_io_service(), m_nextShard(0), death_timer(m_io_service), running(false)
 {
 }
 
 ServiceManager::~ServiceManager()
 {
 	stop();
+	stopShards();
+
+	for(std::vector<boost::asio::io_service*>::iterator it = m_shards.begin(); it != m_shards.end(); ++it){
+		delete *it;
+	}
+	m_shards.clear();
+}
+
+static void runShard(boost::asio::io_service* shard)
+{
+	try{
+		shard->run();
+	}
+	catch(boost::system::system_error& e){
+		LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
+	}
+}
+
+void ServiceManager::createShards()
+{
+	int64_t count = g_config.getNumber(ConfigManager::NETWORK_THREADS);
+	if(count <= 0){
+		count = boost::thread::hardware_concurrency();
+	}
+	count = std::max((int64_t)1, std::min((int64_t)64, count));
+
+	for(int64_t i = 0; i < count; ++i){
+		boost::asio::io_service* shard = new boost::asio::io_service(1);
+		m_shards.push_back(shard);
+		// keeps run() from returning while the shard has no connections
+		m_shardWork.push_back(new boost::asio::io_service::work(*shard));
+	}
+}
+
+void ServiceManager::stopShards()
+{
+	for(std::vector<boost::asio::io_service::work*>::iterator it = m_shardWork.begin(); it != m_shardWork.end(); ++it){
+		delete *it;
+	}
+	m_shardWork.clear();
+
+	for(std::vector<boost::asio::io_service*>::iterator it = m_shards.begin(); it != m_shards.end(); ++it){
+		(*it)->stop();
+	}
+	m_shardThreads.join_all();
+}
+
+boost::asio::io_service& ServiceManager::getNextShard()
+{
+	//only called by the acceptors, which all run on m_io_service
+	boost::asio::io_service* shard = m_shards[m_nextShard];
+	m_nextShard = (m_nextShard + 1) % m_shards.size();
+	return *shard;
 }
 
 std::list<uint16_t> ServiceManager::get_ports() const
@@ -70,12 +123,19 @@ void ServiceManager::run()
 {
 	assert(!running);
 	running = true;
+
+	for(std::vector<boost::asio::io_service*>::iterator it = m_shards.begin(); it != m_shards.end(); ++it){
+		m_shardThreads.create_thread(boost::bind(&runShard, *it));
+	}
+
 	try{
 		m_io_service.run();
 	}
 	catch(boost::system::system_error& e){
 		LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
 	}
+
+	stopShards();
 }
 
 void ServiceManager::stop()
@@ -107,8 +167,9 @@ void ServiceManager::stop()
 ///////////////////////////////////////////////////////////////////////////////
 // ServicePort
 
-ServicePort::ServicePort(boost::asio::io_service& io_service) :
+ServicePort::ServicePort(boost::asio::io_service& io_service, ServiceManager* manager) :
 	m_io_service(io_service),
+	m_manager(manager),
 	m_acceptor(NULL),
 	m_serverPort(0),
 	m_pendingStart(false)
@@ -147,10 +208,12 @@ void ServicePort::accept()
 	}
 
 	try{
-		boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(m_io_service);
+		// sockets are handed to the shards round-robin
+		boost::asio::io_service& shard = m_manager->getNextShard();
+		boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(shard);
 
 		m_acceptor->async_accept(*socket,
-			boost::bind(&ServicePort::onAccept, this, socket,
+			boost::bind(&ServicePort::onAccept, this, socket, &shard,
 			boost::asio::placeholders::error));
 	}
 	catch(boost::system::system_error& e){
@@ -161,7 +224,8 @@ void ServicePort::accept()
 	}
 }
 
-void ServicePort::onAccept(boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error)
+void ServicePort::onAccept(boost::asio::ip::tcp::socket* socket, boost::asio::io_service* shard,
+	const boost::system::error_code& error)
 {
 	if(!error){
 		if(m_services.empty()){
@@ -180,7 +244,7 @@ void ServicePort::onAccept(boost::asio::ip::tcp::socket* socket, const boost::sy
 
 		if(remote_ip != 0 && g_bans.acceptConnection(remote_ip)){
 
-			Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, m_io_service, shared_from_this());
+			Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, *shard, shared_from_this());
 
 			if(m_services.front()->is_single_socket()){
 				// Only one handler, and it will send first
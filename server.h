@@ -26,8 +26,10 @@
 #include <boost/asio.hpp>
 #include <boost/utility.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/thread.hpp>
 #include <iostream>
 #include <list>
+#include <vector>
 
 class Connection;
 typedef boost::shared_ptr<Connection> Connection_ptr;
@@ -36,6 +38,7 @@ class NetworkMessage;
 
 class ServiceBase;
 class ServicePort;
+class ServiceManager;
 
 typedef boost::shared_ptr<ServiceBase> Service_ptr;
 typedef boost::shared_ptr<ServicePort> ServicePort_ptr;
@@ -76,7 +79,7 @@ public:
 class ServicePort : boost::noncopyable, public boost::enable_shared_from_this<ServicePort>
 {
 public:
-	ServicePort(boost::asio::io_service& io_service);
+	ServicePort(boost::asio::io_service& io_service, ServiceManager* manager);
 	~ServicePort();
 
 	static void openAcceptor(boost::weak_ptr<ServicePort> weak_service, uint16_t port);
@@ -89,12 +92,14 @@ public:
 	Protocol* make_protocol(bool checksummed, NetworkMessage& msg) const;
 
 	void onStopServer();
-	void onAccept(boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error);
+	void onAccept(boost::asio::ip::tcp::socket* socket, boost::asio::io_service* shard,
+		const boost::system::error_code& error);
 
 protected:
 	void accept();
 
 	boost::asio::io_service& m_io_service;
+	ServiceManager* m_manager;
 	boost::asio::ip::tcp::acceptor* m_acceptor;
 	std::vector<Service_ptr> m_services;
 
@@ -123,12 +128,26 @@ public:
 
 	bool is_running() const {return !m_acceptors.empty();}
 	std::list<uint16_t> get_ports() const;
+
+	// Returns the io_service the next accepted connection will live on
+	boost::asio::io_service& getNextShard();
+	uint32_t getShardCount() const {return (uint32_t)m_shards.size();}
 protected:
 	void die();
+	void createShards();
+	void stopShards();
 
 	std::map<uint16_t, ServicePort_ptr> m_acceptors;
 
+	// m_io_service only runs the acceptors, every connection is bound to
+	// one of the shards (an io_service with a thread of its own) for its
+	// whole lifetime, so its handlers never run on two threads at once
 	boost::asio::io_service m_io_service;
+	std::vector<boost::asio::io_service*> m_shards;
+	std::vector<boost::asio::io_service::work*> m_shardWork;
+	boost::thread_group m_shardThreads;
+	uint32_t m_nextShard;
+
 	boost::asio::deadline_timer death_timer;
 	bool running;
 };
@@ -142,11 +161,15 @@ bool ServiceManager::add(uint16_t port)
 	}
 	ServicePort_ptr service_port;
 
+	if(m_shards.empty()){
+		createShards();
+	}
+
 	std::map<uint16_t, ServicePort_ptr>::iterator finder = 
 		m_acceptors.find(port);
 
 	if(finder == m_acceptors.end()){
-		service_port.reset(new ServicePort(m_io_service));
+		service_port.reset(new ServicePort(m_io_service, this));
 		service_port->open(port);
 		m_acceptors[port] = service_port;
 	}
@@ -0,0 +1,143 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Contiguous container for spectator queries
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_SPECTATORS_H__
+#define __OTSERV_SPECTATORS_H__
+
+#include "definitions.h"
+#include <cstring>
+#include <cassert>
+
+class Creature;
+
+// Number of spectators kept inside the object before spilling to the heap,
+// this covers nearly every query outside of crowded cities.
+#define SPECTATORVEC_INLINE_SIZE 32
+
+/**
+  * Small-vector of creatures returned by Map::getSpectators.
+  * Elements are stored contiguously, the first SPECTATORVEC_INLINE_SIZE
+  * without any heap allocation at all. Only the operations the spectator
+  * call sites need are provided.
+  */
+class SpectatorVec
+{
+public:
+	typedef Creature* value_type;
+	typedef Creature** iterator;
+	typedef Creature* const* const_iterator;
+	typedef uint32_t size_type;
+
+	SpectatorVec() :
+		m_data(m_inline), m_size(0), m_capacity(SPECTATORVEC_INLINE_SIZE) {}
+	SpectatorVec(const SpectatorVec& rhs) :
+		m_data(m_inline), m_size(0), m_capacity(SPECTATORVEC_INLINE_SIZE)
+	{
+		append(rhs.begin(), rhs.end());
+	}
+	~SpectatorVec(){
+		if(m_data != m_inline){
+			delete[] m_data;
+		}
+	}
+
+	SpectatorVec& operator=(const SpectatorVec& rhs){
+		if(this != &rhs){
+			m_size = 0;
+			append(rhs.begin(), rhs.end());
+		}
+		return *this;
+	}
+
+	iterator begin() {return m_data;}
+	iterator end() {return m_data + m_size;}
+	const_iterator begin() const {return m_data;}
+	const_iterator end() const {return m_data + m_size;}
+
+	size_type size() const {return m_size;}
+	size_type capacity() const {return m_capacity;}
+	bool empty() const {return m_size == 0;}
+
+	Creature* operator[](size_type index) const {
+		assert(index < m_size);
+		return m_data[index];
+	}
+
+	// Keeps the storage, so a vector can be reused between queries
+	void clear() {m_size = 0;}
+
+	void push_back(Creature* creature){
+		if(m_size == m_capacity){
+			reserve(m_capacity * 2);
+		}
+		m_data[m_size++] = creature;
+	}
+
+	// Removes the first occurrence of creature, keeping the order of the rest
+	bool erase(Creature* creature){
+		for(size_type i = 0; i < m_size; ++i){
+			if(m_data[i] == creature){
+				std::memmove(m_data + i, m_data + i + 1, (m_size - i - 1) * sizeof(Creature*));
+				--m_size;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void append(const_iterator first, const_iterator last){
+		size_type count = (size_type)(last - first);
+		if(m_size + count > m_capacity){
+			size_type newCapacity = m_capacity * 2;
+			while(newCapacity < m_size + count){
+				newCapacity *= 2;
+			}
+			reserve(newCapacity);
+		}
+		if(count > 0){
+			std::memcpy(m_data + m_size, first, count * sizeof(Creature*));
+			m_size += count;
+		}
+	}
+
+	void reserve(size_type newCapacity){
+		if(newCapacity <= m_capacity){
+			return;
+		}
+
+		Creature** newData = new Creature*[newCapacity];
+		if(m_size > 0){
+			std::memcpy(newData, m_data, m_size * sizeof(Creature*));
+		}
+		if(m_data != m_inline){
+			delete[] m_data;
+		}
+		m_data = newData;
+		m_capacity = newCapacity;
+	}
+
+protected:
+	Creature** m_data;
+	size_type m_size;
+	size_type m_capacity;
+	Creature* m_inline[SPECTATORVEC_INLINE_SIZE];
+};
+
+#endif
@@ -26,6 +26,7 @@
 #include "networkmessage.h"
 #include "outputmessage.h"
 #include "tools.h"
+#include "scheduler.h"
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 #include <sstream>
@@ -37,6 +38,20 @@
 
 extern ConfigManager g_config;
 extern Game g_game;
+extern Dispatcher g_dispatcher;
+extern Scheduler g_scheduler;
+
+//addresses remembered by the status query limit, the oldest are
+//forgotten first when there are more (some may query too soon then)
+static const size_t STATUS_MAX_TRACKED_IPS = 8192;
+
+static void addStatusBytes(OutputMessage_ptr output, const std::string& bytes)
+{
+	//AddBytes refuses blocks over 8192 bytes
+	for(size_t pos = 0; pos < bytes.size(); pos += 8192){
+		output->AddBytes(bytes.data() + pos, (uint32_t)std::min<size_t>(8192, bytes.size() - pos));
+	}
+}
 
 enum RequestedInfo_t{
 	REQUEST_BASIC_SERVER_INFO  = 0x01,
@@ -54,18 +69,38 @@ enum RequestedInfo_t{
 uint32_t ProtocolStatus::protocolStatusCount = 0;
 #endif
 std::map<uint32_t, int64_t> ProtocolStatus::ipConnectMap;
+std::deque<std::pair<int64_t, uint32_t> > ProtocolStatus::ipConnectQueue;
+boost::mutex ProtocolStatus::ipConnectMapLock;
 
 void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
 {
+	int64_t currentTime = OTSYS_TIME();
+	int64_t timeout = g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT);
+
+	ipConnectMapLock.lock();
+	while(!ipConnectQueue.empty() && (ipConnectQueue.front().first + timeout <= currentTime ||
+		ipConnectQueue.size() >= STATUS_MAX_TRACKED_IPS))
+	{
+		//the address may have queried again since, keep the newer entry
+		std::map<uint32_t, int64_t>::iterator it = ipConnectMap.find(ipConnectQueue.front().second);
+		if(it != ipConnectMap.end() && it->second == ipConnectQueue.front().first)
+			ipConnectMap.erase(it);
+
+		ipConnectQueue.pop_front();
+	}
+
 	std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(getIP());
 	if(it != ipConnectMap.end()){
-		if(OTSYS_TIME() < it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT)){
+		if(currentTime < it->second + timeout){
+			ipConnectMapLock.unlock();
 			getConnection()->closeConnection();
 			return;
 		}
 	}
 
-	ipConnectMap[getIP()] = OTSYS_TIME();
+	ipConnectMap[getIP()] = currentTime;
+	ipConnectQueue.push_back(std::make_pair(currentTime, getIP()));
+	ipConnectMapLock.unlock();
 
 	switch(msg.GetByte()){
 	//XML info protocol
@@ -75,9 +110,10 @@ void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
 			OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
 			if(output){
 				TRACK_MESSAGE(output);
-				Status* status = Status::instance();
-				std::string str = status->getStatusString();
-				output->AddBytes(str.c_str(), str.size());
+				StatusSnapshot_ptr snapshot = Status::instance()->getSnapshot();
+				if(snapshot){
+					addStatusBytes(output, snapshot->xml);
+				}
 				setRawMessages(true); // we dont want the size header, nor encryption
 				OutputMessagePool::getInstance()->send(output);
 			}
@@ -117,6 +153,7 @@ Status::Status()
 	m_playersonline = 0;
 	m_playerspeak = 0;
 	m_start = OTSYS_TIME();
+	m_rebuildQueued = false;
 }
 
 void Status::addPlayer()
@@ -124,11 +161,145 @@ void Status::addPlayer()
 	m_playersonline++;
 	if(m_playerspeak < m_playersonline)
 		m_playerspeak = m_playersonline;
+
+	invalidateSnapshot();
 }
 
 void Status::removePlayer()
 {
 	m_playersonline--;
+	invalidateSnapshot();
+}
+
+void Status::startRefresh()
+{
+	refresh();
+}
+
+void Status::refresh()
+{
+	rebuildSnapshot();
+
+	g_scheduler.addEvent(createSchedulerTask(std::max<int32_t>(1000, g_config.getNumber(ConfigManager::STATUS_REFRESH_INTERVAL)),
+		boost::bind(&Status::refresh, this)));
+}
+
+void Status::invalidateSnapshot()
+{
+	//logins and logouts in the same round share one rebuild
+	if(m_rebuildQueued)
+		return;
+
+	m_rebuildQueued = true;
+	g_dispatcher.addTask(createTask(boost::bind(&Status::rebuildSnapshot, this)));
+}
+
+StatusSnapshot_ptr Status::getSnapshot() const
+{
+	boost::mutex::scoped_lock lockClass(m_snapshotLock);
+	return m_snapshot;
+}
+
+std::string Status::getStatusString() const
+{
+	StatusSnapshot_ptr snapshot = getSnapshot();
+	if(!snapshot)
+		return "";
+
+	return snapshot->xml;
+}
+
+static void addInfoU16(std::string& s, uint16_t value)
+{
+	s += (char)(value & 0xFF);
+	s += (char)(value >> 8);
+}
+
+static void addInfoU32(std::string& s, uint32_t value)
+{
+	addInfoU16(s, (uint16_t)(value & 0xFFFF));
+	addInfoU16(s, (uint16_t)(value >> 16));
+}
+
+static void addInfoString(std::string& s, const std::string& value)
+{
+	//same limit as NetworkMessage::AddString
+	if(value.size() > 8192)
+		return;
+
+	addInfoU16(s, (uint16_t)value.size());
+	s += value;
+}
+
+void Status::rebuildSnapshot()
+{
+	m_rebuildQueued = false;
+
+	boost::shared_ptr<StatusSnapshot> snapshot(new StatusSnapshot);
+	snapshot->xml = buildStatusString();
+
+	uint64_t running = getUptime();
+	std::stringstream ss;
+
+	std::string* info = &snapshot->info[0];
+	info->push_back((char)0x10); // server info
+	addInfoString(*info, g_config.getString(ConfigManager::SERVER_NAME));
+	addInfoString(*info, g_config.getString(ConfigManager::IP));
+	ss << g_config.getNumber(ConfigManager::LOGIN_PORT);
+	addInfoString(*info, ss.str());
+
+	info = &snapshot->info[1];
+	info->push_back((char)0x11); // server info - owner info
+	addInfoString(*info, g_config.getString(ConfigManager::OWNER_NAME));
+	addInfoString(*info, g_config.getString(ConfigManager::OWNER_EMAIL));
+
+	info = &snapshot->info[2];
+	info->push_back((char)0x12); // server info - misc
+	addInfoString(*info, g_config.getString(ConfigManager::MOTD));
+	addInfoString(*info, g_config.getString(ConfigManager::LOCATION));
+	addInfoString(*info, g_config.getString(ConfigManager::URL));
+	addInfoU32(*info, (uint32_t)(running >> 32)); // this method prevents a big number parsing
+	addInfoU32(*info, (uint32_t)(running));       // since servers can be online for months ;)
+
+	info = &snapshot->info[3];
+	info->push_back((char)0x20); // players info
+	addInfoU32(*info, m_playersonline);
+	addInfoU32(*info, g_config.getNumber(ConfigManager::MAX_PLAYERS));
+	addInfoU32(*info, m_playerspeak);
+
+	uint32_t mapWidth, mapHeight;
+	g_game.getMapDimensions(mapWidth, mapHeight);
+
+	info = &snapshot->info[4];
+	info->push_back((char)0x30); // map info
+	addInfoString(*info, m_mapname);
+	addInfoString(*info, m_mapauthor);
+	addInfoU16(*info, mapWidth);
+	addInfoU16(*info, mapHeight);
+
+	info = &snapshot->info[5];
+	info->push_back((char)0x21); // players info - online players list
+	addInfoU32(*info, m_playersonline);
+	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end(); ++it){
+		//Send the most common info
+		addInfoString(*info, it->second->getName());
+		addInfoU32(*info, it->second->getLevel());
+
+		if(!it->second->isRemoved()){
+			snapshot->players.insert(asUpperCaseString(it->second->getName()));
+		}
+	}
+
+	//info[6] (player status) depends on the request
+
+	info = &snapshot->info[7];
+	info->push_back((char)0x23); // server software info
+	addInfoString(*info, OTSERV_NAME);
+	addInfoString(*info, OTSERV_VERSION);
+	addInfoString(*info, OTSERV_CLIENT_VERSION);
+
+	boost::mutex::scoped_lock lockClass(m_snapshotLock);
+	m_snapshot = snapshot;
 }
 
 template <typename T>
@@ -145,7 +316,7 @@ void addXMLProperty(xmlNodePtr p, const std::string& tag, const std::string& val
 	xmlSetProp(p, (const xmlChar*)tag.c_str(), (const xmlChar*)val.c_str());
 }
 
-std::string Status::getStatusString() const
+std::string Status::buildStatusString() const
 {
 	std::string xml;
 
@@ -232,36 +403,9 @@ void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMe
 	// the client selects which information may be
 	// sent back, so we'll save some bandwidth and
 	// make many
-	std::stringstream ss;
-	uint64_t running = getUptime();
-	// since we haven't all the things on the right place like map's
-	// creator/info and other things, i'll put the info chunked into
-	// operators, so the httpd server will only receive the existing
-	// properties of the server, such serverinfo, playersinfo and so
-
-	if(requestedInfo & REQUEST_BASIC_SERVER_INFO){
-		output->AddByte(0x10); // server info
-		output->AddString(g_config.getString(ConfigManager::SERVER_NAME).c_str());
-		output->AddString(g_config.getString(ConfigManager::IP).c_str());
-		ss << g_config.getNumber(ConfigManager::LOGIN_PORT);
-		output->AddString(ss.str().c_str());
-		ss.str("");
-	}
-
-	if(requestedInfo & REQUEST_OWNER_SERVER_INFO){
-		output->AddByte(0x11); // server info - owner info
-		output->AddString(g_config.getString(ConfigManager::OWNER_NAME).c_str());
-		output->AddString(g_config.getString(ConfigManager::OWNER_EMAIL).c_str());
-	}
-
-	if(requestedInfo & REQUEST_MISC_SERVER_INFO){
-		output->AddByte(0x12); // server info - misc
-		output->AddString(g_config.getString(ConfigManager::MOTD).c_str());
-		output->AddString(g_config.getString(ConfigManager::LOCATION).c_str());
-		output->AddString(g_config.getString(ConfigManager::URL).c_str());
-		output->AddU32((uint32_t)(running >> 32)); // this method prevents a big number parsing
-		output->AddU32((uint32_t)(running));       // since servers can be online for months ;)
-	}
+	StatusSnapshot_ptr snapshot = getSnapshot();
+	if(!snapshot)
+		return;
 
 	/*
 	// COMPLETELY breaks backwards-compatibility
@@ -274,52 +418,24 @@ void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMe
 		output->AddU16(g_config.getNumber(ConfigManager::RATE_SPAWN));
 	}
 	*/
-	if(requestedInfo & REQUEST_PLAYERS_INFO){
-		output->AddByte(0x20); // players info
-		output->AddU32(m_playersonline);
-		output->AddU32(g_config.getNumber(ConfigManager::MAX_PLAYERS));
-		output->AddU32(m_playerspeak);
-	}
-
-	if(requestedInfo & REQUEST_MAP_INFO){
-		output->AddByte(0x30); // map info
-		output->AddString(m_mapname.c_str());
-		output->AddString(m_mapauthor.c_str());
-		uint32_t mapWidth, mapHeight;
-		g_game.getMapDimensions(mapWidth, mapHeight);
-		output->AddU16(mapWidth);
-		output->AddU16(mapHeight);
-	}
-
-	if(requestedInfo & REQUEST_EXT_PLAYERS_INFO){
-		output->AddByte(0x21); // players info - online players list
-		output->AddU32(m_playersonline);
-		for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end(); ++it){
-			//Send the most common info
-			output->AddString(it->second->getName());
-			output->AddU32(it->second->getLevel());
-		}
-	}
-
-	if(requestedInfo & REQUEST_PLAYER_STATUS_INFO){
-		output->AddByte(0x22); // players info - online status info of a player
-		const std::string name = msg.GetString();
-		if(g_game.getPlayerByName(name) != NULL){
-			output->AddByte(0x01);
+	for(uint32_t i = 0; i < 8; ++i){
+		if(!(requestedInfo & (1 << i)))
+			continue;
+
+		if((1 << i) == REQUEST_PLAYER_STATUS_INFO){
+			output->AddByte(0x22); // players info - online status info of a player
+			const std::string name = msg.GetString();
+			if(snapshot->players.find(asUpperCaseString(name)) != snapshot->players.end()){
+				output->AddByte(0x01);
+			}
+			else{
+				output->AddByte(0x00);
+			}
 		}
 		else{
-			output->AddByte(0x00);
+			addStatusBytes(output, snapshot->info[i]);
 		}
 	}
-
-	if(requestedInfo & REQUEST_SERVER_SOFTWARE_INFORMATION){
-		output->AddByte(0x23); // server software info
-		output->AddString(OTSERV_NAME);
-		output->AddString(OTSERV_VERSION);
-		output->AddString(OTSERV_CLIENT_VERSION);
-	}
-
-	return;
 }
 
 bool Status::hasSlot() const
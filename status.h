@@ -26,6 +26,9 @@
 #include "protocol.h"
 #include <string>
 #include <map>
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
 
 class ProtocolStatus : public Protocol
 {
@@ -58,12 +61,28 @@ public:
 
 protected:
 	static std::map<uint32_t, int64_t> ipConnectMap;
+	//addresses in the order they queried, to drop the expired ones
+	static std::deque<std::pair<int64_t, uint32_t> > ipConnectQueue;
+	//status requests are parsed on every network thread
+	static boost::mutex ipConnectMapLock;
 
 	#ifdef __DEBUG_NET_DETAIL__
 	virtual void deleteProtocolTask();
 	#endif
 };
 
+// Answers to the status queries, serialized on the dispatcher so the
+// network threads only copy bytes and never read the game state
+struct StatusSnapshot {
+	std::string xml;
+	//sections of the 0x01 answer, indexed by the bit requesting them
+	std::string info[8];
+	//upper case names of the players online
+	std::unordered_set<std::string> players;
+};
+
+typedef boost::shared_ptr<const StatusSnapshot> StatusSnapshot_ptr;
+
 class Status{
 public:
 	// procs
@@ -77,6 +96,10 @@ public:
 	void removePlayer();
 	bool hasSlot() const;
 
+	//builds the first snapshot and keeps it refreshed
+	void startRefresh();
+	StatusSnapshot_ptr getSnapshot() const;
+
 	std::string getStatusString() const;
 	void getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMessage& msg) const;
 	uint32_t getPlayersOnline() const {return m_playersonline;}
@@ -85,11 +108,20 @@ public:
 protected:
 	Status();
 
+	void refresh();
+	void invalidateSnapshot();
+	void rebuildSnapshot();
+	std::string buildStatusString() const;
+
 private:
 	uint64_t m_start;
 	int m_playersonline, m_playerspeak;
 	std::string m_mapname, m_mapauthor;
 
+	StatusSnapshot_ptr m_snapshot;
+	mutable boost::mutex m_snapshotLock;
+	bool m_rebuildQueued;
+
 };
 
 #endif
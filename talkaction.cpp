@@ -25,6 +25,13 @@
 #include "admin.h"
 #include "status.h"
 #include "protocollogin.h"
+#include "objectpool.h"
+#include "workerpool.h"
+#include "savemanager.h"
+#include "ban.h"
+#ifdef __OTSERV_ALLOCATOR__
+#include "allocator.h"
+#endif
 #endif
 
 #include "creature.h"
@@ -46,6 +53,11 @@
 extern Game g_game;
 extern ConfigManager g_config;
 
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+extern WorkerPool g_loginWorkers;
+extern BanManager g_bans;
+#endif
+
 TalkActions::TalkActions() :
 m_scriptInterface("TalkAction Interface")
 {
@@ -412,6 +424,70 @@ bool TalkAction::serverDiag(Player* player, const std::string& words, const std:
 	text << "Auto message pool: " << OutputMessagePool::getInstance()->getAutoMessageCount() << "\n";
 	text << "Free message pool: " << OutputMessagePool::getInstance()->getAvailableMessageCount() << "\n";
 
+	DispatcherStats dispatcherStats = g_dispatcher.getStats();
+	text << "\nDispatcher:\n";
+	text << "--------------------\n";
+	text << "Queued tasks: " << dispatcherStats.queueSize << " (max " << dispatcherStats.maxQueueSize << ")\n";
+	text << "Executed tasks: " << dispatcherStats.tasks << " in " << dispatcherStats.batches << " batches\n";
+	if(dispatcherStats.tasks > 0){
+		text << "Wait time: " << dispatcherStats.totalWaitTime / dispatcherStats.tasks << "ms avg, "
+			<< dispatcherStats.maxWaitTime << "ms max\n";
+	}
+
+	text << "\nLogin workers:\n";
+	text << "--------------------\n";
+	text << "Threads: " << g_loginWorkers.getThreadCount() << "\n";
+	text << "Queued logins: " << g_loginWorkers.getQueueSize() << "\n";
+	text << "Indexed bans: " << g_bans.getIndexedBanCount() << "\n";
+
+	SaveStats saveStats = SaveManager::getInstance()->getStats();
+	text << "\nGlobal saves:\n";
+	text << "--------------------\n";
+	text << "Saves: " << saveStats.saves << " (" << saveStats.failedSaves << " failed)\n";
+	text << "Queued saves: " << saveStats.queueSize << "\n";
+	text << "Own connection: " << (saveStats.ownConnection ? "yes" : "no") << "\n";
+	text << "Last save: " << saveStats.lastPlayers << " players (" << saveStats.lastPlayersSkipped << " skipped), capture "
+		<< saveStats.lastCaptureTime << "ms, write " << saveStats.lastWriteTime << "ms\n";
+
+	const SpectatorCacheStats& spectatorStats = g_game.getSpectatorCacheStats();
+	text << "\nSpectator cache:\n";
+	text << "--------------------\n";
+	text << "Entries: " << g_game.getSpectatorCacheSize() << "\n";
+	text << "Hits: " << spectatorStats.hits << "\n";
+	text << "Misses: " << spectatorStats.misses << "\n";
+	text << "Updates: " << spectatorStats.updates << "\n";
+	text << "Evictions: " << spectatorStats.evictions << "\n";
+
+	std::vector<ObjectPoolStats> poolStats;
+	ObjectPool::getAllStats(poolStats);
+	text << "\nObject pools (objects/capacity, slabs):\n";
+	text << "--------------------\n";
+	for(std::vector<ObjectPoolStats>::iterator it = poolStats.begin(); it != poolStats.end(); ++it){
+		text << it->name << ": " << it->objects << "/" << it->capacity << ", "
+			<< it->slabs << " (" << it->emptySlabs << " empty)\n";
+	}
+
+	#ifdef __OTSERV_ALLOCATOR__
+	std::vector<AllocatorClassStats> allocatorStats;
+	PoolManager::getInstance().getStats(allocatorStats);
+	text << "\nAllocator (block size: blocks in use, used/reserved kb):\n";
+	text << "--------------------\n";
+	for(std::vector<AllocatorClassStats>::iterator it = allocatorStats.begin(); it != allocatorStats.end(); ++it){
+		if(it->allocations == 0){
+			continue;
+		}
+
+		if(it->blockSize == 0){
+			text << "malloc: ";
+		}
+		else{
+			text << it->blockSize << ": ";
+		}
+		text << (it->allocations - it->deallocations) << ", "
+			<< it->usedBytes / 1024 << "/" << it->reservedBytes / 1024 << "\n";
+	}
+	#endif
+
 	text << "\nLibraries:\n";
 	text << "--------------------\n";
 	text << "asio: " << BOOST_ASIO_VERSION << "\n";
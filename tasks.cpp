@@ -22,14 +22,112 @@
 #include "exception.h"
 #include "tasks.h"
 #include "outputmessage.h"
+#include "otsystem.h"
 #include "game.h"
+#include <algorithm>
+#include <vector>
 
 extern Game g_game;
 
-Dispatcher::Dispatcher()
+boost::atomic<int64_t> TaskClock::m_now(OTSYS_MONOTONIC_TIME());
+
+// Task memory is recycled per size class. Every thread keeps its own free
+// lists, since tasks are usually created on one thread and deleted on the
+// dispatcher thread whole batches of free blocks are exchanged through a
+// shared list once a thread holds too many or runs out.
+#define TASK_POOL_GRANULARITY 16
+#define TASK_POOL_CLASSES 16
+#define TASK_POOL_BATCH 128
+
+namespace {
+	struct TaskFreeBlock{
+		TaskFreeBlock* next;
+	};
+
+	struct TaskFreeList{
+		TaskFreeBlock* head;
+		uint32_t count;
+	};
+
+	OTSERV_THREAD_LOCAL TaskFreeList taskFreeLists[TASK_POOL_CLASSES];
+
+	boost::mutex taskPoolLock;
+	std::vector<TaskFreeBlock*> taskPoolBatches[TASK_POOL_CLASSES];
+
+	inline uint32_t getTaskSizeClass(size_t size)
+	{
+		return (uint32_t)((size + TASK_POOL_GRANULARITY - 1) / TASK_POOL_GRANULARITY) - 1;
+	}
+}
+
+void* Task::operator new(size_t size)
 {
-	m_taskList.clear();
-	m_threadState = STATE_TERMINATED;
+	uint32_t sizeClass = getTaskSizeClass(size);
+	if(sizeClass >= TASK_POOL_CLASSES){
+		return ::operator new(size);
+	}
+
+	TaskFreeList& freeList = taskFreeLists[sizeClass];
+	if(!freeList.head){
+		boost::mutex::scoped_lock lockClass(taskPoolLock);
+		std::vector<TaskFreeBlock*>& batches = taskPoolBatches[sizeClass];
+		if(!batches.empty()){
+			freeList.head = batches.back();
+			freeList.count = TASK_POOL_BATCH;
+			batches.pop_back();
+		}
+	}
+
+	if(freeList.head){
+		TaskFreeBlock* block = freeList.head;
+		freeList.head = block->next;
+		--freeList.count;
+		return block;
+	}
+
+	return ::operator new((sizeClass + 1) * TASK_POOL_GRANULARITY);
+}
+
+void Task::operator delete(void* p, size_t size)
+{
+	if(!p){
+		return;
+	}
+
+	uint32_t sizeClass = getTaskSizeClass(size);
+	if(sizeClass >= TASK_POOL_CLASSES){
+		::operator delete(p);
+		return;
+	}
+
+	TaskFreeList& freeList = taskFreeLists[sizeClass];
+	TaskFreeBlock* block = static_cast<TaskFreeBlock*>(p);
+	block->next = freeList.head;
+	freeList.head = block;
+	++freeList.count;
+
+	if(freeList.count == 2 * TASK_POOL_BATCH){
+		// hand the older half over to the threads that allocate tasks
+		TaskFreeBlock* last = freeList.head;
+		for(uint32_t i = 1; i < TASK_POOL_BATCH; ++i){
+			last = last->next;
+		}
+
+		TaskFreeBlock* batch = last->next;
+		last->next = NULL;
+		freeList.count = TASK_POOL_BATCH;
+
+		boost::mutex::scoped_lock lockClass(taskPoolLock);
+		taskPoolBatches[sizeClass].push_back(batch);
+	}
+}
+
+Dispatcher::Dispatcher() :
+	m_taskList(NULL), m_priorityTaskList(NULL), m_sleeping(false), m_queueSize(0),
+	m_maxQueueSize(0), m_producers(0), m_threadState(STATE_TERMINATED)
+{
+	m_batch = NULL;
+	memset(&m_stats, 0, sizeof(m_stats));
 }
 
 void Dispatcher::start()
@@ -49,51 +147,30 @@ void Dispatcher::dispatcherThread(void* p)
 	std::cout << "Starting Dispatcher" << std::endl;
 	#endif
 
-	OutputMessagePool* outputPool;
-
-	// NOTE: second argument defer_lock is to prevent from immediate locking
-	boost::unique_lock<boost::mutex> taskLockUnique(dispatcher->m_taskLock, boost::defer_lock);
-
 	while(dispatcher->m_threadState != STATE_TERMINATED){
-		Task* task = NULL;
-
-		// check if there are tasks waiting
-		taskLockUnique.lock();
-
-		if(dispatcher->m_taskList.empty()){
-			//if the list is empty wait for signal
+		dispatcher->m_batch = dispatcher->takeTasks();
+		if(!dispatcher->m_batch){
+			//if the queue is empty wait for signal
 			#ifdef __DEBUG_SCHEDULER__
 			std::cout << "Dispatcher: Waiting for task" << std::endl;
 			#endif
-			dispatcher->m_taskSignal.wait(taskLockUnique);
+			dispatcher->waitForTasks();
+			continue;
 		}
 
 		#ifdef __DEBUG_SCHEDULER__
 		std::cout << "Dispatcher: Signalled" << std::endl;
 		#endif
 
-		if(!dispatcher->m_taskList.empty() && (dispatcher->m_threadState != STATE_TERMINATED)){
-			// take the first task
-			task = dispatcher->m_taskList.front();
-			dispatcher->m_taskList.pop_front();
-		}
-
-		taskLockUnique.unlock();
+		++dispatcher->m_stats.batches;
 
-		// finally execute the task...
-		if(task){
-			if(!task->hasExpired()){
-				OutputMessagePool::getInstance()->startExecutionFrame();
-				(*task)();
+		// a task may shut the dispatcher down, flush() then runs the rest of the batch
+		while(dispatcher->m_batch && (dispatcher->m_threadState != STATE_TERMINATED)){
+			Task* task = dispatcher->m_batch;
+			dispatcher->m_batch = task->m_nextTask;
 
-				outputPool = OutputMessagePool::getInstance();
-				if(outputPool)
-					outputPool->sendAll();
-
-				g_game.clearSpectatorCache();
-			}
-
-			delete task;
+			// finally execute the task...
+			dispatcher->executeTask(task);
 
 			#ifdef __DEBUG_SCHEDULER__
 			std::cout << "Dispatcher: Executing task" << std::endl;
@@ -104,50 +181,150 @@ void Dispatcher::dispatcherThread(void* p)
 	dispatcherExceptionHandler.RemoveHandler();
 }
 
-void Dispatcher::addTask(Task* task, bool push_front /*= false*/)
+Task* Dispatcher::takeTasks()
 {
-	bool do_signal = false;
-	m_taskLock.lock();
-	if(m_threadState == STATE_RUNNING){
+	Task* batch = NULL;
 
-		do_signal = m_taskList.empty();
-		if(push_front){
-			m_taskList.push_front(task);
-		}
-		else{
-			m_taskList.push_back(task);
+	// both stacks are newest first, reversing them gives execution order
+	Task* task = m_taskList.exchange(NULL, boost::memory_order_acquire);
+	while(task){
+		Task* next = task->m_nextTask;
+		task->m_nextTask = batch;
+		batch = task;
+		task = next;
+	}
+
+	task = m_priorityTaskList.exchange(NULL, boost::memory_order_acquire);
+	if(task){
+		Task* priorityBatch = NULL;
+		Task* priorityTail = task;
+		while(task){
+			Task* next = task->m_nextTask;
+			task->m_nextTask = priorityBatch;
+			priorityBatch = task;
+			task = next;
 		}
 
+		priorityTail->m_nextTask = batch;
+		batch = priorityBatch;
+	}
+
+	return batch;
+}
+
+void Dispatcher::waitForTasks()
+{
+	boost::unique_lock<boost::mutex> taskLockUnique(m_taskLock);
+	m_sleeping.store(true);
+	// re-check after announcing the sleep, a producer that missed the flag
+	// has already published its task
+	if(m_taskList.load() == NULL && m_priorityTaskList.load() == NULL &&
+		m_threadState != STATE_TERMINATED)
+	{
+		m_taskSignal.wait(taskLockUnique);
+	}
+	m_sleeping.store(false);
+}
+
+void Dispatcher::executeTask(Task* task)
+{
+	--m_queueSize;
+
+	int64_t now = TaskClock::update();
+	uint32_t waitTime = (uint32_t)std::max((int64_t)0, now - task->m_queueTime);
+	++m_stats.tasks;
+	m_stats.totalWaitTime += waitTime;
+	if(waitTime > m_stats.maxWaitTime){
+		m_stats.maxWaitTime = waitTime;
+	}
+
+	if(!task->hasExpired()){
+		OutputMessagePool::getInstance()->startExecutionFrame();
+		(*task)();
+
+		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+		if(outputPool)
+			outputPool->sendAll();
+
+		g_game.cleanSpectatorCache();
+	}
+
+	delete task;
+}
+
+bool Dispatcher::addTask(Task* task, bool push_front /*= false*/)
+{
+	// announce the producer before checking the state, shutdown() does
+	// the opposite, so either the task is refused here or it is flushed
+	++m_producers;
+	if(m_threadState.load() != STATE_RUNNING){
+		--m_producers;
 		#ifdef __DEBUG_SCHEDULER__
-		std::cout << "Dispatcher: Added task" << std::endl;
+		std::cout << "Error: [Dispatcher::addTask] Dispatcher thread is terminated." << std::endl;
 		#endif
+		delete task;
+		return false;
 	}
-#ifdef __DEBUG_SCHEDULER__
-	else{
-		std::cout << "Error: [Dispatcher::addTask] Dispatcher thread is terminated." << std::endl;
+
+	task->m_queueTime = TaskClock::now();
+
+	uint32_t queueSize = ++m_queueSize;
+	uint32_t maxQueueSize = m_maxQueueSize.load(boost::memory_order_relaxed);
+	while(queueSize > maxQueueSize &&
+		!m_maxQueueSize.compare_exchange_weak(maxQueueSize, queueSize, boost::memory_order_relaxed)){
+		//maxQueueSize was reloaded, try again
 	}
-#endif
 
-	m_taskLock.unlock();
+	boost::atomic<Task*>& taskList = (push_front ? m_priorityTaskList : m_taskList);
+	Task* head = taskList.load(boost::memory_order_relaxed);
+	do{
+		task->m_nextTask = head;
+	}while(!taskList.compare_exchange_weak(head, task, boost::memory_order_seq_cst, boost::memory_order_relaxed));
+	--m_producers;
+
+	#ifdef __DEBUG_SCHEDULER__
+	std::cout << "Dispatcher: Added task" << std::endl;
+	#endif
 
-	// send a signal if the list was empty
-	if(do_signal){
+	// the dispatcher only needs a signal if it is going to sleep
+	if(m_sleeping.load()){
+		m_taskLock.lock();
+		m_taskLock.unlock();
 		m_taskSignal.notify_one();
 	}
+	return true;
+}
+
+DispatcherStats Dispatcher::getStats() const
+{
+	DispatcherStats stats = m_stats;
+	stats.queueSize = m_queueSize;
+	stats.maxQueueSize = m_maxQueueSize;
+	return stats;
 }
 
 void Dispatcher::flush()
 {
-	Task* task = NULL;
-	while(!m_taskList.empty()){
-		task = m_taskList.front();
-		m_taskList.pop_front();
+	Task* task = m_batch;
+	m_batch = NULL;
+	if(!task){
+		task = takeTasks();
+	}
+
+	while(task){
+		Task* next = task->m_nextTask;
+		--m_queueSize;
 		(*task)();
 		delete task;
 		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
 		if(outputPool)
 			outputPool->sendAll();
-		g_game.clearSpectatorCache();
+		g_game.cleanSpectatorCache();
+
+		task = next;
+		if(!task){
+			task = takeTasks();
+		}
 	}
 	#ifdef __DEBUG_SCHEDULER__
 	std::cout << "Flushing Dispatcher" << std::endl;
@@ -168,8 +345,13 @@ void Dispatcher::shutdown()
 {
 	m_taskLock.lock();
 	m_threadState = STATE_TERMINATED;
-	flush();
 	m_taskLock.unlock();
+	// let the tasks that got past the state check finish pushing
+	while(m_producers.load() != 0){
+		boost::this_thread::yield();
+	}
+	flush();
+	m_taskSignal.notify_one();
 	#ifdef __DEBUG_SCHEDULER__
 	std::cout << "Shutdown Dispatcher" << std::endl;
 	#endif
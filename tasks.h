@@ -23,48 +23,140 @@
 #define __OTSERV_TASKS_H__
 
 #include "definitions.h"
+#include "otsystem.h"
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <new>
 
 const int DISPATCHER_TASK_EXPIRATION = 2000;
 
+// Callables up to this size are stored inside the task itself
+#define TASK_INLINE_SIZE 64
+// How often (ms) the scheduler refreshes the task clock at the latest
+#define TASK_CLOCK_INTERVAL 100
+
+// Coarse monotonic milliseconds used for task expirations. It is refreshed
+// by the dispatcher before every task and by the scheduler thread at least
+// every TASK_CLOCK_INTERVAL, so creating a task never reads the system clock.
+class TaskClock{
+public:
+	static int64_t now() {return m_now.load(boost::memory_order_relaxed);}
+	static int64_t update(){
+		int64_t t = OTSYS_MONOTONIC_TIME();
+		m_now.store(t, boost::memory_order_relaxed);
+		return t;
+	}
+
+protected:
+	static boost::atomic<int64_t> m_now;
+};
+
 class Task{
 public:
 	// DO NOT allocate this class on the stack
-	Task(uint32_t ms, const boost::function<void (void)>& f) : m_f(f)
+	template<class FunctionType>
+	Task(uint32_t ms, const FunctionType& f)
+	{
+		setFunction(f);
+		m_expiration = TaskClock::now() + ms;
+		m_nextTask = NULL;
+		m_queueTime = 0;
+	}
+	template<class FunctionType>
+	Task(const FunctionType& f)
 	{
-		m_expiration = boost::get_system_time() + boost::posix_time::milliseconds(ms);
+		setFunction(f);
+		m_expiration = 0;
+		m_nextTask = NULL;
+		m_queueTime = 0;
 	}
-	Task(const boost::function<void (void)>& f)
-		: m_expiration(boost::date_time::not_a_date_time), m_f(f) {}
 
-	~Task() {}
+	virtual ~Task() {
+		m_destroy(m_function);
+	}
 
 	void operator()(){
-		m_f();
+		m_invoke(m_function);
 	}
 
 	void setDontExpire() {
-		m_expiration = boost::date_time::not_a_date_time;
+		m_expiration = 0;
 	}
 	bool hasExpired() const{
-		if(m_expiration == boost::date_time::not_a_date_time)
+		if(m_expiration == 0)
 			return false;
-		return m_expiration < boost::get_system_time();
+		return m_expiration < TaskClock::now();
 	}
+
+	// Tasks are recycled through a per-thread free list, see tasks.cpp
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 protected:
+	template<class FunctionType>
+	static void invokeFunction(void* f){
+		(*static_cast<FunctionType*>(f))();
+	}
+	template<class FunctionType>
+	static void destroyInlineFunction(void* f){
+		static_cast<FunctionType*>(f)->~FunctionType();
+	}
+	template<class FunctionType>
+	static void destroyHeapFunction(void* f){
+		delete static_cast<FunctionType*>(f);
+	}
+
+	template<class FunctionType>
+	void setFunction(const FunctionType& f){
+		m_invoke = &invokeFunction<FunctionType>;
+		setFunction(f, boost::integral_constant<bool, (sizeof(FunctionType) <= TASK_INLINE_SIZE)>());
+	}
+	template<class FunctionType>
+	void setFunction(const FunctionType& f, boost::true_type){
+		m_function = new(m_storage.buffer) FunctionType(f);
+		m_destroy = &destroyInlineFunction<FunctionType>;
+	}
+	template<class FunctionType>
+	void setFunction(const FunctionType& f, boost::false_type){
+		m_function = new FunctionType(f);
+		m_destroy = &destroyHeapFunction<FunctionType>;
+	}
+
 	// Expiration has another meaning for scheduler tasks,
 	// then it is the time the task should be added to the
 	// dispatcher
-	boost::system_time m_expiration;
-	boost::function<void (void)> m_f;
+	int64_t m_expiration;
+
+	void (*m_invoke)(void*);
+	void (*m_destroy)(void*);
+	void* m_function;
+	union{
+		char buffer[TASK_INLINE_SIZE];
+		int64_t alignInt;
+		double alignDouble;
+		void* alignPointer;
+	} m_storage;
+
+	// Intrusive link and enqueue time used by the dispatcher queue
+	Task* m_nextTask;
+	int64_t m_queueTime;
+
+private:
+	Task(const Task&);
+	Task& operator=(const Task&);
+
+	friend class Dispatcher;
 };
 
-inline Task* createTask(boost::function<void (void)> f){
+template<class FunctionType>
+inline Task* createTask(const FunctionType& f){
 	return new Task(f);
 }
 
-inline Task* createTask(uint32_t expiration, boost::function<void (void)> f){
+template<class FunctionType>
+inline Task* createTask(uint32_t expiration, const FunctionType& f){
 	return new Task(expiration, f);
 }
 
@@ -74,18 +166,32 @@ enum DispatcherState{
 	STATE_TERMINATED
 };
 
+struct DispatcherStats{
+	uint64_t tasks;
+	uint64_t batches;
+	uint64_t totalWaitTime;
+	uint32_t maxWaitTime;
+	uint32_t queueSize;
+	uint32_t maxQueueSize;
+};
+
 class Dispatcher{
 public:
 	Dispatcher();
 	~Dispatcher() {}
 
-	void addTask(Task* task, bool push_front = false);
+	// Can be called from any thread without taking a lock, tasks added
+	// with push_front run before all regular tasks that are still queued.
+	// Returns false and deletes the task once the dispatcher is stopping
+	bool addTask(Task* task, bool push_front = false);
 
 	void start();
 	void stop();
 	void shutdown();
 	void join();
 
+	DispatcherStats getStats() const;
+
 	enum DispatcherState{
 		STATE_RUNNING,
 		STATE_CLOSING,
@@ -96,14 +202,33 @@ protected:
 
 	static void dispatcherThread(void* p);
 
+	// Takes every queued task at once, in execution order
+	Task* takeTasks();
+	void waitForTasks();
+	void executeTask(Task* task);
 	void flush();
 
 	boost::thread m_thread;
 	boost::mutex m_taskLock;
 	boost::condition_variable m_taskSignal;
 
-	std::list<Task*> m_taskList;
-	DispatcherState m_threadState;
+	// Producers push onto these lock-free stacks, the dispatcher thread
+	// swaps out a whole stack and reverses it into m_batch
+	boost::atomic<Task*> m_taskList;
+	boost::atomic<Task*> m_priorityTaskList;
+	// Set while the dispatcher thread is about to sleep, producers only
+	// have to signal then
+	boost::atomic<bool> m_sleeping;
+	Task* m_batch;
+
+	boost::atomic<uint32_t> m_queueSize;
+	boost::atomic<uint32_t> m_maxQueueSize;
+	DispatcherStats m_stats;
+
+	// Producers inside addTask, shutdown() waits for them so that no task
+	// is pushed after its last flush
+	boost::atomic<uint32_t> m_producers;
+	boost::atomic<DispatcherState> m_threadState;
 };
 
 extern Dispatcher g_dispatcher;
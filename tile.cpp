@@ -21,6 +21,7 @@
 #include "otpch.h"
 
 #include "tile.h"
+#include "objectpool.h"
 #include "housetile.h"
 #include "game.h"
 #include "player.h"
@@ -41,6 +42,38 @@ extern ConfigManager g_config;
 StaticTile real_null_tile(0xFFFF, 0xFFFF, 0xFFFF);
 Tile& Tile::null_tile = real_null_tile;
 
+static ObjectPool& getDynamicTilePool()
+{
+	static ObjectPool* pool = new ObjectPool("DynamicTile", sizeof(DynamicTile));
+	return *pool;
+}
+
+void* DynamicTile::operator new(size_t size)
+{
+	return getDynamicTilePool().allocate(size);
+}
+
+void DynamicTile::operator delete(void* p, size_t size)
+{
+	getDynamicTilePool().deallocate(p, size);
+}
+
+static ObjectPool& getStaticTilePool()
+{
+	static ObjectPool* pool = new ObjectPool("StaticTile", sizeof(StaticTile));
+	return *pool;
+}
+
+void* StaticTile::operator new(size_t size)
+{
+	return getStaticTilePool().allocate(size);
+}
+
+void StaticTile::operator delete(void* p, size_t size)
+{
+	getStaticTilePool().deallocate(p, size);
+}
+
 bool Tile::hasProperty(enum ITEMPROPERTY prop, bool checkSolidForItems /* =false */) const
 {
 	if(ground && ground->hasProperty(prop)){
@@ -376,6 +409,9 @@ const Creature* Tile::getTopVisibleCreature(const Creature* creature, bool check
 void Tile::onAddTileItem(Item* item)
 {
 	updateTileFlags(item, false);
+	if(qt_node){
+		qt_node->increaseTileRevision();
+	}
 
 	const Position& cylinderMapPos = getPosition();
 
@@ -398,6 +434,9 @@ void Tile::onAddTileItem(Item* item)
 
 void Tile::onUpdateTileItem(Item* oldItem, const ItemType& oldType, Item* newItem, const ItemType& newType)
 {
+	if(qt_node){
+		qt_node->increaseTileRevision();
+	}
 	const Position& cylinderMapPos = getPosition();
 
 	const SpectatorVec& list = g_game.getSpectators(cylinderMapPos);
@@ -420,6 +459,9 @@ void Tile::onUpdateTileItem(Item* oldItem, const ItemType& oldType, Item* newIte
 void Tile::onRemoveTileItem(const SpectatorVec& list, std::vector<uint32_t>& oldStackPosVector, Item* item)
 {
 	updateTileFlags(item, true);
+	if(qt_node){
+		qt_node->increaseTileRevision();
+	}
 
 	const Position& cylinderMapPos = getPosition();
 	const ItemType& iType = Item::items[item->getID()];
@@ -444,6 +486,10 @@ void Tile::onRemoveTileItem(const SpectatorVec& list, std::vector<uint32_t>& old
 
 void Tile::onUpdateTile()
 {
+	++m_revision;
+	if(qt_node){
+		qt_node->increaseTileRevision();
+	}
 	const Position& cylinderMapPos = getPosition();
 
 	const SpectatorVec& list = g_game.getSpectators(cylinderMapPos);
@@ -493,6 +539,7 @@ void Tile::moveCreature(Creature* creature, Cylinder* toCylinder, bool teleport
 		qt_node->removeCreature(creature);
 		newTile->qt_node->addCreature(creature);
 	}
+	g_game.updateSpectatorCache(creature, this, newTile);
 
 	//add the creature
 	newTile->__addThing(creature);
@@ -877,7 +924,6 @@ void Tile::__addThing(int32_t index, Thing* thing)
 {
 	Creature* creature = thing->getCreature();
 	if(creature){
-		g_game.clearSpectatorCache();
 		creature->setParent(this);
 		CreatureVector* creatures = makeCreatures();
 		creatures->insert(creatures->begin(), creature);
@@ -1139,7 +1185,6 @@ void Tile::__removeThing(Thing* thing, uint32_t count)
 				return; //RET_NOTPOSSIBLE;
 			}
 
-			g_game.clearSpectatorCache();
 			creatures->erase(it);
 			--thingCount;
 			return;
@@ -1526,7 +1571,6 @@ void Tile::__internalAddThing(uint32_t index, Thing* thing)
 
 	Creature* creature = thing->getCreature();
 	if(creature){
-		g_game.clearSpectatorCache();
 		CreatureVector* creatures = makeCreatures();
 		creatures->insert(creatures->begin(), creature);
 		++thingCount;
@@ -1577,6 +1621,8 @@ void Tile::__internalAddThing(uint32_t index, Thing* thing)
 
 void Tile::updateTileFlags(Item* item, bool removed)
 {
+	++m_revision;
+
 	if(!removed){
 		if(!hasFlag(TILESTATE_FLOORCHANGE)){
 			if(item->floorChangeDown()){
@@ -26,6 +26,7 @@
 #include "definitions.h"
 #include "cylinder.h"
 #include "item.h"
+#include "spectators.h"
 #include <boost/shared_ptr.hpp>
 
 class Creature;
@@ -37,9 +38,7 @@ class QTreeLeafNode;
 class BedItem;
 
 typedef std::vector<Creature*> CreatureVector;
-typedef std::list<Creature*> SpectatorVec;
 typedef std::list<Player*> PlayerList;
-typedef std::map<Position, boost::shared_ptr<SpectatorVec> > SpectatorCache;
 typedef std::vector<Item*> ItemVector;
 
 enum tileflags_t{
@@ -185,6 +184,9 @@ public:
 	void setFlag(tileflags_t flag) {m_flags |= (uint32_t)flag;}
 	void resetFlag(tileflags_t flag) {m_flags &= ~(uint32_t)flag;}
 
+	// Bumped whenever an item on the tile changes
+	uint32_t getRevision() const {return m_revision;}
+
 	bool positionChange() const {return hasFlag(TILESTATE_TELEPORT);}
 	bool floorChange() const {return hasFlag(TILESTATE_FLOORCHANGE);}
 	bool floorChangeDown() const {return hasFlag(TILESTATE_FLOORCHANGE_DOWN);}
@@ -278,6 +280,7 @@ protected:
 	uint32_t thingCount;
 	Position tilePos;
 	uint32_t m_flags;
+	uint32_t m_revision;
 };
 
 // Used for walkable tiles, where there is high likeliness of
@@ -293,6 +296,10 @@ public:
 	DynamicTile(uint16_t x, uint16_t y, uint16_t z);
 	~DynamicTile();
 
+	// Allocated from an object pool, see objectpool.h
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 	TileItemVector* getItemList() {return &items;}
 	const TileItemVector* getItemList() const {return &items;}
 	TileItemVector* makeItemList() {return &items;}
@@ -313,6 +320,10 @@ public:
 	StaticTile(uint16_t x, uint16_t y, uint16_t z);
 	~StaticTile();
 
+	// Allocated from an object pool, see objectpool.h
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 	TileItemVector* getItemList() {return items;}
 	const TileItemVector* getItemList() const {return items;}
 	TileItemVector* makeItemList() {return (items)? (items) : (items = new TileItemVector);}
@@ -327,7 +338,8 @@ inline Tile::Tile(uint16_t x, uint16_t y, uint16_t z) :
 	ground(NULL),
 	thingCount(0),
 	tilePos(x, y, z),
-	m_flags(0)
+	m_flags(0),
+	m_revision(0)
 {
 }
 
@@ -31,6 +31,12 @@
 #include <algorithm>
 #include <limits>
 #include <boost/algorithm/string/predicate.hpp>
+#ifdef __OTSERV_X86__
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 extern ConfigManager g_config;
 
@@ -755,6 +761,84 @@ std::string playerSexSubjectString(PlayerSex_t sex)
 }
 
 #define MOD_ADLER 65521
+//largest n such that 255n(n+1)/2 + (n+1)(MOD_ADLER-1) fits in 32 bits
+#define NMAX_ADLER 5552
+
+uint32_t adlerChecksumScalar(uint32_t adler, const uint8_t* data, size_t len)
+{
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	while(len > 0){
+		size_t tlen = len > NMAX_ADLER ? NMAX_ADLER : len;
+		len -= tlen;
+		do{
+			a += *data++;
+			b += a;
+		} while(--tlen);
+
+		a %= MOD_ADLER;
+		b %= MOD_ADLER;
+	}
+
+	return (b << 16) | a;
+}
+
+#ifdef __OTSERV_X86__
+// 16 bytes per step: the byte sum comes from psadbw, the position weighted
+// sum from pmaddwd against 16..1, and 16 times the sum of the earlier
+// blocks is added to b once per run of NMAX_ADLER bytes
+OTSERV_TARGET("sse2")
+static uint32_t adlerChecksumSSE2(uint32_t adler, const uint8_t* data, size_t len)
+{
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weightsHigh = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i weightsLow = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+
+	while(len >= 16){
+		size_t blocks = std::min(len, (size_t)NMAX_ADLER) / 16;
+		len -= blocks * 16;
+
+		__m128i vs1 = zero, vs2 = zero, vprev = zero;
+		b += a * (uint32_t)(blocks * 16);
+		do{
+			__m128i bytes = _mm_loadu_si128((const __m128i*)data);
+			data += 16;
+
+			vprev = _mm_add_epi32(vprev, vs1);
+			vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+			vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsHigh));
+			vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsLow));
+		} while(--blocks);
+
+		uint32_t s1[4], prev[4], s2[4];
+		_mm_storeu_si128((__m128i*)s1, vs1);
+		_mm_storeu_si128((__m128i*)prev, vprev);
+		_mm_storeu_si128((__m128i*)s2, vs2);
+
+		a += s1[0] + s1[2];
+		b += ((prev[0] + prev[2]) << 4) + s2[0] + s2[1] + s2[2] + s2[3];
+
+		a %= MOD_ADLER;
+		b %= MOD_ADLER;
+	}
+
+	return adlerChecksumScalar((b << 16) | a, data, len);
+}
+
+static const bool adlerUseSSE2 = cpuHasSSE2();
+#endif
+
+uint32_t adlerChecksumUpdate(uint32_t adler, const uint8_t* data, size_t len)
+{
+#ifdef __OTSERV_X86__
+	if(adlerUseSSE2){
+		return adlerChecksumSSE2(adler, data, len);
+	}
+#endif
+	return adlerChecksumScalar(adler, data, len);
+}
+
 uint32_t adlerChecksum(uint8_t *data, int32_t len)
 {
 	if(len > NETWORKMESSAGE_MAXSIZE)
@@ -765,22 +849,63 @@ uint32_t adlerChecksum(uint8_t *data, int32_t len)
 		return 0;
 	}
 
-	uint32_t a = 1, b = 0;
-	while (len > 0)
-	{
-		size_t tlen = len > 5552 ? 5552 : len;
-		len -= tlen;
-		do
-		{
-			a += *data++;
-			b += a;
-		} while (--tlen);
+	return adlerChecksumUpdate(1, data, len);
+}
 
-		a %= MOD_ADLER;
-		b %= MOD_ADLER;
-		}
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash /*= HASH_INITIAL*/)
+{
+	//FNV-1a
+	for(size_t i = 0; i < size; ++i){
+		hash = (hash ^ (uint8_t)data[i]) * 1099511628211ULL;
+	}
 
-	return (b << 16) | a;
+	//0 is left free to mean "unknown"
+	return (hash != 0 ? hash : 1);
+}
+
+uint64_t hashStrings(const std::vector<std::string>& strings, uint64_t hash /*= HASH_INITIAL*/)
+{
+	for(std::vector<std::string>::const_iterator it = strings.begin(); it != strings.end(); ++it){
+		hash = hashBytes(it->data(), it->size(), hash);
+		//a separator keeps ("ab", "c") apart from ("a", "bc")
+		hash = hashBytes("\n", 1, hash);
+	}
+
+	return hash;
+}
+
+bool cpuHasSSE2()
+{
+#if defined(__OTSERV_X86__) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#elif defined(__OTSERV_X86__)
+	//may run from a static initializer, before libgcc has looked at the cpu
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+#else
+	return false;
+#endif
+}
+
+bool cpuHasAVX2()
+{
+#if defined(__OTSERV_X86__) && defined(_MSC_VER) && !defined(__OTSERV_NO_AVX2__)
+	int info[4];
+	__cpuid(info, 1);
+	//AVX and OSXSAVE, and the system has to save the ymm registers
+	if((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6){
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(__OTSERV_X86__) && !defined(_MSC_VER)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
 }
 
 void showTime(std::stringstream& str, uint32_t time)
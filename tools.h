@@ -119,6 +119,20 @@ std::string playerSexAdjectiveString(PlayerSex_t sex);
 std::string playerSexSubjectString(PlayerSex_t sex);
 
 uint32_t adlerChecksum(uint8_t *data, int32_t len);
+// Continues a checksum, start with adler = 1
+uint32_t adlerChecksumUpdate(uint32_t adler, const uint8_t* data, size_t len);
+// One byte at a time, the fallback and reference for the SSE2 kernel
+uint32_t adlerChecksumScalar(uint32_t adler, const uint8_t* data, size_t len);
+
+// Hashes to notice changed data, never 0 so that can mean "unknown".
+// Pass a previous result as hash to continue it.
+#define HASH_INITIAL 14695981039346656037ULL
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash = HASH_INITIAL);
+uint64_t hashStrings(const std::vector<std::string>& strings, uint64_t hash = HASH_INITIAL);
+
+// Instruction set extensions of the processor the server runs on
+bool cpuHasSSE2();
+bool cpuHasAVX2();
 
 void showTime(std::stringstream& str, uint32_t time);
 uint32_t parseTime(const std::string& time);
@@ -0,0 +1,218 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Checks the packet checksum against the scalar code and times it
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "../../definitions.h"
+#include "../../configmanager.h"
+#include "../../otsystem.h"
+#include "../../tools.h"
+#include "../../xtea.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+ConfigManager g_config;
+
+#define TEST_ROUNDS 20000
+// Longer than a message, so several runs of 5552 bytes are summed
+#define TEST_MAX_SIZE 20000
+// About a full message, adlerChecksum refuses anything longer
+#define BENCH_MESSAGE_SIZE 15000
+#define BENCH_TIME 1000
+
+uint32_t randomU32()
+{
+	return (uint32_t)random_range(0, 0xFFFF) << 16 | (uint32_t)random_range(0, 0xFFFF);
+}
+
+void randomFill(uint8_t* buffer, size_t size)
+{
+	for(size_t i = 0; i < size; ++i){
+		buffer[i] = (uint8_t)random_range(0, 0xFF);
+	}
+}
+
+// The definition, reduced after every byte
+uint32_t adlerReference(uint32_t adler, const uint8_t* data, size_t len)
+{
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	for(size_t i = 0; i < len; ++i){
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+bool checkAdler(const uint8_t* data, size_t len, uint32_t adler, const char* what)
+{
+	uint32_t expected = adlerReference(adler, data, len);
+	uint32_t scalar = adlerChecksumScalar(adler, data, len);
+	uint32_t checksum = adlerChecksumUpdate(adler, data, len);
+	if(scalar != expected || checksum != expected){
+		std::cout << "FAILED: " << what << ", " << len << " bytes from " << adler << ": expected " << expected <<
+			", scalar " << scalar << ", adlerChecksumUpdate " << checksum << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Random lengths and starting values, unaligned data, and all 0xFF
+// buffers, which give the largest sums, at lengths around each reduction
+bool testAdler()
+{
+	std::vector<uint8_t> buffer(TEST_MAX_SIZE + 16);
+	for(uint32_t round = 0; round < TEST_ROUNDS; ++round){
+		size_t len = (round < 256 ? round : random_range(0, TEST_MAX_SIZE));
+		size_t offset = random_range(0, 15);
+		randomFill(&buffer[offset], len);
+		uint32_t adler = (round % 2 == 0 ? 1 : randomU32() % 65521 | (randomU32() % 65521) << 16);
+		if(!checkAdler(&buffer[offset], len, adler, "random data")){
+			return false;
+		}
+	}
+
+	memset(&buffer[0], 0xFF, buffer.size());
+	for(size_t run = 1; run <= 3; ++run){
+		for(size_t len = run * 5552 - 17; len <= run * 5552 + 17; ++len){
+			if(!checkAdler(&buffer[1], len, 1, "0xFF") ||
+				!checkAdler(&buffer[0], len, 65520 | 65520 << 16, "0xFF after the largest sums"))
+			{
+				return false;
+			}
+		}
+	}
+
+	//a checksum continued over pieces equals the one over the whole buffer
+	for(uint32_t round = 0; round < 1000; ++round){
+		size_t len = random_range(0, TEST_MAX_SIZE);
+		randomFill(&buffer[0], len);
+		uint32_t adler = 1;
+		for(size_t pos = 0; pos < len;){
+			size_t piece = std::min<size_t>(len - pos, random_range(0, 700));
+			adler = adlerChecksumUpdate(adler, &buffer[pos], piece);
+			pos += piece;
+		}
+
+		if(adler != adlerReference(1, &buffer[0], len)){
+			std::cout << "FAILED: checksum continued over pieces of " << len << " bytes" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// xteaEncryptChecksum against encrypting first and checksumming after
+bool testEncryptChecksum()
+{
+	std::vector<uint32_t> plain(NETWORKMESSAGE_MAXSIZE / 8 * 2);
+	std::vector<uint32_t> separate(plain.size());
+	std::vector<uint32_t> fused(plain.size());
+	for(uint32_t round = 0; round < TEST_ROUNDS; ++round){
+		uint32_t key[4] = {randomU32(), randomU32(), randomU32(), randomU32()};
+		size_t blocks = (round < 256 ? round : random_range(0, NETWORKMESSAGE_MAXSIZE / 8));
+		randomFill((uint8_t*)&plain[0], plain.size() * 4);
+		if(round % 16 == 0){
+			memset(&plain[0], 0xFF, plain.size() * 4);
+		}
+
+		separate = plain;
+		fused = plain;
+		xteaEncrypt(&separate[0], blocks, key);
+		uint32_t expected = adlerChecksum((uint8_t*)&separate[0], blocks * 8);
+		uint32_t checksum = xteaEncryptChecksum(&fused[0], blocks, key);
+		if(separate != fused || checksum != expected){
+			std::cout << "FAILED: encrypt and checksum of " << blocks << " blocks" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+template<class Function>
+void bench(const char* name, Function function)
+{
+	std::vector<uint32_t> buffer(BENCH_MESSAGE_SIZE / 4);
+	randomFill((uint8_t*)&buffer[0], buffer.size() * 4);
+
+	uint64_t bytes = 0;
+	uint32_t sink = 0;
+	int64_t start = OTSYS_MONOTONIC_TIME();
+	int64_t elapsed = 0;
+	while(elapsed < BENCH_TIME){
+		for(int i = 0; i < 64; ++i){
+			sink += function(&buffer[0], buffer.size() / 2);
+		}
+		bytes += 64 * BENCH_MESSAGE_SIZE;
+		elapsed = OTSYS_MONOTONIC_TIME() - start;
+	}
+
+	std::cout << std::setw(28) << name << ": " << std::fixed << std::setprecision(1) <<
+		(double)bytes / 1048576. / ((double)elapsed / 1000.) << " MB/s" << (sink == 1 ? " " : "") << std::endl;
+}
+
+const uint32_t benchKey[4] = {0x01234567, 0x89ABCDEF, 0xFEDCBA98, 0x76543210};
+
+uint32_t benchScalar(uint32_t* buffer, size_t blocks)
+{
+	return adlerChecksumScalar(1, (const uint8_t*)buffer, blocks * 8);
+}
+
+uint32_t benchChecksum(uint32_t* buffer, size_t blocks)
+{
+	return adlerChecksum((uint8_t*)buffer, blocks * 8);
+}
+
+uint32_t benchSeparate(uint32_t* buffer, size_t blocks)
+{
+	xteaEncrypt(buffer, blocks, benchKey);
+	return adlerChecksum((uint8_t*)buffer, blocks * 8);
+}
+
+uint32_t benchFused(uint32_t* buffer, size_t blocks)
+{
+	return xteaEncryptChecksum(buffer, blocks, benchKey);
+}
+
+int main(int argc, char* argv[])
+{
+	std::cout << "SSE2 " << (cpuHasSSE2() ? "available" : "not available") <<
+		", " << getXTEAKernelName() << " XTEA kernel" << std::endl;
+
+	std::cout << "Testing adlerChecksum... " << std::flush;
+	if(!testAdler()){
+		return 1;
+	}
+	std::cout << "[done]" << std::endl;
+
+	std::cout << "Testing xteaEncryptChecksum... " << std::flush;
+	if(!testEncryptChecksum()){
+		return 1;
+	}
+	std::cout << "[done]" << std::endl;
+
+	std::cout << BENCH_MESSAGE_SIZE << " byte messages:" << std::endl;
+	bench("adlerChecksumScalar", &benchScalar);
+	bench("adlerChecksum", &benchChecksum);
+	bench("xteaEncrypt, adlerChecksum", &benchSeparate);
+	bench("xteaEncryptChecksum", &benchFused);
+	return 0;
+}
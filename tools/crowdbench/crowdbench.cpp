@@ -0,0 +1,217 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Times the known creature bookkeeping of a client in a dense crowd
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "../../definitions.h"
+#include "../../otsystem.h"
+#include "../../knowncreatures.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <cstdlib>
+
+// Creatures that exist, the client can see crowdSize of them at a time
+#define POPULATION 4000
+#define FIRST_ID 0x40000000
+// Map descriptions sent per run, and the part of the crowd that walks
+// out of view between two of them
+#define STEPS 1000
+#define CHURN 0.05
+// Runs are repeated until they took at least this long (ms)
+#define MIN_TIME 500
+
+// std::list the protocol kept before KnownCreatureSet, with the same
+// operations: a known creature is found by walking the list
+class KnownCreatureList
+{
+public:
+	uint32_t size() const {return m_list.size();}
+	bool touch(uint32_t id){
+		for(std::list<uint32_t>::iterator it = m_list.begin(); it != m_list.end(); ++it){
+			if(*it == id){
+				m_list.erase(it);
+				m_list.push_back(id);
+				return true;
+			}
+		}
+		return false;
+	}
+	void push_back(uint32_t id) {m_list.push_back(id);}
+	uint32_t front() const {return m_list.front();}
+	void pop_front() {m_list.pop_front();}
+	void rotate(){
+		m_list.push_back(m_list.front());
+		m_list.pop_front();
+	}
+
+protected:
+	std::list<uint32_t> m_list;
+};
+
+// Same pseudo random sequence for both containers
+class Random
+{
+public:
+	Random(uint32_t seed) : m_state(seed) {}
+	uint32_t next(){
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return m_state;
+	}
+
+protected:
+	uint32_t m_state;
+};
+
+struct Crowd
+{
+	std::vector<uint32_t> view;
+	std::vector<bool> inView;
+};
+
+// ProtocolGame::checkCreatureAsKnown, with canSee answered by the crowd
+template<class Known>
+void checkCreatureAsKnown(Known& knownCreatures, const Crowd& crowd, uint32_t id,
+	bool& known, uint32_t& removedKnown)
+{
+	if(knownCreatures.touch(id)){
+		known = true;
+		return;
+	}
+
+	known = false;
+	knownCreatures.push_back(id);
+
+	if(knownCreatures.size() > KNOWNCREATURES_MAX){
+		for(int n = 0; n < KNOWNCREATURES_MAX; ++n){
+			removedKnown = knownCreatures.front();
+			if(!crowd.inView[removedKnown - FIRST_ID])
+				break;
+
+			knownCreatures.rotate();
+		}
+
+		knownCreatures.pop_front();
+	}
+	else{
+		removedKnown = 0;
+	}
+}
+
+// Sends STEPS map descriptions of the crowd, returns a hash of what the
+// client was told so both containers can be compared
+template<class Known>
+uint32_t runCrowd(uint32_t crowdSize)
+{
+	Known knownCreatures;
+	Random random(crowdSize);
+
+	Crowd crowd;
+	crowd.inView.resize(POPULATION, false);
+	for(uint32_t i = 0; i < crowdSize; ++i){
+		crowd.view.push_back(FIRST_ID + i);
+		crowd.inView[i] = true;
+	}
+
+	uint32_t hash = 0;
+	uint32_t churn = std::max<uint32_t>(1, (uint32_t)(crowdSize * CHURN));
+	for(uint32_t step = 0; step < STEPS; ++step){
+		for(uint32_t i = 0; i < churn; ++i){
+			uint32_t n = random.next() % crowdSize;
+			uint32_t id;
+			do{
+				id = FIRST_ID + random.next() % POPULATION;
+			}while(crowd.inView[id - FIRST_ID]);
+
+			crowd.inView[crowd.view[n] - FIRST_ID] = false;
+			crowd.inView[id - FIRST_ID] = true;
+			crowd.view[n] = id;
+		}
+
+		for(std::vector<uint32_t>::const_iterator it = crowd.view.begin(); it != crowd.view.end(); ++it){
+			bool known;
+			uint32_t removedKnown = 0;
+			checkCreatureAsKnown(knownCreatures, crowd, *it, known, removedKnown);
+			hash = hash * 31 + (known ? 1 : removedKnown);
+		}
+	}
+	return hash;
+}
+
+// Checks per second
+template<class Known>
+double timeCrowd(uint32_t crowdSize, uint32_t& hash)
+{
+	uint32_t runs = 0;
+	int64_t start = OTSYS_MONOTONIC_TIME();
+	int64_t elapsed = 0;
+	while(elapsed < MIN_TIME){
+		hash = runCrowd<Known>(crowdSize);
+		++runs;
+		elapsed = OTSYS_MONOTONIC_TIME() - start;
+	}
+	return (double)crowdSize * STEPS * runs / (elapsed / 1000.);
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<uint32_t> crowdSizes;
+	for(int i = 1; i < argc; ++i){
+		uint32_t crowdSize = atoi(argv[i]);
+		if(crowdSize == 0 || crowdSize > POPULATION / 2){
+			std::cout << "Usage: crowdbench [creatures in view (1-" << POPULATION / 2 << ")]..." << std::endl;
+			return 1;
+		}
+		crowdSizes.push_back(crowdSize);
+	}
+
+	if(crowdSizes.empty()){
+		crowdSizes.push_back(50);
+		crowdSizes.push_back(100);
+		crowdSizes.push_back(200);
+		crowdSizes.push_back(400);
+		crowdSizes.push_back(800);
+	}
+
+	std::cout << "Creature checks per second over " << STEPS << " map descriptions:" << std::endl;
+	std::cout << std::setw(8) << "in view" << std::setw(18) << "std::list" <<
+		std::setw(18) << "KnownCreatureSet" << std::setw(10) << "speedup" << std::endl;
+
+	bool ok = true;
+	for(std::vector<uint32_t>::iterator it = crowdSizes.begin(); it != crowdSizes.end(); ++it){
+		uint32_t listHash, setHash;
+		double listRate = timeCrowd<KnownCreatureList>(*it, listHash);
+		double setRate = timeCrowd<KnownCreatureSet>(*it, setHash);
+
+		std::cout << std::setw(8) << *it << std::fixed << std::setprecision(0) <<
+			std::setw(18) << listRate << std::setw(18) << setRate <<
+			std::setw(9) << std::setprecision(1) << setRate / listRate << "x";
+
+		if(listHash != setHash){
+			std::cout << "  FAILED: the clients were told different creatures";
+			ok = false;
+		}
+		std::cout << std::endl;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Walks a node file with the old and the mapped loader and times both
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "../../definitions.h"
+#include "../../otsystem.h"
+#include "../../fileloader.h"
+#include "streamloader.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#define BENCH_RUNS 5
+
+// Node types of an OTBM file, enough to give the generated file its shape
+enum{
+	GEN_ROOT = 0,
+	GEN_MAP_DATA = 2,
+	GEN_TILE_AREA = 4,
+	GEN_TILE = 5,
+	GEN_ITEM = 6
+};
+
+void writeProps(FileLoader& f, const std::vector<uint8_t>& props)
+{
+	if(!props.empty()){
+		f.setProps((void*)&props[0], props.size());
+	}
+}
+
+void addU16(std::vector<uint8_t>& props, uint16_t value)
+{
+	props.push_back(value & 0xFF);
+	props.push_back(value >> 8);
+}
+
+// A map shaped file: tile areas of 256 tiles with a few items each.
+// Positions and item ids run through 0xFD-0xFF, so plenty of props are escaped
+bool generateFile(const char* filename, uint32_t areas)
+{
+	FileLoader f;
+	if(!f.openFile(filename, "OTBM", true)){
+		return false;
+	}
+
+	std::vector<uint8_t> props;
+	f.startNode(GEN_ROOT);
+	props.clear();
+	for(int i = 0; i < 16; ++i){
+		props.push_back(rand() & 0xFF);
+	}
+	writeProps(f, props);
+
+	f.startNode(GEN_MAP_DATA);
+	props.clear();
+	props.push_back(1);
+	addU16(props, 17);
+	const char* description = "generated by nodebench";
+	props.insert(props.end(), description, description + 17);
+	writeProps(f, props);
+
+	for(uint32_t area = 0; area < areas; ++area){
+		f.startNode(GEN_TILE_AREA);
+		props.clear();
+		addU16(props, (area % 128) * 256);
+		addU16(props, (area / 128 % 128) * 256);
+		props.push_back(area / 16384 % 16);
+		writeProps(f, props);
+
+		for(int tile = 0; tile < 256; ++tile){
+			f.startNode(GEN_TILE);
+			props.clear();
+			props.push_back(tile & 0xFF);
+			props.push_back(tile);
+			writeProps(f, props);
+
+			int items = rand() % 4;
+			for(int item = 0; item < items; ++item){
+				f.startNode(GEN_ITEM);
+				props.clear();
+				addU16(props, 100 + rand() % 8000);
+				if(rand() % 4 == 0){
+					//count attribute
+					props.push_back(15);
+					props.push_back(rand() & 0xFF);
+				}
+				writeProps(f, props);
+				f.endNode();
+			}
+			f.endNode();
+		}
+		f.endNode();
+	}
+
+	f.endNode();
+	f.endNode();
+	return f.getError() == ERROR_NONE;
+}
+
+// Both trees in step: same types, same unescaped props, same shape
+bool compareNodes(StreamFileLoader& streamLoader, STREAM_NODE streamParent,
+	FileLoader& fileLoader, NODE parent, uint64_t& nodes)
+{
+	unsigned long streamType = 0, type = 0;
+	STREAM_NODE streamNode = streamLoader.getChildNode(streamParent, streamType);
+	NODE node = fileLoader.getChildNode(parent, type);
+	while(streamNode && node){
+		++nodes;
+		if(streamType != type){
+			std::cout << "FAILED: node " << nodes << " has type " << type << ", expected " << streamType << std::endl;
+			return false;
+		}
+
+		unsigned long streamSize = 0, size = 0;
+		const unsigned char* streamProps = streamLoader.getProps(streamNode, streamSize);
+		const unsigned char* props = fileLoader.getProps(node, size);
+		if(!streamProps || !props || streamSize != size || memcmp(streamProps, props, size) != 0){
+			std::cout << "FAILED: props of node " << nodes << " differ" << std::endl;
+			return false;
+		}
+
+		if(!compareNodes(streamLoader, streamNode, fileLoader, node, nodes)){
+			return false;
+		}
+
+		streamNode = streamLoader.getNextNode(streamNode, streamType);
+		node = fileLoader.getNextNode(node, type);
+	}
+
+	if(streamNode || node){
+		std::cout << "FAILED: " << (node ? "extra" : "missing") << " node after node " << nodes << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// What a loader does on startup: visit every node and read its props
+template<class Loader, class Node>
+bool walkNodes(Loader& f, Node parent, uint64_t& nodes, uint32_t& sum)
+{
+	unsigned long type;
+	Node node = f.getChildNode(parent, type);
+	while(node){
+		++nodes;
+		unsigned long size;
+		const unsigned char* props = f.getProps(node, size);
+		if(!props){
+			return false;
+		}
+
+		sum = sum * 31 + type;
+		for(unsigned long i = 0; i < size; ++i){
+			sum = sum * 31 + props[i];
+		}
+
+		if(!walkNodes(f, node, nodes, sum)){
+			return false;
+		}
+		node = f.getNextNode(node, type);
+	}
+	return true;
+}
+
+int64_t benchStream(const char* filename, const char* identifier, uint32_t& sum)
+{
+	int64_t start = OTSYS_MONOTONIC_TIME();
+	StreamFileLoader f;
+	uint64_t nodes = 0;
+	sum = 0;
+	if(!f.openFile(filename, identifier, true) || !walkNodes(f, (STREAM_NODE)NULL, nodes, sum)){
+		return -1;
+	}
+	return OTSYS_MONOTONIC_TIME() - start;
+}
+
+int64_t benchMapped(const char* filename, const char* identifier, uint32_t& sum)
+{
+	int64_t start = OTSYS_MONOTONIC_TIME();
+	FileLoader f;
+	uint64_t nodes = 0;
+	sum = 0;
+	if(!f.openFile(filename, identifier, false) || !walkNodes(f, (NODE)NULL, nodes, sum)){
+		return -1;
+	}
+	return OTSYS_MONOTONIC_TIME() - start;
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc == 4 && strcmp(argv[1], "--generate") == 0){
+		std::cout << "Generating " << argv[3] << "... " << std::flush;
+		if(!generateFile(argv[3], atoi(argv[2]))){
+			std::cout << "FAILED" << std::endl;
+			return 1;
+		}
+		std::cout << "[done]" << std::endl;
+		argv[1] = argv[3];
+		argc = 2;
+	}
+
+	if(argc < 2 || argc > 3){
+		std::cout << "Usage: " << argv[0] << " <file> [identifier]" << std::endl;
+		std::cout << "       " << argv[0] << " --generate <tile areas> <file>" << std::endl;
+		return 1;
+	}
+
+	const char* filename = argv[1];
+	const char* identifier = "OTBM";
+	if(argc == 3){
+		identifier = argv[2];
+	}
+	else if(strlen(filename) > 4 && strcmp(filename + strlen(filename) - 4, ".otb") == 0){
+		identifier = "OTBI";
+	}
+
+	std::cout << "Comparing the loaders... " << std::flush;
+	StreamFileLoader streamLoader;
+	if(!streamLoader.openFile(filename, identifier, true)){
+		std::cout << "FAILED: the old loader could not open the file, error " << streamLoader.getError() << std::endl;
+		return 1;
+	}
+
+	FileLoader fileLoader;
+	if(!fileLoader.openFile(filename, identifier, false)){
+		std::cout << "FAILED: FileLoader could not open the file, error " << fileLoader.getError() << std::endl;
+		return 1;
+	}
+
+	uint64_t nodes = 0;
+	if(!compareNodes(streamLoader, NULL, fileLoader, NULL, nodes)){
+		return 1;
+	}
+	std::cout << "[done] " << nodes << " nodes" << std::endl;
+
+	//open and walk, best of a few runs so both read from the page cache
+	int64_t streamBest = -1, mappedBest = -1;
+	uint32_t streamSum = 0, mappedSum = 0;
+	for(int run = 0; run < BENCH_RUNS; ++run){
+		int64_t streamTime = benchStream(filename, identifier, streamSum);
+		int64_t mappedTime = benchMapped(filename, identifier, mappedSum);
+		if(streamTime < 0 || mappedTime < 0 || streamSum != mappedSum){
+			std::cout << "FAILED: open and walk run " << run << std::endl;
+			return 1;
+		}
+
+		if(streamBest < 0 || streamTime < streamBest){
+			streamBest = streamTime;
+		}
+		if(mappedBest < 0 || mappedTime < mappedBest){
+			mappedBest = mappedTime;
+		}
+	}
+
+	std::cout << "Open and walk, best of " << BENCH_RUNS << ":" << std::endl;
+	std::cout << std::setw(18) << "old loader" << ": " << streamBest << " ms" << std::endl;
+	std::cout << std::setw(18) << "FileLoader" << ": " << mappedBest << " ms" << std::endl;
+	return 0;
+}
@@ -0,0 +1,457 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// The old node reader, read side only, renamed to sit next to FileLoader
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "streamloader.h"
+#include <algorithm>
+#include <cmath>
+
+StreamFileLoader::StreamFileLoader()
+{
+	m_file = NULL;
+	m_root = NULL;
+	m_buffer = new unsigned char[1024];
+	m_buffer_size = 1024;
+	m_lastError = ERROR_NONE;
+	//cache
+	m_use_cache = false;
+	m_cache_size = 0;
+	m_cache_index = NO_VALID_CACHE;
+	m_cache_offset = NO_VALID_CACHE;
+	memset(m_cached_data, 0, sizeof(m_cached_data));
+}
+
+StreamFileLoader::~StreamFileLoader()
+{
+	if(m_file){
+		fclose(m_file);
+		m_file = NULL;
+	}
+
+	StreamNode::clearNet(m_root);
+	delete[] m_buffer;
+
+	for(int i = 0; i < CACHE_BLOCKS; ++i){
+		if(m_cached_data[i].data)
+			delete[] m_cached_data[i].data;
+	}
+}
+
+bool StreamFileLoader::openFile(const char* filename, const char* accept_identifier, bool caching)
+{
+	m_file = fopen(filename, "rb");
+	if(m_file){
+		char identifier[4];
+		if(fread(identifier, 1, 4, m_file) < 4){
+			fclose(m_file);
+			m_file = NULL;
+			m_lastError = ERROR_INVALID_FILE_VERSION;
+			return false;
+		}
+		// Accept 0x00000000 as wildcard
+		else if (memcmp(identifier, accept_identifier, 4) != 0 &&
+				 memcmp(identifier, "\0\0\0\0", 4) != 0)
+		{
+			fclose(m_file);
+			m_file = NULL;
+			m_lastError = ERROR_INVALID_FILE_VERSION;
+			return false;
+		}
+		else{
+			if(caching){
+				m_use_cache = true;
+				fseek(m_file, 0, SEEK_END);
+				int file_size = ftell(m_file);
+				m_cache_size = std::min(32768, std::max(file_size/20, 8192)) & ~0x1FFF;
+			}
+
+			//parse nodes
+			if(safeSeek(4)){
+				delete m_root;
+				m_root = new StreamNode();
+				m_root->start = 4;
+				int byte;
+				if(safeSeek(4) && readByte(byte) && byte == NODE_START){
+					bool ret = parseNode(m_root);
+					return ret;
+				}
+				else{
+					return false;
+				}
+			}
+			else{
+				m_lastError = ERROR_INVALID_FORMAT;
+				return false;
+			}
+		}
+	}
+	else{
+		m_lastError = ERROR_CAN_NOT_OPEN;
+		return false;
+	}
+}
+
+bool StreamFileLoader::parseNode(STREAM_NODE node)
+{
+	int byte;
+	long pos;
+	STREAM_NODE currentNode = node;
+	while(1){
+		//read node type
+		if(readByte(byte)){
+			currentNode->type = byte;
+			bool setPropsSize = false;
+			while(1){
+				//search child and next node
+				if(readByte(byte)){
+					if(byte == NODE_START){
+						//child node start
+						if(safeTell(pos)){
+							STREAM_NODE childNode = new StreamNode();
+							childNode->start = pos;
+							setPropsSize = true;
+							currentNode->propsSize = pos - currentNode->start - 2;
+							currentNode->child = childNode;
+							if(!parseNode(childNode)){
+								return false;
+							}
+						}
+						else{
+							return false;
+						}
+					}
+					else if(byte == NODE_END){
+						//current node end
+						if(!setPropsSize){
+							if(safeTell(pos)){
+								currentNode->propsSize = pos - currentNode->start - 2;
+							}
+							else{
+								return false;
+							}
+						}
+						if(readByte(byte)){
+							if(byte == NODE_START){
+								//starts next node
+								if(safeTell(pos)){
+									STREAM_NODE nextNode = new StreamNode();
+									nextNode->start = pos;
+									currentNode->next = nextNode;
+									currentNode = nextNode;
+									break;
+								}
+								else{
+									return false;
+								}
+							}
+							else if(byte == NODE_END){
+								//up 1 level and move 1 position back
+								if(safeTell(pos) && safeSeek(pos)){
+									return true;
+								}
+								else{
+									return false;
+								}
+							}
+							else{
+								//wrong format
+								m_lastError = ERROR_INVALID_FORMAT;
+								return false;
+							}
+						}
+						else{
+							//end of file?
+							return true;
+						}
+					}
+					else if(byte == ESCAPE_CHAR){
+						if(!readByte(byte))
+							return false;
+					}
+				}
+				else{
+					return false;
+				}
+			}
+		}
+		else{
+			return false;
+		}
+	}
+}
+
+const unsigned char* StreamFileLoader::getProps(const STREAM_NODE node, unsigned long &size)
+{
+	if(node){
+		while(node->propsSize >= m_buffer_size){
+            delete[] m_buffer;
+            while (node->propsSize >= m_buffer_size)
+				m_buffer_size *= 2;
+            m_buffer = new unsigned char[m_buffer_size];
+        }
+		//get buffer
+		if(readBytes(m_buffer, node->propsSize, node->start + 2)){
+			//unscape buffer
+			unsigned int j = 0;
+			bool escaped = false;
+			for(unsigned int i = 0; i < node->propsSize; ++i, ++j){
+				if(m_buffer[i] == ESCAPE_CHAR){
+					//escape char found, skip it and write next
+					++i;
+					m_buffer[j] = m_buffer[i];
+					//is neede a displacement for next bytes
+					escaped = true;
+				}
+				else if(escaped){
+					//perform that displacement
+					m_buffer[j] = m_buffer[i];
+				}
+				else{
+					//the buffer is right as is
+				}
+			}
+			size = j;
+			return m_buffer;
+		}
+		else{
+			return NULL;
+		}
+	}
+	else{
+		return NULL;
+	}
+}
+
+const STREAM_NODE StreamFileLoader::getChildNode(const STREAM_NODE parent, unsigned long &type)
+{
+	if(parent){
+		STREAM_NODE child = parent->child;
+		if(child){
+			type = child->type;
+		}
+		return child;
+	}
+	else{
+		type = m_root->type;
+		return m_root;
+	}
+}
+
+const STREAM_NODE StreamFileLoader::getNextNode(const STREAM_NODE prev, unsigned long &type)
+{
+	if(prev){
+		STREAM_NODE next = prev->next;
+		if(next){
+			type = next->type;
+		}
+		return next;
+	}
+	else{
+		return NO_NODE;
+	}
+}
+
+
+inline bool StreamFileLoader::readByte(int &value)
+{
+	if(m_use_cache){
+		if(m_cache_index == NO_VALID_CACHE){
+			m_lastError = ERROR_CACHE_ERROR;
+			return false;
+		}
+		if(m_cache_offset >= m_cached_data[m_cache_index].size){
+			long pos = m_cache_offset + m_cached_data[m_cache_index].base;
+			long tmp = getCacheBlock(pos);
+			if(tmp < 0)
+				return false;
+
+			m_cache_index = tmp;
+			m_cache_offset = pos - m_cached_data[m_cache_index].base;
+			if(m_cache_offset >= m_cached_data[m_cache_index].size){
+				return false;
+			}
+		}
+		value = m_cached_data[m_cache_index].data[m_cache_offset];
+		m_cache_offset++;
+		return true;
+	}
+	else{
+		value = fgetc(m_file);
+		if(value == EOF){
+			m_lastError = ERROR_EOF;
+			return false;
+		}
+		else
+			return true;
+	}
+}
+
+inline bool StreamFileLoader::readBytes(unsigned char* buffer, unsigned int size, long pos)
+{
+	if(m_use_cache){
+		//seek at pos
+		unsigned long reading, remain = size, bufferPos = 0;
+		do{
+			//prepare cache
+			unsigned long i = getCacheBlock(pos);
+			if(i == NO_VALID_CACHE)
+				return false;
+
+			m_cache_index = i;
+			m_cache_offset = pos - m_cached_data[i].base;
+
+			//get maximun read block size and calculate remaining bytes
+			reading = std::min(remain, m_cached_data[i].size - m_cache_offset);
+			remain = remain - reading;
+
+			//read it
+			memcpy(buffer + bufferPos, m_cached_data[m_cache_index].data + m_cache_offset, reading);
+
+			//update variables
+			m_cache_offset = m_cache_offset + reading;
+			bufferPos = bufferPos + reading;
+			pos = pos + reading;
+		}while(remain > 0);
+		return true;
+	}
+	else{
+		if(fseek(m_file, pos, SEEK_SET)){
+			m_lastError = ERROR_SEEK_ERROR;
+			return false;
+		}
+		size_t value = fread(buffer, 1, size, m_file);
+		if(value != size){
+			m_lastError = ERROR_EOF;
+			return false;
+		}
+		else{
+			return true;
+		}
+	}
+}
+
+inline bool StreamFileLoader::safeSeek(unsigned long pos)
+{
+	if(m_use_cache){
+		unsigned long i = getCacheBlock(pos);
+		if(i == NO_VALID_CACHE)
+			return false;
+
+		m_cache_index = i;
+		m_cache_offset = pos - m_cached_data[i].base;
+	}
+	else{
+		if(fseek(m_file, pos, SEEK_SET)){
+			m_lastError = ERROR_SEEK_ERROR;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+inline bool StreamFileLoader::safeTell(long &pos)
+{
+	if(m_use_cache){
+		if(m_cache_index == NO_VALID_CACHE){
+			m_lastError = ERROR_CACHE_ERROR;
+			return false;
+		}
+
+		pos = m_cached_data[m_cache_index].base + m_cache_offset - 1;
+		return true;
+	}
+	else{
+		pos = ftell(m_file);
+		if(pos == -1){
+			m_lastError = ERROR_TELL_ERROR;
+			return false;
+		}
+		else{
+			pos = pos - 1;
+			return true;
+		}
+	}
+}
+
+inline unsigned long StreamFileLoader::getCacheBlock(unsigned long pos)
+{
+	bool found = false;
+	unsigned long i;
+	unsigned long base_pos = pos & ~(m_cache_size - 1);
+	for(i = 0; i < CACHE_BLOCKS; ++i){
+		if(m_cached_data[i].loaded){
+			if(m_cached_data[i].base == base_pos){
+				found = true;
+				break;
+			}
+		}
+	}
+	if(!found){
+		i = loadCacheBlock(pos);
+	}
+	return i;
+}
+
+long StreamFileLoader::loadCacheBlock(unsigned long pos)
+{
+	long i;
+	long loading_cache = -1;
+	long base_pos = pos & ~(m_cache_size - 1);
+	for(i = 0; i < CACHE_BLOCKS; ++i){
+		if(!m_cached_data[i].loaded){
+			loading_cache = i;
+			break;
+		}
+	}
+	if(loading_cache == -1){
+		for(i = 0; i < CACHE_BLOCKS; ++i){
+			if((long)(labs((long)m_cached_data[i].base - base_pos)) > (long)(2*m_cache_size)){
+				loading_cache = i;
+				break;
+			}
+		}
+		if(loading_cache == -1){
+			loading_cache = 0;
+		}
+	}
+
+	if(m_cached_data[loading_cache].data == NULL){
+		m_cached_data[loading_cache].data = new unsigned char[m_cache_size];
+	}
+
+	m_cached_data[loading_cache].base = base_pos;
+
+	if(fseek(m_file, m_cached_data[loading_cache].base, SEEK_SET)){
+		m_lastError = ERROR_SEEK_ERROR;
+		return -1;
+	}
+
+	size_t size = fread(m_cached_data[loading_cache].data, 1, m_cache_size, m_file);
+	m_cached_data[loading_cache].size = size;
+
+	if(size < (pos - m_cached_data[loading_cache].base)){
+		m_lastError = ERROR_SEEK_ERROR;
+		return -1;
+	}
+
+	m_cached_data[loading_cache].loaded = 1;
+
+	return loading_cache;
+}
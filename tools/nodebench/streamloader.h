@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// The node file reader as it was before mapping, kept for comparison
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_STREAMLOADER_H__
+#define __OTSERV_STREAMLOADER_H__
+
+#include "../../fileloader.h"
+
+struct StreamNode{
+	StreamNode(){
+		start = 0;
+		propsSize = 0;
+		next = 0;
+		child = 0;
+		type = 0;
+	}
+	unsigned long start;
+	unsigned long propsSize;
+	unsigned long type;
+	StreamNode* next;
+	StreamNode* child;
+
+	static void clearNet(StreamNode* root){
+		if(root){
+			clearChild(root);
+		}
+	}
+
+private:
+	static void clearNext(StreamNode* node){
+		StreamNode* deleteNode = node;
+		StreamNode* nextNode;
+		while(deleteNode){
+			if(deleteNode->child){
+				clearChild(deleteNode->child);
+			}
+			nextNode = deleteNode->next;
+			delete deleteNode;
+			deleteNode = nextNode;
+		}
+	}
+
+	static void clearChild(StreamNode* node){
+		if(node->child){
+			clearChild(node->child);
+		}
+		if(node->next){
+			clearNext(node->next);
+		}
+		delete node;
+	}
+};
+
+typedef StreamNode* STREAM_NODE;
+
+// The reading half of the old FileLoader: one fgetc or cache block
+// lookup per byte, and a node allocated for every start marker
+class StreamFileLoader{
+public:
+	StreamFileLoader();
+	~StreamFileLoader();
+
+	bool openFile(const char* filename, const char* identifier, bool caching);
+	const unsigned char* getProps(const STREAM_NODE, unsigned long &size);
+	const STREAM_NODE getChildNode(const STREAM_NODE parent, unsigned long &type);
+	const STREAM_NODE getNextNode(const STREAM_NODE prev, unsigned long &type);
+
+	int getError(){return m_lastError;}
+
+protected:
+	enum SPECIAL_BYTES{
+		NODE_START = 0xFE,
+		NODE_END = 0xFF,
+		ESCAPE_CHAR = 0xFD
+	};
+
+	bool parseNode(STREAM_NODE node);
+
+	inline bool readByte(int &value);
+	inline bool readBytes(unsigned char* buffer, unsigned int size, long pos);
+	inline bool safeSeek(unsigned long pos);
+	inline bool safeTell(long &pos);
+
+	FILE* m_file;
+	FILELOADER_ERRORS m_lastError;
+	STREAM_NODE m_root;
+	unsigned long m_buffer_size;
+	unsigned char* m_buffer;
+
+	bool m_use_cache;
+	struct _cache{
+		unsigned long loaded;
+		unsigned long base;
+		unsigned char* data;
+		size_t size;
+	};
+	#define CACHE_BLOCKS 3
+	unsigned long m_cache_size;
+	_cache m_cached_data[CACHE_BLOCKS];
+	#define NO_VALID_CACHE 0xFFFFFFFF
+	unsigned long m_cache_index;
+	unsigned long m_cache_offset;
+	inline unsigned long getCacheBlock(unsigned long pos);
+	long loadCacheBlock(unsigned long pos);
+};
+
+#endif
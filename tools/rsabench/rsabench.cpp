@@ -0,0 +1,169 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Times RSA::decrypt running on several threads at once
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "../../definitions.h"
+#include "../../otsystem.h"
+#include "../../rsa.h"
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+// Messages each thread decrypts in turn, and how long (ms) each
+// thread count runs
+#define MESSAGES 64
+#define BENCH_TIME 2000
+
+RSA g_RSA;
+
+boost::atomic<bool> running(false);
+boost::atomic<bool> failed(false);
+
+// The server key from otserv.cpp
+void setServerKey()
+{
+	const char* p("14299623962416399520070177382898895550795403345466153217470516082934737582776038882967213386204600674145392845853859217990626450972452084065728686565928113");
+	const char* q("7630979195970404721891201847792002125535401292779123937207447574596692788513647179235335529307251350570728407373705564708871762033017096809910315212884101");
+	const char* d("46730330223584118622160180015036832148732986808519344675210555262940258739805766860224610646919605860206328024326703361630109888417839241959507572247284807035235569619173792292786907845791904955103601652822519121908367187885509270025388641700821735345222087940578381210879116823013776808975766851829020659073");
+	g_RSA.setKey(p, q, d);
+}
+
+// Login blocks the way the client builds them: a zero first byte keeps
+// the number below the modulus
+void createMessages(std::vector<std::string>& plain, std::vector<std::string>& encrypted)
+{
+	char key[128];
+	g_RSA.getPublicKey(key);
+
+	mpz_t mod;
+	mpz_init(mod);
+	mpz_import(mod, 128, 1, 1, 0, 0, key);
+	char* modulus = mpz_get_str(NULL, 10, mod);
+	mpz_clear(mod);
+
+	for(uint32_t i = 0; i < MESSAGES; ++i){
+		char msg[128];
+		msg[0] = 0;
+		for(uint32_t j = 1; j < 128; ++j){
+			msg[j] = (char)(rand() & 0xFF);
+		}
+		plain.push_back(std::string(msg, 128));
+
+		g_RSA.encrypt(msg, 128, modulus);
+		encrypted.push_back(std::string(msg, 128));
+	}
+	free(modulus);
+}
+
+void decryptThread(const std::vector<std::string>* plain, const std::vector<std::string>* encrypted,
+	uint64_t* count)
+{
+	char msg[128];
+	uint32_t i = 0;
+	while(!running){
+		boost::this_thread::yield();
+	}
+
+	while(running){
+		memcpy(msg, (*encrypted)[i].data(), 128);
+		g_RSA.decrypt(msg, 128);
+		if(memcmp(msg, (*plain)[i].data(), 128) != 0){
+			failed = true;
+		}
+
+		++*count;
+		i = (i + 1) % MESSAGES;
+	}
+}
+
+// Decryptions per second with that many threads
+double runThreads(uint32_t threadCount, const std::vector<std::string>& plain,
+	const std::vector<std::string>& encrypted)
+{
+	std::vector<uint64_t> counts(threadCount, 0);
+	boost::thread_group threads;
+	for(uint32_t i = 0; i < threadCount; ++i){
+		threads.create_thread(boost::bind(&decryptThread, &plain, &encrypted, &counts[i]));
+	}
+
+	int64_t start = OTSYS_MONOTONIC_TIME();
+	running = true;
+	boost::this_thread::sleep(boost::posix_time::milliseconds(BENCH_TIME));
+	running = false;
+	threads.join_all();
+	int64_t elapsed = OTSYS_MONOTONIC_TIME() - start;
+
+	uint64_t total = 0;
+	for(uint32_t i = 0; i < threadCount; ++i){
+		total += counts[i];
+	}
+	return (double)total / (elapsed / 1000.);
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t maxThreads = boost::thread::hardware_concurrency();
+	if(argc > 1){
+		maxThreads = atoi(argv[1]);
+	}
+
+	if(maxThreads == 0 || maxThreads > 256){
+		std::cout << "Usage: rsabench [max threads (1-256)]" << std::endl;
+		return 1;
+	}
+
+	setServerKey();
+
+	std::vector<std::string> plain, encrypted;
+	createMessages(plain, encrypted);
+
+	std::cout << "Login decryptions per second, " << boost::thread::hardware_concurrency() <<
+		" hardware threads:" << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(14) << "decrypts/s" << std::setw(10) << "scaling" << std::endl;
+
+	//1, 2, 4... and maxThreads itself
+	std::vector<uint32_t> threadCounts;
+	for(uint32_t threadCount = 1; threadCount < maxThreads; threadCount *= 2){
+		threadCounts.push_back(threadCount);
+	}
+	threadCounts.push_back(maxThreads);
+
+	double single = 0;
+	for(std::vector<uint32_t>::iterator it = threadCounts.begin(); it != threadCounts.end(); ++it){
+		double rate = runThreads(*it, plain, encrypted);
+		if(*it == 1){
+			single = rate;
+		}
+
+		std::cout << std::setw(8) << *it << std::fixed << std::setprecision(0) <<
+			std::setw(14) << rate << std::setw(9) << std::setprecision(2) << rate / single << "x" << std::endl;
+
+		if(failed){
+			std::cout << "FAILED: a decryption gave the wrong plaintext" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
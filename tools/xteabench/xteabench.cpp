@@ -0,0 +1,169 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Checks the XTEA kernels against the scalar code and times them
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "../../definitions.h"
+#include "../../configmanager.h"
+#include "../../otsystem.h"
+#include "../../tools.h"
+#include "../../xtea.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+ConfigManager g_config;
+
+// Random buffers per kernel, and the longest one in blocks
+#define TEST_ROUNDS 20000
+#define TEST_MAX_BLOCKS 70
+// Size of a full network message
+#define BENCH_MESSAGE_SIZE 16384
+#define BENCH_TIME 1000
+
+static const char* kernelNames[] = {"scalar", "sse2", "avx2"};
+
+uint32_t randomU32()
+{
+	return (uint32_t)random_range(0, 0xFFFF) << 16 | (uint32_t)random_range(0, 0xFFFF);
+}
+
+void randomFill(uint32_t* buffer, size_t words)
+{
+	for(size_t i = 0; i < words; ++i){
+		buffer[i] = randomU32();
+	}
+}
+
+// Every block count from 0 to TEST_MAX_BLOCKS comes up, so each tail the
+// 4 and 8 block kernels leave is covered, and buffers start at any word
+// so they are rarely aligned to the vector width
+bool testKernel(const std::string& name)
+{
+	std::vector<uint32_t> plain(TEST_MAX_BLOCKS * 2 + 8);
+	std::vector<uint32_t> reference(plain.size());
+	std::vector<uint32_t> buffer(plain.size());
+
+	for(uint32_t round = 0; round < TEST_ROUNDS; ++round){
+		uint32_t key[4];
+		randomFill(key, 4);
+
+		size_t blocks = (round < TEST_MAX_BLOCKS + 1 ? round : random_range(0, TEST_MAX_BLOCKS));
+		size_t offset = random_range(0, 7);
+		size_t words = blocks * 2;
+		randomFill(&plain[0], plain.size());
+
+		reference = plain;
+		buffer = plain;
+		xteaEncryptScalar(&reference[offset], blocks, key);
+		xteaEncrypt(&buffer[offset], blocks, key);
+		if(memcmp(&reference[offset], &buffer[offset], words * 4) != 0){
+			std::cout << "FAILED: " << name << " encrypt, " << blocks << " blocks at word " << offset << std::endl;
+			return false;
+		}
+
+		xteaDecrypt(&buffer[offset], blocks, key);
+		if(memcmp(&plain[offset], &buffer[offset], words * 4) != 0){
+			std::cout << "FAILED: " << name << " decrypt, " << blocks << " blocks at word " << offset << std::endl;
+			return false;
+		}
+
+		//decrypting data that was never encrypted must agree as well
+		reference = plain;
+		buffer = plain;
+		xteaDecryptScalar(&reference[offset], blocks, key);
+		xteaDecrypt(&buffer[offset], blocks, key);
+		if(memcmp(&reference[offset], &buffer[offset], words * 4) != 0){
+			std::cout << "FAILED: " << name << " decrypt of random data, " << blocks << " blocks at word " << offset << std::endl;
+			return false;
+		}
+
+		//the words around the buffer are left alone
+		if(memcmp(&buffer[0], &plain[0], offset * 4) != 0 ||
+			memcmp(&buffer[offset + words], &plain[offset + words], (buffer.size() - offset - words) * 4) != 0)
+		{
+			std::cout << "FAILED: " << name << " wrote outside of " << blocks << " blocks at word " << offset << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+void benchKernel(const std::string& name)
+{
+	std::vector<uint32_t> buffer(BENCH_MESSAGE_SIZE / 4);
+	uint32_t key[4];
+	randomFill(key, 4);
+	randomFill(&buffer[0], buffer.size());
+
+	uint64_t bytes = 0;
+	int64_t start = OTSYS_MONOTONIC_TIME();
+	int64_t elapsed = 0;
+	while(elapsed < BENCH_TIME){
+		for(int i = 0; i < 64; ++i){
+			xteaEncrypt(&buffer[0], buffer.size() / 2, key);
+			xteaDecrypt(&buffer[0], buffer.size() / 2, key);
+		}
+		bytes += 64 * 2 * BENCH_MESSAGE_SIZE;
+		elapsed = OTSYS_MONOTONIC_TIME() - start;
+	}
+
+	std::cout << std::setw(8) << name << ": " << std::fixed << std::setprecision(1) <<
+		(double)bytes / 1048576. / ((double)elapsed / 1000.) << " MB/s" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	std::cout << "Default kernel: " << getXTEAKernelName() << std::endl;
+
+	std::vector<std::string> kernels;
+	for(uint32_t i = 0; i < sizeof(kernelNames) / sizeof(kernelNames[0]); ++i){
+		if(setXTEAKernel(kernelNames[i])){
+			kernels.push_back(kernelNames[i]);
+		}
+		else{
+			std::cout << kernelNames[i] << " is not available on this processor, skipped." << std::endl;
+		}
+	}
+
+	bool ok = true;
+	for(std::vector<std::string>::iterator it = kernels.begin(); it != kernels.end(); ++it){
+		setXTEAKernel(*it);
+		std::cout << "Testing " << *it << "... " << std::flush;
+		if(testKernel(*it)){
+			std::cout << "[done]" << std::endl;
+		}
+		else{
+			ok = false;
+		}
+	}
+
+	if(!ok){
+		return 1;
+	}
+
+	std::cout << "Encrypting and decrypting " << BENCH_MESSAGE_SIZE << " byte messages:" << std::endl;
+	for(std::vector<std::string>::iterator it = kernels.begin(); it != kernels.end(); ++it){
+		setXTEAKernel(*it);
+		benchKernel(*it);
+	}
+	return 0;
+}
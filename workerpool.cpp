@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Bounded pool of threads for blocking login work
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "otpch.h"
+
+#include "workerpool.h"
+#include "exception.h"
+
+WorkerPool::WorkerPool(const std::string& name) :
+	m_name(name),
+	m_maxQueueSize(0),
+	m_threadCount(0),
+	m_running(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	shutdown();
+	join();
+}
+
+void WorkerPool::start(uint32_t threads, uint32_t maxQueueSize)
+{
+	boost::mutex::scoped_lock lockClass(m_taskLock);
+	if(m_running){
+		return;
+	}
+
+	m_running = true;
+	m_maxQueueSize = std::max((uint32_t)1, maxQueueSize);
+	m_threadCount = std::max((uint32_t)1, threads);
+	for(uint32_t i = 0; i < m_threadCount; ++i){
+		m_threads.create_thread(boost::bind(&WorkerPool::workerThread, (void*)this));
+	}
+}
+
+void WorkerPool::shutdown()
+{
+	std::deque<QueuedTask> dropped;
+
+	m_taskLock.lock();
+	m_running = false;
+	dropped.swap(m_taskList);
+	m_taskLock.unlock();
+	m_taskSignal.notify_all();
+
+	for(std::deque<QueuedTask>::iterator it = dropped.begin(); it != dropped.end(); ++it){
+		if(it->onDropped){
+			it->onDropped();
+		}
+		delete it->task;
+	}
+}
+
+void WorkerPool::join()
+{
+	m_threads.join_all();
+}
+
+bool WorkerPool::addTask(Task* task, const boost::function<void ()>& onDropped /*= boost::function<void ()>()*/)
+{
+	m_taskLock.lock();
+	if(!m_running || m_taskList.size() >= m_maxQueueSize){
+		m_taskLock.unlock();
+
+		#ifdef __DEBUG_SCHEDULER__
+		std::cout << "Warning: [WorkerPool::addTask] " << m_name << " refused a task." << std::endl;
+		#endif
+		delete task;
+		return false;
+	}
+
+	QueuedTask queued;
+	queued.task = task;
+	queued.onDropped = onDropped;
+	m_taskList.push_back(queued);
+	m_taskLock.unlock();
+	m_taskSignal.notify_one();
+	return true;
+}
+
+uint32_t WorkerPool::getQueueSize()
+{
+	boost::mutex::scoped_lock lockClass(m_taskLock);
+	return (uint32_t)m_taskList.size();
+}
+
+void WorkerPool::workerThread(void* p)
+{
+	WorkerPool* pool = (WorkerPool*)p;
+
+	ExceptionHandler workerExceptionHandler;
+	workerExceptionHandler.InstallHandler();
+
+	boost::unique_lock<boost::mutex> taskLockUnique(pool->m_taskLock);
+	while(true){
+		while(pool->m_running && pool->m_taskList.empty()){
+			pool->m_taskSignal.wait(taskLockUnique);
+		}
+
+		if(!pool->m_running){
+			break;
+		}
+
+		Task* task = pool->m_taskList.front().task;
+		pool->m_taskList.pop_front();
+
+		taskLockUnique.unlock();
+		if(!task->hasExpired()){
+			(*task)();
+		}
+		delete task;
+		taskLockUnique.lock();
+	}
+
+	workerExceptionHandler.RemoveHandler();
+}
@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Bounded pool of threads for blocking login work
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_WORKERPOOL_H__
+#define __OTSERV_WORKERPOOL_H__
+
+#include "definitions.h"
+#include "tasks.h"
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+#include <string>
+#include <deque>
+
+// A fixed number of threads running tasks that may block, like the
+// database queries and RSA of a login, so the network threads do not.
+// The queue is bounded: when it is full a task is refused, the caller
+// has to answer the client itself instead of letting the backlog grow.
+class WorkerPool : boost::noncopyable
+{
+public:
+	WorkerPool(const std::string& name);
+	~WorkerPool();
+
+	void start(uint32_t threads, uint32_t maxQueueSize);
+	// Queued tasks that did not start yet are dropped, their onDropped
+	// functions are called on the calling thread
+	void shutdown();
+	void join();
+
+	// Takes ownership of the task, false (and the task is deleted)
+	// when the pool is full or not running. onDropped is only called if
+	// shutdown() drops the task, not when it is refused here
+	bool addTask(Task* task, const boost::function<void ()>& onDropped = boost::function<void ()>());
+
+	uint32_t getQueueSize();
+	uint32_t getThreadCount() const {return m_threadCount;}
+
+protected:
+	static void workerThread(void* p);
+
+	struct QueuedTask{
+		Task* task;
+		boost::function<void ()> onDropped;
+	};
+
+	std::string m_name;
+	boost::thread_group m_threads;
+	boost::mutex m_taskLock;
+	boost::condition_variable m_taskSignal;
+	std::deque<QueuedTask> m_taskList;
+	uint32_t m_maxQueueSize;
+	uint32_t m_threadCount;
+	bool m_running;
+};
+
+#endif
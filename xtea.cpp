@@ -0,0 +1,313 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Scalar, SSE2 and AVX2 XTEA kernels and their runtime selection
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#include "otpch.h"
+
+#include "xtea.h"
+#include "tools.h"
+#include <algorithm>
+
+#ifdef __OTSERV_X86__
+#include <emmintrin.h>
+#ifndef __OTSERV_NO_AVX2__
+#include <immintrin.h>
+#endif
+#endif
+
+#define XTEA_ROUNDS 32
+#define XTEA_DELTA 0x61C88647
+//blocks encrypted before they are checksummed, 512 bytes
+#define XTEA_CHECKSUM_CHUNK 64
+
+void xteaEncryptScalar(uint32_t* buffer, size_t blocks, const uint32_t* k)
+{
+	for(size_t n = 0; n < blocks; ++n, buffer += 2){
+		uint32_t v0 = buffer[0], v1 = buffer[1];
+		uint32_t sum = 0;
+
+		for(int32_t i = 0; i < XTEA_ROUNDS; ++i){
+			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
+			sum -= XTEA_DELTA;
+			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum>>11 & 3]);
+		}
+		buffer[0] = v0; buffer[1] = v1;
+	}
+}
+
+void xteaDecryptScalar(uint32_t* buffer, size_t blocks, const uint32_t* k)
+{
+	for(size_t n = 0; n < blocks; ++n, buffer += 2){
+		uint32_t v0 = buffer[0], v1 = buffer[1];
+		uint32_t sum = 0xC6EF3720;
+
+		for(int32_t i = 0; i < XTEA_ROUNDS; ++i){
+			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum>>11 & 3]);
+			sum += XTEA_DELTA;
+			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
+		}
+		buffer[0] = v0; buffer[1] = v1;
+	}
+}
+
+#ifdef __OTSERV_X86__
+
+// What is added to each half in every encryption round, the sum does not
+// depend on the data so the wide kernels only broadcast these
+struct XTEARoundKeys
+{
+	uint32_t k0[XTEA_ROUNDS];
+	uint32_t k1[XTEA_ROUNDS];
+};
+
+static void computeRoundKeys(const uint32_t* k, XTEARoundKeys& keys)
+{
+	uint32_t sum = 0;
+	for(int32_t i = 0; i < XTEA_ROUNDS; ++i){
+		keys.k0[i] = sum + k[sum & 3];
+		sum -= XTEA_DELTA;
+		keys.k1[i] = sum + k[sum>>11 & 3];
+	}
+}
+
+// The kernels return how many blocks they did, the rest is left to the scalar code
+
+OTSERV_TARGET("sse2")
+static size_t xteaEncryptSSE2(uint32_t* buffer, size_t blocks, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for(; n + 4 <= blocks; n += 4){
+		__m128i* p = (__m128i*)(buffer + n * 2);
+		__m128 a = _mm_castsi128_ps(_mm_loadu_si128(p));
+		__m128 b = _mm_castsi128_ps(_mm_loadu_si128(p + 1));
+		// first words of the 4 blocks in v0, second words in v1
+		__m128i v0 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i v1 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		for(int32_t i = 0; i < XTEA_ROUNDS; ++i){
+			__m128i f = _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v1, 4), _mm_srli_epi32(v1, 5)), v1);
+			v0 = _mm_add_epi32(v0, _mm_xor_si128(f, _mm_set1_epi32(keys.k0[i])));
+			f = _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v0, 4), _mm_srli_epi32(v0, 5)), v0);
+			v1 = _mm_add_epi32(v1, _mm_xor_si128(f, _mm_set1_epi32(keys.k1[i])));
+		}
+
+		_mm_storeu_si128(p, _mm_unpacklo_epi32(v0, v1));
+		_mm_storeu_si128(p + 1, _mm_unpackhi_epi32(v0, v1));
+	}
+	return n;
+}
+
+OTSERV_TARGET("sse2")
+static size_t xteaDecryptSSE2(uint32_t* buffer, size_t blocks, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for(; n + 4 <= blocks; n += 4){
+		__m128i* p = (__m128i*)(buffer + n * 2);
+		__m128 a = _mm_castsi128_ps(_mm_loadu_si128(p));
+		__m128 b = _mm_castsi128_ps(_mm_loadu_si128(p + 1));
+		__m128i v0 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i v1 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		for(int32_t i = XTEA_ROUNDS - 1; i >= 0; --i){
+			__m128i f = _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v0, 4), _mm_srli_epi32(v0, 5)), v0);
+			v1 = _mm_sub_epi32(v1, _mm_xor_si128(f, _mm_set1_epi32(keys.k1[i])));
+			f = _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v1, 4), _mm_srli_epi32(v1, 5)), v1);
+			v0 = _mm_sub_epi32(v0, _mm_xor_si128(f, _mm_set1_epi32(keys.k0[i])));
+		}
+
+		_mm_storeu_si128(p, _mm_unpacklo_epi32(v0, v1));
+		_mm_storeu_si128(p + 1, _mm_unpackhi_epi32(v0, v1));
+	}
+	return n;
+}
+
+#ifndef __OTSERV_NO_AVX2__
+
+// The 256 bit shuffles work on each 128 bit half, so the blocks end up in
+// v0/v1 out of order, but both in the same order, which unpack undoes
+
+OTSERV_TARGET("avx2")
+static size_t xteaEncryptAVX2(uint32_t* buffer, size_t blocks, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for(; n + 8 <= blocks; n += 8){
+		__m256i* p = (__m256i*)(buffer + n * 2);
+		__m256 a = _mm256_castsi256_ps(_mm256_loadu_si256(p));
+		__m256 b = _mm256_castsi256_ps(_mm256_loadu_si256(p + 1));
+		__m256i v0 = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i v1 = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		for(int32_t i = 0; i < XTEA_ROUNDS; ++i){
+			__m256i f = _mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(v1, 4), _mm256_srli_epi32(v1, 5)), v1);
+			v0 = _mm256_add_epi32(v0, _mm256_xor_si256(f, _mm256_set1_epi32(keys.k0[i])));
+			f = _mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(v0, 4), _mm256_srli_epi32(v0, 5)), v0);
+			v1 = _mm256_add_epi32(v1, _mm256_xor_si256(f, _mm256_set1_epi32(keys.k1[i])));
+		}
+
+		_mm256_storeu_si256(p, _mm256_unpacklo_epi32(v0, v1));
+		_mm256_storeu_si256(p + 1, _mm256_unpackhi_epi32(v0, v1));
+	}
+	return n;
+}
+
+OTSERV_TARGET("avx2")
+static size_t xteaDecryptAVX2(uint32_t* buffer, size_t blocks, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for(; n + 8 <= blocks; n += 8){
+		__m256i* p = (__m256i*)(buffer + n * 2);
+		__m256 a = _mm256_castsi256_ps(_mm256_loadu_si256(p));
+		__m256 b = _mm256_castsi256_ps(_mm256_loadu_si256(p + 1));
+		__m256i v0 = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i v1 = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		for(int32_t i = XTEA_ROUNDS - 1; i >= 0; --i){
+			__m256i f = _mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(v0, 4), _mm256_srli_epi32(v0, 5)), v0);
+			v1 = _mm256_sub_epi32(v1, _mm256_xor_si256(f, _mm256_set1_epi32(keys.k1[i])));
+			f = _mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(v1, 4), _mm256_srli_epi32(v1, 5)), v1);
+			v0 = _mm256_sub_epi32(v0, _mm256_xor_si256(f, _mm256_set1_epi32(keys.k0[i])));
+		}
+
+		_mm256_storeu_si256(p, _mm256_unpacklo_epi32(v0, v1));
+		_mm256_storeu_si256(p + 1, _mm256_unpackhi_epi32(v0, v1));
+	}
+	return n;
+}
+
+#endif // __OTSERV_NO_AVX2__
+
+typedef size_t (*XTEAKernel)(uint32_t* buffer, size_t blocks, const XTEARoundKeys& keys);
+
+struct XTEAKernels
+{
+	const char* name;
+	XTEAKernel encrypt;
+	XTEAKernel decrypt;
+};
+
+static XTEAKernels getXTEAKernels(const std::string& name)
+{
+	XTEAKernels kernels = {"scalar", NULL, NULL};
+#ifndef __OTSERV_NO_AVX2__
+	if(name == "avx2" && cpuHasAVX2()){
+		kernels.name = "avx2";
+		kernels.encrypt = &xteaEncryptAVX2;
+		kernels.decrypt = &xteaDecryptAVX2;
+		return kernels;
+	}
+#endif
+	if(name == "sse2" && cpuHasSSE2()){
+		kernels.name = "sse2";
+		kernels.encrypt = &xteaEncryptSSE2;
+		kernels.decrypt = &xteaDecryptSSE2;
+	}
+	return kernels;
+}
+
+static XTEAKernels selectXTEAKernels()
+{
+	XTEAKernels kernels = getXTEAKernels("avx2");
+	if(!kernels.encrypt){
+		kernels = getXTEAKernels("sse2");
+	}
+	return kernels;
+}
+
+// chosen during static initialization, before any network thread runs
+static XTEAKernels xteaKernels = selectXTEAKernels();
+
+void xteaEncrypt(uint32_t* buffer, size_t blocks, const uint32_t* key)
+{
+	size_t done = 0;
+	if(xteaKernels.encrypt && blocks >= 4){
+		XTEARoundKeys keys;
+		computeRoundKeys(key, keys);
+		done = xteaKernels.encrypt(buffer, blocks, keys);
+		// an AVX2 kernel leaves up to 7 blocks, SSE2 does 4 of them
+		if(blocks - done >= 4 && xteaKernels.encrypt != &xteaEncryptSSE2){
+			done += xteaEncryptSSE2(buffer + done * 2, blocks - done, keys);
+		}
+	}
+	xteaEncryptScalar(buffer + done * 2, blocks - done, key);
+}
+
+void xteaDecrypt(uint32_t* buffer, size_t blocks, const uint32_t* key)
+{
+	size_t done = 0;
+	if(xteaKernels.decrypt && blocks >= 4){
+		XTEARoundKeys keys;
+		computeRoundKeys(key, keys);
+		done = xteaKernels.decrypt(buffer, blocks, keys);
+		if(blocks - done >= 4 && xteaKernels.decrypt != &xteaDecryptSSE2){
+			done += xteaDecryptSSE2(buffer + done * 2, blocks - done, keys);
+		}
+	}
+	xteaDecryptScalar(buffer + done * 2, blocks - done, key);
+}
+
+const char* getXTEAKernelName()
+{
+	return xteaKernels.name;
+}
+
+bool setXTEAKernel(const std::string& name)
+{
+	XTEAKernels kernels = getXTEAKernels(name);
+	if(name != kernels.name){
+		return false;
+	}
+
+	xteaKernels = kernels;
+	return true;
+}
+
+#else
+
+void xteaEncrypt(uint32_t* buffer, size_t blocks, const uint32_t* key)
+{
+	xteaEncryptScalar(buffer, blocks, key);
+}
+
+void xteaDecrypt(uint32_t* buffer, size_t blocks, const uint32_t* key)
+{
+	xteaDecryptScalar(buffer, blocks, key);
+}
+
+const char* getXTEAKernelName()
+{
+	return "scalar";
+}
+
+bool setXTEAKernel(const std::string& name)
+{
+	return name == "scalar";
+}
+
+#endif // __OTSERV_X86__
+
+uint32_t xteaEncryptChecksum(uint32_t* buffer, size_t blocks, const uint32_t* key)
+{
+	uint32_t adler = 1;
+	for(size_t pos = 0; pos < blocks; pos += XTEA_CHECKSUM_CHUNK){
+		size_t count = std::min(blocks - pos, (size_t)XTEA_CHECKSUM_CHUNK);
+		xteaEncrypt(buffer + pos * 2, count, key);
+		adler = adlerChecksumUpdate(adler, (const uint8_t*)(buffer + pos * 2), count * 8);
+	}
+	return adler;
+}
@@ -0,0 +1,51 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// XTEA encryption of network messages
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_XTEA_H__
+#define __OTSERV_XTEA_H__
+
+#include "definitions.h"
+#include <cstddef>
+#include <string>
+
+// XTEA with the key schedule and round count the client uses.
+// Blocks are two native endian 32 bit words, the buffer need not be aligned.
+// The processor is checked once, and when it allows, 4 (SSE2) or 8 (AVX2)
+// blocks go through the rounds together.
+void xteaEncrypt(uint32_t* buffer, size_t blocks, const uint32_t* key);
+void xteaDecrypt(uint32_t* buffer, size_t blocks, const uint32_t* key);
+
+// Encrypts as xteaEncrypt and returns the Adler-32 checksum of the result.
+// Each piece is checksummed right after it is encrypted, still in L1
+uint32_t xteaEncryptChecksum(uint32_t* buffer, size_t blocks, const uint32_t* key);
+
+// One block at a time, the fallback and reference for the wide kernels
+void xteaEncryptScalar(uint32_t* buffer, size_t blocks, const uint32_t* key);
+void xteaDecryptScalar(uint32_t* buffer, size_t blocks, const uint32_t* key);
+
+// Name of the kernel xteaEncrypt/xteaDecrypt use on this processor
+const char* getXTEAKernelName();
+
+// Makes xteaEncrypt/xteaDecrypt use the named kernel ("scalar", "sse2" or
+// "avx2"), false if this processor or build lacks it. For tests and
+// benchmarks, it must not be called while messages are being encrypted
+bool setXTEAKernel(const std::string& name);
+
+#endif